@@ -20,14 +20,24 @@
  *      -o,--output=<file>       set output filename
  *      -r,--rowrange=<range>    convert rows within given <range>
  *      -s,--select=<expr>       select rows based on <expr>
+ *      --columns=<list>         convert only the named columns, in order
+ *      --exclude=<list>         convert all but the named columns
  *
  *                                   PROCESSING OPTIONS
  *      -C,--concat              concatenate all input files to output
  *      -H,--noheader            suppress CSV column header
+ *      -M,--columnar            format each chunk a column at a time
  *      -N,--nostrip             don't strip strings of whitespace
+ *      -P,--pipeline            overlap reading, formatting and writing
  *      -Q,--noquote             don't quote strings in text formats
  *      -S,--singlequote         use single quotes for strings
+ *      -T,--threads=<N>         use <N> conversion threads
  *      -X,--explode             explode array cols to separate columns
+ *      --compress=<z>[:<N>]     compress output with gzip or zstd, level <N>
+ *      --shards=<N>             split each table into <N> output files
+ *      --shard-rows=<N>         split tables into output files of <N> rows
+ *      --shard-bytes=<N>        split tables into files of <N> table bytes
+ *      --partition-by=<spec>    split tables into partitions by a column
  *
  *                                   FORMAT OPTIONS
  *      --asv                    output an ascii-separated value table
@@ -35,6 +45,10 @@
  *      --csv                    output a comma-separated value table
  *      --tsv                    output a tab-separated value table
  *      --ipac                   output an IPAC formatted table
+ *      --parquet                output a Parquet file
+ *      --row-group=<N>          <N> rows per Parquet row group
+ *      --arrow                  output an Arrow IPC stream
+ *      -F,--float=<fmt>         float format: 'fixed' (default) or 'shortest'
  *
  *                                   SQL OPTIONS
  *      -B,--binary              output binary SQL
@@ -53,6 +67,13 @@
  *      --truncate               truncate DB table before loading
  *      --pkey=<colname>         create a serial ID column named <colname>
  *
+ *      --sqlite-db=<file>       load straight into SQLite database <file>
+ *      --commit=<N>             commit every <N> rows (--sqlite-db)
+ *      --pg-conn=<conninfo>     COPY straight to the Postgres server
+ *      --load-data=<file>       MySQL LOAD DATA via <file> (FIFO or spool)
+ *      --max-stmt-bytes=<N>     start a new INSERT before <N> bytes
+ *      --max-stmt-rows=<N>      start a new INSERT after <N> rows
+ *
  *
  *  @file       fits2db.c
  *  @author     Mike Fitzpatrick, NOAO Data Lab Project, Tucson, AZ, USA
@@ -68,17 +89,65 @@
 #include <time.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <float.h>
 #include <math.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <arpa/inet.h>
 
+#include <zlib.h>
+#ifdef HAVE_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 #include "fitsio.h"
+#ifdef HAVE_SQLITE
+#include <sqlite3.h>
+#endif
+#ifdef HAVE_LIBPQ
+#include <libpq-fe.h>
+#endif
 
 
 // Utility values
 #define MAX_CHUNK               100000
 #define MAX_COLS                1024
+#define MAX_THREADS             64
+#define MAX_QBLOCKS             8               // max queued blocks per task
+#define NSLOTS                  4               // pipeline slots (power of 2)
+#define MAX_IOV                 1024            // iovecs per writev()
+#define MIN_IOV                 64              // min value written in place
+#define MIN_SPANROW             4096            // min row read as spans
+#define MAX_RGBYTES             268435456       // default row group buffer
+#define MAX_PQDICT              65536           // max dictionary entries
+#define SZ_PQDICT               1048576         // max dictionary page size
+#define SZ_PQPAGE               1048576         // Parquet data page size
+#define SZ_FBFIELDS             8               // flatbuffer table fields
+#define SZ_TSTACK               8               // Thrift struct nesting
+#define SZ_ZBLOCK               1048576         // compressed block size
+#define MAX_ZFRAME              8388608         // max zstd frame to a worker
+#define SZ_FITSBLOCK            2880            // FITS logical record
+#define MAX_PREDOPS             128             // max ops in a selection
+#define MAX_PREDSTACK           32              // max selection stack depth
+#define SZ_PREDBATCH            256             // rows selected per batch
+#define MAX_RANGES              1024            // max --rowrange ranges
+#define MAX_SHARDS              1024            // max output shards a table
 
 #define	SZ_RESBUF	        8192
 #define SZ_COLNAME              64
@@ -88,7 +157,8 @@
 #define SZ_LINEBUF              10240
 #define SZ_PATH                 512
 #define SZ_FNAME                256
-#define SZ_VALBUF               256
+#define SZ_VALBUF               512
+#define SZ_SQLBUF               (SZ_PATH + 64)  // SQL text around a name
 
 #define PARG_ERR                -512000000
 
@@ -113,11 +183,106 @@
 #define TAB_POSTGRES            002             // SQL -- PostgreSQL
 #define TAB_MYSQL               004             // SQL -- MySQL
 #define TAB_SQLITE              010             // SQL -- SQLite
+#define TAB_PARQUET             020             // Parquet file
+#define TAB_ARROW               040             // Arrow IPC stream
 
-#define TAB_DBTYPE(t)           (t>TAB_IPAC)
+#define TAB_DBTYPE(t)           (t>TAB_IPAC && t<TAB_PARQUET)
+#define TAB_BINFILE(t)          (t>=TAB_PARQUET)
 
 #define TAB_SERIAL              999             // Serial ID column type
 
+#define CMP_NONE                0               // output compression
+#define CMP_GZIP                1
+#define CMP_ZSTD                2
+#define CMP_BZIP2               3               // (input only)
+
+//  Row Selection Codes (see dl_predParse)
+#define P_COL                   1               // ops:  column value
+#define P_INT                   2               //   constants
+#define P_DBL                   3
+#define P_STR                   4
+#define P_BOOL                  5
+#define P_NEG                   6               //   unary operators
+#define P_NOT                   7
+#define P_ADD                   8               //   arithmetic
+#define P_SUB                   9
+#define P_MUL                   10
+#define P_DIV                   11
+#define P_MOD                   12
+#define P_EQ                    13              //   comparisons
+#define P_NE                    14
+#define P_LT                    15
+#define P_LE                    16
+#define P_GT                    17
+#define P_GE                    18
+#define P_AND                   19              //   logical
+#define P_OR                    20
+#define PV_BOOL                 1               // value types
+#define PV_INT                  2
+#define PV_DBL                  3
+#define PV_STR                  4
+
+//  Parquet Codes (see parquet.thrift)
+#define PQ_BOOLEAN              0               // physical types
+#define PQ_INT32                1
+#define PQ_INT64                2
+#define PQ_FLOAT                4
+#define PQ_DOUBLE               5
+#define PQ_BYTE_ARRAY           6
+#define PQ_REQUIRED             0               // repetition types
+#define PQ_REPEATED             2
+#define PQ_UTF8                 0               // converted types
+#define PQ_LIST                 3
+#define PQ_UINT_8               11
+#define PQ_UINT_16              12
+#define PQ_INT_8                15
+#define PQ_INT_16               16
+#define PQ_PLAIN                0               // encodings
+#define PQ_PLAIN_DICT           2
+#define PQ_RLE                  3
+#define PQ_DATA_PAGE            0               // page types
+#define PQ_DICT_PAGE            2
+#define PQ_SERIAL               -1              // added column values
+#define PQ_RANDOM               -2
+#define PQ_VALUE                -3
+
+//  Thrift Compact Protocol Types
+#define TT_TRUE                 1
+#define TT_FALSE                2
+#define TT_BYTE                 3
+#define TT_I32                  5
+#define TT_I64                  6
+#define TT_BINARY               8
+#define TT_LIST                 9
+#define TT_STRUCT               12
+
+//  Arrow Codes (see Schema.fbs, Message.fbs)
+#define AR_V5                   4               // metadata version
+#define AR_SCHEMA               1               // message headers
+#define AR_BATCH                3
+#define AR_INT                  2               // types
+#define AR_FLOAT                3
+#define AR_UTF8                 5
+#define AR_BOOL                 6
+#define AR_FIXEDLIST            16
+#define AR_SINGLE               1               // float precisions
+#define AR_DOUBLE               2
+
+//  Floating-point Format Codes
+#define FMT_FIXED               0               // fixed-point (%f, %.16f)
+#define FMT_SHORTEST            1               // shortest round-trip
+
+//  Shortest float format tables (see dl_initFloatFmt)
+#define D_POW5_INV_BITCOUNT     125
+#define D_POW5_BITCOUNT         125
+#define F_POW5_INV_BITCOUNT     59
+#define F_POW5_BITCOUNT         61
+#define D_POW5_INV_SIZE         342
+#define D_POW5_SIZE             326
+#define F_POW5_INV_SIZE         31
+#define F_POW5_SIZE             47
+#define SZ_BIGNUM               32              // 32-bit words (1024 bits)
+
 // Default values
 #define DEF_CHUNK               10000
 #define DEF_ONAME               "root"
@@ -126,6 +291,12 @@
 #define DEF_DELIMITER           ','
 #define DEF_QUOTE               '"'
 #define DEF_MODE                "w+"
+#define DEF_COMMIT              100000          // rows per SQLite transaction
+#define DEF_ROWGROUP            1048576         // rows per Parquet row group
+
+#define SQLITE_PRAGMAS          "PRAGMA journal_mode = OFF;" \
+                                "PRAGMA synchronous = OFF;" \
+                                "PRAGMA cache_size = -262144;"
 
 
 /*  Table column descriptor
@@ -140,35 +311,466 @@ typedef struct {
     int       ncols;
     long      width;
     long      repeat;
+    long      offset;                   // byte offset in the row
     char      colname[SZ_COLNAME];
     char      coltype[SZ_COLNAME];
     char      colunits[SZ_COLNAME];
 } Col, *ColPtr;
 
-Col inColumns[MAX_COLS];
-Col outColumns[MAX_COLS];
 
-int numInCols 		= 0;		// number of input columns
-int numOutCols 		= 0;		// number of output columns
+/*  Run of same-sized values to be byte-swapped in each row.
+ */
+typedef struct {
+    int       offset;                   // byte offset in the row
+    int       count;                    // number of values
+    int       size;                     // value size (2, 4 or 8 bytes)
+} Swap, *SwapPtr;
+
+
+/*  Span of row bytes needed by the projected columns.
+ */
+typedef struct {
+    int       offset;                   // byte offset in the row
+    int       len;                      // number of bytes
+} Span, *SpanPtr;
+
+
+/*  Range of table rows to convert (--rowrange), numbered from 1.
+ */
+typedef struct {
+    long      first;                    // first row
+    long      last;                     // last row (LONG_MAX for the end)
+} Range, *RangePtr;
+
+
+/*  Output partitioning (--partition-by).  Each row goes to the partition
+ *  its key column value hashes to, or whose range holds it.
+ */
+#define PART_HASH               0               // hash partitions
+#define PART_RANGE              1               // range partitions
+
+typedef struct {
+    char      colname[SZ_COLNAME];      // partition key column
+    int       method;                   // PART_HASH or PART_RANGE
+    int       nparts;                   // number of partitions
+    int       nbounds;                  // number of range bounds
+    long long bounds[MAX_SHARDS];       // lower bounds of partitions 1..
+} Part, *PartPtr;
+
+
+/*  Row selection op.  A --select expression is parsed once into a
+ *  postfix program of these, which each file binds to its columns.
+ */
+typedef struct {
+    int       op;                       // P_* operation
+    int       type;                     // result type (PV_*)
+    int       mode;                     // operand type of a binary op
+    int       elem;                     // array element (1 = first)
+    int       ctype;                    // column data type
+    int       width;                    // value size in the row
+    long      offset;                   // value byte offset in the row
+    long long ival;                     // integer or logical constant
+    double    dval;                     // real constant
+    char      name[SZ_COLNAME];         // column name or string constant
+} PredOp, *PredOpPtr;
+
+typedef struct {
+    PredOp    ops[MAX_PREDOPS];         // program, in postfix order
+    int       nops;                     // number of ops
+} Pred, *PredPtr;
+
+/*  Row selection value, one row of a batch.
+ */
+typedef union {
+    long long i;                        // integer or logical
+    double    d;                        // real
+    unsigned char *s;                   // string in the row
+} PVal, *PValPtr;
+
+
+/*  Formatted value of one row of a column (columnar mode).
+ */
+typedef struct {
+    char     *ptr;                      // value text
+    int       len;                      // text length
+} Val, *ValPtr;
+
+
+struct Context;
+struct Op;
+typedef unsigned char *(*EmitFunc) (struct Context *ctx, unsigned char *dp,
+                                    ColPtr col);
+typedef void (*BatchFunc) (struct Context *ctx, struct Op *op,
+                                    unsigned char *data, int nrows,
+                                    long naxis1, ValPtr vals);
+
+/*  Row program op:  print one column value (or an added column) with the
+ *  text that surrounds it in the output row.
+ */
+typedef struct Op {
+    int       offset;                   // byte offset of the value in a row
+    ColPtr    col;                      // input column (NULL if added)
+    EmitFunc  emit;                     // value print function
+    BatchFunc batch;                    // column print function (columnar)
+    int       direct;                   // value may be written in place
+    char      prefix[4];                // text before the value
+    char      suffix[4];                // text after the value
+    int       npre, nsuf;               // prefix and suffix lengths
+} Op, *OpPtr;
+
+/*  Row program, compiled from the table layout and output format before
+ *  conversion so each row is a plain loop over the ops.
+ */
+typedef struct {
+    Op        ops[MAX_COLS + 3];        // column ops (plus add/sid/rid)
+    int       nops;                     // number of ops
+    char     *rowhdr;                   // text/bytes starting each row
+    int       nhdr;                     // row header length
+    int       comma;                    // comma between rows (INSERT)?
+    int       newline;                  // newline at end of row?
+    int       direct;                   // any ops written as is?
+    int       split;                    // INSERTs split by size budget?
+    long      naxis1;                   // row width in bytes
+    long      rowmax;                   // max bytes of a formatted row
+} Prog, *ProgPtr;
+
+
+/*  Output block queued for the ordered writer (threaded mode only).
+ */
+typedef struct Block {
+    char     *buf;                      // block data
+    long      len;                      // number of bytes to write
+    struct Block *next;
+} Block, *BlockPtr;
+
+/*  Conversion task, one per input file (or output shard).
+ */
+typedef struct {
+    char     *ifname;                   // input file name (w/ modifiers)
+    char     *ofname;                   // output file name
+    char     *omode;                    // output file mode
+    int       filenum;                  // file number in input list
+    int       bnum;                     // file number within bundle
+    int       shard;                    // output shard of the table
+    int       index;                    // task number (i.e. output order)
+
+    BlockPtr  head, tail;               // queued output blocks
+    int       nblocks;                  // number of queued blocks
+    int       done;                     // task is complete
+} Task, *TaskPtr;
+
+/*  Conversion context.  All state that changes while converting a file
+ *  lives here so that several files may be converted at once.
+ */
+typedef struct Context {
+    Col       inColumns[MAX_COLS];      // input column descriptors
+    Col       outColumns[MAX_COLS];     // output column descriptors
+    int       numInCols;                // number of input columns
+    int       numOutCols;               // number of output columns
+    Swap      swaps[MAX_COLS];          // values to swap in each row
+    int       nswaps;                   // number of swap runs
+    Span      spans[MAX_COLS+MAX_PREDOPS];  // row bytes of projected columns
+    int       nspans;                   // number of spans (0 = whole row)
+    int       narrow;                   // read only the spans of a row?
+    Pred      pred;                     // row selection program
+    PValPtr   pstack;                   // row selection value stack
+    Prog      prog;                     // row program
+    char     *cbuf;                     // column value text (columnar)
+    long      csize;                    // allocated column text size
+    ValPtr    vals;                     // column values (columnar)
+    long      nvals;                    // allocated number of values
+    unsigned char *tbuf;                // transposed column (columnar)
+    long      tsize;                    // allocated transposed size
+    struct iovec *iov;                  // output vector (binary)
+    int       niov;                     // number of iovecs used
+    FILE     *sqlfd;                    // SQL output during LOAD DATA
+    char      load_name[SZ_PATH];       // LOAD DATA file (or spool)
+    char     *sqlbuf;                   // table setup SQL (SQLite load)
+    size_t    sqllen;                   // setup SQL length
+    char     *stmthdr;                  // ends one INSERT, starts the next
+    int       nstmthdr;                 // statement header length
+    long      stmt_rows;                // rows in the current INSERT
+    long      stmt_bytes;               // bytes in the current INSERT
+
+    char      esc_buf[SZ_ESCBUF];       // escaped value buffer
+    char     *obuf, *optr;              // output buffer pointers
+    long      olen;                     // output buffer length
+    long      osize;                    // allocated output buffer size
+
+    int       serial_number;            // ID serial number
+    int       do_binary;                // do binary SQL output (this file)
+    char     *omode;                    // output file mode
+    FILE     *ofd;                      // output file descriptor
+    TaskPtr   task;                     // task being processed (threaded)
+    int       queued;                   // output queued for the writer?
+    int       in_turn;                  // holding the header turn?
+    struct Zin *zin;                    // compressed input stream
+
+    int       shard;                    // output shard of the table
+    long      rowfirst, rowlast;        // rows of the shard
+    PredOp    pkey;                     // partition key column
+    char      tabname[SZ_PATH];         // table written (or partition)
+} Context, *CtxPtr;
+
+/*  Worker pool state (threaded mode only).
+ */
+typedef struct {
+    TaskPtr   tasks;                    // task list
+    int       ntasks;                   // number of tasks
+    int       next;                     // next task to be assigned
+    int       turn;                     // task allowed to print headers
+    int       wtask;                    // task being written
+    Context   layout;                   // table layout passed between files
+
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+} Pool;
+
+/*  Slice of a chunk of rows formatted by one thread.
+ */
+typedef struct {
+    CtxPtr    ctx;                      // slice context (private buffer)
+    ProgPtr   prog;                     // row program
+    unsigned char *dp;                  // first row of the slice
+    int       nrows;                    // number of rows in slice
+    int       more;                     // comma follows the last row?
+} Slice, *SlicePtr;
+
+/*  Gang of threads formatting the slices of one chunk.
+ */
+typedef struct {
+    SlicePtr  slices;                   // slices of the current chunk
+    int       nslices;                  // number of slices
+    int       next;                     // next slice to be formatted
+    int       ndone;                    // number of slices done
+    int       gen;                      // chunk generation number
+    int       nhelpers;                 // number of helper threads
+    int       quit;                     // helpers should exit
+
+    pthread_t tid[MAX_THREADS];
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+} Gang;
+
+/*  Chunk slot passed along the read/format/write pipeline.
+ */
+typedef struct {
+    unsigned char *buf;                 // read buffer (unmapped input)
+    unsigned char *data;                // raw table bytes
+    long      nbytes;                   // number of bytes read
+    int       nrows;                    // number of rows in chunk
+    int       eof;                      // end of table (or read error)
+    SlicePtr  slices;                   // formatted output slices
+} Chunk, *ChunkPtr;
+
+/*  Single-producer/single-consumer ring of chunk slots.  The head and
+ *  tail only ever advance, each from one side, so no lock is needed.
+ */
+typedef struct {
+    ChunkPtr  slot[NSLOTS];
+    atomic_uint head;                   // next slot to get (consumer)
+    atomic_uint tail;                   // next slot to put (producer)
+} Ring, *RingPtr;
+
+/*  Pipeline state for one table.
+ */
+typedef struct {
+    CtxPtr    ctx;                      // conversion context
+    fitsfile *fptr;                     // input table
+    unsigned char *table;               // mapped table data, or NULL
+    long      nrows;                    // number of rows in table
+    long      naxis1;                   // row width in bytes
+    int       nelem;                    // rows per chunk
+    int       nslices;                  // slices per chunk
+    int       status;                   // reader CFITSIO status
+
+    Ring      free;                     // empty slots (writer -> reader)
+    Ring      full;                     // read slots (reader -> formatter)
+    Ring      done;                     // formatted slots (formatter -> writer)
+} Pipe, *PipePtr;
+
+/*  Growing byte buffer, also holding the field ids of the Thrift compact
+ *  protocol structures written into it (binary file output only).
+ */
+typedef struct {
+    unsigned char *buf;                 // buffer
+    long      len;                      // bytes used
+    long      size;                     // allocated size
+    short     last[SZ_TSTACK];          // last field id in each struct
+    int       depth;                    // struct nesting depth
+} Tbuf, *TbufPtr;
+
+/*  Parquet (or Arrow) output column.  Each row group the column's values
+ *  are encoded from the buffered rows into its own chunk, so columns may
+ *  be encoded in parallel.
+ */
+typedef struct {
+    char      name[SZ_COLNAME];         // column name
+    int       ftype;                    // FITS type (or added value)
+    int       type;                     // Parquet physical type
+    int       ctype;                    // converted type (-1 if none)
+    int       bits;                     // integer logical type width
+    int       offset;                   // first value offset in the row
+    int       size;                     // value size in the row
+    int       width;                    // string width
+    int       nvals;                    // values per row (list if > 1)
+
+    Tbuf      out;                      // encoded column chunk
+    Tbuf      page;                     // page being encoded
+    Tbuf      tmp;                      // levels/dictionary being encoded
+    long      nvalues;                  // values in the chunk
+    long      dict_off;                 // dictionary page offset (or -1)
+    long      data_off;                 // first data page offset
+    int       ndict;                    // dictionary entries
+} PqCol, *PqColPtr;
+
+/*  Parquet file being written.  Rows are buffered until a row group is
+ *  full;  the metadata of written row groups is kept for the footer.
+ */
+typedef struct {
+    PqColPtr  cols;                     // output columns
+    int       ncols;                    // number of columns
+    unsigned char *rows;                // buffered table rows
+    int      *sids;                     // serial IDs of buffered rows
+    float    *rids;                     // random IDs of buffered rows
+    long      nrows;                    // number of buffered rows
+    long      maxrows;                  // rows per row group
+    long      szrows;                   // allocated rows
+    long      naxis1;                   // row width in bytes
+    long      offset;                   // file offset of the next write
+    long      totrows;                  // rows in written row groups
+    Tbuf      groups;                   // written row group metadata
+    int       ngroups;                  // number of row groups
+    int       next;                     // next column to encode
+
+    pthread_mutex_t mutex;
+} Parquet;
+
+/*  Arrow IPC stream being written.  Each chunk of rows is written as a
+ *  record batch.
+ */
+typedef struct {
+    PqColPtr  cols;                     // output columns
+    int       ncols;                    // number of columns
+    long      naxis1;                   // row width in bytes
+    Tbuf      meta;                     // message metadata (a flatbuffer)
+    Tbuf      body;                     // message body
+    long     *nodes;                    // field node lengths
+    long     *bufs;                     // body buffer offsets and lengths
+    int       nnodes;                   // number of field nodes
+    int       nbufs;                    // number of body buffers
+} Arrow;
+
+/*  Compressed output.  The output stream is cut into blocks, each of which
+ *  is compressed independently and written in order.
+ */
+typedef struct {
+    unsigned char *in;                  // data to (de)compress
+    unsigned char *out;                 // (de)compressed data
+    long      inlen;                    // input length
+    long      insize;                   // allocated input size
+    long      outlen;                   // output length
+    long      outsize;                  // allocated output size
+    int       done;                     // block is ready?
+} Zblock, *ZblockPtr;
 
+typedef struct {
+    FILE     *fd;                       // output file
+    FILE     *pfd;                      // pipe the output is written to
+    int       rfd;                      // read end of the pipe
+    pthread_t reader;                   // reader/writer thread
+    pthread_t tid[MAX_THREADS];         // compression threads
+    int       nworkers;                 // number of compression threads
+    Zblock    blocks[2*MAX_THREADS+2];  // ring of blocks in flight
+    int       nslots;                   // ring size in use
+    long      nread;                    // blocks read from the pipe
+    long      ncomp;                    // blocks handed to a worker
+    long      nwritten;                 // blocks written to the file
+    int       eof;                      // end of the output stream?
+
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+} Zout;
+
+/*  Compressed input.  A reader thread decompresses the stream into a ring
+ *  of blocks ahead of the conversion, which reads them in order.
+ */
+typedef struct Zin {
+    char     *name;                     // input file name
+    int       fd;                       // input file
+    int       type;                     // compression type
+    unsigned char *ibuf;                // compressed input
+    long      ilen;                     // bytes buffered
+    long      ipos;                     // next byte to decompress
+    long      isize;                    // input buffer size
+    int       ieof;                     // end of the input file?
+    int       member;                   // inside a gzip member/bzip2 stream?
+    z_stream  zs;                       // gzip decoder
+#ifdef HAVE_BZIP2
+    bz_stream bz;                       // bzip2 decoder
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zd;                   // zstd decoder
+#endif
 
-char    esc_buf[SZ_ESCBUF];             // escaped value buffer
-char   *obuf, *optr;                    // output buffer pointers
-long    olen = 0;                       // output buffer length
+    pthread_t reader;                   // decompressing thread
+    pthread_t tid[MAX_THREADS];         // zstd frame threads
+    int       nworkers;                 // number of frame threads
+    Zblock    blocks[2*MAX_THREADS+2];  // ring of decompressed blocks
+    int       nslots;                   // ring size in use
+    long      nread;                    // blocks queued by the reader
+    long      ncomp;                    // blocks handed to a worker
+    long      nused;                    // blocks consumed
+    long      pos;                      // next byte of the current block
+    long      offset;                   // bytes consumed since the headers
+    int       eof;                      // end of the stream?
+    int       error;                    // decompression error?
+    int       stop;                     // stream is being closed?
+
+    unsigned char *hdr;                 // headers, as a FITS memory file
+    size_t    hdrlen;                   // header length
+
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+} Zin, *ZinPtr;
+
+Context  context;                       // serial conversion context
+Pool     pool;                          // worker pool
+Gang     gang;                          // slice formatting threads
+Parquet  pq;                            // Parquet file being written
+Arrow    arrow;                         // Arrow stream being written
+Zout     zout;                          // compressed output being written
 
 char   *prog_name       = NULL;         // program name
 
 char   *extname         = NULL;         // extension name
 char   *iname           = NULL;         // input file name
+char   *zname           = NULL;         // output compression (type[:level])
 char   *oname           = NULL;         // output file name
 char   *basename        = NULL;         // base output file name
-char   *rows            = NULL;         // row selection string
+char   *rows            = NULL;         // row range string
+Range   row_ranges[MAX_RANGES];         // parsed row ranges, sorted
+int     nranges         = 0;            // number of row ranges
+int     nshards         = 0;            // number of output shards
+long    shard_rows      = 0;            // rows per output shard
+long    shard_bytes     = 0;            // table bytes per output shard
+int     sharded         = 0;            // writing output shards?
+char   *partspec        = NULL;         // partition spec string
+Part    part;                           // parsed partition spec
+int     partitioned     = 0;            // routing rows to partitions?
+atomic_int failed;                      // a table or the output failed?
 char   *expr            = NULL;         // selection expression string
+Pred    select_pred;                    // parsed selection expression
+char   *columns         = NULL;         // columns to convert, in order
+char   *exclude         = NULL;         // columns to leave out
 char   *tablename       = NULL;         // database table name
 char   *sidname         = NULL;         // serial ID column name
 char   *ridname         = NULL;         // random ID column name
 char   *dbname          = NULL;         // database name name (MySQL create)
 char   *addname         = NULL;         // column name to be added
+char   *sqlite_db       = NULL;         // SQLite database to load directly
+char   *pg_conninfo     = NULL;         // Postgres server to load directly
+char   *load_file       = NULL;         // MySQL LOAD DATA file or FIFO
 
 char    delimiter       = DEF_DELIMITER;// default to CSV
 char	arr_delimiter 	= DEF_DELIMITER;// default to CSV
@@ -176,6 +778,7 @@ char    quote_char      = DEF_QUOTE;    // string quote character
 char   *omode           = DEF_MODE;     // output file mode
 
 int     format          = DEF_FORMAT;   // default output format
+int     float_fmt       = FMT_FIXED;    // floating-point value format
 int     mach_swap       = 0;            // is machine swapped relative to FITS?
 int     do_binary       = 0;            // do binary SQL output
 int     do_quote        = 1;            // quote ascii values?
@@ -197,12 +800,33 @@ int     header          = 1;            // prepend column headers
 int     number          = 0;            // number rows ?
 int     single          = 0;            // load rows one at a time?
 int     chunk_size      = DEF_CHUNK;    // processing chunk size
-
-int     serial_number   = 0;            // ID serial number
+int     nthreads        = 1;            // number of conversion threads
+int     pipeline        = 0;            // overlap read/format/write?
+int     columnar        = 0;            // format chunks column-at-a-time?
+int     commit_rows     = DEF_COMMIT;   // rows per SQLite transaction
+int     nloads          = 0;            // number of LOAD DATA files
+int     max_stmt_bytes  = 0;            // INSERT statement byte budget
+int     max_stmt_rows   = 0;            // INSERT statement row budget
+int     row_group       = 0;            // rows per Parquet row group
+int     zcompress       = CMP_NONE;     // output compression
+int     zlevel          = -1;           // compression level (-1 = default)
+
+int     serial_number   = 0;            // next ID serial number
 
 int     debug           = 0;            // debug flag
 int     verbose         = 0;            // verbose output flag
 
+#ifdef HAVE_SQLITE
+sqlite3 *sql_db         = NULL;         // database of a direct SQLite load
+#endif
+#ifdef HAVE_LIBPQ
+PGconn *pg_conn         = NULL;         // server of a direct Postgres load
+int     pg_copy         = 0;            // COPY in progress (<0 on error)?
+char   *pg_sql          = NULL;         // SQL waiting to be run
+long    pg_nsql         = 0;            // length of waiting SQL
+long    pg_szsql        = 0;            // allocated SQL buffer size
+#endif
+
 char   *pgcopy_hdr      = "PGCOPY\n\377\r\n\0\0\0\0\0";
 int     len_pgcopy_hdr  = 15;
 
@@ -221,7 +845,7 @@ size_t  sz_double       = sizeof (double);
 static Task  self       = {  "fits2db",  fits2db,  0,  0,  0  };
  */
 
-static char  *opts 	= "hdvnb:c:e:E:i:o:r:s:t:BCHNOQSXZ012345:678L:U:A:D:";
+static char  *opts 	= "hdvnb:c:e:E:F:i:o:r:s:t:T:BCHMNOPQSXZ012345:6789:L:U:A:D:W:G:Y:K:R:Jg:az:l:x:k:j:y:p:";
 static struct option long_opts[] = {
     { "help",         no_argument,          NULL,   'h'},
     { "debug",        no_argument,          NULL,   'd'},
@@ -230,19 +854,30 @@ static struct option long_opts[] = {
 
     { "bundle",       required_argument,    NULL,   'b'},
     { "chunk",        required_argument,    NULL,   'c'},
+    { "columns",      required_argument,    NULL,   'l'},
+    { "compress",     required_argument,    NULL,   'z'},
     { "extnum",       required_argument,    NULL,   'e'},
     { "extname",      required_argument,    NULL,   'E'},
+    { "exclude",      required_argument,    NULL,   'x'},
+    { "float",        required_argument,    NULL,   'F'},
     { "input",        required_argument,    NULL,   'i'},
     { "output",       required_argument,    NULL,   'o'},
     { "rowrange",     required_argument,    NULL,   'r'},
     { "select",       required_argument,    NULL,   's'},
+    { "shards",       required_argument,    NULL,   'k'},
+    { "shard-rows",   required_argument,    NULL,   'j'},
+    { "shard-bytes",  required_argument,    NULL,   'y'},
+    { "partition-by", required_argument,    NULL,   'p'},
     { "table",        required_argument,    NULL,   't'},
+    { "threads",      required_argument,    NULL,   'T'},
 
     { "binary",       no_argument,          NULL,   'B'},
     { "concat",       no_argument,          NULL,   'C'},
     { "noheader",     no_argument,          NULL,   'H'},
+    { "columnar",     no_argument,          NULL,   'M'},
     { "nostrip",      no_argument,          NULL,   'N'},
     { "oid",          no_argument,          NULL,   'O'},
+    { "pipeline",     no_argument,          NULL,   'P'},
     { "noquote",      no_argument,          NULL,   'Q'},
     { "singlequote",  no_argument,          NULL,   'S'},
     { "explode",      no_argument,          NULL,   'X'},
@@ -253,11 +888,20 @@ static struct option long_opts[] = {
     { "csv",          no_argument,          NULL,   '2'},
     { "tsv",          no_argument,          NULL,   '3'},
     { "ipac",         no_argument,          NULL,   '4'},
+    { "parquet",      no_argument,          NULL,   'J'},
+    { "row-group",    required_argument,    NULL,   'g'},
+    { "arrow",        no_argument,          NULL,   'a'},
 
     { "sql",          required_argument,    NULL,   '5'},
     { "drop",         no_argument,          NULL,   '6'},
     { "create",       no_argument,          NULL,   '7'},
     { "truncate",     no_argument,          NULL,   '8'},
+    { "sqlite-db",    required_argument,    NULL,   '9'},
+    { "commit",       required_argument,    NULL,   'W'},
+    { "pg-conn",      required_argument,    NULL,   'G'},
+    { "load-data",    required_argument,    NULL,   'Y'},
+    { "max-stmt-bytes", required_argument,  NULL,   'K'},
+    { "max-stmt-rows",  required_argument,  NULL,   'R'},
     { "sid",          required_argument,    NULL,   'L'},
     { "rid",          required_argument,    NULL,   'U'},
     { "add",          required_argument,    NULL,   'A'},
@@ -273,38 +917,273 @@ static struct option long_opts[] = {
  */
 static void Usage (void);
 
-static void dl_escapeCSV (char* in);
-static void dl_quote (char* in);
-static void dl_fits2db (char *iname, char *oname, int filenum, 
+static void dl_escapeCSV (CtxPtr ctx, char* in);
+static void dl_quote (CtxPtr ctx, char* in);
+static int  dl_escapeLoad (char *out, char *in);
+static void dl_fits2db (CtxPtr ctx, char *iname, char *oname, int filenum, 
                             int bnum, int nfiles);
-static void dl_printHdr (int firstcol, int lastcol, FILE *ofd);
-static void dl_printIPACTypes (char *tablename, fitsfile *fptr, int firstcol,
-                                int lastcol, FILE *ofd);
-static void dl_createSQLTable (char *tablename, fitsfile *fptr, int firstcol,
-                                int lastcol, FILE *ofd);
-static void dl_printSQLHdr (char *tablename, fitsfile *fptr, int firstcol,
-                                int lastcol, FILE *ofd);
-static void dl_printHdrString (char *tablename);
-static void dl_getColInfo (fitsfile *fptr, int firstcol, int lastcol);
-static int  dl_validateColInfo (fitsfile *fptr, int firstcol, int lastcol);
-static void dl_getOutputCols (fitsfile *fptr, int firstcol, int lastcol);
-
-static unsigned char *dl_printCol (unsigned char *dp, ColPtr col, char end_ch);
-static unsigned char *dl_printString (unsigned char *dp, ColPtr col);
-static unsigned char *dl_printLogical (unsigned char *dp, ColPtr col);
-static unsigned char *dl_printByte (unsigned char *dp, ColPtr col);
-static unsigned char *dl_printShort (unsigned char *dp, ColPtr col);
-static unsigned char *dl_printInt (unsigned char *dp, ColPtr col);
-static unsigned char *dl_printLong (unsigned char *dp, ColPtr col);
-static unsigned char *dl_printFloat (unsigned char *dp, ColPtr col);
-static unsigned char *dl_printDouble (unsigned char *dp, ColPtr col);
-static void           dl_printSerial (void);
-static void           dl_printRandom (void);
-static void           dl_printValue (int value);
+static void dl_printHdr (CtxPtr ctx, int firstcol, int lastcol);
+static void dl_printIPACTypes (CtxPtr ctx, char *tablename, fitsfile *fptr,
+                                int firstcol, int lastcol);
+static void dl_createSQLTable (CtxPtr ctx, char *tablename, fitsfile *fptr,
+                                int firstcol, int lastcol);
+static void dl_createCols (CtxPtr ctx);
+static void dl_printSQLHdr (CtxPtr ctx, char *tablename, fitsfile *fptr,
+                                int firstcol, int lastcol);
+static void dl_printSQLEnd (CtxPtr ctx);
+static void dl_printHdrString (CtxPtr ctx, char *tablename);
+static void dl_stmtHdr (CtxPtr ctx, char *tablename);
+static int  dl_stmtFull (CtxPtr ctx, long len);
+static void dl_stmtBreak (CtxPtr ctx, ProgPtr prog, long row, long len,
+                int nleft, int full);
+static void dl_loadBegin (CtxPtr ctx);
+static void dl_loadEnd (CtxPtr ctx);
+static void dl_loadStmt (CtxPtr ctx);
+static int  dl_getColInfo (CtxPtr ctx, fitsfile *fptr, int firstcol,
+                                int lastcol);
+static void dl_getColDims (fitsfile *fptr, ColPtr col);
+static int  dl_validateColInfo (CtxPtr ctx, fitsfile *fptr, int firstcol,
+                                int lastcol);
+static void dl_getOutputCols (CtxPtr ctx, fitsfile *fptr, int firstcol,
+                                int lastcol);
+static int  dl_selectCols (ColPtr cols, int ncols);
+static int  dl_nextName (char **lp, char *name);
+static int  dl_inList (char *list, char *name);
+static int  dl_getRanges (char *spec);
+static long dl_nextChunk (CtxPtr ctx, long *row, long nelem, long nrows);
+static long dl_rangeRows (CtxPtr ctx, long nrows);
+static long dl_rangeRow (long n, long nrows);
+static void dl_shardRows (CtxPtr ctx, long nrows, long naxis1);
+static long dl_shardSize (long total, long naxis1);
+static int  dl_countShards (char *iname);
+static void dl_shardName (char *ofname, int shard, int nsh, char *sfname);
+static int  dl_getPartition (char *spec);
+static int  dl_partBind (CtxPtr ctx, ColPtr cols, int ncols);
+static int  dl_partRows (CtxPtr ctx, unsigned char *out, unsigned char *in,
+                                int nrows, long naxis1);
+static int  dl_partOf (long long val);
+static unsigned long long dl_partHash (long long val);
+static void dl_tableName (CtxPtr ctx);
+static void dl_copyRow (CtxPtr ctx, unsigned char *dst, unsigned char *src,
+                                long naxis1);
+static void dl_getSwapRuns (CtxPtr ctx);
+static void dl_getSpans (CtxPtr ctx, long naxis1);
+static void dl_addSpan (CtxPtr ctx, long offset, int len);
+static void dl_getRowProg (CtxPtr ctx, long naxis1);
+static long dl_opMax (CtxPtr ctx, OpPtr op);
+static int  dl_colBytes (ColPtr col, int *size);
+static void dl_swapChunk (CtxPtr ctx, unsigned char *out, unsigned char *in,
+                                int nrows, long naxis1);
+static int  dl_prepChunk (CtxPtr ctx, unsigned char *buf, unsigned char **data,
+                                int nrows, long naxis1);
+
+static unsigned char *dl_opBad (CtxPtr ctx, unsigned char *dp, ColPtr col);
+static unsigned char *dl_opValue (CtxPtr ctx, unsigned char *dp, ColPtr col);
+static unsigned char *dl_opSerial (CtxPtr ctx, unsigned char *dp, ColPtr col);
+static unsigned char *dl_opRandom (CtxPtr ctx, unsigned char *dp, ColPtr col);
+static void dl_batchEmit (CtxPtr ctx, OpPtr op, unsigned char *data,
+                                int nrows, long naxis1, ValPtr vals);
+static void dl_batchString (CtxPtr ctx, OpPtr op, unsigned char *data,
+                                int nrows, long naxis1, ValPtr vals);
+static void dl_batchInt (CtxPtr ctx, OpPtr op, unsigned char *data,
+                                int nrows, long naxis1, ValPtr vals);
+static void dl_batchReal (CtxPtr ctx, OpPtr op, unsigned char *data,
+                                int nrows, long naxis1, ValPtr vals);
+static unsigned char *dl_printString (CtxPtr ctx, unsigned char *dp,
+                                ColPtr col);
+static unsigned char *dl_printLogical (CtxPtr ctx, unsigned char *dp,
+                                ColPtr col);
+static unsigned char *dl_printByte (CtxPtr ctx, unsigned char *dp, ColPtr col);
+static unsigned char *dl_printShort (CtxPtr ctx, unsigned char *dp, ColPtr col);
+static unsigned char *dl_printInt (CtxPtr ctx, unsigned char *dp, ColPtr col);
+static unsigned char *dl_printLong (CtxPtr ctx, unsigned char *dp, ColPtr col);
+static unsigned char *dl_printFloat (CtxPtr ctx, unsigned char *dp, ColPtr col);
+static unsigned char *dl_printDouble (CtxPtr ctx, unsigned char *dp,
+                                ColPtr col);
+static unsigned char *dl_printArray (CtxPtr ctx, unsigned char *dp,
+                                ColPtr col);
+static void           dl_printSerial (CtxPtr ctx);
+static void           dl_printRandom (CtxPtr ctx);
+static void           dl_printValue (CtxPtr ctx, int value);
+static void           dl_putInt (CtxPtr ctx, long long value, int width);
+static void           dl_putNonFinite (CtxPtr ctx, double dval, char *fmt);
+static void           dl_putFloat (CtxPtr ctx, float rval, int width);
+static void           dl_putDouble (CtxPtr ctx, double dval, int width);
+static void           dl_initFloatFmt (void);
+
+static void dl_outWrite (CtxPtr ctx, void *buf, long len);
+static void dl_outPrintf (CtxPtr ctx, char *fmt, ...);
+static void dl_outFlush (CtxPtr ctx);
+static void dl_outChunk (CtxPtr ctx);
+static void dl_outOpen (CtxPtr ctx, char *oname);
+static void dl_outClose (CtxPtr ctx);
+static void dl_beginTurn (CtxPtr ctx);
+static void dl_endTurn (CtxPtr ctx, long nrows);
+static void dl_runTasks (TaskPtr tasks, int ntasks, int nfiles);
+static void dl_gangStart (int nthreads);
+static void dl_gangRun (SlicePtr slices, int nslices);
+static void dl_gangStop (void);
+static unsigned char *dl_formatRows (CtxPtr ctx, ProgPtr prog,
+                                unsigned char *dp, int nrows, int more);
+static unsigned char *dl_formatCols (CtxPtr ctx, ProgPtr prog,
+                                unsigned char *dp, int nrows, int more);
+static unsigned char *dl_formatStmts (CtxPtr ctx, ProgPtr prog,
+                                unsigned char *dp, int nrows);
+static void dl_formatSlices (CtxPtr ctx, SlicePtr slices, int nslices,
+                                unsigned char *data, long naxis1, int nrows,
+                                int more);
+static void dl_writeSlices (CtxPtr ctx, SlicePtr slices, int nslices);
+static void dl_formatIov (CtxPtr ctx, ProgPtr prog, unsigned char *dp,
+                                int nrows);
+static void dl_addIov (CtxPtr ctx, void *base, long len);
+static void dl_writeIov (CtxPtr ctx);
+static int  dl_writeAll (int fd, struct iovec *iov, int niov);
+static int  dl_writeBuf (int fd, void *buf, long len);
+static SlicePtr dl_newSlices (CtxPtr ctx, int nslices, long osize);
+static void dl_freeSlices (SlicePtr slices, int nslices);
+static int  dl_pipeline (CtxPtr ctx, fitsfile *fptr, unsigned char *table,
+                                long nrows, long naxis1, int nelem,
+                                int nslices, int more);
+
+static int  dl_sqliteOpen (char *dbfile);
+static void dl_sqliteClose (void);
+static void dl_sqliteSetup (CtxPtr ctx);
+static int  dl_sqliteExec (CtxPtr ctx);
+static int  dl_sqliteLoad (CtxPtr ctx, fitsfile *fptr, unsigned char *table,
+                                unsigned char *buf, long nrows, long naxis1,
+                                int nelem);
+static int  dl_pgOpen (char *conninfo);
+static void dl_pgClose (void);
+static void dl_pgWrite (char *buf, long len);
+static void dl_pgExec (void);
+static void dl_pgEnd (void);
+#ifdef HAVE_LIBPQ
+static void dl_pgError (char *msg, char *pgmsg);
+#endif
+
+static void dl_parquetBegin (CtxPtr ctx, long naxis1);
+static int  dl_parquetLoad (CtxPtr ctx, fitsfile *fptr, unsigned char *table,
+                                unsigned char *buf, long nrows, long naxis1,
+                                int nelem);
+static void dl_parquetRows (CtxPtr ctx, unsigned char *data, long nrows);
+static void dl_parquetFlush (CtxPtr ctx);
+static void dl_parquetEnd (CtxPtr ctx);
+static void dl_parquetFree (void);
+static PqColPtr dl_pqColumns (CtxPtr ctx, int *ncols);
+static int  dl_pqType (ColPtr col, PqColPtr c);
+static void *dl_pqWorker (void *arg);
+static void dl_pqEncode (PqColPtr c);
+static unsigned int *dl_pqDict (PqColPtr c);
+static void dl_pqValues (PqColPtr c, long r0, long r1);
+static unsigned char *dl_pqString (PqColPtr c, unsigned char *vp, int *len);
+static void dl_pqLevels (PqColPtr c, long r0, long r1);
+static void dl_pqHybrid (TbufPtr t, unsigned int *vals, long n, int width);
+static void dl_pqPage (PqColPtr c, int type, long nvalues, int encoding);
+static void dl_pqSchema (TbufPtr t, PqColPtr c, char *name);
+static void dl_pqPut32 (TbufPtr t, unsigned int v);
+static void dl_tPut (TbufPtr t, void *p, long n);
+static void dl_tVarint (TbufPtr t, unsigned long long v);
+static void dl_tInt (TbufPtr t, long long v);
+static void dl_tBytes (TbufPtr t, char *s);
+static void dl_tField (TbufPtr t, int id, int type);
+static void dl_tBegin (TbufPtr t);
+static void dl_tEnd (TbufPtr t);
+static void dl_tStruct (TbufPtr t, int id);
+static void dl_tList (TbufPtr t, int id, int type, int n);
+static void dl_tI32 (TbufPtr t, int id, int v);
+static void dl_tI64 (TbufPtr t, int id, long long v);
+static void dl_tString (TbufPtr t, int id, char *s);
+static void dl_tFree (TbufPtr t);
+
+static void dl_arrowBegin (CtxPtr ctx, long naxis1);
+static int  dl_arrowLoad (CtxPtr ctx, fitsfile *fptr, unsigned char *table,
+                                unsigned char *buf, long nrows, long naxis1,
+                                int nelem);
+static void dl_arrowBatch (CtxPtr ctx, unsigned char *data, long nrows);
+static void dl_arrowColumn (CtxPtr ctx, PqColPtr c, unsigned char *data,
+                                long nrows);
+static void dl_arrowEnd (CtxPtr ctx);
+static void dl_arrowFree (void);
+static long dl_arrowField (TbufPtr t, PqColPtr c, char *name, int list);
+static long dl_arrowHeader (TbufPtr t, int type, long bodylen);
+static void dl_arrowWrite (CtxPtr ctx);
+static void dl_arrowNode (long length);
+static unsigned char *dl_arrowBuffer (long nbytes);
+
+static FILE *dl_zOpen (FILE *fd);
+static FILE *dl_zClose (void);
+static void *dl_zReader (void *arg);
+static void *dl_zWorker (void *arg);
+static int   dl_zWrite (void);
+static void  dl_zCompress (ZblockPtr b);
+static void  dl_zFree (void);
+
+static int   dl_predParse (char *expr, PredPtr pred);
+static int   dl_predOr (char **ip, PredPtr pred);
+static int   dl_predAnd (char **ip, PredPtr pred);
+static int   dl_predCmp (char **ip, PredPtr pred);
+static int   dl_predSum (char **ip, PredPtr pred);
+static int   dl_predTerm (char **ip, PredPtr pred);
+static int   dl_predUnary (char **ip, PredPtr pred);
+static int   dl_predPrimary (char **ip, PredPtr pred);
+static int   dl_predMatch (char **ip, char *oper);
+static PredOpPtr dl_predEmit (PredPtr pred, int code);
+static int   dl_predBind (CtxPtr ctx, ColPtr cols, int ncols);
+static int   dl_predRows (CtxPtr ctx, unsigned char *out, unsigned char *in,
+                                int nrows, long naxis1);
+static PValPtr dl_predEval (CtxPtr ctx, unsigned char *dp, int n,
+                                long naxis1);
+static void  dl_predLoad (PredOpPtr op, PValPtr v, unsigned char *dp, int n,
+                                long naxis1);
+static void  dl_predBinary (PredOpPtr op, PValPtr a, PValPtr b, int n,
+                                int wa, int wb);
+static int   dl_predStrcmp (unsigned char *a, int alen, unsigned char *b,
+                                int blen);
+
+static int    dl_openTable (CtxPtr ctx, char *iname, fitsfile **fptr,
+                                int *status);
+static void   dl_closeTable (CtxPtr ctx, fitsfile *fptr, int *status);
+static int    dl_readTable (CtxPtr ctx, fitsfile *fptr, LONGLONG firstrow,
+                                LONGLONG firstchar, LONGLONG nbytes,
+                                unsigned char *buf, int *status);
+static ZinPtr dl_zinOpen (char *iname, int type, int nworkers);
+static void   dl_zinClose (ZinPtr z);
+static long   dl_zinHeader (ZinPtr z, long start);
+static long   dl_zinKey (ZinPtr z, long start, char *key);
+static void   dl_zinCard (unsigned char *hdr, int n, char *key, char *value);
+static long   dl_zinRead (ZinPtr z, unsigned char *buf, long nbytes);
+static void  *dl_zinReader (void *arg);
+static void  *dl_zinWorker (void *arg);
+static long   dl_zinFill (ZinPtr z);
+static long   dl_zinInflate (ZinPtr z, unsigned char *out, long size);
+static int    dl_zinStep (ZinPtr z, unsigned char *out, long size,
+                                long *nout, long *nin);
+#ifdef HAVE_ZSTD
+static int    dl_zinFrame (ZinPtr z, ZblockPtr b);
+#endif
+static void dl_arrowLE (unsigned char *p, int size, long n);
+static long dl_fbTable (TbufPtr t, int nfields, int *sizes, long *fpos);
+static long dl_fbVector (TbufPtr t, int n, int esize);
+static long dl_fbString (TbufPtr t, char *s);
+static void dl_fbSet (TbufPtr t, long pos, unsigned long long v, int size);
+static void dl_fbPatch (TbufPtr t, long pos, long target);
+static void dl_fbAlign (TbufPtr t, int align);
+
+#ifdef HAVE_SQLITE
+static void dl_sqliteRow (CtxPtr ctx, sqlite3_stmt *stmt, ProgPtr prog,
+                                unsigned char *dp);
+static void dl_sqliteValue (sqlite3_stmt *stmt, int idx, ColPtr col,
+                                unsigned char *vp);
+#endif
 
 static int dl_atoi (char *v);
+static long dl_atolPos (char *v);
 static int dl_isFITS (char *v);
-static int dl_isGZip (char *v);
+static int dl_zType (char *fname);
+static int dl_zTypeOf (unsigned char *buf, long len);
+static unsigned char *dl_mapTable (fitsfile *fptr, char *iname, long nbytes,
+                    void **base, size_t *len);
+static void dl_willNeed (CtxPtr ctx, unsigned char *addr, long nbytes);
 static void dl_error (int exit_code, char *error_message, char *tag);
 
 static char *dl_colType (ColPtr col);
@@ -319,9 +1198,8 @@ static int    dl_paramNext (char *opts, struct option long_opts[],
                     int argc, char *argv[], char *optval, int *posindex);
 static void   dl_paramFree (int argc, char *argv[]);
 
-static void bswap2 (char *a, char *b, int nbytes);
 static void bswap4 (char *a, int aoff, char *b, int boff, int nbytes);
-static void bswap8 (char *a, int aoff, char *b, int boff, int nbytes);
+static void dl_swapRun (unsigned char *p, int n, int size);
 static char *sstrip (char *s);
 static int is_swapped (void);
 
@@ -337,7 +1215,8 @@ main (int argc, char **argv)
     char **pargv, optval[SZ_FNAME], *prog_name;
     char **iflist = NULL, **ifstart = NULL;
     char  *iname = NULL, *oname = NULL, tmp[SZ_FNAME];
-    int    i, ch = 0, status = 0, pos = 0;
+    int    i, ch = 0, status = 0, pos = 0, ntasks = 0;
+    TaskPtr tasks = NULL;
 
 
     /*  Initialize local task values.
@@ -349,6 +1228,7 @@ main (int argc, char **argv)
     /*  Initialize the randome number generator.
      */
     srand ((unsigned int)time(NULL));
+    mach_swap = is_swapped ();
 
 
     /*  Parse the argument list.  The use of dl_paramInit() is required to
@@ -376,19 +1256,40 @@ main (int argc, char **argv)
 
 	    case 'b':  bundle = dl_atoi (optval);	break;  // --bundle
 	    case 'c':  chunk_size = dl_atoi (optval);	break;  // --chunk_size
+	    case 'z':  zname = strdup (optval);		break;  // --compress
+	    case 'l':  columns = strdup (optval);	break;  // --columns
+	    case 'x':  exclude = strdup (optval);	break;  // --exclude
 	    case 'e':  extnum = dl_atoi (optval);	break;  // --extnum
 	    case 'E':  extname = strdup (optval);	break;  // --extname
-	    case 'r':  rows = strdup (optval);		break;  // --rows
+	    case 'F':  if (strcmp (optval, "shortest") == 0)  // --float
+                            float_fmt = FMT_SHORTEST;
+                       else if (strcmp (optval, "fixed") == 0)
+                            float_fmt = FMT_FIXED;
+                       else {
+                            fprintf (stderr, "%s: Invalid float format '%s'"
+                                " (use 'fixed' or 'shortest')\n", prog_name,
+                                optval);
+                            return (ERR);
+                       }
+                       break;
+	    case 'r':  rows = strdup (optval);		break;  // --rowrange
 	    case 's':  expr = strdup (optval);	        break;  // --select
+	    case 'k':  nshards = (int) dl_atolPos (optval); break; // --shards
+	    case 'j':  shard_rows = dl_atolPos (optval); break; // --shard-rows
+	    case 'y':  shard_bytes = dl_atolPos (optval); break; // --shard-bytes
+	    case 'p':  partspec = strdup (optval);	break;  // --partition-by
 	    case 't':  tablename = strdup (optval);	break;  // --table
+	    case 'T':  nthreads = dl_atoi (optval);	break;  // --threads
 
 	    case 'B':  do_binary++;			break;  // --binary
 	    case 'C':  concat++;			break;  // --concat
 	    case 'X':  explode++;			break;  // --explode
 	    case 'H':  header = 0;			break;  // --noheader
+	    case 'M':  columnar++;			break;  // --columnar
 	    case 'Q':  do_quote = 0;			break;  // --noquote
 	    case 'N':  do_strip = 0;			break;  // --nostrip
 	    case 'O':  do_oids = 0;			break;  // --oid
+	    case 'P':  pipeline++;			break;  // --pipeline
 	    case 'Z':  do_load = 0;			break;  // --noload
 	    case 'S':  quote_char = '\'';		break;  // --quote
 
@@ -411,6 +1312,9 @@ main (int argc, char **argv)
                        format = TAB_IPAC;
                        arr_delimiter='|';
                        break;
+	    case 'J':  format = TAB_PARQUET;		break;  // --parquet
+	    case 'g':  row_group = dl_atoi (optval);	break;  // --row-group
+	    case 'a':  format = TAB_ARROW;		break;  // --arrow
 
 	    case '5':  if (optval[0] == 'm') {          // MySQL ouptut
                             format = TAB_MYSQL;
@@ -430,6 +1334,12 @@ main (int argc, char **argv)
 	    case '6':  do_drop++, do_create++;          break;  // --drop
 	    case '7':  do_create++;                     break;  // --create
 	    case '8':  do_truncate++;                   break;  // --truncate
+	    case '9':  sqlite_db = strdup (optval);     break;  // --sqlite-db
+	    case 'W':  commit_rows = dl_atoi (optval);  break;  // --commit
+	    case 'G':  pg_conninfo = strdup (optval);   break;  // --pg-conn
+	    case 'Y':  load_file = strdup (optval);     break;  // --load-data
+	    case 'K':  max_stmt_bytes = dl_atoi (optval); break; // --max-stmt-bytes
+	    case 'R':  max_stmt_rows = dl_atoi (optval);  break; // --max-stmt-rows
 	    case 'L':  sidname = strdup (optval);       break;  // --sid
 	    case 'U':  ridname = strdup (optval);       break;  // --rid
 	    case 'D':  dbname = strdup (optval);        break;  // --dbname
@@ -481,13 +1391,164 @@ main (int argc, char **argv)
             NULL);
         return (ERR);
     }
-    if (rows) {
-        fprintf (stderr,
-            "Warning: 'rows' option not yet implemented, skipping\n");
+    if (expr && dl_predParse (expr, &select_pred) != OK) {
+        if (verbose)
+            fprintf (stderr, "Selection '%s' is left to CFITSIO\n", expr);
+        select_pred.nops = 0;
+    }
+    if (columns && exclude) {
+        dl_error (3, "Only one of 'columns' or 'exclude' may be specified",
+            NULL);
+        return (ERR);
+    }
+    if (rows && dl_getRanges (rows) != OK)
         return (ERR);
+    if ((nshards != 0) + (shard_rows != 0) + (shard_bytes != 0) +
+        (partspec != NULL) > 1) {
+            dl_error (3, "Only one of 'shards', 'shard-rows', 'shard-bytes' "
+                "or 'partition-by' may be specified", NULL);
+            return (ERR);
+    }
+    if (partspec && dl_getPartition (partspec) != OK)
+        return (ERR);
+    if (partitioned && do_create && TAB_DBTYPE(format) &&
+        format != TAB_POSTGRES) {
+            dl_error (3, "Partitions can only be created for Postgres, "
+                "the child tables must already exist", NULL);
+            return (ERR);
+    }
+    if (nshards < 0 || nshards > MAX_SHARDS || shard_rows < 0 ||
+        shard_bytes < 0) {
+            dl_error (3, "Invalid number of shards", NULL);
+            return (ERR);
+    }
+    sharded = (nshards > 0 || shard_rows > 0 || shard_bytes > 0);
+    if (sharded && (sqlite_db || pg_conninfo || load_file)) {
+        dl_error (3, "Shards and partitions can only be written to output "
+            "files", NULL);
+        return (ERR);
+    }
+    if (sharded && (concat || bundle > 1)) {
+        dl_error (3, "Shards and partitions can't be bundled or "
+            "concatenated", NULL);
+        return (ERR);
+    }
+    if (nthreads < 1)
+        nthreads = 1;
+    else if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+    if (zname) {
+        if (strlen (zname) < 4 || (zname[4] != '\0' && zname[4] != ':'))
+            zcompress = CMP_NONE;
+        else if (strncmp (zname, "gzip", 4) == 0)
+            zcompress = CMP_GZIP;
+        else if (strncmp (zname, "zstd", 4) == 0)
+            zcompress = CMP_ZSTD;
+        if (zcompress == CMP_NONE) {
+            dl_error (2, "Unknown compression type", zname);
+            return (ERR);
+        }
+#ifndef HAVE_ZSTD
+        if (zcompress == CMP_ZSTD) {
+            dl_error (2, "fits2db was built without zstd support", NULL);
+            return (ERR);
+        }
+#endif
+        if (zname[4] == ':') {
+            char *ep = NULL;
+            int   lo = 0, hi = 9;
+
+#ifdef HAVE_ZSTD
+            if (zcompress == CMP_ZSTD)
+                lo = ZSTD_minCLevel (), hi = ZSTD_maxCLevel ();
+#endif
+            zlevel = (int) strtol (&zname[5], &ep, 10);
+            if (ep == &zname[5] || *ep || zlevel < lo || zlevel > hi) {
+                fprintf (stderr, "%s: Invalid compression level '%s' "
+                    "(use %d to %d)\n", prog_name, &zname[5], lo, hi);
+                return (ERR);
+            }
+        }
+
+        /*  Direct loads don't write an output file.
+         */
+        if (sqlite_db || pg_conninfo)
+            zcompress = CMP_NONE;
+    }
+    if (float_fmt == FMT_SHORTEST)
+        dl_initFloatFmt ();
+
+    /*  A direct SQLite load binds values straight from the table, so there
+     *  is no text to format in parallel or to write.  All input files go
+     *  to the one table.
+     */
+    if (sqlite_db) {
+        format = TAB_SQLITE;
+        do_binary = 0;
+        nthreads = 1;
+        pipeline = 0;
+        concat++;
+        if (commit_rows < 1)
+            commit_rows = DEF_COMMIT;
+        if (dl_sqliteOpen (sqlite_db) != OK)
+            return (ERR);
     }
-    if (do_binary)
+
+    /*  A direct Postgres load sends the usual COPY stream to the server
+     *  rather than to psql.
+     */
+    if (pg_conninfo) {
+        format = TAB_POSTGRES;
+        delimiter = '\t';
+        arr_delimiter = ',';
+        do_quote = 0;
+        if (dl_pgOpen (pg_conninfo) != OK)
+            return (ERR);
+    }
+
+    /*  MySQL LOAD DATA rows are tab-separated like a Postgres text COPY,
+     *  one statement per file.
+     */
+    if (load_file) {
+        format = TAB_MYSQL;
+        delimiter = '\t';
+        arr_delimiter = ',';
+        do_quote = 0;
+        do_binary = 0;
         bundle = 1;
+    }
+
+    /*  Parquet row groups are written one file at a time, the threads
+     *  encode the columns of each.  Arrow batches are written as read.
+     */
+    if (TAB_BINFILE(format)) {
+        do_binary = 0;
+        pipeline = 0;
+        columnar = 0;
+    }
+
+    /*  Concatenated Postgres output is one COPY of all the files unless
+     *  bundled.  psql reads a binary COPY to the end of its input, so only
+     *  a direct load may send a binary bundle per COPY.  A concatenated
+     *  Parquet file always holds all of them.
+     */
+    if (concat && format == TAB_POSTGRES &&
+        (bundle <= 1 || (do_binary && !pg_conninfo)))
+            bundle = nfiles;
+    if (concat && TAB_BINFILE(format))
+        bundle = nfiles;
+
+    /*  INSERT budgets are counted as rows are written, so a split
+     *  statement is formatted in order by one thread.
+     */
+    if ((format != TAB_MYSQL && format != TAB_SQLITE) || load_file ||
+        sqlite_db)
+            max_stmt_bytes = max_stmt_rows = 0;
+    if (max_stmt_bytes || max_stmt_rows) {
+        nthreads = 1;
+        pipeline = 0;
+        columnar = 0;
+    }
 
 
     /*  Generate the output file lists if needed.
@@ -498,7 +1559,7 @@ main (int argc, char **argv)
          */
         if (oname && strcmp (oname, "-") == 0)
             free (oname), oname = NULL;
-        if (oname == NULL) 
+        if (oname == NULL && !sharded)
             oname = strdup ("stdout");
     } else {
         if (oname)
@@ -520,8 +1581,10 @@ main (int argc, char **argv)
         return (ERR);
 
     } else {
-        char ofname[SZ_PATH], ifname[SZ_PATH];
+        char ofname[SZ_PATH], ifname[SZ_PATH], bfname[SZ_PATH];
+        char sfname[SZ_PATH];
         int  ndigits = (int) log10 (nfiles) + 1, bnum = 0;
+        int  k, nsh = 1, maxtasks = nfiles;
 
 
         if (debug) {
@@ -530,6 +1593,16 @@ main (int argc, char **argv)
             }
         }
 
+        /*  In threaded mode we only build the task list here, the files
+         *  are converted by the worker pool once we know all of them.  A
+         *  single file instead uses the threads to format slices of rows,
+         *  unless it is split into shards which are written at once.
+         *  Compressed shards share the one compressor, so go in turn.
+         */
+        if (nthreads > 1 && (nfiles > 1 || sharded) && !pg_conninfo &&
+            !load_file && !TAB_BINFILE(format) && !(sharded && zcompress))
+                tasks = (TaskPtr) calloc (nfiles + 1, sizeof (Task));
+
         for (iflist=ifstart, i=0; *iflist; iflist++, i++) {
 
             memset (ifname, 0, SZ_PATH);
@@ -554,15 +1627,19 @@ main (int argc, char **argv)
                 sprintf (tmp, "%s[%s]", ifname, extname);
                 strcpy (ifname, tmp);
             }
-            if (expr) {
+            if (expr && select_pred.nops == 0) {
                 memset (tmp, 0, SZ_FNAME);
                 sprintf (tmp, "%s[%s]", ifname, expr);
                 strcpy (ifname, tmp);
             }
 
-            /*  Construct the output filename.
+            /*  Construct the output filename.  The files of a bundle are
+             *  all written to the output of its first file.
              */
-            if (basename) {
+            if (bnum > 0 && !concat) {
+                strcpy (ofname, bfname);
+
+            } else if (basename) {
                 if (concat) {
                     if (i == 0)
                         sprintf (ofname, "%s.%s", basename, dl_fextn());
@@ -589,7 +1666,8 @@ main (int argc, char **argv)
                 free ((char *) in);
             }
 
-            omode = ((concat && i > 0) ? "a+" : "w+");
+            strcpy (bfname, ofname);
+            omode = (((concat && i > 0) || bnum > 0) ? "a+" : "w+");
 
             if (debug)
                 fprintf (stderr, "ifname='%s'  ofname='%s'\n", ifname, ofname);
@@ -597,18 +1675,55 @@ main (int argc, char **argv)
 
             /*  Do the conversion if we have a FITS file.
              */
-            if (dl_isFITS (ifname) || dl_isGZip (ifname)) {
+            if (dl_isFITS (ifname) || dl_zType (ifname)) {
                 if (verbose)
                     fprintf (stderr, "Processing file: %s\n", ifname);
 
-                if (!noop)
-		    if (access (ifname, F_OK) == 0)
-                        dl_fits2db (ifname, ofname, i, bnum, nfiles);
-		    else {
+                if (!noop) {
+		    if (access (ifname, F_OK) < 0) {
 			fprintf (stderr, "Error: Cannot access '%s'\n", ifname);
 			continue;
 		    }
 
+                    /*  A sharded table is converted once per shard, each
+                     *  to its own output file.
+                     */
+                    nsh = (sharded ? dl_countShards (ifname) : 1);
+                    if (nsh > MAX_SHARDS) {
+                        fprintf (stderr, "Error: Too many shards for '%s'\n",
+                            ifname);
+                        continue;
+                    }
+                    for (k=0; k < nsh; k++) {
+                        if (sharded)
+                            dl_shardName (ofname, k, nsh, sfname);
+
+                        if (tasks) {
+                            TaskPtr t = (TaskPtr) NULL;
+
+                            if (ntasks == maxtasks) {
+                                maxtasks *= 2;
+                                tasks = (TaskPtr) realloc (tasks,
+                                    (maxtasks + 1) * sizeof (Task));
+                            }
+                            t = &tasks[ntasks];
+                            memset (t, 0, sizeof (Task));
+                            t->ifname  = strdup (ifname);
+                            t->ofname  = strdup (sharded ? sfname : ofname);
+                            t->omode   = omode;
+                            t->filenum = i;
+                            t->bnum    = bnum;
+                            t->shard   = k;
+                            t->index   = ntasks++;
+                        } else {
+                            context.omode = omode;
+                            context.shard = k;
+                            dl_fits2db (&context, ifname,
+                                (sharded ? sfname : ofname), i, bnum, nfiles);
+                        }
+                    }
+                }
+
                 /* Increment the filenumber within the bundle so we can keep
                  * track of headers.
                  */
@@ -617,10 +1732,14 @@ main (int argc, char **argv)
                 fprintf (stderr, "Error: Skipping non-FITS file '%s'.\n", 
                                     ifname);
         }
-    }
 
+        if (ntasks > 0)
+            dl_runTasks (tasks, ntasks, nfiles);
+    }
     if (status)
         fits_report_error (stderr, status);     // print any error message
+    if (atomic_load (&failed))
+        status = ERR;                           // bad column or selection
 
 
     /*  Clean up.  Rememebr to free whatever pointers were created when
@@ -631,11 +1750,31 @@ main (int argc, char **argv)
 
     if (rows) free (rows);
     if (expr) free (expr);
+    if (partspec) free (partspec);
     if (iname) free (iname);
     if (oname) free (oname);
     if (extname) free (extname);
     if (tablename) free (tablename);
     if (ifstart) free ((void *) ifstart);
+    if (sqlite_db) {
+        dl_sqliteClose ();
+        free (sqlite_db);
+    }
+    if (pg_conninfo) {
+        dl_pgClose ();
+        free (pg_conninfo);
+    }
+    if (load_file) free (load_file);
+    if (format == TAB_PARQUET) dl_parquetFree ();
+    if (format == TAB_ARROW) dl_arrowFree ();
+    if (zcompress) dl_zFree ();
+    if (zname) free (zname);
+    if (context.stmthdr) free (context.stmthdr);
+    if (tasks) {
+        for (i=0; i < ntasks; i++)
+            free ((void *) tasks[i].ifname), free ((void *) tasks[i].ofname);
+        free ((void *) tasks);
+    }
 
     dl_paramFree (argc, pargv);
 
@@ -648,25 +1787,37 @@ main (int argc, char **argv)
  *  some ascii 'database' table like a CSV.
  */
 static void
-dl_fits2db (char *iname, char *oname, int filenum, int bnum, int nfiles)
+dl_fits2db (CtxPtr ctx, char *iname, char *oname, int filenum, int bnum,
+            int nfiles)
 {
     fitsfile *fptr = (fitsfile *) NULL;
     int   status = 0;
-    long  jj, nrows;
-    int   hdunum, hdutype, ncols, i, j;
+    long  jj, n, nrows;
+    int   hdunum, hdutype, ncols;
     int   firstcol = 1, lastcol = 0, firstrow = 1;
-    int   nelem, chunk = chunk_size;
+    int   nelem, nsel, chunk = chunk_size, nslices = 1, more = 0;
 
-    FILE  *ofd = (FILE *) NULL;
     //ColPtr col = (ColPtr) NULL;
 
-    unsigned char *data = NULL, *dp = NULL;
+    unsigned char *data = NULL, *buf = NULL, *table = NULL;
+    SlicePtr slices = (SlicePtr) NULL;
     long   naxis1, rowsize = 0, nbytes = 0, firstchar = 1, totrows = 0;
+    void  *mapbase = NULL;
+    size_t maplen = 0;
 
 
-    mach_swap = is_swapped ();
+    /*  A comma follows the last row of a chunk when more tables are to
+     *  follow in the same INSERT statement, and a COPY goes on into the
+     *  next file.
+     */
+    more = (filenum < (nfiles-1) && bnum < (bundle-1));
+
+    /*  Headers and table names are set up one file at a time, in input
+     *  order, even when converting in parallel.
+     */
+    dl_beginTurn (ctx);
 
-    if (!fits_open_file (&fptr, iname, READONLY, &status)) {
+    if (!dl_openTable (ctx, iname, &fptr, &status)) {
         if ( fits_get_hdu_num (fptr, &hdunum) == 1 )
             /*  This is the primary array;  try to move to the first extension
              *  and see if it is a table.
@@ -693,74 +1844,90 @@ dl_fits2db (char *iname, char *oname, int filenum, int bnum, int nfiles)
             nelem = rowsize;
 
 
-            /*  Open the output file.
+            /*  Open the output file.  A direct SQLite load collects the
+             *  table setup SQL to be run in the database instead.
              */
-            if (strcasecmp (oname, "stdout") == 0 || oname[0] == '-')
-                ofd = stdout;
-            else {
-                if ((ofd = fopen (oname, omode)) == (FILE *) NULL)
-                    dl_error (3, "Error opening output file '%s'\n", oname);
-            }
+            if (sqlite_db)
+                dl_sqliteSetup (ctx);
+            else
+                dl_outOpen (ctx, oname);
+            if (pg_conninfo && bnum == 0)
+                dl_pgEnd ();                    // a new bundle ends the COPY
 
             /*  Print column names as column headers when writing a new file,
-             *  skip if we're appending output.
-             *
-             *  FIXME -- Need to add a check that new file matches columns
-             *           when we have multi-file input.
+             *  skip if we're appending output.  Appended files must match
+             *  the columns of the first, their rows go in the same COPY or
+             *  INSERT.
              */
             fits_read_key (fptr, TLONG, "NAXIS1", &naxis1, NULL, &status);
-            if (filenum == 0 || !concat) {
-		dl_getColInfo (fptr, firstcol, lastcol);
+            dl_shardRows (ctx, nrows, naxis1);
+            if (filenum == 0 || (!concat && bnum == 0)) {
+		if (dl_getColInfo (ctx, fptr, firstcol, lastcol) != OK) {
+                    fprintf (stderr, "Skipping table '%s'\n", iname);
+                    dl_outClose (ctx);
+                    dl_endTurn (ctx, 0);
+                    dl_closeTable (ctx, fptr, &status);
+                    return;
+                }
 
                 if (!tablename) 
                     tablename = dl_makeTableName (iname);
+                dl_tableName (ctx);
 
                 if (format == TAB_DELIMITED)
-                    dl_printHdr (firstcol, lastcol, ofd);
+                    dl_printHdr (ctx, firstcol, lastcol);
                 else if (format == TAB_IPAC)
-                    dl_printIPACTypes (iname, fptr, firstcol, lastcol, ofd);
-                else {
-                    int c = 0;
-
-                    /*  Binary mode is only supported for Postgres, and not
-                     *  for array operations.  Disable if needed but issue
-                     *  a warning.
-                     */
-                    if (do_binary) {
-                        for (c=firstcol; c <= lastcol; c++) {
-                            ColPtr col = (ColPtr) &inColumns[c];
-                            if (col->type != TSTRING && col->repeat > 1) {
-                                fprintf (stderr, "Warning: binary mode not "
-                                    "supported for array columns, disabling\n");
-                                fflush (stderr);
-                                do_binary = 0;
-                                break;
-                            }
-                        }
-                    }
-
-                    // This is some sort of SQL output.
+                    dl_printIPACTypes (ctx, iname, fptr, firstcol, lastcol);
+                else if (TAB_BINFILE(format))
+                    ;                           // schema is written below
+                else if (ctx->shard == 0 || partitioned) {
+                    // This is some sort of SQL output.  Only the first
+                    // shard of a table creates or truncates it, each
+                    // partition has a table of its own.
                     if (do_create)
-                        dl_createSQLTable (tablename, fptr, firstcol, lastcol,
-                            ofd);
-                    if (do_truncate)
-                        fprintf (ofd, "TRUNCATE TABLE %s;\n", tablename);
+                        dl_createSQLTable (ctx, ctx->tabname, fptr, firstcol,
+                            lastcol);
+                    if (do_truncate && format == TAB_SQLITE)
+                        dl_outPrintf (ctx, "DELETE FROM %s;\n", ctx->tabname);
+                    else if (do_truncate)
+                        dl_outPrintf (ctx, "TRUNCATE TABLE %s;\n",
+                            ctx->tabname);
 
                 }
             } else {
                 // Make sure this file has the same columns.
-                if (dl_validateColInfo (fptr, firstcol, lastcol)) {
+                dl_tableName (ctx);
+                if (dl_validateColInfo (ctx, fptr, firstcol, lastcol)) {
                     fprintf (stderr, "Skipping unmatching table '%s'\n", 
                         iname);
+                    if (sqlite_db)
+                        dl_sqliteExec (ctx);
+                    if (!more && bnum > 0 && format == TAB_PARQUET)
+                        dl_parquetEnd (ctx);    // the bundle ends here
+                    else if (!more && bnum > 0 && format == TAB_ARROW)
+                        dl_arrowEnd (ctx);
+                    else if (!more && bnum > 0)
+                        dl_printSQLEnd (ctx);
+                    dl_outClose (ctx);
+                    dl_endTurn (ctx, 0);
+                    dl_closeTable (ctx, fptr, &status);
                     return;
                 }
             }
 
+            if (sqlite_db && dl_sqliteExec (ctx) != OK) {
+                dl_endTurn (ctx, 0);
+                dl_closeTable (ctx, fptr, &status);
+                return;
+            }
+
 
             /*  If we're not loading the database, close the file and return.
              */
             if (do_load == 0) {
-                fits_close_file (fptr, &status);
+                dl_outClose (ctx);
+                dl_endTurn (ctx, 0);
+                dl_closeTable (ctx, fptr, &status);
                 if (status)                 /* print any error message */
                     fits_report_error (stderr, status);
                 return;
@@ -771,131 +1938,186 @@ dl_fits2db (char *iname, char *oname, int filenum, int bnum, int nfiles)
              *  COPY/INSERT statement.  This helps avoid memory problems in
              *  the database clients we write to.
              */
-            if (bnum == 0 && TAB_DBTYPE(format))
-                dl_printSQLHdr (tablename, fptr, firstcol, lastcol, ofd);
+            if (bnum == 0 && TAB_DBTYPE(format) && !sqlite_db)
+                dl_printSQLHdr (ctx, ctx->tabname, fptr, firstcol, lastcol);
+            else if (bnum == 0 && format == TAB_PARQUET)
+                dl_parquetBegin (ctx, naxis1);
+            else if (bnum == 0 && format == TAB_ARROW)
+                dl_arrowBegin (ctx, naxis1);
 
+            dl_endTurn (ctx, dl_rangeRows (ctx, nrows));
 
-            /*  Allocate the I/O buffer.
+
+            /*  Map the table data of a plain disk file so rows are
+             *  formatted straight from the page cache.  Otherwise allocate
+             *  the I/O buffer, allowing for the extra row the last chunk
+             *  may hold.
              */                
             nbytes = nelem * naxis1;
             if (debug)
                 fprintf (stderr, "nelem=%d  naxis1=%ld  nbytes=%ld  nrows=%d\n",
                     nelem, naxis1, nbytes, (int)nrows);
                 
-            data = (unsigned char *) calloc (1, nbytes * 8);
-            obuf = (char *) calloc (1, nbytes * 8);
-            olen = 0;
+            table = dl_mapTable (fptr, iname, nrows * naxis1, &mapbase,
+                &maplen);
 
-            /*  Loop over the rows in the table in optimal chunk sizes.
+            /*  Find the parts of a row the projected columns need.  If
+             *  that is little of a wide row, pages of the mapped table
+             *  aren't read ahead.
              */
-            for (jj=firstrow; jj <= nrows; jj += nelem) {
-                if ( (jj + nelem) >= nrows)
-                    nelem = (nrows - jj + 1);
+            dl_getSpans (ctx, naxis1);
+            if (table && ctx->narrow)
+                madvise (mapbase, maplen, MADV_RANDOM);
 
-                /*  Read a chunk of data from the file.
-                 */
-                nbytes = nelem * naxis1;
-                fits_read_tblbytes (fptr, firstrow, firstchar, nbytes,
-                    data, &status);
-                if (status) {                   /* print any error message */
-                    fits_report_error (stderr, status);
-                    break;
-                }
+            /*  Text output needs numeric values in native byte order, so
+             *  each chunk is swapped once as it is read (into the buffer
+             *  when the table is mapped).
+             */
+            ctx->nswaps = 0;
+            if (mach_swap && !ctx->do_binary)
+                dl_getSwapRuns (ctx);
+            if (table == NULL || ctx->nswaps > 0 || ctx->pred.nops > 0 ||
+                partitioned)
+                    buf = (unsigned char *) calloc (nelem + 1, naxis1);
+            dl_getRowProg (ctx, naxis1);
+            ctx->osize = (nelem + 1) * ctx->prog.rowmax;
+            ctx->obuf = (char *) calloc (1, ctx->osize);
+            ctx->olen = 0;
+
+            /*  When converting a single file with several threads, each
+             *  chunk is cut into slices of rows that are formatted in
+             *  parallel into private buffers.
+             */
+            if (ctx->task == NULL && nthreads > 1 && nelem > 1 &&
+                !TAB_BINFILE(format)) {
+                nslices = (nelem < nthreads ? nelem : nthreads);
+                dl_gangStart (nslices);
+            }
 
-                /* Process the chunk by parsing the binary data and printing
-                 * out according to column type.
-                 */
-                dp = data;
-                optr = obuf;
-                olen = 0;
-
-                for (j=firstrow; j <= nelem; j++) {
-                    if (format == TAB_POSTGRES && do_binary) {
-                        unsigned short val = 0;
-                        val = (explode ? htons ((short) numOutCols) : 
-                                         htons ((short) ncols));
-                        memcpy (optr, &val, sz_short);
-                        optr += sz_short;
-                        olen += sz_short;
-
-                    } else if (single && 
-                        (format == TAB_SQLITE || format == TAB_MYSQL)) {
-                            // For SQLite we print the header for each row.
-                            dl_printHdrString (tablename);
-                    }
-                
-                    /*  Print all the columns in the table.
-                     */
-                    for (i=firstcol; i <= ncols; i++)
-                        dp = dl_printCol (dp, &inColumns[i], 
-                                    (i < ncols ? delimiter : '\n'));
+            /*  In pipelined mode separate threads read and write chunks
+             *  while this one formats them.  Otherwise loop over the rows
+             *  in the table in optimal chunk sizes.
+             */
+            if (sqlite_db) {
+                status = dl_sqliteLoad (ctx, fptr, table, buf, nrows, naxis1,
+                    nelem);
+                totrows = dl_rangeRows (ctx, nrows);
+
+            } else if (format == TAB_PARQUET) {
+                status = dl_parquetLoad (ctx, fptr, table, buf, nrows, naxis1,
+                    nelem);
+                totrows = dl_rangeRows (ctx, nrows);
+
+            } else if (format == TAB_ARROW) {
+                status = dl_arrowLoad (ctx, fptr, table, buf, nrows, naxis1,
+                    nelem);
+                totrows = dl_rangeRows (ctx, nrows);
+
+            } else if (pipeline && ctx->task == NULL) {
+                status = dl_pipeline (ctx, fptr, table, nrows, naxis1, nelem,
+                    nslices, more);
+                totrows = dl_rangeRows (ctx, nrows);
 
+            } else {
+                // Allow for the extra row the last chunk may hold.
+                if (nslices > 1)
+                    slices = dl_newSlices (ctx, nslices,
+                        ((nelem + nslices) / nslices) * ctx->prog.rowmax);
 
-                    if (format == TAB_MYSQL || format == TAB_SQLITE) {
-                        // Add a comma for all but the last row of a table.
-                        if (j < nelem)
-                            *optr++ = ',', olen++;
+                for (jj=firstrow; (n = dl_nextChunk (ctx, &jj, nelem, nrows));
+                    jj += n) {
 
-                        // Add a comma if there will be more tables to follow.
-                        else if (filenum < (nfiles-1) && bnum < (bundle-1))
-                            *optr++ = ',', olen++;
+                    /*  Read a chunk of data from the file, or just point
+                     *  at it in the mapped table.
+                     */
+                    firstchar = (jj - 1) * naxis1 + 1;
+                    nbytes = n * naxis1;
+                    if (table) {
+                        data = table + (firstchar - 1);
+                        if ((jj + n) <= nrows)
+                            dl_willNeed (ctx, data + nbytes, nbytes);
+                    } else {
+                        dl_readTable (ctx, fptr, firstrow, firstchar, nbytes,
+                            buf, &status);
+                        if (status) {           /* print any error message */
+                            fits_report_error (stderr, status);
+                            break;
+                        }
+                        data = buf;
                     }
+                    nsel = dl_prepChunk (ctx, buf, &data, n, naxis1);
 
-                    if (! do_binary)
-                        *optr++ = '\n', olen++;     // terminate the row
-                }
-                write (fileno(ofd), obuf, olen);
-                fflush (ofd);
+                    /* Process the chunk by parsing the binary data and
+                     * printing out according to column type.
+                     */
+                    ctx->optr = ctx->obuf;
+                    ctx->olen = 0;
+
+                    if (nsel == 0) {
+                        ;                       // no rows selected
+                    } else if (nslices > 1) {
+                        dl_formatSlices (ctx, slices, nslices, data, naxis1,
+                            nsel, more);
+                        dl_writeSlices (ctx, slices, nslices);
+                    } else if (ctx->prog.direct && !ctx->queued) {
+                        dl_formatIov (ctx, &ctx->prog, data, nsel);
+                    } else {
+                        dl_formatRows (ctx, &ctx->prog, data, nsel, more);
+                        dl_outChunk (ctx);
+                    }
 
-                /*  Advance the offset counters in the file.
-                 */
-                firstchar += nbytes;
-                totrows += nelem;
+                    totrows += nsel;
+                }
             }
 
 
-            /*  Terminate the output stream.
+            /*  Terminate the output stream.  A LOAD DATA ends with its file,
+             *  a COPY or INSERT with the last file of its bundle.  The COPY
+             *  of a file on its own written for psql just ends with the
+             *  output, unless it is one of several shards.  A Parquet file
+             *  ends with its footer, an Arrow stream with its end-of-stream
+             *  marker.
              */
-            if ((concat && filenum == (nfiles-1)) || 
-                (bnum > 0 && bnum == (bundle-1))) {
-
-                if (format == TAB_POSTGRES) {
-                    optr = obuf, olen = 0;
-//fprintf (stderr, "writing EOF  f=%d nf=%d  bn=%d bun=%d\n",
-//        filenum, nfiles, bnum, bundle);
-                    memset (optr, 0, nbytes);
-                    if (do_binary) {
-                        short  eof = -1;
-                        memcpy (optr, &eof, sz_short),   olen += sz_short;
-                    } else
-                        memcpy (optr, "\\.\n", 3),       olen += 3;
-
-                    write (fileno(ofd), obuf, olen);
-                    fflush (ofd);
-
-                } else if (format == TAB_MYSQL || format == TAB_SQLITE) {
-                    write (fileno(ofd), ";\n" , 2);
-                    fflush (ofd);
-                }
-            }
+            if (load_file)
+                dl_loadEnd (ctx);
+            else if (format == TAB_PARQUET) {
+                if (!more)
+                    dl_parquetEnd (ctx);
+            } else if (format == TAB_ARROW) {
+                if (!more)
+                    dl_arrowEnd (ctx);
+            } else if (!more && (format != TAB_POSTGRES || concat || bnum > 0 ||
+                pg_conninfo || sharded))
+                    dl_printSQLEnd (ctx);
 
 
             /*  Free the column structures and data pointers.
              */
-            if (data) free ((char *) data);
-            if (obuf) free ((void *) obuf);
-            //for (ii = firstcol; ii <= lastcol; ii++) {
-            //    col = (ColPtr) &inColumns[ii];
-            //    free ((void *) col);
-            //}
+            if (buf) free ((char *) buf);
+            if (ctx->prog.rowhdr) free ((char *) ctx->prog.rowhdr);
+            ctx->prog.rowhdr = NULL;
+            if (mapbase) munmap (mapbase, maplen);
+            if (ctx->obuf) free ((void *) ctx->obuf);
+            if (ctx->cbuf) free ((void *) ctx->cbuf);
+            if (ctx->vals) free ((void *) ctx->vals);
+            if (ctx->tbuf) free ((void *) ctx->tbuf);
+            if (ctx->iov) free ((void *) ctx->iov);
+            ctx->iov = NULL;
+            ctx->cbuf = NULL, ctx->vals = NULL, ctx->tbuf = NULL;
+            ctx->csize = ctx->nvals = ctx->tsize = 0;
+            ctx->obuf = ctx->optr = NULL;
+            if (slices)
+                dl_freeSlices (slices, nslices);
+            if (nslices > 1)
+                dl_gangStop ();
 
             /*  Close the output file.
              */
-            if (ofd != stdout)
-                fclose (ofd);
+            dl_outClose (ctx);
         }
     }
-    fits_close_file (fptr, &status);
+    dl_endTurn (ctx, 0);
+    dl_closeTable (ctx, fptr, &status);
 
     if (status)                                 /* print any error message */
         fits_report_error (stderr, status);
@@ -903,1377 +2125,7766 @@ dl_fits2db (char *iname, char *oname, int filenum, int bnum, int nfiles)
 
 
 /**
- *  DL_GETCOLINFO -- Get information about the columns in teh table.
+ *  DL_FORMATROWS -- Format a run of rows into the context output buffer by
+ *  running the row program over each row.  If 'more' is set a comma
+ *  follows the last row of an INSERT statement.
  */
-static void
-dl_getColInfo (fitsfile *fptr, int firstcol, int lastcol)
+static unsigned char *
+dl_formatRows (CtxPtr ctx, ProgPtr prog, unsigned char *dp, int nrows,
+                int more)
 {
-    register int i;
-    char  keyword[FLEN_KEYWORD], dims[FLEN_KEYWORD];
-    ColPtr icol = (ColPtr) NULL;
-    int   status = 0;
-
-
-    /* Gather information about the input columns.
-     */
-    for (i = firstcol, numInCols = 0; i <= lastcol; i++, numInCols++) {
-        icol = (ColPtr) &inColumns[i];
-        memset (icol, 0, sizeof(Col));
+    register int i, j;
+    register OpPtr op = (OpPtr) NULL;
 
-        status = 0;                             // reset CFITSIO status
-        memset (keyword, 0, FLEN_KEYWORD);
-        fits_make_keyn ("TTYPE", i, keyword, &status);
-        fits_read_key (fptr, TSTRING, keyword, icol->colname, NULL, &status);
-        fits_get_coltype (fptr, i, &icol->type, &icol->repeat,
-            &icol->width, &status);
-        fits_get_col_display_width (fptr, i, &icol->dispwidth, &status);
-        if (icol->type == TSTRING && do_quote) 
-            icol->dispwidth+= 2;
-        icol->colnum = i;
 
-        icol->ndim = 1;		                // default dimensions
-        icol->nrows = 1;
-        icol->ncols = icol->repeat;
+    if (prog->split)
+        return (dl_formatStmts (ctx, prog, dp, nrows));
+    if (columnar)
+        return (dl_formatCols (ctx, prog, dp, nrows, more));
 
-        if (icol->repeat > 1 && icol->type != TSTRING && explode) {
-            memset (keyword, 0, FLEN_KEYWORD);
-            fits_make_keyn ("TDIM", i, keyword, &status);
-            fits_read_key (fptr, TSTRING, keyword, dims, NULL, &status);
-            if (status == 0)    // Dimension string usually means a 2-D array
-                icol->ndim = sscanf (dims, "(%d,%d)", 
-                    &icol->nrows, &icol->ncols);
-            status = 0;
+    for (j=1; j <= nrows; j++, dp += prog->naxis1) {
+        if (prog->nhdr) {
+            memcpy (ctx->optr, prog->rowhdr, prog->nhdr);
+            ctx->optr += prog->nhdr, ctx->olen += prog->nhdr;
         }
-    }
 
-    if (debug) {
-        fprintf (stderr, "Input Columns [%d]:\n", numInCols);
-        for (i=1; i <= numInCols; i++) {
-            icol = (ColPtr) &inColumns[i];
-            fprintf (stderr, "  %d  '%s'  rep=%ld nr=%d nc=%d\n", icol->colnum, 
-                icol->colname, icol->repeat, icol->nrows, icol->ncols);
+        for (i=0, op=prog->ops; i < prog->nops; i++, op++) {
+            if (op->npre) {
+                memcpy (ctx->optr, op->prefix, op->npre);
+                ctx->optr += op->npre, ctx->olen += op->npre;
+            }
+            (*op->emit) (ctx, dp + op->offset, op->col);
+            if (op->nsuf) {
+                memcpy (ctx->optr, op->suffix, op->nsuf);
+                ctx->optr += op->nsuf, ctx->olen += op->nsuf;
+            }
         }
+
+        // Add a comma for all but the last row of a table, or if
+        // there will be more tables to follow.
+        if (prog->comma && (j < nrows || more))
+            *ctx->optr++ = ',', ctx->olen++;
+        if (prog->newline)
+            *ctx->optr++ = '\n', ctx->olen++;     // terminate the row
     }
 
-    /* Now expand to create the output column information so we don't need 
-     * to repeat this for each table type.  If we're exploding columns
-     * compute all the output columns names, otherwise simply copy the input
-     * names.
-     */
-    dl_getOutputCols (fptr, firstcol, lastcol);
+    return (dp);
 }
 
 
 /**
- *  DL_VALIDATECOLINFO -- Validate that this file has the same column
- *  information.
+ *  DL_STMTFULL -- See whether a row of 'len' bytes would take the current
+ *  INSERT over either statement budget.
  */
 static int
-dl_validateColInfo (fitsfile *fptr, int firstcol, int lastcol)
+dl_stmtFull (CtxPtr ctx, long len)
 {
-    register int i;
-    char   keyword[FLEN_KEYWORD], dims[FLEN_KEYWORD];
-    Col    newColumns[MAX_COLS], *col = (ColPtr) NULL, *icol = (ColPtr) NULL;
-    int    numCols, status = 0;
-
+    if (max_stmt_rows && ctx->stmt_rows >= max_stmt_rows)
+        return (1);
+    if (max_stmt_bytes && ctx->stmt_bytes + len + 4 > (long) max_stmt_bytes)
+        return (1);
+    return (0);
+}
 
-    /* Gather information about the input columns.
-     */
-    for (i = firstcol, numCols = 0; i <= lastcol; i++, numCols++) {
-        col = (ColPtr) &newColumns[i];
-        memset (col, 0, sizeof(Col));
-        col->colnum = i;
 
-        status = 0;                             // reset CFITSIO status
-        memset (keyword, 0, FLEN_KEYWORD);
-        fits_make_keyn ("TTYPE", i, keyword, &status);
-        fits_read_key (fptr, TSTRING, keyword, col->colname, NULL, &status);
-        fits_get_coltype (fptr, i, &col->type, &col->repeat, &col->width,
-            &status);
+/**
+ *  DL_STMTBREAK -- Fill in the separator left before the row at 'row':  a
+ *  comma, or when 'full' the end of the statement and the header of the
+ *  next.  Both budgets split through here so their boundaries match.
+ */
+static void
+dl_stmtBreak (CtxPtr ctx, ProgPtr prog, long row, long len, int nleft,
+                int full)
+{
+    long   need, extra = ctx->nstmthdr - 2;
 
-        col->ndim = 1;				// default dimensions
-        col->nrows = 1;
-        col->ncols = col->repeat;
 
-        if (col->repeat > 1 && col->type != TSTRING && explode) {
-            memset (keyword, 0, FLEN_KEYWORD);
-            fits_make_keyn ("TDIM", i, keyword, &status);
-            fits_read_key (fptr, TSTRING, keyword, dims, NULL, &status);
-            if (status == 0)
-                col->ndim = sscanf (dims, "(%d,%d)", &col->nrows, &col->ncols);
-            status = 0;
-        }
+    if (! full) {
+        memcpy (ctx->obuf + row - 2, ",\n", 2);
+        ctx->stmt_bytes += 2;
+        return;
     }
 
-    if (debug) {
-        fprintf (stderr, "Table Columns [%d]:\n", numCols);
-        for (i=1; i <= numCols; i++) {
-            col = (ColPtr) &newColumns[i];
-            fprintf (stderr, "  %d  '%s'  rep=%ld nr=%d nc=%d\n", col->colnum, 
-                col->colname, col->repeat, col->nrows, col->ncols);
-        }
+    /*  Move the row up past the new header, growing the buffer when the
+     *  headers leave too little room for the rest of the chunk.
+     */
+    need = ctx->olen + extra + nleft * prog->rowmax;
+    if (need > ctx->osize) {
+        ctx->osize = need * 2;
+        ctx->obuf = (char *) realloc (ctx->obuf, ctx->osize);
     }
-
-    /*  Check column names, dimensionality, and type for equality.
-     */
-    for (i=firstcol; i <= lastcol; i++) {
-        col = (ColPtr) &newColumns[i];
-        icol = (ColPtr) &inColumns[i];
-
-        if (strcmp (col->colname, icol->colname))
-            return (1);
-        if (col->type != icol->type ||
-            col->ndim != icol->ndim ||
-            col->nrows != icol->nrows)
-                return (1);
-        if (col->type != TSTRING)
-            if (col->ncols != icol->ncols || col->repeat != icol->repeat)
-                return (1);
-    }
-
-
-    /*  If we have a valid set of columns, copy the current table structure
-     *  so we process the input file correctly.
-     */
-    if (status == 0)
-        memcpy (&inColumns[0], &newColumns[0], ((numCols + 1) * sizeof (Col)));
-
-    return (status);                                    // No error
-}
+    memmove (ctx->obuf + row + extra, ctx->obuf + row, len);
+    memcpy (ctx->obuf + row - 2, ctx->stmthdr, ctx->nstmthdr);
+    ctx->olen += extra;
+    ctx->optr = ctx->obuf + ctx->olen;
+    ctx->stmt_rows = 0;
+    ctx->stmt_bytes = extra;
+}
 
 
 /**
- *  DL_GETOUTPUTCOLS -- Get the output column information.
+ *  DL_FORMATSTMTS -- Format a run of INSERT rows within the statement
+ *  budgets.  The separator before each row is only chosen once the row is
+ *  known, by dl_stmtBreak().  The last row is left open for the next chunk,
+ *  or for the terminator.
  */
-static void
-dl_getOutputCols (fitsfile *fptr, int firstcol, int lastcol)
+static unsigned char *
+dl_formatStmts (CtxPtr ctx, ProgPtr prog, unsigned char *dp, int nrows)
 {
-    register int i, j, ii, jj;
-    ColPtr icol = (ColPtr) NULL;
-    ColPtr ocol = (ColPtr) NULL;
+    register int i, j;
+    register OpPtr op = (OpPtr) NULL;
+    long   row, len;
 
 
-    if (explode) {
-        jj = firstcol;
-        for (ii = firstcol; ii <= lastcol; ii++) {
-            icol = (ColPtr) &inColumns[ii];
+    for (j=1; j <= nrows; j++, dp += prog->naxis1) {
+        if (ctx->stmt_rows > 0)
+            ctx->optr += 2, ctx->olen += 2;     // room for the separator
+        row = ctx->olen;
 
-            if (icol->repeat > 1 && icol->type != TSTRING) {
-                if (icol->ndim > 1) {                           // 2-D array
-                    for (i=1; i <= icol->nrows; i++) {
-                        for (j=1; j <= icol->ncols; j++)  {
-                            ocol = (ColPtr) &outColumns[jj++];
-                            memset (ocol->colname, 0, SZ_COLNAME);
-                            sprintf (ocol->colname, "%s_%d_%d",
-                                icol->colname, i, j);
-                            strcpy (ocol->coltype, dl_colType (icol));
-                            ocol->dispwidth = icol->dispwidth;
-                        }
-                    }
-                } else {                                        // 1-D array
-                    for (i=1; i <= icol->repeat; i++) {
-                        ocol = (ColPtr) &outColumns[jj++];
-                        memset (ocol->colname, 0, SZ_COLNAME);
-                        sprintf (ocol->colname, "%s_%d", icol->colname, i);
-                        strcpy (ocol->coltype, dl_colType (icol));
-                        ocol->dispwidth = icol->dispwidth;
-                    }
-                }
-            } else {
-                ocol = (ColPtr) &outColumns[jj++];
-                memset (ocol->colname, 0, SZ_COLNAME);
-                strcpy (ocol->colname, icol->colname);
-                strcpy (ocol->coltype, dl_colType (icol));
-                ocol->dispwidth = icol->dispwidth;
+        for (i=0, op=prog->ops; i < prog->nops; i++, op++) {
+            if (op->npre) {
+                memcpy (ctx->optr, op->prefix, op->npre);
+                ctx->optr += op->npre, ctx->olen += op->npre;
+            }
+            (*op->emit) (ctx, dp + op->offset, op->col);
+            if (op->nsuf) {
+                memcpy (ctx->optr, op->suffix, op->nsuf);
+                ctx->optr += op->nsuf, ctx->olen += op->nsuf;
             }
         }
-        numOutCols = jj - 1;
-
-    } else {
-        for (i = firstcol, numOutCols = 0; i <= lastcol; i++, numOutCols++) {
-            icol = (ColPtr) &inColumns[i];
-            ocol = (ColPtr) &outColumns[i];
-            memcpy (ocol, icol, sizeof(Col));
+        len = ctx->olen - row;
 
-            if (format == TAB_IPAC)
-                strcpy (ocol->coltype, dl_IPACType (icol));
-            else if (TAB_DBTYPE(format))
-                strcpy (ocol->coltype, dl_SQLType (icol));
-        }
-        numOutCols = numInCols;
+        if (ctx->stmt_rows > 0)
+            dl_stmtBreak (ctx, prog, row, len, nrows - j + 1,
+                dl_stmtFull (ctx, len));
+        ctx->stmt_rows++;
+        ctx->stmt_bytes += len;
     }
 
+    return (dp);
+}
+
 
-    /*  Add a column to the output table.  For now, assume it's an integer
-     *  column we'll default to a zero value.
+/**
+ *  DL_FORMATCOLS -- Format a run of rows a column at a time.  Each op's
+ *  batch function formats the whole column into the value buffer, then
+ *  the values are interleaved into rows in the output buffer.
+ */
+static unsigned char *
+dl_formatCols (CtxPtr ctx, ProgPtr prog, unsigned char *dp, int nrows,
+                int more)
+{
+    register int i, j;
+    register OpPtr op = (OpPtr) NULL;
+    register ValPtr v = (ValPtr) NULL;
+    char   *optr = ctx->optr;
+    long    olen = ctx->olen, nvals = (long) prog->nops * nrows;
+
+
+    /*  Values take no more room than the rows they are part of.
      */
-    if (addname) {
-        ocol = (ColPtr) &outColumns[++numOutCols];
-        memset (ocol->colname, 0, SZ_COLNAME);
-        strcpy (ocol->colname, addname);
-        strcpy (ocol->coltype, "integer");
+    if (ctx->csize < ctx->osize) {
+        ctx->cbuf = (char *) realloc (ctx->cbuf, (ctx->csize = ctx->osize));
+    }
+    if (ctx->nvals < nvals) {
+        ctx->vals = (ValPtr) realloc (ctx->vals,
+            (ctx->nvals = nvals) * sizeof (Val));
+    }
+    if (ctx->tsize < (long) nrows * 9) {
+        ctx->tbuf = (unsigned char *) realloc (ctx->tbuf,
+            (ctx->tsize = (long) nrows * 9));
     }
 
-    /*  If we're creating a serial ID column, add it to the output list.
-     */
-    if (sidname) {
-        ocol = (ColPtr) &outColumns[numOutCols+1];
-        memset (ocol->colname, 0, SZ_COLNAME);
-        strcpy (ocol->colname, sidname);
+    ctx->optr = ctx->cbuf, ctx->olen = 0;
+    for (i=0, op=prog->ops; i < prog->nops; i++, op++)
+        (*op->batch) (ctx, op, dp, nrows, prog->naxis1, &ctx->vals[i * nrows]);
+    ctx->optr = optr, ctx->olen = olen;
 
-        if (format == TAB_IPAC)
-            strcpy (ocol->coltype, "integer");
-        else if (format == TAB_POSTGRES) {
-            /*  For the serial ID column we need to create it as a simple
-             *  integer column to allow for parallel ingests of large
-             *  catalogs or numbers of files.  Once the table is fully
-             *  ingested the column type can be changed to a 'serial' type
-             *  using the commands:
-             *
-             *     CREATE SEQUENCE <id_seq>;
-             *     ALTER TABLE <table> ALTER COLUMN <id>
-             *          SET DEFAULT nextval('<id_seq>'::regclass);
-             *
-             *  Once created, a sequence can be reset (e.g. when rows are
-             *  deleted or re-ordered) with the commands:
-             *
-             *     ALTER SEQUENCE <seq> RESTART [ WITH <start_num> ];
-             *     UPDATE <table> set <id_column> = DEFAULT;
-             */
-            strcpy (ocol->coltype, "integer");
-            //strcpy (ocol->coltype, "serial primary key");
+    for (j=0; j < nrows; j++) {
+        if (prog->nhdr) {
+            memcpy (ctx->optr, prog->rowhdr, prog->nhdr);
+            ctx->optr += prog->nhdr, ctx->olen += prog->nhdr;
         }
-        numOutCols++;
-    }
 
-    /*  If we're creating a serial ID column, add it to the output list.
-     */
-    if (ridname) {
-        ocol = (ColPtr) &outColumns[numOutCols+1];
-        memset (ocol->colname, 0, SZ_COLNAME);
-        strcpy (ocol->colname, ridname);
+        for (i=0, op=prog->ops; i < prog->nops; i++, op++) {
+            v = &ctx->vals[i * nrows + j];
+            memcpy (ctx->optr, op->prefix, op->npre);
+            ctx->optr += op->npre;
+            memcpy (ctx->optr, v->ptr, v->len);
+            ctx->optr += v->len;
+            memcpy (ctx->optr, op->suffix, op->nsuf);
+            ctx->optr += op->nsuf;
+            ctx->olen += op->npre + v->len + op->nsuf;
+        }
 
-        if (format == TAB_IPAC || format == TAB_POSTGRES) 
-            strcpy (ocol->coltype, "real");
-        numOutCols++;
+        if (prog->comma && (j < (nrows - 1) || more))
+            *ctx->optr++ = ',', ctx->olen++;
+        if (prog->newline)
+            *ctx->optr++ = '\n', ctx->olen++;     // terminate the row
     }
 
-
-    if (debug) {
-        fprintf (stderr, "Output Columns [%d]:\n", numOutCols);
-        for (i=1; i <= numOutCols; i++) {
-            ocol = (ColPtr) &outColumns[i];
-            fprintf (stderr, "  %d  %-24s  '%s'\n", ocol->colnum, 
-                ocol->colname, ocol->coltype);
-        }
-    }
+    return (dp + nrows * prog->naxis1);
 }
 
 
 /**
- *  DL_PRINTHDR -- Print the CSV column headers.
+ *  DL_FORMATSLICES -- Format a chunk of rows as parallel slices.  Serial
+ *  IDs are assigned from the row offset so they don't depend on thread
+ *  timing.
  */
 static void
-dl_printHdr (int firstcol, int lastcol, FILE *ofd)
+dl_formatSlices (CtxPtr ctx, SlicePtr slices, int nslices, unsigned char *data,
+                long naxis1, int nrows, int more)
 {
-    register int i, ncols = numOutCols;
-    ColPtr col = (ColPtr) NULL;
+    register int i, first, last;
 
 
-    //if (*omode == 'a')
-    //    return;
-
-    if (format == TAB_IPAC)
-        fprintf (ofd, "|");
+    for (i=0; i < nslices; i++) {
+        SlicePtr s = &slices[i];
 
-    /*  If we're using a serial ID column it isn't included in the data list
-     *  since the database fills in the value for us.  So, don't include it in 
-     *  the header when doing Postgres. 
-    if (format == TAB_POSTGRES && sidname)
-        ncols--;
-     */
+        first = (int) (((long) nrows * i) / nslices);
+        last  = (int) (((long) nrows * (i + 1)) / nslices);
 
-    for (i=1; i <= ncols; i++) {           // print column types
-        col = (ColPtr) &outColumns[i];
+        s->prog  = &ctx->prog;
+        s->dp    = data + (first * naxis1);
+        s->nrows = last - first;
+        s->more  = (last < nrows ? 1 : more);
 
-        if (format == TAB_IPAC)                 // FIXME
-            fprintf (ofd, "%-*s", col->dispwidth, col->colname);
-        else
-            fprintf (ofd, "%-s", col->colname);
-        if (i < ncols)
-            //fprintf (ofd, "%c", delimiter);
-            fprintf (ofd, "%c", ',');
+        s->ctx->optr = s->ctx->obuf;
+        s->ctx->olen = 0;
+        s->ctx->serial_number = ctx->serial_number + first;
     }
-
-    if (format == TAB_IPAC)
-        fprintf (ofd, "|");
-
-    if (format == TAB_IPAC || format == TAB_DELIMITED)
-        fprintf (ofd, "\n");
-    fflush (ofd);
+    if (nslices > 1)
+        dl_gangRun (slices, nslices);
+    else
+        dl_formatRows (slices->ctx, slices->prog, slices->dp, slices->nrows,
+            slices->more);
+    ctx->serial_number += nrows;
 }
 
 
 /**
- *  DL_PRINTHDRSTRING -- Print the CSV column headers.
+ *  DL_WRITESLICES -- Write the formatted slice buffers in row order.
  */
 static void
-dl_printHdrString (char *tablename)
+dl_writeSlices (CtxPtr ctx, SlicePtr slices, int nslices)
 {
-    register int i, ncols = numOutCols, len;
-    char   buf[160];
-    ColPtr col = (ColPtr) NULL;
-
+    struct iovec iov[MAX_THREADS];
+    register int i, niov = 0;
 
-    memset (buf, 0, 160);
-    sprintf (buf, "INSERT INTO %s (", tablename);
-    memcpy (optr, buf, (len = strlen (buf)));
-    optr += len, olen += len;
 
+    for (i=0; i < nslices; i++) {
+        if (slices[i].ctx->olen > 0) {
+            iov[niov].iov_base = slices[i].ctx->obuf;
+            iov[niov++].iov_len = slices[i].ctx->olen;
+        }
+    }
+    if (pg_conninfo) {
+        for (i=0; i < niov; i++)
+            dl_pgWrite (iov[i].iov_base, iov[i].iov_len);
+    } else if (niov > 0) {
+        fflush (ctx->ofd);
+        dl_writeAll (fileno(ctx->ofd), iov, niov);
+    }
+}
 
-    for (i=1; i <= ncols; i++) {                // print column types
-        col = (ColPtr) &outColumns[i];
-
-        len = strlen (col->colname);
-        memcpy (optr, col->colname, len);
-        optr += len;
-        olen += len;
 
-        if (i < ncols) {
-            *optr++ = ',';
-            olen += 1;
+/**
+ *  DL_FORMATIOV -- Format and write a run of rows of binary output as an
+ *  I/O vector.  Row and field headers and most values go into the output
+ *  buffer as usual;  long strings are written straight from the table
+ *  data rather than being copied.
+ */
+static void
+dl_formatIov (CtxPtr ctx, ProgPtr prog, unsigned char *dp, int nrows)
+{
+    register int i, j;
+    register OpPtr op = (OpPtr) NULL;
+    unsigned char *vp = (unsigned char *) NULL;
+    unsigned int len = 0, vlen = 0;
+    char   *seg = ctx->obuf;                    // unwritten buffer segment
+
+
+    ctx->optr = ctx->obuf;
+    ctx->olen = 0;
+    ctx->niov = 0;
+    if (ctx->iov == NULL)
+        ctx->iov = (struct iovec *) calloc (MAX_IOV, sizeof (struct iovec));
+
+    for (j=0; j < nrows; j++, dp += prog->naxis1) {
+        memcpy (ctx->optr, prog->rowhdr, prog->nhdr);
+        ctx->optr += prog->nhdr, ctx->olen += prog->nhdr;
+
+        for (i=0, op=prog->ops; i < prog->nops; i++, op++) {
+            vp = dp + op->offset;
+            if (op->direct) {
+                len = strnlen ((char *) vp, op->col->repeat);
+                if (len >= MIN_IOV) {
+                    vlen = htonl (len);
+                    memcpy (ctx->optr, &vlen, sz_int);
+                    ctx->optr += sz_int, ctx->olen += sz_int;
+
+                    dl_addIov (ctx, seg, ctx->optr - seg);
+                    dl_addIov (ctx, vp, len);
+                    seg = ctx->optr;
+                    continue;
+                }
+            }
+            (*op->emit) (ctx, vp, op->col);
         }
     }
+    dl_addIov (ctx, seg, ctx->optr - seg);
+    dl_writeIov (ctx);
+}
+
+
+/**
+ *  DL_ADDIOV -- Add a segment to the output vector, writing the vector
+ *  out first if it is full.
+ */
+static void
+dl_addIov (CtxPtr ctx, void *base, long len)
+{
+    if (len <= 0)
+        return;
+    if (ctx->niov == MAX_IOV)
+        dl_writeIov (ctx);
 
-    memset (buf, 0, 160);
-    sprintf (buf, ") VALUES ");
-    memcpy (optr, buf, (len = strlen (buf)));
-    optr += len, olen += len;
+    ctx->iov[ctx->niov].iov_base = base;
+    ctx->iov[ctx->niov++].iov_len = len;
 }
 
 
 /**
- *  DL_CREATESQLTABLE -- Print the SQL CREATE command.
+ *  DL_WRITEIOV -- Write the output vector, restarting after a partial
+ *  write.
  */
 static void
-dl_createSQLTable (char *tablename, fitsfile *fptr, int firstcol, int lastcol,
-                    FILE *ofd)
+dl_writeIov (CtxPtr ctx)
 {
-    register int  i;
-    ColPtr col = (ColPtr) NULL;
+    struct iovec *iov = ctx->iov;
+    int     niov = ctx->niov;
 
 
-    /*  For MySQL we assume the output is being piped to the 'mysql' client,
-     *  if the database is being created we need to also create it before 
-     *  creating the table.  If we don't specify the 'dbname' assume it exists
-     *  and is an arg to the mysql client, so simply create the table.
-     */
-    if (dbname && format == TAB_MYSQL) {
-        fprintf (ofd, "CREATE DATABASE IF NOT EXISTS %s;\n", dbname);
-        fprintf (ofd, "USE %s;\n", dbname);
+    if (pg_conninfo) {
+        for ( ; niov > 0; iov++, niov--)
+            dl_pgWrite (iov->iov_base, iov->iov_len);
+        ctx->niov = 0;
+        return;
     }
 
-                    
-    if (do_drop)
-        fprintf (ofd, "DROP TABLE IF EXISTS %s CASCADE;\n", tablename);
-                        
-    fprintf (ofd, "CREATE TABLE IF NOT EXISTS %s (\n", tablename);
+    fflush (ctx->ofd);                          // keep order w/ dl_outPrintf
+    dl_writeAll (fileno(ctx->ofd), iov, niov);
+    ctx->niov = 0;
+}
 
-    for (i=1; i <= numOutCols; i++) {             // print column types
-        col = (ColPtr) &outColumns[i];
-        fprintf (ofd, "    %s\t%s", col->colname, col->coltype);
-        if (i < numOutCols)
-            fprintf (ofd, ",\n");
-    }
 
-    if (do_oids && format == TAB_POSTGRES)
-        // For Postgres only, allow creation of OIDS.
-        fprintf (ofd, "\n) WITH OIDS;\n\n");
-    else
-        fprintf (ofd, "\n);\n\n");
+/**
+ *  DL_WRITEALL -- Write an I/O vector to a descriptor, restarting after a
+ *  partial or interrupted write.  A failed write fails the run.  The
+ *  vector is consumed.
+ */
+static int
+dl_writeAll (int fd, struct iovec *iov, int niov)
+{
+    static atomic_int werr;                     // reported the error?
+    ssize_t nw = 0;
+
 
-    fflush (ofd);
+    while (niov > 0) {
+        if ((nw = writev (fd, iov, niov)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if (!atomic_exchange (&werr, 1))
+                dl_error (3, "Error writing output", strerror (errno));
+            atomic_store (&failed, 1);
+            return (ERR);
+        }
+        while (niov > 0 && nw >= (ssize_t) iov->iov_len)
+            nw -= iov->iov_len, iov++, niov--;
+        if (niov > 0) {
+            iov->iov_base = (char *) iov->iov_base + nw;
+            iov->iov_len -= nw;
+        }
+    }
+    return (OK);
 }
 
 
 /**
- *  DL_PRINTSQLHDR -- Print the SQL COPY headers.
+ *  DL_WRITEBUF -- Write a buffer to a descriptor with dl_writeAll().
  */
-static void
-dl_printSQLHdr (char *tablename, fitsfile *fptr, int firstcol, int lastcol,
-                    FILE *ofd)
+static int
+dl_writeBuf (int fd, void *buf, long len)
 {
-    int   hdr_extn = 0;
-    char  copy_buf[160];
+    struct iovec iov;
 
 
-    if (! do_load)
-        return;
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    return (dl_writeAll (fd, &iov, 1));
+}
 
-    if (do_binary && format == TAB_POSTGRES) {
-        memset (copy_buf, 0, 160);
-        sprintf (copy_buf, "COPY %s FROM stdin WITH BINARY;\n", tablename);
 
-        if (!noop)
-            write (fileno(ofd), copy_buf, strlen(copy_buf));   // header string
+/**
+ *  DL_NEWSLICES -- Allocate a set of slices, each with a private context
+ *  and an output buffer of 'osize' bytes.
+ */
+static SlicePtr
+dl_newSlices (CtxPtr ctx, int nslices, long osize)
+{
+    SlicePtr slices = (SlicePtr) calloc (nslices, sizeof (Slice));
+    register int i;
 
-        write (fileno(ofd), pgcopy_hdr, len_pgcopy_hdr);   // header string
-        write (fileno(ofd), &hdr_extn, sz_int);            // header extn length
 
-    } else {
-        if (format == TAB_POSTGRES) {
-            fprintf (ofd, "\nCOPY %s (", tablename);
-            dl_printHdr (firstcol, lastcol, ofd);
-            fprintf (ofd, ") from stdin;\n");
-        } else if (format == TAB_MYSQL || format == TAB_SQLITE) {
-            fprintf (ofd, "\nINSERT INTO %s (", tablename);
-            dl_printHdr (firstcol, lastcol, ofd);
-            fprintf (ofd, ") VALUES\n");
-        }
+    for (i=0; i < nslices; i++) {
+        CtxPtr sctx = (CtxPtr) calloc (1, sizeof (Context));
+
+        sctx->do_binary = ctx->do_binary;
+        sctx->numOutCols = ctx->numOutCols;
+        sctx->osize = osize;
+        sctx->obuf = (char *) calloc (1, sctx->osize);
+        slices[i].ctx = sctx;
     }
-    fflush (ofd);
+    return (slices);
 }
 
 
 /**
- *  DL_PRINTIPACTYPES -- Print the IPAC column type headers.
+ *  DL_FREESLICES -- Free a set of slices.
  */
 static void
-dl_printIPACTypes (char *tablename, fitsfile *fptr, int firstcol, int lastcol,
-                    FILE *ofd)
+dl_freeSlices (SlicePtr slices, int nslices)
 {
     register int i;
-    ColPtr col = (ColPtr) NULL;
-
-
-    if (*omode == 'a' || format != TAB_IPAC)
-        return;
 
-    dl_printHdr (firstcol, lastcol, ofd);               // print column names
 
-    fprintf (ofd, "|");
-    for (i=1; i <= numOutCols; i++) {                   // print column types
-        col = (ColPtr) &outColumns[i];
-        fprintf (ofd, "%-*s|", col->dispwidth, col->coltype);
+    for (i=0; i < nslices; i++) {
+        free ((void *) slices[i].ctx->obuf);
+        free ((void *) slices[i].ctx->cbuf);
+        free ((void *) slices[i].ctx->vals);
+        free ((void *) slices[i].ctx->tbuf);
+        free ((void *) slices[i].ctx);
     }
-
-    fprintf (ofd, "\n");
-    fflush (ofd);
+    free ((void *) slices);
 }
 
 
 /**
- * DL_COLTYPE -- Get the type string for the column.
+ *  DL_SWAPCHUNK -- Byte-swap the numeric values of a chunk of rows into
+ *  native order, copying from 'in' to 'out' a row at a time if they
+ *  differ (e.g. when 'in' is a read-only mapping of the file).  Only the
+ *  spans of projected columns are copied.
  */
-static char *
-dl_colType (ColPtr col)
+static void
+dl_swapChunk (CtxPtr ctx, unsigned char *out, unsigned char *in, int nrows,
+                long naxis1)
 {
-    if (format == TAB_POSTGRES)
-        return dl_SQLType (col);
-
-    else if (format == TAB_MYSQL)
-        return dl_SQLType (col);
+    register int i, j;
+    SwapPtr  sw = (SwapPtr) NULL;
+
+
+    for (i=0; i < nrows; i++, in += naxis1, out += naxis1) {
+        if (out != in && ctx->nspans > 0) {
+            for (j=0; j < ctx->nspans; j++)
+                memcpy (out + ctx->spans[j].offset, in + ctx->spans[j].offset,
+                    ctx->spans[j].len);
+        } else if (out != in)
+            memcpy (out, in, naxis1);
+        for (j=0, sw=ctx->swaps; j < ctx->nswaps; j++, sw++)
+            dl_swapRun (out + sw->offset, sw->count, sw->size);
+    }
+}
 
-    else if (format == TAB_SQLITE)
-        return dl_SQLType (col);
 
-    else //if (format == TAB_IPAC)
-        return dl_IPACType (col);
+/**
+ *  DL_PREPCHUNK -- Ready a chunk of rows for formatting:  keep just the
+ *  rows the selection picks and that belong to the output partition,
+ *  then swap their values to native order.
+ *  Either moves the rows into 'buf' and points 'data' at it.  Returns the
+ *  number of rows left.
+ */
+static int
+dl_prepChunk (CtxPtr ctx, unsigned char *buf, unsigned char **data, int nrows,
+                long naxis1)
+{
+    if (ctx->pred.nops > 0) {
+        nrows = dl_predRows (ctx, buf, *data, nrows, naxis1);
+        *data = buf;
+    }
+    if (partitioned) {
+        nrows = dl_partRows (ctx, buf, *data, nrows, naxis1);
+        *data = buf;
+    }
+    if (ctx->nswaps > 0) {
+        dl_swapChunk (ctx, buf, *data, nrows, naxis1);
+        *data = buf;
+    }
+    return (nrows);
 }
 
 
 /**
- * DL_SQLTYPE -- Get the SQL type string for the column.
+ *  DL_GETCOLINFO -- Get information about the columns in teh table.
+ *  Returns ERR if the row selection can't be used with them.
  */
-static char *
-dl_SQLType (ColPtr col)
+static int
+dl_getColInfo (CtxPtr ctx, fitsfile *fptr, int firstcol, int lastcol)
 {
-    static char *type = NULL;
-    static char tbuf[SZ_VALBUF];
+    register int i;
+    char  keyword[FLEN_KEYWORD];
+    ColPtr icol = (ColPtr) NULL;
+    int   status = 0, size = 0;
+    long  offset = 0;
 
 
-    switch (col->type) {
-    case TBIT:                                          // NYI
-    case TCOMPLEX:
-    case TDBLCOMPLEX:      
-                    break;
-    case TSTRING:   type = ((col->repeat > 1) ? "text" : "char");
-                    break;
-    case TLOGICAL:  type = "smallint";
-                    break;
+    /* Gather information about the input columns.
+     */
+    for (i = firstcol, ctx->numInCols = 0; i <= lastcol;
+            i++, ctx->numInCols++) {
+        icol = (ColPtr) &ctx->inColumns[i];
+        memset (icol, 0, sizeof(Col));
 
-    case TBYTE:
-    case TSBYTE:    type = "smallint";
-		    break;
-    case TSHORT:
-    case TUSHORT:   type = "smallint";
-		    break;
-    case TINT:
-    case TUINT:
-    case TINT32BIT: type = "integer";
-		    break;
+        status = 0;                             // reset CFITSIO status
+        memset (keyword, 0, FLEN_KEYWORD);
+        fits_make_keyn ("TTYPE", i, keyword, &status);
+        fits_read_key (fptr, TSTRING, keyword, icol->colname, NULL, &status);
+        fits_get_coltype (fptr, i, &icol->type, &icol->repeat,
+            &icol->width, &status);
+        fits_get_col_display_width (fptr, i, &icol->dispwidth, &status);
+        if (icol->type == TSTRING && do_quote) 
+            icol->dispwidth+= 2;
+        icol->colnum = i;
 
-    case TLONGLONG: type = "bigint";
-                    break;
-    case TFLOAT:    type = "real";
-		    break;
-    case TDOUBLE:   type = "double precision";
-		    break;
+        icol->ndim = 1;		                // default dimensions
+        icol->nrows = 1;
+        icol->ncols = icol->repeat;
 
-    default:        fprintf (stderr, "Error: unsupported type %d\n", col->type);
+        if (icol->repeat > 1 && icol->type != TSTRING)
+            dl_getColDims (fptr, icol);
+
+        icol->offset = offset;
+        offset += dl_colBytes (icol, &size);
     }
 
-    memset (tbuf, 0, SZ_VALBUF);
-    if (!explode && col->repeat > 1 && col->type != TSTRING)
-        sprintf (tbuf, "%s[%ld]", type, col->repeat);
-    else
-        strcpy (tbuf, type);
+    /*  The row selection may use any column.  Keep only the columns asked
+     *  for, the row offsets are kept so the others are simply stepped over.
+     */
+    if (dl_predBind (ctx, ctx->inColumns, ctx->numInCols) != OK ||
+        dl_partBind (ctx, ctx->inColumns, ctx->numInCols) != OK ||
+        (ctx->numInCols = dl_selectCols (ctx->inColumns,
+            ctx->numInCols)) == 0) {
+                ctx->numInCols = ctx->numOutCols = 0;
+                atomic_store (&failed, 1);
+                return (ERR);
+    }
 
-    return (tbuf);
+    if (debug) {
+        fprintf (stderr, "Input Columns [%d]:\n", ctx->numInCols);
+        for (i=1; i <= ctx->numInCols; i++) {
+            icol = (ColPtr) &ctx->inColumns[i];
+            fprintf (stderr, "  %d  '%s'  rep=%ld nr=%d nc=%d  off=%ld\n",
+                icol->colnum, icol->colname, icol->repeat, icol->nrows,
+                icol->ncols, icol->offset);
+        }
+    }
+
+    /* Now expand to create the output column information so we don't need 
+     * to repeat this for each table type.  If we're exploding columns
+     * compute all the output columns names, otherwise simply copy the input
+     * names.
+     */
+    dl_getOutputCols (ctx, fptr, 1, ctx->numInCols);
+    return (OK);
 }
 
 
 /**
- * DL_IPACTYPE -- Get the IPAC-table type string for the column.
+ *  DL_GETCOLDIMS -- Get the shape of an array column from its TDIM value.
+ *  A dimension string usually means a 2-D array;  anything else, or a
+ *  shape that doesn't match the repeat count, is left as a 1-D array.
  */
-static char *
-dl_IPACType (ColPtr col)
+static void
+dl_getColDims (fitsfile *fptr, ColPtr col)
 {
-    char *type = NULL;
+    char  keyword[FLEN_KEYWORD], dims[FLEN_KEYWORD];
+    int   status = 0, nrows = 0, ncols = 0;
 
-    switch (col->type) {
-    case TBIT:                                          // NYI
-    case TCOMPLEX:                                      // NYI
-    case TDBLCOMPLEX:                                   // NYI
-                    break;
 
-    case TSTRING:   type = "char";          
-                    break;
-    case TLOGICAL:
-    case TBYTE:
-    case TSBYTE:
-    case TSHORT:
-    case TUSHORT:
-    case TINT:
-    case TUINT:
-    case TINT32BIT:
-    case TLONGLONG: type = "int";
-                    break;
-    case TFLOAT:    type = "real";
+    memset (keyword, 0, FLEN_KEYWORD);
+    fits_make_keyn ("TDIM", col->colnum, keyword, &status);
+    fits_read_key (fptr, TSTRING, keyword, dims, NULL, &status);
+    if (status == 0 && sscanf (dims, "(%d,%d)", &nrows, &ncols) == 2 &&
+        (long) nrows * ncols == col->repeat) {
+            col->ndim = 2;
+            col->nrows = nrows;
+            col->ncols = ncols;
+    }
+}
+
+
+/**
+ *  DL_SELECTCOLS -- Apply the --columns or --exclude list to a set of
+ *  column descriptors, in place.  Named columns are kept in the order
+ *  given, excluded ones are dropped from table order.  Returns the
+ *  number of columns left, or zero if a named column isn't in the table.
+ */
+static int
+dl_selectCols (ColPtr cols, int ncols)
+{
+    register int i, j;
+    char   name[SZ_COLNAME], *lp = NULL;
+    ColPtr sel = (ColPtr) NULL;
+    int    nsel = 0;
+
+
+    if (columns == NULL && exclude == NULL)
+        return (ncols);
+
+    sel = (ColPtr) calloc (ncols + 1, sizeof (Col));
+    if (columns) {
+        for (lp = columns; dl_nextName (&lp, name); ) {
+            for (i=1; i <= ncols; i++)
+                if (strcasecmp (cols[i].colname, name) == 0)
                     break;
-    case TDOUBLE:   type = "double";
+            if (i > ncols) {
+                dl_error (3, "No such column", name);
+                free ((void *) sel);
+                return (0);
+            }
+            for (j=1; j <= nsel; j++)           // skip duplicates
+                if (sel[j].colnum == cols[i].colnum)
                     break;
-    default:        type = " ";
+            if (j > nsel)
+                memcpy (&sel[++nsel], &cols[i], sizeof (Col));
+        }
+    } else {
+        for (i=1; i <= ncols; i++)
+            if (!dl_inList (exclude, cols[i].colname))
+                memcpy (&sel[++nsel], &cols[i], sizeof (Col));
     }
 
-    return (type);
+    if (nsel == 0)
+        dl_error (3, "No columns selected", NULL);
+    memcpy (&cols[1], &sel[1], nsel * sizeof (Col));
+    free ((void *) sel);
+
+    return (nsel);
 }
 
 
 /**
- *  DL_PRINTCOL -- Print the column value(s).
- *
- *  FIXME -- We don't handled unsigned or long correctly yet.
+ *  DL_NEXTNAME -- Get the next name from a comma-separated list, advancing
+ *  the list pointer.  Returns zero at the end of the list.
  */
+static int
+dl_nextName (char **lp, char *name)
+{
+    char  *ip = *lp, *op = name;
 
-#define SZ_TXTBUF               16738
 
-static unsigned char *
-dl_printCol (unsigned char *dp, ColPtr col, char end_char)
-{
-    if (!explode && !do_binary && col->type != TSTRING && col->repeat > 1) {
-        if (format == TAB_DELIMITED) {
-            *optr++ = quote_char, *optr++ = '(';
-            olen += 2;
-        } else {
-            *optr++ = '{';
-            olen += 1;
-        }
-    }
+    while (*ip == ',' || isspace ((unsigned char) *ip))
+        ip++;
+    while (*ip && *ip != ',' && op < &name[SZ_COLNAME-1])
+        *op++ = *ip++;
+    while (op > name && isspace ((unsigned char) op[-1]))
+        op--;
+    *op = '\0';
 
-                    
-    if (format == TAB_IPAC && col->colnum == 1)
-        *optr++ = '|', olen++;
-    if ((format == TAB_MYSQL || format == TAB_SQLITE) && col->colnum == 1)
-        *optr++ = '(', olen++;
+    while (*ip && *ip != ',')                   // truncated name
+        ip++;
+    *lp = ip;
 
-    switch (col->type) {
-    case TBIT:                          // TFORM='X'    bit
-        fprintf (stderr, "Error: Unsupported column type, col[%s] = %d\n", 
-            col->colname, col->type);
-        break;
-    case TCOMPLEX:                      // TFORM='C'    complex
-    case TDBLCOMPLEX:                   // TFORM='M'    double complex
-        fprintf (stderr, "Error: Unsupported column type, col[%s] = %d\n", 
-            col->colname, col->type);
-        break;
+    return (op > name);
+}
 
-    case TSTRING:                       // TFORM='A'    8-bit character
-        dp = dl_printString (dp, col);
-        break;
 
-    case TLOGICAL:                      // TFORM='L'    8-bit logical (boolean)
-        dp = dl_printLogical (dp, col);
-        break;
+/**
+ *  DL_INLIST -- See whether a name is in a comma-separated list, ignoring
+ *  case.
+ */
+static int
+dl_inList (char *list, char *name)
+{
+    char   item[SZ_COLNAME], *lp = list;
 
-    case TBYTE:                         // TFORM='B'    1 unsigned byte
-    case TSBYTE:                        // TFORM='S'    8-bit signed byte
-        dp = dl_printByte (dp, col);
-        break;
 
-    case TSHORT:                        // TFORM='I'    16-bit integer
-    case TUSHORT:                       // TFORM='U'    unsigned 16-bit integer
-        dp = dl_printShort (dp, col);
-        break;
+    while (dl_nextName (&lp, item))
+        if (strcasecmp (item, name) == 0)
+            return (1);
+    return (0);
+}
 
-    case TINT:                          // TFORM='J'    32-bit integer
-    case TUINT:                         // TFORM='V'    unsigned 32-bit integer
-    case TINT32BIT:                     // TFORM='J'    signed 32-bit integer
-        dp = dl_printInt (dp, col);
-        break;
 
-    case TLONGLONG:                     // TFORM='K'    64-bit integer
-        dp = dl_printLong (dp, col);
-        break;
+/**
+ *  DL_GETRANGES -- Parse a --rowrange list such as "1-1000,50000-60000"
+ *  into the row ranges.  Each item is a row 'N', a range 'N-M' or the
+ *  rows 'N-' to the end of the table.  Ranges are sorted and merged so
+ *  each row is converted once, in table order.
+ */
+static int
+dl_getRanges (char *spec)
+{
+    register int i, j;
+    char   item[SZ_COLNAME], *lp = spec, *ip = NULL;
+    Range  r;
 
-    case TFLOAT:                        // TFORM='E'    single precision float
-        dp = dl_printFloat (dp, col);
-        break;
 
-    case TDOUBLE:                       // TFORM='D'    double precision float
-        dp = dl_printDouble (dp, col);
-        break;
+    for (nranges=0; dl_nextName (&lp, item); nranges++) {
+        if (nranges == MAX_RANGES) {
+            dl_error (2, "Too many row ranges", spec);
+            return (ERR);
+        }
+        r.first = strtol (item, &ip, 10);
+        r.last = r.first;
+        while (isspace ((unsigned char) *ip))
+            ip++;
+        if (*ip == '-') {
+            for (ip++; isspace ((unsigned char) *ip); )
+                ip++;
+            r.last = (*ip ? strtol (ip, &ip, 10) : LONG_MAX);
+        }
+        if (*ip || !isdigit ((unsigned char) item[0]) || r.first < 1 ||
+            r.last < r.first) {
+                dl_error (2, "Invalid row range", item);
+                return (ERR);
+        }
 
-    default:
-        fprintf (stderr, "Error: Unknown column type, col[%s] = %d\n", 
-            col->colname, col->type);
-        break;
+        for (i=nranges; i > 0 && row_ranges[i-1].first > r.first; i--)
+            row_ranges[i] = row_ranges[i-1];
+        row_ranges[i] = r;
+    }
+    if (nranges == 0) {
+        dl_error (2, "Invalid row range", spec);
+        return (ERR);
     }
 
-    if (!explode && !do_binary && col->type != TSTRING && col->repeat > 1) {
-        if (format == TAB_DELIMITED) {
-            *optr++ = quote_char, *optr++ = ')';
-            olen += 2;
-        } else {
-            *optr++ = '}';
-            olen += 1;
-        }
+    for (i=0, j=1; j < nranges; j++) {         // merge overlaps
+        if (row_ranges[j].first - 1 <= row_ranges[i].last) {
+            if (row_ranges[j].last > row_ranges[i].last)
+                row_ranges[i].last = row_ranges[j].last;
+        } else
+            row_ranges[++i] = row_ranges[j];
     }
+    nranges = i + 1;
 
+    return (OK);
+}
 
-    if (end_char == '\n') {
-        if (format == TAB_IPAC)
-            *optr++ = '|', olen++;
-        if ((format == TAB_MYSQL || format == TAB_SQLITE))
-            *optr++ = ')', olen++;
-    }
-    
-    /*  For Postgres binary output where we've specified a serial value, add
-     *  it to the output stream at the end of a row.  For text formats, add
-     *  it as the last column of data.
-     */
-    if (end_char == '\n') {
-        if (addname) {
-            if (!do_binary)
-                *optr++ = delimiter, olen++;     // append the comma or newline
-            dl_printValue (1);
-        }
-        if (sidname) {
-            //if (format == TAB_POSTGRES && do_binary) {
-            if (format == TAB_POSTGRES) {
-		if (!do_binary)
-                    *optr++ = delimiter, olen++; // append the comma or newline
-                dl_printSerial ();
-            } else if ((format == TAB_DELIMITED || format == TAB_IPAC)) {
-                *optr++ = delimiter, olen++;     // append the comma or newline
-                dl_printSerial ();
-            } else
-		printf ("Unsupported serial format\n");
-        }
-        if (ridname) {
-            //if (format == TAB_POSTGRES && do_binary) {
-            if (format == TAB_POSTGRES) {
-		if (!do_binary)
-                    *optr++ = delimiter, olen++; // append the comma or newline
-                dl_printRandom ();
-            } else if ((format == TAB_DELIMITED || format == TAB_IPAC)) {
-                *optr++ = delimiter, olen++;     // append the comma or newline
-                dl_printRandom ();
-            } else
-		printf ("Unsupported random format\n");
-        }
-    }
 
-    if (!do_binary && end_char != '\n')
-        *optr++ = end_char, olen++;     // append the comma or newline
+/**
+ *  DL_NEXTCHUNK -- Find the next chunk of up to 'nelem' rows to convert,
+ *  starting at or after '*row' within the row ranges (the whole table
+ *  if there are none) and the rows of the output shard.  As when reading
+ *  the table whole, the last chunk of a range may hold an extra row.
+ *  Returns the number of rows, with '*row' set to the first, or zero when
+ *  the ranges are done.  The byte offset of the chunk is then just
+ *  (*row - 1) * naxis1.
+ */
+static long
+dl_nextChunk (CtxPtr ctx, long *row, long nelem, long nrows)
+{
+    long   first = 1, last = nrows;
+    int    i = 0;
+
+
+    if (ctx->rowlast < nrows)
+        nrows = ctx->rowlast;
+    do {
+        if (nranges > 0)
+            first = row_ranges[i].first, last = row_ranges[i].last;
+        if (first < ctx->rowfirst)
+            first = ctx->rowfirst;
+        if (last > nrows)
+            last = nrows;
+        if (*row < first)
+            *row = first;
+        if (*row <= last)
+            return ((*row + nelem) >= last ? (last - *row + 1) : nelem);
+    } while (++i < nranges);
+
+    return (0);
+}
 
 
-    return (dp);
+/**
+ *  DL_RANGEROWS -- Count the rows of a table of 'nrows' rows that are
+ *  within the row ranges and the rows of the output shard.
+ */
+static long
+dl_rangeRows (CtxPtr ctx, long nrows)
+{
+    long   first = 1, last = nrows, n = 0;
+    int    i = 0;
+
+
+    if (ctx->rowlast < nrows)
+        nrows = ctx->rowlast;
+    do {
+        if (nranges > 0)
+            first = row_ranges[i].first, last = row_ranges[i].last;
+        if (first < ctx->rowfirst)
+            first = ctx->rowfirst;
+        if (last > nrows)
+            last = nrows;
+        if (last >= first)
+            n += last - first + 1;
+    } while (++i < nranges);
+
+    return (n);
 }
 
 
 /**
- *  DL_PRINTSTRING -- Print the column as a string value.
+ *  DL_RANGEROW -- Get the table row of the n'th row (from 0) within the
+ *  row ranges.
  */
-static unsigned char *
-dl_printString (unsigned char *dp, ColPtr col)
+static long
+dl_rangeRow (long n, long nrows)
 {
-    char  buf[SZ_TXTBUF], *bp;
-    int   len = 0;
+    long   len;
+    int    i;
 
 
-    if (do_binary) {
-        unsigned int val = 0;
-        val = htonl (col->repeat);
+    for (i=0; i < nranges && row_ranges[i].first <= nrows; i++) {
+        len = (row_ranges[i].last < nrows ? row_ranges[i].last : nrows) -
+            row_ranges[i].first + 1;
+        if (n < len)
+            return (row_ranges[i].first + n);
+        n -= len;
+    }
+    return (nranges ? nrows + 1 : n + 1);
+}
 
-        //memcpy (optr, &val, sz_int);            optr += sz_int;
-        //memcpy (optr, dp, col->repeat);         optr += col->repeat;
 
-        memset (buf, 0, SZ_TXTBUF);
-        memcpy (buf, dp, col->repeat);
-        //len = strlen ((bp = sstrip(buf)));
-        len = strlen ((bp = buf));
-//fprintf (stderr, "STR:  '%s'  rep=%d  len=%d\n", buf, col->repeat, len);
-        val = htonl (len);
+/**
+ *  DL_SHARDROWS -- Set the rows of the table that go to this context's
+ *  output shard.  Shards take contiguous runs of the rows in range, of
+ *  --shard-rows rows or --shard-bytes of table data each, or --shards
+ *  runs of (nearly) equal size.
+ */
+static void
+dl_shardRows (CtxPtr ctx, long nrows, long naxis1)
+{
+    long   total, size, first, last;
 
-        memcpy (optr, &val, sz_int);            optr += sz_int;
-        memcpy (optr, bp, len);                 optr += len;
 
-        olen += sz_int + len;
+    ctx->rowfirst = 1, ctx->rowlast = LONG_MAX;
+    if (!sharded || partitioned)
+        return;                                 // partitions read every row
 
+    total = dl_rangeRows (ctx, nrows);
+    if (shard_rows || shard_bytes) {
+        size = dl_shardSize (total, naxis1);
+        first = ctx->shard * size;
+        last = (first + size < total ? first + size : total) - 1;
     } else {
-        memset (buf, 0, SZ_TXTBUF);
-        memcpy (buf, dp, col->repeat);
-        if (do_escape) {
-            dl_escapeCSV ((do_strip ? sstrip (buf) : buf));
-            memcpy (optr, esc_buf, (len = strlen (esc_buf)));
-        } else {
-            if (do_quote) {
-                dl_quote ((do_strip ? sstrip (buf) : buf));
-                memcpy (optr, esc_buf, (len = strlen (esc_buf)));
-            } else {
-                bp =  sstrip(buf);
-                memcpy (optr, bp, (len = strlen(bp)));
-            }
-        }
-
-        olen += len;
-        optr += len;
+        first = (ctx->shard * total) / nshards;
+        last = ((ctx->shard + 1) * total) / nshards - 1;
     }
-    dp += col->repeat;
 
-    return (dp);
+    if (last < first)
+        ctx->rowfirst = 1, ctx->rowlast = 0;    // an empty shard
+    else {
+        ctx->rowfirst = dl_rangeRow (first, nrows);
+        ctx->rowlast = dl_rangeRow (last, nrows);
+    }
 }
 
 
 /**
- *  DL_PRINTLOGICAL -- Print the column as logical values.
+ *  DL_SHARDSIZE -- Get the number of rows in a --shard-rows or
+ *  --shard-bytes shard.
  */
-static unsigned char *
-dl_printLogical (unsigned char *dp, ColPtr col)
+static long
+dl_shardSize (long total, long naxis1)
 {
-    char ch;
-    char  valbuf[SZ_VALBUF];
-    int   i, j, len = 0;
+    long   size = shard_rows;
 
 
-    if (do_binary) {
-        unsigned int sz_val = 0;
-        unsigned short lval = 0;
-        if (explode) {
-            len = sz_short;
-            sz_val = htonl(sz_short);
-            for (i=1; i <= col->nrows; i++) {
-                for (j=1; j <= col->ncols; j++) {
-                    memcpy (optr, &sz_val, sz_int);     optr += sz_int;
-                    ch = (char) *dp++;
-                    lval = ((tolower((int)ch) == 't') ? htons(1) : 0);
-                    memcpy (optr, &lval, sz_short);     optr += sz_short;
-                    olen += sz_int + len;
-                }
-            }
-        } else {
-            len = col->repeat * sz_short;
-            sz_val = htonl(col->repeat * sz_short);
-            memcpy (optr, &sz_val, sz_int);             optr += sz_int;
+    if (shard_bytes)
+        size = (naxis1 > 0 ? shard_bytes / naxis1 : total);
+    return (size > 0 ? size : 1);
+}
 
-            for (i=1; i <= col->nrows; i++) {
-                for (j=1; j <= col->ncols; j++) {
-                    ch = (char) *dp++;
-                    lval = ((tolower((int)ch) == 't') ? htons(1) : 0);
-                    memcpy (optr, &lval, sz_short);     optr += sz_short;
-                    olen += sz_short + len;
-                }
-            }
-            olen += sz_int + sz_val;
-        }
 
-    } else {
-        for (i=1; i <= col->nrows; i++) {
-            for (j=1; j <= col->ncols; j++) {
-                memset (valbuf, 0, SZ_VALBUF);
+/**
+ *  DL_COUNTSHARDS -- Get the number of output shards for a table.  With a
+ *  shard size the table is opened to find how many rows it has.
+ */
+static int
+dl_countShards (char *iname)
+{
+    CtxPtr    ctx = (CtxPtr) NULL;
+    fitsfile *fptr = (fitsfile *) NULL;
+    long      nrows = 0, naxis1 = 0, total = 0, size = 1;
+    int       hdunum, hdutype, status = 0;
 
-                ch = (char) *dp++;
-                if (format == TAB_IPAC)
-                    sprintf (valbuf, "%d", ((tolower((int)ch) == 't') ? 1 : 0));
-                else
-                    sprintf (valbuf, "%*d", col->dispwidth, 
-                        ((tolower((int)ch) == 't') ? 1 : 0));
-                memcpy (optr, valbuf, (len = strlen (valbuf)));
-                olen += len;
-                optr += len;
-                if (col->repeat > 1 && j < col->ncols)
-                    *optr++ = arr_delimiter,  olen++;
-            }
-            if (col->repeat > 1 && i < col->nrows)
-                *optr++ = arr_delimiter,  olen++;
-        }
+
+    if (!shard_rows && !shard_bytes)
+        return (nshards);
+
+    ctx = (CtxPtr) calloc (1, sizeof (Context));
+    ctx->rowfirst = 1, ctx->rowlast = LONG_MAX;
+    if (!dl_openTable (ctx, iname, &fptr, &status)) {
+        if (fits_get_hdu_num (fptr, &hdunum) == 1)
+            fits_movabs_hdu (fptr, 2, &hdutype, &status);
+        fits_get_num_rows (fptr, &nrows, &status);
+        fits_read_key (fptr, TLONG, "NAXIS1", &naxis1, NULL, &status);
+
+        total = dl_rangeRows (ctx, nrows);
+        size = dl_shardSize (total, naxis1);
     }
+    dl_closeTable (ctx, fptr, &status);
+    free ((void *) ctx);
 
-    return (dp);
+    return (total > size ? (int) ((total + size - 1) / size) : 1);
 }
 
 
 /**
- *  DL_PRINTBYTE -- Print the column as byte values.
+ *  DL_SHARDNAME -- Make the output file name of a shard by adding its
+ *  number (from 1) to the root of the table's output file name, e.g.
+ *  'tab.csv' becomes 'tab_1.csv'.  Partitions are numbered from 0, as
+ *  the hash remainders are, so 'tab.csv' becomes 'tab_p0.csv'.
  */
-static unsigned char *
-dl_printByte (unsigned char *dp, ColPtr col)
+static void
+dl_shardName (char *ofname, int shard, int nsh, char *sfname)
 {
-    char ch;
-    unsigned char uch;
-    char  valbuf[SZ_VALBUF];
-    int   i, j, len = 0;
+    char  *ep = strrchr (ofname, '.');
+    int    ndigits = (nsh < 10 ? 1 : (nsh < 100 ? 2 : (nsh < 1000 ? 3 : 4)));
 
 
-    if (do_binary) {
-        unsigned int sz_val = 0;
-        short sval = 0;
-        if (explode) {
-            len = sz_short;
-            sz_val = htonl(sz_short);
-            for (i=1; i <= col->nrows; i++) {
-                for (j=1; j <= col->ncols; j++) {
-                    memcpy (optr, &sz_val, sz_int);     optr += sz_int;
-                    sval = htons((short) *dp++);
-                    memcpy (optr, &sval, sz_short);     optr += sz_short;
-                    olen += sz_int + len;
-                }
-            }
-        } else {
+    if (ep == NULL || strchr (ep, '/'))
+        ep = ofname + strlen (ofname);
+    if (partitioned)
+        snprintf (sfname, SZ_PATH, "%.*s_p%d%s", (int) (ep - ofname), ofname,
+            shard, ep);
+    else
+        snprintf (sfname, SZ_PATH, "%.*s_%0*d%s", (int) (ep - ofname), ofname,
+            ndigits, shard + 1, ep);
+}
+
+
+/**
+ *  DL_GETPARTITION -- Parse a --partition-by spec, either 'col:hash:N' for
+ *  N hash partitions or 'col:range:b1,b2,...' for range partitions split
+ *  at the (increasing) bounds.  The partitions then stand in for the
+ *  output shards of each table.
+ */
+static int
+dl_getPartition (char *spec)
+{
+    char   *ip = strchr (spec, ':'), *ep = NULL, *mp = NULL;
+    long long b;
+
+
+    memset (&part, 0, sizeof (Part));
+    if (ip == NULL || ip == spec || (ip - spec) >= SZ_COLNAME)
+        goto bad;
+    strncpy (part.colname, spec, (size_t) (ip - spec));
+
+    mp = ++ip;
+    if ((ip = strchr (mp, ':')) == NULL)
+        goto bad;
+    ip++;
+    if (strncasecmp (mp, "hash:", 5) == 0) {
+        part.method = PART_HASH;
+        part.nparts = (int) strtol (ip, &ep, 10);
+        if (ep == ip || *ep || part.nparts < 1 || part.nparts > MAX_SHARDS)
+            goto bad;
+
+    } else if (strncasecmp (mp, "range:", 6) == 0) {
+        part.method = PART_RANGE;
+        for (ep = ip; *ep; ip = ep + 1) {
+            if (part.nbounds == MAX_SHARDS - 1)
+                goto bad;
+            b = strtoll (ip, &ep, 10);
+            while (isspace ((unsigned char) *ep))
+                ep++;
+            if (ep == ip || (*ep && *ep != ',') ||
+                (part.nbounds > 0 && b <= part.bounds[part.nbounds-1]))
+                    goto bad;
+            part.bounds[part.nbounds++] = b;
+        }
+        if (part.nbounds == 0)
+            goto bad;
+        part.nparts = part.nbounds + 1;
+
+    } else
+        goto bad;
+
+    nshards = part.nparts;
+    partitioned = 1;
+    return (OK);
+
+bad:
+    dl_error (2, "Invalid partition spec", spec);
+    return (ERR);
+}
+
+
+/**
+ *  DL_PARTBIND -- Find the partition key column of a table.  The key must
+ *  be a scalar integer column whose value is printed as stored, so rows
+ *  land where the database would put them.
+ */
+static int
+dl_partBind (CtxPtr ctx, ColPtr cols, int ncols)
+{
+    register int j;
+    ColPtr   col = (ColPtr) NULL;
+    PredOpPtr op = &ctx->pkey;
+    int      size = 0;
+
+
+    if (!partitioned)
+        return (OK);
+
+    for (j=1; j <= ncols; j++)
+        if (strcasecmp (cols[j].colname, part.colname) == 0) {
+            col = &cols[j];
+            break;
+        }
+    if (col == NULL) {
+        dl_error (3, "No such partition column", part.colname);
+        return (ERR);
+    }
+    if (col->repeat != 1 || (col->type != TBYTE && col->type != TSHORT &&
+        col->type != TINT && col->type != TLONG && col->type != TLONGLONG)) {
+            dl_error (3, "Partition column must be an integer column",
+                part.colname);
+            return (ERR);
+    }
+
+    memset (op, 0, sizeof (PredOp));
+    op->op = P_COL;
+    op->type = PV_INT;
+    op->ctype = col->type;
+    op->offset = col->offset;
+    op->width = dl_colBytes (col, &size);
+    strcpy (op->name, col->colname);
+
+    return (OK);
+}
+
+
+/**
+ *  DL_PARTROWS -- Keep the rows of a chunk that belong to this context's
+ *  partition, copying them from 'in' to the start of 'out' (which may be
+ *  the same buffer).  The keys are loaded a batch at a time.  Returns the
+ *  number of rows kept.
+ */
+static int
+dl_partRows (CtxPtr ctx, unsigned char *out, unsigned char *in, int nrows,
+                long naxis1)
+{
+    register int i, r, n;
+    unsigned char *src = NULL, *dst = out;
+    PVal     v[SZ_PREDBATCH];
+
+
+    for (r=0; r < nrows; r += SZ_PREDBATCH) {
+        n = (nrows - r < SZ_PREDBATCH ? nrows - r : SZ_PREDBATCH);
+        dl_predLoad (&ctx->pkey, v, in + r * naxis1, n, naxis1);
+
+        for (i=0; i < n; i++) {
+            if (dl_partOf (v[i].i) != ctx->shard)
+                continue;
+            src = in + (r + i) * naxis1;
+            if (dst != src)
+                dl_copyRow (ctx, dst, src, naxis1);
+            dst += naxis1;
+        }
+    }
+
+    return ((int) ((dst - out) / naxis1));
+}
+
+
+/**
+ *  DL_PARTOF -- Get the partition (from 0) of a key value:  the remainder
+ *  of its hash, or the number of range bounds at or below it.
+ */
+static int
+dl_partOf (long long val)
+{
+    register int lo = 0, hi = part.nbounds, mid;
+
+
+    if (part.method == PART_HASH)
+        return ((int) (dl_partHash (val) % (unsigned) part.nparts));
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (part.bounds[mid] <= val)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo);
+}
+
+
+/*  Bob Jenkins' lookup3 mixing, as PostgreSQL's hash_bytes_uint32 uses.
+ */
+#define PH_ROT(x,k)     (((x) << (k)) | ((x) >> (32 - (k))))
+#define PH_MIX(a,b,c) { \
+    a -= c;  a ^= PH_ROT(c, 4);  c += b; \
+    b -= a;  b ^= PH_ROT(a, 6);  a += c; \
+    c -= b;  c ^= PH_ROT(b, 8);  b += a; \
+    a -= c;  a ^= PH_ROT(c,16);  c += b; \
+    b -= a;  b ^= PH_ROT(a,19);  a += c; \
+    c -= b;  c ^= PH_ROT(b, 4);  b += a; }
+#define PH_FINAL(a,b,c) { \
+    c ^= b;  c -= PH_ROT(b,14); \
+    a ^= c;  a -= PH_ROT(c,11); \
+    b ^= a;  b -= PH_ROT(a,25); \
+    c ^= b;  c -= PH_ROT(b,16); \
+    a ^= c;  a -= PH_ROT(c, 4); \
+    b ^= a;  b -= PH_ROT(a,14); \
+    c ^= b;  c -= PH_ROT(b,24); }
+
+/**
+ *  DL_PARTHASH -- Hash a key value the way a PostgreSQL hash partitioned
+ *  table does (hashint8extended with the partition seed, combined into
+ *  the row hash), so partition 'k' holds the rows of the child table
+ *  with 'MODULUS N, REMAINDER k'.  Smaller integer types hash the same.
+ */
+static unsigned long long
+dl_partHash (long long val)
+{
+    unsigned long long seed = 0x7A5B22367996DCFDULL;
+    unsigned int a, b, c, lo = (unsigned int) val;
+    unsigned int hi = (unsigned int) ((unsigned long long) val >> 32);
+
+
+    lo ^= (val >= 0 ? hi : ~hi);
+
+    a = b = c = 0x9e3779b9 + (unsigned int) sizeof (unsigned int) + 3923095;
+    a += (unsigned int) (seed >> 32);
+    b += (unsigned int) seed;
+    PH_MIX (a, b, c);
+    a += lo;
+    PH_FINAL (a, b, c);
+
+    return ((((unsigned long long) b << 32) | c) + 0x49a0f4dd15e5a8e3ULL);
+}
+
+
+/**
+ *  DL_TABLENAME -- Set the name of the table a context writes, the child
+ *  table 'name_pK' of the partition when partitioning.
+ */
+static void
+dl_tableName (CtxPtr ctx)
+{
+    if (partitioned)
+        snprintf (ctx->tabname, SZ_PATH, "%s_p%d", tablename, ctx->shard);
+    else
+        snprintf (ctx->tabname, SZ_PATH, "%s", tablename);
+}
+
+
+/**
+ *  DL_VALIDATECOLINFO -- Validate that this file has the same column
+ *  information.
+ */
+static int
+dl_validateColInfo (CtxPtr ctx, fitsfile *fptr, int firstcol, int lastcol)
+{
+    register int i;
+    char   keyword[FLEN_KEYWORD];
+    Col    newColumns[MAX_COLS], *col = (ColPtr) NULL, *icol = (ColPtr) NULL;
+    int    numCols, status = 0, size = 0;
+    long   offset = 0;
+
+
+    /* Gather information about the input columns.
+     */
+    for (i = firstcol, numCols = 0; i <= lastcol; i++, numCols++) {
+        col = (ColPtr) &newColumns[i];
+        memset (col, 0, sizeof(Col));
+        col->colnum = i;
+
+        status = 0;                             // reset CFITSIO status
+        memset (keyword, 0, FLEN_KEYWORD);
+        fits_make_keyn ("TTYPE", i, keyword, &status);
+        fits_read_key (fptr, TSTRING, keyword, col->colname, NULL, &status);
+        fits_get_coltype (fptr, i, &col->type, &col->repeat, &col->width,
+            &status);
+
+        col->ndim = 1;				// default dimensions
+        col->nrows = 1;
+        col->ncols = col->repeat;
+
+        if (col->repeat > 1 && col->type != TSTRING)
+            dl_getColDims (fptr, col);
+
+        col->offset = offset;
+        offset += dl_colBytes (col, &size);
+    }
+    if (dl_predBind (ctx, newColumns, numCols) != OK ||
+        dl_partBind (ctx, newColumns, numCols) != OK ||
+        (numCols = dl_selectCols (newColumns, numCols)) == 0) {
+            atomic_store (&failed, 1);
+            return (1);
+    }
+
+    if (debug) {
+        fprintf (stderr, "Table Columns [%d]:\n", numCols);
+        for (i=1; i <= numCols; i++) {
+            col = (ColPtr) &newColumns[i];
+            fprintf (stderr, "  %d  '%s'  rep=%ld nr=%d nc=%d\n", col->colnum, 
+                col->colname, col->repeat, col->nrows, col->ncols);
+        }
+    }
+
+    /*  Check column names, dimensionality, and type for equality.
+     */
+    if (numCols != ctx->numInCols)
+        return (1);
+    for (i=1; i <= numCols; i++) {
+        col = (ColPtr) &newColumns[i];
+        icol = (ColPtr) &ctx->inColumns[i];
+
+        if (strcmp (col->colname, icol->colname))
+            return (1);
+        if (col->type != icol->type ||
+            col->ndim != icol->ndim ||
+            col->nrows != icol->nrows)
+                return (1);
+        if (col->type != TSTRING)
+            if (col->ncols != icol->ncols || col->repeat != icol->repeat)
+                return (1);
+    }
+
+
+    /*  If we have a valid set of columns, copy the current table structure
+     *  so we process the input file correctly.
+     */
+    if (status == 0)
+        memcpy (&ctx->inColumns[0], &newColumns[0],
+            ((numCols + 1) * sizeof (Col)));
+
+    return (status);                                    // No error
+}
+
+
+/**
+ *  DL_GETOUTPUTCOLS -- Get the output column information.
+ */
+static void
+dl_getOutputCols (CtxPtr ctx, fitsfile *fptr, int firstcol, int lastcol)
+{
+    register int i, j, ii, jj;
+    ColPtr icol = (ColPtr) NULL;
+    ColPtr ocol = (ColPtr) NULL;
+
+
+    if (explode) {
+        jj = firstcol;
+        for (ii = firstcol; ii <= lastcol; ii++) {
+            icol = (ColPtr) &ctx->inColumns[ii];
+
+            if (icol->repeat > 1 && icol->type != TSTRING) {
+                if (icol->ndim > 1) {                           // 2-D array
+                    for (i=1; i <= icol->nrows; i++) {
+                        for (j=1; j <= icol->ncols; j++)  {
+                            ocol = (ColPtr) &ctx->outColumns[jj++];
+                            memset (ocol->colname, 0, SZ_COLNAME);
+                            sprintf (ocol->colname, "%s_%d_%d",
+                                icol->colname, i, j);
+                            strcpy (ocol->coltype, dl_colType (icol));
+                            ocol->dispwidth = icol->dispwidth;
+                        }
+                    }
+                } else {                                        // 1-D array
+                    for (i=1; i <= icol->repeat; i++) {
+                        ocol = (ColPtr) &ctx->outColumns[jj++];
+                        memset (ocol->colname, 0, SZ_COLNAME);
+                        sprintf (ocol->colname, "%s_%d", icol->colname, i);
+                        strcpy (ocol->coltype, dl_colType (icol));
+                        ocol->dispwidth = icol->dispwidth;
+                    }
+                }
+            } else {
+                ocol = (ColPtr) &ctx->outColumns[jj++];
+                memset (ocol->colname, 0, SZ_COLNAME);
+                strcpy (ocol->colname, icol->colname);
+                strcpy (ocol->coltype, dl_colType (icol));
+                ocol->dispwidth = icol->dispwidth;
+            }
+        }
+        ctx->numOutCols = jj - 1;
+
+    } else {
+        for (i = firstcol, ctx->numOutCols = 0; i <= lastcol;
+                i++, ctx->numOutCols++) {
+            icol = (ColPtr) &ctx->inColumns[i];
+            ocol = (ColPtr) &ctx->outColumns[i];
+            memcpy (ocol, icol, sizeof(Col));
+
+            if (format == TAB_IPAC)
+                strcpy (ocol->coltype, dl_IPACType (icol));
+            else if (TAB_DBTYPE(format))
+                strcpy (ocol->coltype, dl_SQLType (icol));
+        }
+        ctx->numOutCols = ctx->numInCols;
+    }
+
+
+    /*  Add a column to the output table.  For now, assume it's an integer
+     *  column we'll default to a zero value.
+     */
+    if (addname) {
+        ocol = (ColPtr) &ctx->outColumns[++ctx->numOutCols];
+        memset (ocol->colname, 0, SZ_COLNAME);
+        strcpy (ocol->colname, addname);
+        strcpy (ocol->coltype, "integer");
+    }
+
+    /*  If we're creating a serial ID column, add it to the output list.
+     */
+    if (sidname) {
+        ocol = (ColPtr) &ctx->outColumns[ctx->numOutCols+1];
+        memset (ocol->colname, 0, SZ_COLNAME);
+        strcpy (ocol->colname, sidname);
+
+        if (format == TAB_IPAC || format == TAB_SQLITE)
+            strcpy (ocol->coltype, "integer");
+        else if (format == TAB_POSTGRES) {
+            /*  For the serial ID column we need to create it as a simple
+             *  integer column to allow for parallel ingests of large
+             *  catalogs or numbers of files.  Once the table is fully
+             *  ingested the column type can be changed to a 'serial' type
+             *  using the commands:
+             *
+             *     CREATE SEQUENCE <id_seq>;
+             *     ALTER TABLE <table> ALTER COLUMN <id>
+             *          SET DEFAULT nextval('<id_seq>'::regclass);
+             *
+             *  Once created, a sequence can be reset (e.g. when rows are
+             *  deleted or re-ordered) with the commands:
+             *
+             *     ALTER SEQUENCE <seq> RESTART [ WITH <start_num> ];
+             *     UPDATE <table> set <id_column> = DEFAULT;
+             */
+            strcpy (ocol->coltype, "integer");
+            //strcpy (ocol->coltype, "serial primary key");
+        }
+        ctx->numOutCols++;
+    }
+
+    /*  If we're creating a serial ID column, add it to the output list.
+     */
+    if (ridname) {
+        ocol = (ColPtr) &ctx->outColumns[ctx->numOutCols+1];
+        memset (ocol->colname, 0, SZ_COLNAME);
+        strcpy (ocol->colname, ridname);
+
+        if (format == TAB_IPAC || format == TAB_POSTGRES ||
+            format == TAB_SQLITE)
+                strcpy (ocol->coltype, "real");
+        ctx->numOutCols++;
+    }
+
+
+    if (debug) {
+        fprintf (stderr, "Output Columns [%d]:\n", ctx->numOutCols);
+        for (i=1; i <= ctx->numOutCols; i++) {
+            ocol = (ColPtr) &ctx->outColumns[i];
+            fprintf (stderr, "  %d  %-24s  '%s'\n", ocol->colnum, 
+                ocol->colname, ocol->coltype);
+        }
+    }
+}
+
+
+/**
+ *  DL_GETSWAPRUNS -- Find the numeric values in a table row that must be
+ *  byte-swapped for text output.  Adjacent values of the same size are
+ *  merged into a single run so array columns swap as one slice.
+ */
+static void
+dl_getSwapRuns (CtxPtr ctx)
+{
+    register int i, offset, nbytes;
+    int      size = 0;
+    ColPtr   col = (ColPtr) NULL;
+    SwapPtr  sw = (SwapPtr) NULL;
+
+
+    ctx->nswaps = 0;
+    for (i=1; i <= ctx->numInCols; i++) {
+        col = (ColPtr) &ctx->inColumns[i];
+        nbytes = dl_colBytes (col, &size);
+        offset = col->offset;
+
+        if (size > 0) {
+            sw = (ctx->nswaps ? &ctx->swaps[ctx->nswaps - 1] : NULL);
+            if (sw && sw->size == size &&
+                (sw->offset + sw->count * size) == offset) {
+                    sw->count += nbytes / size;
+            } else {
+                sw = &ctx->swaps[ctx->nswaps++];
+                sw->offset = offset;
+                sw->count = nbytes / size;
+                sw->size = size;
+            }
+        }
+    }
+}
+
+
+/**
+ *  DL_GETSPANS -- Find the byte ranges of a row the projected columns
+ *  (and those the row selection tests) occupy, merging neighbours.  With
+ *  no --columns or --exclude list there are no spans and whole rows are
+ *  used.  When the row is wide and the columns kept are a small part of
+ *  it, only the spans are read.
+ */
+static void
+dl_getSpans (CtxPtr ctx, long naxis1)
+{
+    register int i, j;
+    int      size = 0, end;
+    long     total = 0;
+    ColPtr   col = (ColPtr) NULL;
+    SpanPtr  sp = (SpanPtr) NULL;
+    PredOpPtr op = (PredOpPtr) NULL;
+
+
+    ctx->nspans = 0;
+    ctx->narrow = 0;
+    if (columns == NULL && exclude == NULL)
+        return;
+
+    /*  Insert the columns in row order, then merge the ranges that touch.
+     */
+    for (i=1; i <= ctx->numInCols; i++) {
+        col = (ColPtr) &ctx->inColumns[i];
+        dl_addSpan (ctx, col->offset, dl_colBytes (col, &size));
+    }
+    for (i=0, op=ctx->pred.ops; i < ctx->pred.nops; i++, op++)
+        if (op->op == P_COL)
+            dl_addSpan (ctx, op->offset, op->width);
+    if (partitioned)
+        dl_addSpan (ctx, ctx->pkey.offset, ctx->pkey.width);
+    for (i=0, j=0, sp=ctx->spans; i < ctx->nspans; i++) {
+        end = ctx->spans[i].offset + ctx->spans[i].len;
+        if (j > 0 && (sp->offset + sp->len) >= ctx->spans[i].offset) {
+            if (end > (sp->offset + sp->len))
+                sp->len = end - sp->offset;
+        } else {
+            sp = &ctx->spans[j++];
+            *sp = ctx->spans[i];
+        }
+    }
+    ctx->nspans = j;
+
+    for (i=0; i < ctx->nspans; i++)
+        total += ctx->spans[i].len;
+    ctx->narrow = (naxis1 >= MIN_SPANROW && (total * 4) <= naxis1);
+
+    if (debug)
+        fprintf (stderr, "spans=%d  bytes=%ld/%ld  narrow=%d\n",
+            ctx->nspans, total, naxis1, ctx->narrow);
+}
+
+
+/**
+ *  DL_ADDSPAN -- Insert a byte range in the (unmerged) row spans, in
+ *  order of offset.
+ */
+static void
+dl_addSpan (CtxPtr ctx, long offset, int len)
+{
+    register int j;
+
+
+    if (len <= 0)
+        return;
+    for (j=ctx->nspans; j > 0 && ctx->spans[j-1].offset > offset; j--)
+        ctx->spans[j] = ctx->spans[j-1];
+    ctx->spans[j].offset = offset;
+    ctx->spans[j].len = len;
+    ctx->nspans++;
+}
+
+
+/**
+ *  DL_COLBYTES -- Get the number of bytes a column takes in a table row,
+ *  and the size of each value to be byte-swapped (0 if not swapped).
+ */
+static int
+dl_colBytes (ColPtr col, int *size)
+{
+    switch (col->type) {
+    case TSHORT:
+    case TUSHORT:       *size = 2;  return (2 * col->repeat);
+    case TINT:
+    case TUINT:
+    case TLONG:
+    case TULONG:
+    case TFLOAT:        *size = 4;  return (4 * col->repeat);
+    case TLONGLONG:
+    case TULONGLONG:
+    case TDOUBLE:       *size = 8;  return (8 * col->repeat);
+    case TCOMPLEX:      *size = 4;  return (8 * col->repeat);
+    case TDBLCOMPLEX:   *size = 8;  return (16 * col->repeat);
+    case TBIT:          *size = 0;  return ((col->repeat + 7) / 8);
+    default:            *size = 0;  return (col->repeat);
+    }
+}
+
+
+/**
+ *  DL_GETROWPROG -- Compile the table layout and output format into the
+ *  row program:  one op per column with its row offset, print function
+ *  and the delimiters, brackets and quotes around it, followed by ops for
+ *  any added columns.  All format checks are made here, once per table,
+ *  rather than for each value.
+ */
+static void
+dl_getRowProg (CtxPtr ctx, long naxis1)
+{
+    register int i, nin = ctx->numInCols;
+    ProgPtr  prog = &ctx->prog;
+    ColPtr   col = (ColPtr) NULL;
+    OpPtr    op = (OpPtr) NULL;
+    int      sql = (format == TAB_MYSQL || format == TAB_SQLITE) && !load_file;
+    int      text = !ctx->do_binary, is_array = 0;
+    unsigned short nfields = 0;
+
+
+    if (prog->rowhdr)
+        free ((char *) prog->rowhdr);
+    memset (prog, 0, sizeof (Prog));
+    prog->naxis1 = naxis1;
+    prog->comma = sql;
+    prog->newline = text;
+    prog->split = sql && !single && (max_stmt_bytes || max_stmt_rows);
+
+    /*  Binary rows begin with the field count, single-row INSERTs with the
+     *  statement header.
+     */
+    if (format == TAB_POSTGRES && ctx->do_binary) {
+        nfields = htons ((short) ctx->numOutCols);
+        prog->rowhdr = (char *) calloc (1, sz_short);
+        memcpy (prog->rowhdr, &nfields, (prog->nhdr = sz_short));
+
+    } else if (single && sql) {
+        char  *optr = ctx->optr;
+        long   olen = ctx->olen;
+
+        prog->rowhdr = (char *) calloc (1, SZ_SQLBUF + MAX_COLS * SZ_COLNAME);
+        ctx->optr = prog->rowhdr, ctx->olen = 0;
+        dl_printHdrString (ctx, ctx->tabname);
+        prog->nhdr = ctx->olen;
+        ctx->optr = optr, ctx->olen = olen;
+    }
+
+    for (i=1; i <= nin; i++) {
+        col = (ColPtr) &ctx->inColumns[i];
+        op = &prog->ops[prog->nops++];
+        op->offset = col->offset;
+        op->col = col;
+
+        switch (col->type) {
+        case TSTRING:       op->emit = dl_printString;      break;
+        case TLOGICAL:      op->emit = dl_printLogical;     break;
+        case TBYTE:
+        case TSBYTE:        op->emit = dl_printByte;        break;
+        case TSHORT:
+        case TUSHORT:       op->emit = dl_printShort;       break;
+        case TINT:
+        case TUINT:
+        case TINT32BIT:     op->emit = dl_printInt;         break;
+        case TLONGLONG:     op->emit = dl_printLong;        break;
+        case TFLOAT:        op->emit = dl_printFloat;       break;
+        case TDOUBLE:       op->emit = dl_printDouble;      break;
+        default:            op->emit = dl_opBad;            break;
+        }
+        op->batch = dl_batchEmit;
+
+        /*  Unexploded arrays in binary output are Postgres array values.
+         *  Long strings are already in the COPY format and may be written
+         *  straight from the table;  smaller values are cheaper to copy.
+         */
+        if (!text && !explode && col->type != TSTRING && col->repeat > 1 &&
+            op->emit != dl_opBad)
+                op->emit = dl_printArray;
+        if (!text && col->type == TSTRING && col->repeat >= MIN_IOV)
+            op->direct = prog->direct = 1;
+
+        /*  Text arrays are enclosed in brackets, SQL and IPAC rows in
+         *  parens or bars.
+         */
+        is_array = (!explode && text && col->type != TSTRING &&
+            col->repeat > 1);
+        if (is_array) {
+            if (format == TAB_DELIMITED) {
+                op->prefix[op->npre++] = quote_char;
+                op->prefix[op->npre++] = '(';
+                op->suffix[op->nsuf++] = quote_char;
+                op->suffix[op->nsuf++] = ')';
+            } else {
+                op->prefix[op->npre++] = '{';
+                op->suffix[op->nsuf++] = '}';
+            }
+        }
+        if (i == 1 && format == TAB_IPAC)
+            op->prefix[op->npre++] = '|';
+        if (i == 1 && sql)
+            op->prefix[op->npre++] = '(';
+
+        if (i == nin) {
+            if (format == TAB_IPAC)
+                op->suffix[op->nsuf++] = '|';
+            if (sql)
+                op->suffix[op->nsuf++] = ')';
+        } else if (text)
+            op->suffix[op->nsuf++] = delimiter;
+
+        /*  In columnar mode scalar numbers and strings have their own
+         *  batch functions.  Strings are passed through from the table,
+         *  so any quotes go in the prefix and suffix.
+         */
+        if (columnar && text) {
+            switch (col->type) {
+            case TBYTE:
+            case TSBYTE:
+            case TSHORT:
+            case TUSHORT:
+            case TINT:
+            case TUINT:
+            case TINT32BIT:
+            case TLONGLONG:
+                if (col->repeat == 1)
+                    op->batch = dl_batchInt;
+                break;
+            case TFLOAT:
+            case TDOUBLE:
+                if (col->repeat == 1)
+                    op->batch = dl_batchReal;
+                break;
+            case TSTRING:
+                if (do_escape || load_file)
+                    break;
+                op->batch = dl_batchString;
+                if (do_quote) {
+                    op->prefix[op->npre++] = quote_char;
+                    memmove (&op->suffix[1], &op->suffix[0], op->nsuf++);
+                    op->suffix[0] = quote_char;
+                }
+                break;
+            }
+        }
+    }
+
+    /*  Added columns follow the last table column.  For Postgres binary
+     *  output there is no delimiter before them.
+     */
+    if (addname) {
+        op = &prog->ops[prog->nops++];
+        op->emit = dl_opValue;
+        op->batch = dl_batchEmit;
+        if (text)
+            op->prefix[op->npre++] = delimiter;
+    }
+    if (sidname) {
+        if (format == TAB_POSTGRES || format == TAB_DELIMITED ||
+            format == TAB_IPAC || TAB_BINFILE(format) || sqlite_db ||
+            load_file) {
+                op = &prog->ops[prog->nops++];
+                op->emit = dl_opSerial;
+                op->batch = dl_batchEmit;
+                if (text)
+                    op->prefix[op->npre++] = delimiter;
+        } else
+            fprintf (stderr, "Warning: unsupported serial format\n");
+    }
+    if (ridname) {
+        if (format == TAB_POSTGRES || format == TAB_DELIMITED ||
+            format == TAB_IPAC || TAB_BINFILE(format) || sqlite_db ||
+            load_file) {
+                op = &prog->ops[prog->nops++];
+                op->emit = dl_opRandom;
+                op->batch = dl_batchEmit;
+                if (text)
+                    op->prefix[op->npre++] = delimiter;
+        } else
+            fprintf (stderr, "Warning: unsupported random format\n");
+    }
+
+    /*  Output buffers are sized from the longest row the program can
+     *  print, the separator between rows included.
+     */
+    prog->rowmax = prog->nhdr + 2;
+    for (i=0, op=prog->ops; i < prog->nops; i++, op++)
+        prog->rowmax += op->npre + dl_opMax (ctx, op) + op->nsuf;
+}
+
+
+/**
+ *  DL_OPMAX -- Get the most bytes an op can print for one row.  Binary
+ *  values are a length word and the value (bytes and logicals widened
+ *  to smallint), arrays have their header besides.  Text numbers take
+ *  the longest value of their type, fixed-point reals the longest '%f'
+ *  of the largest value, and strings may be quoted with every character
+ *  escaped.
+ */
+static long
+dl_opMax (CtxPtr ctx, OpPtr op)
+{
+    ColPtr  col = op->col;
+    long    n = (col ? col->repeat : 1);
+    int     size = 0, width = 0;
+
+
+    if (col == NULL)                            // added, serial or random
+        return (ctx->do_binary ? 2 * sz_int : 32);
+
+    if (ctx->do_binary) {
+        switch (col->type) {
+        case TSTRING:       return (sz_int + n);
+        case TLOGICAL:
+        case TBYTE:
+        case TSBYTE:
+        case TSHORT:
+        case TUSHORT:       size = sz_short;        break;
+        case TINT:
+        case TUINT:
+        case TINT32BIT:
+        case TFLOAT:        size = sz_int;          break;
+        default:            size = sz_double;       break;
+        }
+        return (op->emit == dl_printArray ? 8 * sz_int + n * (sz_int + size) :
+            n * (sz_int + size));
+    }
+
+    switch (col->type) {
+    case TSTRING:       return (2 * n + 2);
+    case TLOGICAL:      width = 1;                  break;
+    case TBYTE:
+    case TSBYTE:        width = 4;                  break;
+    case TSHORT:
+    case TUSHORT:       width = 6;                  break;
+    case TINT:
+    case TUINT:
+    case TINT32BIT:     width = 11;                 break;
+    case TLONGLONG:     width = 20;                 break;
+    case TFLOAT:        width = FLT_MAX_10_EXP + 9; break;
+    default:            width = DBL_MAX_10_EXP + 19; break;
+    }
+    if (col->dispwidth > width)
+        width = col->dispwidth;
+    return (n * (width + 1));
+}
+
+
+/**
+ *  DL_PRINTHDR -- Print the CSV column headers.
+ */
+static void
+dl_printHdr (CtxPtr ctx, int firstcol, int lastcol)
+{
+    register int i, ncols = ctx->numOutCols;
+    ColPtr col = (ColPtr) NULL;
+
+
+    //if (*omode == 'a')
+    //    return;
+
+    if (format == TAB_IPAC)
+        dl_outPrintf (ctx, "|");
+
+    /*  If we're using a serial ID column it isn't included in the data list
+     *  since the database fills in the value for us.  So, don't include it in 
+     *  the header when doing Postgres. 
+    if (format == TAB_POSTGRES && sidname)
+        ncols--;
+     */
+
+    for (i=1; i <= ncols; i++) {           // print column types
+        col = (ColPtr) &ctx->outColumns[i];
+
+        if (format == TAB_IPAC)                 // FIXME
+            dl_outPrintf (ctx, "%-*s", col->dispwidth, col->colname);
+        else
+            dl_outPrintf (ctx, "%-s", col->colname);
+        if (i < ncols)
+            //dl_outPrintf (ctx, "%c", delimiter);
+            dl_outPrintf (ctx, "%c", ',');
+    }
+
+    if (format == TAB_IPAC)
+        dl_outPrintf (ctx, "|");
+
+    if (format == TAB_IPAC || format == TAB_DELIMITED)
+        dl_outPrintf (ctx, "\n");
+    dl_outFlush (ctx);
+}
+
+
+/**
+ *  DL_PRINTHDRSTRING -- Print the CSV column headers.
+ */
+static void
+dl_printHdrString (CtxPtr ctx, char *tablename)
+{
+    register int i, ncols = ctx->numOutCols, len;
+    char   buf[SZ_SQLBUF];
+    ColPtr col = (ColPtr) NULL;
+
+
+    memset (buf, 0, SZ_SQLBUF);
+    snprintf (buf, SZ_SQLBUF, "INSERT INTO %s (", tablename);
+    memcpy (ctx->optr, buf, (len = strlen (buf)));
+    ctx->optr += len, ctx->olen += len;
+
+
+    for (i=1; i <= ncols; i++) {                // print column types
+        col = (ColPtr) &ctx->outColumns[i];
+
+        len = strlen (col->colname);
+        memcpy (ctx->optr, col->colname, len);
+        ctx->optr += len;
+        ctx->olen += len;
+
+        if (i < ncols) {
+            *ctx->optr++ = ',';
+            ctx->olen += 1;
+        }
+    }
+
+    memset (buf, 0, SZ_SQLBUF);
+    snprintf (buf, SZ_SQLBUF, ") VALUES ");
+    memcpy (ctx->optr, buf, (len = strlen (buf)));
+    ctx->optr += len, ctx->olen += len;
+}
+
+
+/**
+ *  DL_CREATESQLTABLE -- Print the SQL CREATE command.
+ */
+static void
+dl_createSQLTable (CtxPtr ctx, char *tablename, fitsfile *fptr, int firstcol,
+                    int lastcol)
+{
+    char   parent[SZ_PATH];
+
+
+    /*  For MySQL we assume the output is being piped to the 'mysql' client,
+     *  if the database is being created we need to also create it before 
+     *  creating the table.  If we don't specify the 'dbname' assume it exists
+     *  and is an arg to the mysql client, so simply create the table.
+     */
+    if (dbname && format == TAB_MYSQL) {
+        dl_outPrintf (ctx, "CREATE DATABASE IF NOT EXISTS %s;\n", dbname);
+        dl_outPrintf (ctx, "USE %s;\n", dbname);
+    }
+
+                    
+    if (do_drop)
+        dl_outPrintf (ctx, "DROP TABLE IF EXISTS %s%s;\n", tablename,
+            (format == TAB_SQLITE ? "" : " CASCADE"));     // no SQLite CASCADE
+
+    /*  A partition is created as a child of the partitioned parent, which
+     *  every partition's output creates if it isn't there yet.
+     */
+    if (partitioned) {
+        snprintf (parent, SZ_PATH, "%.*s",              // less the "_pK"
+            (int) (strrchr (tablename, '_') - tablename), tablename);
+        dl_outPrintf (ctx, "CREATE TABLE IF NOT EXISTS %s (\n", parent);
+        dl_createCols (ctx);
+        dl_outPrintf (ctx, "\n) PARTITION BY %s (%s);\n\n",
+            (part.method == PART_HASH ? "HASH" : "RANGE"), part.colname);
+
+        dl_outPrintf (ctx, "CREATE TABLE IF NOT EXISTS %s PARTITION OF %s\n",
+            tablename, parent);
+        if (part.method == PART_HASH)
+            dl_outPrintf (ctx, "    FOR VALUES WITH (MODULUS %d, REMAINDER %d);"
+                "\n\n", part.nparts, ctx->shard);
+        else if (ctx->shard == 0)
+            dl_outPrintf (ctx, "    FOR VALUES FROM (MINVALUE) TO (%lld);\n\n",
+                part.bounds[0]);
+        else if (ctx->shard == part.nbounds)
+            dl_outPrintf (ctx, "    FOR VALUES FROM (%lld) TO (MAXVALUE);\n\n",
+                part.bounds[ctx->shard-1]);
+        else
+            dl_outPrintf (ctx, "    FOR VALUES FROM (%lld) TO (%lld);\n\n",
+                part.bounds[ctx->shard-1], part.bounds[ctx->shard]);
+        dl_outFlush (ctx);
+        return;
+    }
+
+    dl_outPrintf (ctx, "CREATE TABLE IF NOT EXISTS %s (\n", tablename);
+    dl_createCols (ctx);
+
+    if (do_oids && format == TAB_POSTGRES)
+        // For Postgres only, allow creation of OIDS.
+        dl_outPrintf (ctx, "\n) WITH OIDS;\n\n");
+    else
+        dl_outPrintf (ctx, "\n);\n\n");
+
+    dl_outFlush (ctx);
+}
+
+
+/**
+ *  DL_CREATECOLS -- Print the column definitions of a CREATE command.
+ */
+static void
+dl_createCols (CtxPtr ctx)
+{
+    register int  i;
+    ColPtr col = (ColPtr) NULL;
+
+
+    for (i=1; i <= ctx->numOutCols; i++) {             // print column types
+        col = (ColPtr) &ctx->outColumns[i];
+        dl_outPrintf (ctx, "    %s\t%s", col->colname, col->coltype);
+        if (i < ctx->numOutCols)
+            dl_outPrintf (ctx, ",\n");
+    }
+}
+
+
+/**
+ *  DL_PRINTSQLHDR -- Print the SQL COPY headers.
+ */
+static void
+dl_printSQLHdr (CtxPtr ctx, char *tablename, fitsfile *fptr, int firstcol,
+                    int lastcol)
+{
+    int   hdr_extn = 0;
+    char  copy_buf[SZ_SQLBUF];
+
+
+    if (! do_load)
+        return;
+
+    if (ctx->do_binary && format == TAB_POSTGRES) {
+        memset (copy_buf, 0, SZ_SQLBUF);
+        snprintf (copy_buf, SZ_SQLBUF, "COPY %s FROM stdin WITH BINARY;\n",
+            tablename);
+
+        if (!noop)
+            dl_outWrite (ctx, copy_buf, strlen(copy_buf)); // header string
+        if (pg_conninfo)
+            dl_pgExec ();                               // start the COPY
+
+        dl_outWrite (ctx, pgcopy_hdr, len_pgcopy_hdr);  // header string
+        dl_outWrite (ctx, &hdr_extn, sz_int);           // header extn length
+
+    } else {
+        if (format == TAB_POSTGRES) {
+            dl_outPrintf (ctx, "\nCOPY %s (", tablename);
+            dl_printHdr (ctx, firstcol, lastcol);
+            dl_outPrintf (ctx, ") from stdin;\n");
+            if (pg_conninfo)
+                dl_pgExec ();                           // start the COPY
+        } else if (load_file) {
+            dl_loadBegin (ctx);
+        } else if (format == TAB_MYSQL || format == TAB_SQLITE) {
+            dl_outPrintf (ctx, "\nINSERT INTO %s (", tablename);
+            dl_printHdr (ctx, firstcol, lastcol);
+            dl_outPrintf (ctx, ") VALUES\n");
+            if (max_stmt_bytes || max_stmt_rows)
+                dl_stmtHdr (ctx, tablename);
+        }
+    }
+    dl_outFlush (ctx);
+}
+
+
+/**
+ *  DL_PRINTSQLEND -- End the COPY/INSERT statement begun by dl_printSQLHdr()
+ *  after the last file of its bundle.
+ */
+static void
+dl_printSQLEnd (CtxPtr ctx)
+{
+    short  eof = -1;
+
+
+    if (! do_load || sqlite_db || load_file || !TAB_DBTYPE(format))
+        return;
+
+    if (format == TAB_POSTGRES) {
+        if (ctx->do_binary)
+            dl_outWrite (ctx, &eof, sz_short);  // file trailer
+        else if (!pg_conninfo)
+            dl_outWrite (ctx, "\\.\n", 3);
+    } else
+        dl_outWrite (ctx, ";\n" , 2);
+
+    if (pg_conninfo)
+        dl_pgEnd ();
+    else
+        dl_outFlush (ctx);
+}
+
+
+/**
+ *  DL_STMTHDR -- Save the text that ends one budgeted INSERT and starts the
+ *  next, and begin counting the statement just printed.
+ */
+static void
+dl_stmtHdr (CtxPtr ctx, char *tablename)
+{
+    char  *optr = ctx->optr;
+    long   olen = ctx->olen;
+
+
+    if (ctx->stmthdr == NULL)
+        ctx->stmthdr = (char *) calloc (1, SZ_SQLBUF + MAX_COLS * SZ_COLNAME);
+    memcpy (ctx->stmthdr, ";\n\n", 3);
+    ctx->optr = ctx->stmthdr + 3, ctx->olen = 3;
+    dl_printHdrString (ctx, tablename);
+    ctx->stmthdr[ctx->olen - 1] = '\n';          // "VALUES\n" as printed
+    ctx->nstmthdr = ctx->olen;
+    ctx->optr = optr, ctx->olen = olen;
+
+    ctx->stmt_rows = 0;
+    ctx->stmt_bytes = ctx->nstmthdr - 2;
+}
+
+
+/**
+ *  DL_LOADBEGIN -- Start a MySQL LOAD DATA of the table rows.  The rows
+ *  are written to the load file in place of the output.  If that is a
+ *  named pipe the statement comes first so the client reads the rows as
+ *  they are written, otherwise the rows are spooled to a file for the
+ *  statement that follows them.
+ */
+static void
+dl_loadBegin (CtxPtr ctx)
+{
+    struct stat st;
+
+
+    if (stat (load_file, &st) == 0 && S_ISFIFO (st.st_mode)) {
+        strcpy (ctx->load_name, load_file);
+        dl_loadStmt (ctx);
+    } else if (nloads == 0)
+        strcpy (ctx->load_name, load_file);
+    else
+        sprintf (ctx->load_name, "%s.%d", load_file, nloads);
+    nloads++;
+
+    ctx->sqlfd = ctx->ofd;
+    if ((ctx->ofd = fopen (ctx->load_name, "w")) == (FILE *) NULL) {
+        dl_error (3, "Error opening load file", ctx->load_name);
+        ctx->ofd = fopen ("/dev/null", "w");
+    }
+}
+
+
+/**
+ *  DL_LOADEND -- Finish the LOAD DATA rows and go back to the SQL output.
+ */
+static void
+dl_loadEnd (CtxPtr ctx)
+{
+    struct stat st;
+
+
+    if (ctx->sqlfd == NULL)
+        return;
+
+    fclose (ctx->ofd);
+    ctx->ofd = ctx->sqlfd;
+    ctx->sqlfd = (FILE *) NULL;
+
+    if (stat (ctx->load_name, &st) == 0 && !S_ISFIFO (st.st_mode))
+        dl_loadStmt (ctx);
+}
+
+
+/**
+ *  DL_LOADSTMT -- Print the LOAD DATA statement for the load file.
+ */
+static void
+dl_loadStmt (CtxPtr ctx)
+{
+    dl_outPrintf (ctx, "\nLOAD DATA LOCAL INFILE '%s' INTO TABLE %s\n",
+        ctx->load_name, tablename);
+    dl_outPrintf (ctx, "    FIELDS TERMINATED BY '\\t' ESCAPED BY '\\\\'\n");
+    dl_outPrintf (ctx, "    LINES TERMINATED BY '\\n' (");
+    dl_printHdr (ctx, 1, ctx->numInCols);
+    dl_outPrintf (ctx, ");\n");
+    dl_outFlush (ctx);
+}
+
+
+/**
+ *  DL_PRINTIPACTYPES -- Print the IPAC column type headers.
+ */
+static void
+dl_printIPACTypes (CtxPtr ctx, char *tablename, fitsfile *fptr, int firstcol,
+                    int lastcol)
+{
+    register int i;
+    ColPtr col = (ColPtr) NULL;
+
+
+    if (*ctx->omode == 'a' || format != TAB_IPAC)
+        return;
+
+    dl_printHdr (ctx, firstcol, lastcol);               // print column names
+
+    dl_outPrintf (ctx, "|");
+    for (i=1; i <= ctx->numOutCols; i++) {              // print column types
+        col = (ColPtr) &ctx->outColumns[i];
+        dl_outPrintf (ctx, "%-*s|", col->dispwidth, col->coltype);
+    }
+
+    dl_outPrintf (ctx, "\n");
+    dl_outFlush (ctx);
+}
+
+
+/**
+ * DL_COLTYPE -- Get the type string for the column.
+ */
+static char *
+dl_colType (ColPtr col)
+{
+    if (format == TAB_POSTGRES)
+        return dl_SQLType (col);
+
+    else if (format == TAB_MYSQL)
+        return dl_SQLType (col);
+
+    else if (format == TAB_SQLITE)
+        return dl_SQLType (col);
+
+    else //if (format == TAB_IPAC)
+        return dl_IPACType (col);
+}
+
+
+/**
+ * DL_SQLTYPE -- Get the SQL type string for the column.
+ */
+static char *
+dl_SQLType (ColPtr col)
+{
+    static char *type = NULL;
+    static char tbuf[SZ_VALBUF];
+
+
+    switch (col->type) {
+    case TBIT:                                          // NYI
+    case TCOMPLEX:
+    case TDBLCOMPLEX:      
+                    break;
+    case TSTRING:   type = ((col->repeat > 1) ? "text" : "char");
+                    break;
+    case TLOGICAL:  type = "smallint";
+                    break;
+
+    case TBYTE:
+    case TSBYTE:    type = "smallint";
+		    break;
+    case TSHORT:
+    case TUSHORT:   type = "smallint";
+		    break;
+    case TINT:
+    case TUINT:
+    case TINT32BIT: type = "integer";
+		    break;
+
+    case TLONGLONG: type = "bigint";
+                    break;
+    case TFLOAT:    type = "real";
+		    break;
+    case TDOUBLE:   type = "double precision";
+		    break;
+
+    default:        fprintf (stderr, "Error: unsupported type %d\n", col->type);
+    }
+
+    memset (tbuf, 0, SZ_VALBUF);
+    if (!explode && col->repeat > 1 && col->type != TSTRING)
+        sprintf (tbuf, "%s[%ld]", type, col->repeat);
+    else
+        strcpy (tbuf, type);
+
+    return (tbuf);
+}
+
+
+/**
+ * DL_IPACTYPE -- Get the IPAC-table type string for the column.
+ */
+static char *
+dl_IPACType (ColPtr col)
+{
+    char *type = NULL;
+
+    switch (col->type) {
+    case TBIT:                                          // NYI
+    case TCOMPLEX:                                      // NYI
+    case TDBLCOMPLEX:                                   // NYI
+                    break;
+
+    case TSTRING:   type = "char";          
+                    break;
+    case TLOGICAL:
+    case TBYTE:
+    case TSBYTE:
+    case TSHORT:
+    case TUSHORT:
+    case TINT:
+    case TUINT:
+    case TINT32BIT:
+    case TLONGLONG: type = "int";
+                    break;
+    case TFLOAT:    type = "real";
+                    break;
+    case TDOUBLE:   type = "double";
+                    break;
+    default:        type = " ";
+    }
+
+    return (type);
+}
+
+
+/**
+ *  DL_OPBAD -- Report a column type we can't print.
+ *
+ *  FIXME -- We don't handled unsigned or long correctly yet.
+ */
+
+#define SZ_TXTBUF               16738
+
+static unsigned char *
+dl_opBad (CtxPtr ctx, unsigned char *dp, ColPtr col)
+{
+    switch (col->type) {
+    case TBIT:                          // TFORM='X'    bit
+    case TCOMPLEX:                      // TFORM='C'    complex
+    case TDBLCOMPLEX:                   // TFORM='M'    double complex
+        fprintf (stderr, "Error: Unsupported column type, col[%s] = %d\n", 
+            col->colname, col->type);
+        break;
+    default:
+        fprintf (stderr, "Error: Unknown column type, col[%s] = %d\n", 
+            col->colname, col->type);
+        break;
+    }
+
+    return (dp);
+}
+
+
+/**
+ *  DL_OPVALUE -- Print the added column value.
+ */
+static unsigned char *
+dl_opValue (CtxPtr ctx, unsigned char *dp, ColPtr col)
+{
+    dl_printValue (ctx, 1);
+    return (dp);
+}
+
+
+/**
+ *  DL_OPSERIAL -- Print the serial ID column value.
+ */
+static unsigned char *
+dl_opSerial (CtxPtr ctx, unsigned char *dp, ColPtr col)
+{
+    dl_printSerial (ctx);
+    return (dp);
+}
+
+
+/**
+ *  DL_OPRANDOM -- Print the random ID column value.
+ */
+static unsigned char *
+dl_opRandom (CtxPtr ctx, unsigned char *dp, ColPtr col)
+{
+    dl_printRandom (ctx);
+    return (dp);
+}
+
+
+/**
+ *  DL_BATCHEMIT -- Format a column of a chunk with its print function.
+ */
+static void
+dl_batchEmit (CtxPtr ctx, OpPtr op, unsigned char *data, int nrows,
+                long naxis1, ValPtr vals)
+{
+    register int i;
+    unsigned char *dp = data + op->offset;
+
+
+    for (i=0; i < nrows; i++, dp += naxis1) {
+        vals[i].ptr = ctx->optr;
+        (*op->emit) (ctx, dp, op->col);
+        vals[i].len = (int) (ctx->optr - vals[i].ptr);
+    }
+}
+
+
+/**
+ *  DL_BATCHSTRING -- Trim a string column of a chunk.  The values point
+ *  into the table data rather than being copied.
+ */
+static void
+dl_batchString (CtxPtr ctx, OpPtr op, unsigned char *data, int nrows,
+                long naxis1, ValPtr vals)
+{
+    register int i, len;
+    register char *cp = (char *) NULL;
+    char   *dp = (char *) data + op->offset;
+    int     repeat = (int) op->col->repeat;
+    int     strip = (do_strip || !do_quote);
+
+
+    for (i=0; i < nrows; i++, dp += naxis1) {
+        cp = dp;
+        len = (int) strnlen (cp, repeat);
+        if (strip) {
+            while (len > 0 && cp[len-1] == ' ')
+                len--;
+            while (len > 0 && *cp == ' ')
+                cp++, len--;
+        }
+        vals[i].ptr = cp;
+        vals[i].len = len;
+    }
+}
+
+
+/**
+ *  DL_BATCHINT -- Format a scalar integer column of a chunk.  The column
+ *  is first gathered into a contiguous array, then encoded.
+ */
+static void
+dl_batchInt (CtxPtr ctx, OpPtr op, unsigned char *data, int nrows,
+                long naxis1, ValPtr vals)
+{
+    register int i;
+    unsigned char *dp = data + op->offset;
+    long long *tv = (long long *) ctx->tbuf;
+    int    width = (format == TAB_IPAC ? op->col->dispwidth : 0);
+    short  sval;
+    int    ival;
+
+
+    switch (op->col->type) {
+    case TBYTE:
+        for (i=0; i < nrows; i++, dp += naxis1)
+            tv[i] = *dp;
+        break;
+    case TSBYTE:
+        for (i=0; i < nrows; i++, dp += naxis1)
+            tv[i] = (char) *dp;
+        break;
+    case TSHORT:
+        for (i=0; i < nrows; i++, dp += naxis1)
+            memcpy (&sval, dp, sz_short), tv[i] = sval;
+        break;
+    case TUSHORT:
+        for (i=0; i < nrows; i++, dp += naxis1)
+            memcpy (&sval, dp, sz_short), tv[i] = (unsigned short) sval;
+        break;
+    case TLONGLONG:
+        for (i=0; i < nrows; i++, dp += naxis1)
+            memcpy (&tv[i], dp, sz_long);
+        break;
+    default:                            // unsigned ints print as signed
+        for (i=0; i < nrows; i++, dp += naxis1)
+            memcpy (&ival, dp, sz_int), tv[i] = ival;
+        break;
+    }
+
+    for (i=0; i < nrows; i++) {
+        vals[i].ptr = ctx->optr;
+        dl_putInt (ctx, tv[i], width);
+        vals[i].len = (int) (ctx->optr - vals[i].ptr);
+    }
+}
+
+
+/**
+ *  DL_BATCHREAL -- Format a scalar float or double column of a chunk.  The
+ *  column is gathered into a contiguous array and classified as finite or
+ *  not in one pass, then encoded.
+ */
+static void
+dl_batchReal (CtxPtr ctx, OpPtr op, unsigned char *data, int nrows,
+                long naxis1, ValPtr vals)
+{
+    register int i, len = 0;
+    unsigned char *dp = data + op->offset;
+    unsigned char *special = ctx->tbuf + (long) nrows * sz_double;
+    double *dv = (double *) ctx->tbuf;
+    float  *fv = (float *) ctx->tbuf;
+    int     is_float = (op->col->type == TFLOAT);
+    int     width = (format == TAB_IPAC ? op->col->dispwidth : 0);
+    char    valbuf[SZ_VALBUF];
+
+
+    if (is_float) {
+        for (i=0; i < nrows; i++, dp += naxis1)
+            memcpy (&fv[i], dp, sz_float);
+        for (i=0; i < nrows; i++)
+            special[i] = !isfinite (fv[i]);
+    } else {
+        for (i=0; i < nrows; i++, dp += naxis1)
+            memcpy (&dv[i], dp, sz_double);
+        for (i=0; i < nrows; i++)
+            special[i] = !isfinite (dv[i]);
+    }
+
+    for (i=0; i < nrows; i++) {
+        vals[i].ptr = ctx->optr;
+        if (special[i]) {
+            dl_putNonFinite (ctx, (is_float ? (double) fv[i] : dv[i]),
+                (is_float ? "%lf" : "%.16lf"));
+
+        } else if (float_fmt == FMT_SHORTEST) {
+            if (is_float)
+                dl_putFloat (ctx, fv[i], width);
+            else
+                dl_putDouble (ctx, dv[i], width);
+
+        } else {
+            if (format == TAB_IPAC)
+                sprintf (valbuf, "%*f", width,
+                    (is_float ? (double) fv[i] : dv[i]));
+            else if (is_float)
+                sprintf (valbuf, "%f", (double) fv[i]);
+            else
+                sprintf (valbuf, "%.16f", dv[i]);
+
+            memcpy (ctx->optr, valbuf, (len = strlen (valbuf)));
+            ctx->olen += len, ctx->optr += len;
+        }
+        vals[i].len = (int) (ctx->optr - vals[i].ptr);
+    }
+}
+
+
+/**
+ *  DL_PRINTSTRING -- Print the column as a string value.
+ */
+static unsigned char *
+dl_printString (CtxPtr ctx, unsigned char *dp, ColPtr col)
+{
+    char  buf[SZ_TXTBUF], *bp;
+    int   len = 0;
+
+
+    if (ctx->do_binary) {
+        unsigned int val = 0;
+        val = htonl (col->repeat);
+
+        //memcpy (ctx->optr, &val, sz_int);            ctx->optr += sz_int;
+        //memcpy (ctx->optr, dp, col->repeat);         ctx->optr += col->repeat;
+
+        memset (buf, 0, SZ_TXTBUF);
+        memcpy (buf, dp, col->repeat);
+        //len = strlen ((bp = sstrip(buf)));
+        len = strlen ((bp = buf));
+//fprintf (stderr, "STR:  '%s'  rep=%d  len=%d\n", buf, col->repeat, len);
+        val = htonl (len);
+
+        memcpy (ctx->optr, &val, sz_int);            ctx->optr += sz_int;
+        memcpy (ctx->optr, bp, len);                 ctx->optr += len;
+
+        ctx->olen += sz_int + len;
+
+    } else {
+        memset (buf, 0, SZ_TXTBUF);
+        memcpy (buf, dp, col->repeat);
+        if (load_file) {
+            len = dl_escapeLoad (ctx->optr, (do_strip ? sstrip (buf) : buf));
+        } else if (do_escape) {
+            dl_escapeCSV (ctx, (do_strip ? sstrip (buf) : buf));
+            memcpy (ctx->optr, ctx->esc_buf, (len = strlen (ctx->esc_buf)));
+        } else {
+            if (do_quote) {
+                dl_quote (ctx, (do_strip ? sstrip (buf) : buf));
+                memcpy (ctx->optr, ctx->esc_buf, (len = strlen (ctx->esc_buf)));
+            } else {
+                bp =  sstrip(buf);
+                memcpy (ctx->optr, bp, (len = strlen(bp)));
+            }
+        }
+
+        ctx->olen += len;
+        ctx->optr += len;
+    }
+    dp += col->repeat;
+
+    return (dp);
+}
+
+
+/**
+ *  DL_PRINTLOGICAL -- Print the column as logical values.
+ */
+static unsigned char *
+dl_printLogical (CtxPtr ctx, unsigned char *dp, ColPtr col)
+{
+    char ch;
+    char  valbuf[SZ_VALBUF];
+    int   i, j, len = 0;
+
+
+    if (ctx->do_binary) {
+        unsigned int sz_val = 0;
+        unsigned short lval = 0;
+        if (explode) {
+            len = sz_short;
+            sz_val = htonl(sz_short);
+            for (i=1; i <= col->nrows; i++) {
+                for (j=1; j <= col->ncols; j++) {
+                    memcpy (ctx->optr, &sz_val, sz_int);    ctx->optr += sz_int;
+                    ch = (char) *dp++;
+                    lval = ((tolower((int)ch) == 't') ? htons(1) : 0);
+                    memcpy (ctx->optr, &lval, sz_short);  ctx->optr += sz_short;
+                    ctx->olen += sz_int + len;
+                }
+            }
+        } else {
+            len = col->repeat * sz_short;
+            sz_val = htonl(col->repeat * sz_short);
+            memcpy (ctx->optr, &sz_val, sz_int);            ctx->optr += sz_int;
+
+            for (i=1; i <= col->nrows; i++) {
+                for (j=1; j <= col->ncols; j++) {
+                    ch = (char) *dp++;
+                    lval = ((tolower((int)ch) == 't') ? htons(1) : 0);
+                    memcpy (ctx->optr, &lval, sz_short);  ctx->optr += sz_short;
+                }
+            }
+            ctx->olen += sz_int + len;
+        }
+
+    } else {
+        for (i=1; i <= col->nrows; i++) {
+            for (j=1; j <= col->ncols; j++) {
+                memset (valbuf, 0, SZ_VALBUF);
+
+                ch = (char) *dp++;
+                if (format == TAB_IPAC)
+                    sprintf (valbuf, "%d", ((tolower((int)ch) == 't') ? 1 : 0));
+                else
+                    sprintf (valbuf, "%*d", col->dispwidth, 
+                        ((tolower((int)ch) == 't') ? 1 : 0));
+                memcpy (ctx->optr, valbuf, (len = strlen (valbuf)));
+                ctx->olen += len;
+                ctx->optr += len;
+                if (col->repeat > 1 && j < col->ncols)
+                    *ctx->optr++ = arr_delimiter,  ctx->olen++;
+            }
+            if (col->repeat > 1 && i < col->nrows)
+                *ctx->optr++ = arr_delimiter,  ctx->olen++;
+        }
+    }
+
+    return (dp);
+}
+
+
+/**
+ *  DL_PRINTBYTE -- Print the column as byte values.
+ */
+static unsigned char *
+dl_printByte (CtxPtr ctx, unsigned char *dp, ColPtr col)
+{
+    char ch;
+    unsigned char uch;
+    int   i, j, len = 0;
+    int   width = (format == TAB_IPAC ? col->dispwidth : 0);
+
+
+    if (ctx->do_binary) {
+        unsigned int sz_val = 0;
+        short sval = 0;
+        if (explode) {
+            len = sz_short;
+            sz_val = htonl(sz_short);
+            for (i=1; i <= col->nrows; i++) {
+                for (j=1; j <= col->ncols; j++) {
+                    memcpy (ctx->optr, &sz_val, sz_int);    ctx->optr += sz_int;
+                    sval = htons((short) *dp++);
+                    memcpy (ctx->optr, &sval, sz_short);  ctx->optr += sz_short;
+                    ctx->olen += sz_int + len;
+                }
+            }
+        } else {
+            len = col->repeat * sz_short;
+            sz_val = htonl(col->repeat * sz_short);
+            memcpy (ctx->optr, &sz_val, sz_int);            ctx->optr += sz_int;
+            ctx->olen += sz_int;
+
+            for (i=1; i <= col->nrows; i++) {
+                for (j=1; j <= col->ncols; j++) {
+                    sval = htons((short) *dp++);
+                    memcpy (ctx->optr, &sval, sz_short);  ctx->optr += sz_short;
+                    ctx->olen += sz_short;
+                }
+            }
+        }
+    } else {
+        for (i=1; i <= col->nrows; i++) {
+            for (j=1; j <= col->ncols; j++) {
+                if (col->type == TBYTE) {
+                    uch = (unsigned char) *dp++;
+                    dl_putInt (ctx, uch, width);
+                } else {
+                    ch = (char) *dp++;
+                    dl_putInt (ctx, ch, width);
+                }
+                if (col->repeat > 1 && j < col->ncols)
+                    *ctx->optr++ = arr_delimiter,  ctx->olen++;
+            }
+            if (col->repeat > 1 && i < col->nrows)
+                *ctx->optr++ = arr_delimiter,  ctx->olen++;
+        }
+    }
+
+    return (dp);
+}
+
+
+/**
+ *  DL_PRINTSHORT -- Print the column as short integer values.
+ */
+static unsigned char *
+dl_printShort (CtxPtr ctx, unsigned char *dp, ColPtr col)
+{
+    short sval = 0.0;
+    unsigned short usval = 0.0;
+    int   i, j, len = 0;
+    int   width = (format == TAB_IPAC ? col->dispwidth : 0);
+
+
+    if (ctx->do_binary) {
+        unsigned int sz_val = 0;
+        if (explode) {
+            len = sz_short;
+            sz_val = htonl(sz_short);
+            for (i=1; i <= col->nrows; i++) {
+                for (j=1; j <= col->ncols; j++) {
+                    memcpy (ctx->optr, &sz_val, sz_int);    ctx->optr += sz_int;
+                    memcpy (ctx->optr, dp, sz_short);        ctx->optr += len;
+                    ctx->olen += sz_int + len;
+                    dp += sz_short;
+                }
+            }
+        } else {
             len = col->repeat * sz_short;
             sz_val = htonl(col->repeat * sz_short);
-            memcpy (optr, &sz_val, sz_int);             optr += sz_int;
-            olen += sz_int;
+            memcpy (ctx->optr, &sz_val, sz_int);            ctx->optr += sz_int;
+            memcpy (ctx->optr, dp, sz_short * col->repeat);  ctx->optr += len;
+            ctx->olen += sz_int + len;
+            dp += col->repeat * sz_short;
+        }
+
+    } else {
+        for (i=1; i <= col->nrows; i++) {
+            for (j=1; j <= col->ncols; j++) {
+                if (col->type == TUSHORT) {
+                    memcpy (&usval, dp, sz_short);
+                    dl_putInt (ctx, usval, width);
+                } else {
+                    memcpy (&sval, dp, sz_short);
+                    dl_putInt (ctx, sval, width);
+                }
+                dp += sz_short;
+                if (col->repeat > 1 && j < col->ncols)
+                    *ctx->optr++ = arr_delimiter,  ctx->olen++;
+            }
+            if (col->repeat > 1 && i < col->nrows)
+                *ctx->optr++ = arr_delimiter,  ctx->olen++;
+        }
+    }
+
+    return (dp);
+}
+
+
+/**
+ *  DL_PRINTINT -- Print the column as integer values.
+ */
+static unsigned char *
+dl_printInt (CtxPtr ctx, unsigned char *dp, ColPtr col)
+{
+    int   ival = 0.0;
+    unsigned int uival = 0.0;
+    int   i, j, len = 0;
+    int   width = (format == TAB_IPAC ? col->dispwidth : 0);
+
+
+    if (ctx->do_binary) {
+        unsigned int sz_val = 0;
+        if (explode) {
+            len = sz_int;
+            sz_val = htonl(sz_int);
+            for (i=1; i <= col->nrows; i++) {
+                for (j=1; j <= col->ncols; j++) {
+                    memcpy (ctx->optr, &sz_val, sz_int);    ctx->optr += sz_int;
+                    memcpy (ctx->optr, dp, sz_int);          ctx->optr += len;
+                    ctx->olen += sz_int + len;
+                    dp += sz_int;
+                }
+            }
+        } else {
+            len = col->repeat * sz_int;
+            sz_val = htonl(col->repeat * sz_int);
+            memcpy (ctx->optr, &sz_val, sz_int);            ctx->optr += sz_int;
+            memcpy (ctx->optr, dp, sz_int * col->repeat);    ctx->optr += len;
+            ctx->olen += sz_int + len;
+            dp += col->repeat * sz_int;
+        }
+
+    } else {
+        for (i=1; i <= col->nrows; i++) {
+            for (j=1; j <= col->ncols; j++) {
+                if (col->type == TUINT) {
+                    memcpy (&uival, dp, sz_int);
+                    dl_putInt (ctx, (int) uival, width);
+                } else {
+                    memcpy (&ival, dp, sz_int);
+                    dl_putInt (ctx, ival, width);
+                }
+                dp += sz_int;
+                if (col->repeat > 1 && j < col->ncols)
+                    *ctx->optr++ = arr_delimiter,  ctx->olen++;
+            }
+            if (col->repeat > 1 && i < col->nrows)
+                *ctx->optr++ = arr_delimiter,  ctx->olen++;
+        }
+    }
+
+    return (dp);
+}
+
+
+/**
+ *  DL_PRINTLONG -- Print the column as long integer values.
+ */
+static unsigned char *
+dl_printLong (CtxPtr ctx, unsigned char *dp, ColPtr col)
+{
+    long  lval = 0.0;
+    int   i, j, len = 0;
+    int   width = (format == TAB_IPAC ? col->dispwidth : 0);
+
+
+    if (ctx->do_binary) {
+        unsigned int sz_val = 0;
+        if (explode) {
+            len = sz_long;
+            sz_val = htonl(sz_long);
+            for (i=1; i <= col->nrows; i++) {
+                for (j=1; j <= col->ncols; j++) {
+                    memcpy (ctx->optr, &sz_val, sz_int);    ctx->optr += sz_int;
+                    memcpy (ctx->optr, dp, sz_long);         ctx->optr += len;
+                    ctx->olen += sz_int + len;
+                    dp += sz_long;
+                }
+            }
+        } else {
+            len = col->repeat * sz_long;
+            sz_val = htonl(col->repeat * sz_long);
+            memcpy (ctx->optr, &sz_val, sz_int);            ctx->optr += sz_int;
+            memcpy (ctx->optr, dp, sz_long * col->repeat);   ctx->optr += len;
+            ctx->olen += sz_int + len;
+            dp += col->repeat * sz_long;
+        }
+
+    } else {
+        for (i=1; i <= col->nrows; i++) {
+            for (j=1; j <= col->ncols; j++) {
+                memcpy (&lval, dp, sz_long);
+                dl_putInt (ctx, lval, width);
+                dp += sz_long;
+                if (col->repeat > 1 && j < col->ncols)
+                    *ctx->optr++ = arr_delimiter,  ctx->olen++;
+            }
+            if (col->repeat > 1 && i < col->nrows)
+                *ctx->optr++ = arr_delimiter,  ctx->olen++;
+        }
+    }
+
+    return (dp);
+}
+
+
+/**
+ *  DL_PRINTFLOAT -- Print the column as floating-point values.
+ */
+static unsigned char *
+dl_printFloat (CtxPtr ctx, unsigned char *dp, ColPtr col)
+{
+    float rval = 0.0;
+    char  valbuf[SZ_VALBUF];
+    int   i, j, len = 0;
+
+
+    if (ctx->do_binary) {
+        unsigned int sz_val = 0;
+        if (explode) {
+            len = sz_float;
+            sz_val = htonl(sz_float);
+            for (i=1; i <= col->nrows; i++) {
+                for (j=1; j <= col->ncols; j++) {
+                    memcpy (ctx->optr, &sz_val, sz_int);    ctx->optr += sz_int;
+                    memcpy (ctx->optr, dp, sz_float);        ctx->optr += len;
+                    ctx->olen += sz_int + len;
+                    dp += sz_float;
+                }
+            }
+        } else {
+            len = col->repeat * sz_float;
+            sz_val = htonl(col->repeat * sz_float);
+            memcpy (ctx->optr, &sz_val, sz_int);            ctx->optr += sz_int;
+            memcpy (ctx->optr, dp, sz_float * col->repeat);  ctx->optr += len;
+            ctx->olen += sz_int + len;
+            dp += col->repeat * sz_float;
+        }
+
+    } else {
+        for (i=1; i <= col->nrows; i++) {
+            for (j=1; j <= col->ncols; j++) {
+                memcpy (&rval, dp, sz_float);
+
+                if (!isfinite (rval)) {
+                    dl_putNonFinite (ctx, (double) rval, "%lf");
+
+                } else if (float_fmt == FMT_SHORTEST) {
+                    dl_putFloat (ctx, rval,
+                        (format == TAB_IPAC ? col->dispwidth : 0));
+
+                } else {
+                    if (format == TAB_IPAC)
+                        sprintf (valbuf, "%*f", col->dispwidth, (double) rval);
+                    else
+                        sprintf (valbuf, "%f", (double) rval);
+
+                    memcpy (ctx->optr, valbuf, (len = strlen (valbuf)));
+                    ctx->olen += len, ctx->optr += len;
+                }
+                dp += sz_float;
+                if (col->repeat > 1 && j < col->ncols)
+                    *ctx->optr++ = arr_delimiter,  ctx->olen++;
+            }
+            if (col->repeat > 1 && i < col->nrows)
+                *ctx->optr++ = arr_delimiter,  ctx->olen++;
+        }
+    }
+
+    return (dp);
+}
+
+
+/**
+ *  DL_PRINTDOUBLE -- Print the column as double-precision values.
+ */
+static unsigned char *
+dl_printDouble (CtxPtr ctx, unsigned char *dp, ColPtr col)
+{
+    double dval = 0.0;
+    char  valbuf[SZ_VALBUF];
+    int   i, j, len = 0;
+
+
+    if (ctx->do_binary) {
+        unsigned int sz_val = 0;
+        if (explode) {
+            len = sz_double;
+            sz_val = htonl(sz_double);
+            for (i=1; i <= col->nrows; i++) {
+                for (j=1; j <= col->ncols; j++) {
+                    memcpy (ctx->optr, &sz_val, sz_int);    ctx->optr += sz_int;
+                    memcpy (ctx->optr, dp, sz_double);       ctx->optr += len;
+                    ctx->olen += sz_int + len;
+                    dp += sz_double;
+                }
+            }
+        } else {
+            len = col->repeat * sz_double;
+            sz_val = htonl(col->repeat * sz_double);
+            memcpy (ctx->optr, &sz_val, sz_int);            ctx->optr += sz_int;
+            memcpy (ctx->optr, dp, sz_double * col->repeat); ctx->optr += len;
+            ctx->olen += sz_int + len;
+            dp += col->repeat * sz_double;
+        }
+
+    } else {
+        for (i=1; i <= col->nrows; i++) {
+            for (j=1; j <= col->ncols; j++) {
+                memcpy (&dval, dp, sz_double);
+
+                if (!isfinite (dval)) {
+                    dl_putNonFinite (ctx, (double) dval, "%.16lf");
+
+                } else if (float_fmt == FMT_SHORTEST) {
+                    dl_putDouble (ctx, dval,
+                        (format == TAB_IPAC ? col->dispwidth : 0));
+
+                } else {
+                    if (format == TAB_IPAC)
+                        sprintf (valbuf, "%*f", col->dispwidth, (double) dval);
+                    else
+                        sprintf (valbuf, "%.16f", (double) dval);
+
+                    memcpy (ctx->optr, valbuf, (len = strlen (valbuf)));
+                    ctx->olen += len, ctx->optr += len;
+                }
+                dp += sz_double;
+                if (col->repeat > 1 && j < col->ncols)
+                    *ctx->optr++ = arr_delimiter,  ctx->olen++;
+            }
+            if (col->repeat > 1 && i < col->nrows)
+                *ctx->optr++ = arr_delimiter,  ctx->olen++;
+        }
+    }
+
+    return (dp);
+}
+
+
+/**
+ *  DL_PRINTARRAY -- Print an array column as a Postgres binary array:  the
+ *  number of dimensions, a flags word (no NULLs), the element type OID and
+ *  the size and lower bound of each dimension, then the elements each with
+ *  their length.  FITS data are big-endian like the COPY format, so
+ *  numeric elements are copied straight through;  bytes and logicals are
+ *  widened to smallint to match their column type.
+ */
+static unsigned char *
+dl_printArray (CtxPtr ctx, unsigned char *dp, ColPtr col)
+{
+    unsigned int hdr[8], elen = 0, oid = 0;
+    unsigned short sval = 0;
+    int    i, n = (int) col->repeat, size = 0, nhdr = 0;
+
+
+    switch (col->type) {
+    case TLOGICAL:
+    case TBYTE:
+    case TSBYTE:
+    case TSHORT:
+    case TUSHORT:       oid = 21;   size = sz_short;        break;  // int2
+    case TINT:
+    case TUINT:
+    case TINT32BIT:     oid = 23;   size = sz_int;          break;  // int4
+    case TLONGLONG:     oid = 20;   size = sz_long;         break;  // int8
+    case TFLOAT:        oid = 700;  size = sz_float;        break;  // float4
+    case TDOUBLE:       oid = 701;  size = sz_double;       break;  // float8
+    default:
+        return (dl_opBad (ctx, dp, col));
+    }
+
+    /*  The field length, then the array header.  Dimensions are listed
+     *  slowest-varying first, i.e. the reverse of the FITS TDIM order.
+     */
+    hdr[1] = htonl (col->ndim);
+    hdr[2] = 0;
+    hdr[3] = htonl (oid);
+    if (col->ndim == 2) {
+        hdr[4] = htonl (col->ncols), hdr[5] = htonl (1);
+        hdr[6] = htonl (col->nrows), hdr[7] = htonl (1);
+        nhdr = 8;
+    } else {
+        hdr[4] = htonl (n), hdr[5] = htonl (1);
+        nhdr = 6;
+    }
+    hdr[0] = htonl ((nhdr - 1) * sz_int + n * (sz_int + size));
+
+    memcpy (ctx->optr, hdr, nhdr * sz_int);
+    ctx->optr += nhdr * sz_int, ctx->olen += nhdr * sz_int;
+
+    elen = htonl (size);
+    for (i=0; i < n; i++) {
+        memcpy (ctx->optr, &elen, sz_int);          ctx->optr += sz_int;
+        if (col->type == TLOGICAL) {
+            sval = ((tolower ((int) *dp++) == 't') ? htons(1) : 0);
+            memcpy (ctx->optr, &sval, sz_short);
+        } else if (col->type == TBYTE || col->type == TSBYTE) {
+            sval = htons ((short) *dp++);
+            memcpy (ctx->optr, &sval, sz_short);
+        } else {
+            memcpy (ctx->optr, dp, size);
+            dp += size;
+        }
+        ctx->optr += size;
+    }
+    ctx->olen += n * (sz_int + size);
+
+    return (dp);
+}
+
+
+/**
+ *  DL_PRINTSERIAL -- Print the serial number column as integer values.
+ */
+static void
+dl_printSerial (CtxPtr ctx)
+{
+    unsigned int ival = ctx->serial_number++;
+    unsigned int sz_val = htonl(sz_int);
+
+    if (ctx->do_binary) {
+        memcpy (ctx->optr, &sz_val, sz_int);         	ctx->optr += sz_int;
+        ival = htonl(ival);
+        memcpy (ctx->optr, (char *)&ival, sz_int);   	ctx->optr += sz_int;
+        ctx->olen += (2 * sz_int);
+
+    } else
+        dl_putInt (ctx, (int) ival, 0);
+}
+
+
+/**
+ *  DL_PRINTRANDOM -- Print the random number column as float values.
+ */
+static void
+dl_printRandom (CtxPtr ctx)
+{
+    unsigned int len = 0, sz_val = htonl(sz_float);
+    float rval = (((float)rand()/(float)(RAND_MAX)) * RANDOM_SCALE);
+    char  valbuf[SZ_VALBUF];
+
+
+    if (mach_swap && ctx->do_binary)
+        bswap4 ((unsigned char *)&rval, 1, (unsigned char *)&rval, 1, sz_float);
+
+    if (ctx->do_binary) {
+        sz_val = htonl(sz_float);
+        memcpy (ctx->optr, &sz_val, sz_int);           	ctx->optr += sz_int;
+        memcpy (ctx->optr, (char *)&rval, sz_float);   	ctx->optr += sz_float;
+        ctx->olen += (sz_int + sz_float);
+
+    } else {
+        memset (valbuf, 0, SZ_VALBUF);
+        //sprintf (valbuf, "%c%f", delimiter, rval);
+        sprintf (valbuf, "%f", rval);
+        memcpy (ctx->optr, valbuf, (len = strlen (valbuf)));
+        ctx->olen += len;
+        ctx->optr += len;
+    }
+}
+
+
+/**
+ *  DL_PRINTVALUE -- Print a (integer) value to the output stream.
+ */
+static void
+dl_printValue (CtxPtr ctx, int value)
+{
+    unsigned int ival = value;
+    unsigned int sz_val = htonl(sz_int);
+
+
+    if (ctx->do_binary) {
+        memcpy (ctx->optr, &sz_val, sz_int);         ctx->optr += sz_int;
+        ival = htonl(ival);
+        memcpy (ctx->optr, (char *)&ival, sz_int);   ctx->optr += sz_int;
+        ctx->olen += (2 * sz_int);
+
+    } else
+        dl_putInt (ctx, value, 0);
+}
+
+
+/*  Two-digit decimal strings "00" .. "99" and powers of ten used by the
+ *  integer encoder.
+ */
+static const char dl_digits[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233"
+    "34353637383940414243444546474849505152535455565758596061626364656667"
+    "6869707172737475767778798081828384858687888990919293949596979899";
+
+static const unsigned long long dl_pow10[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+
+/**
+ *  DL_PUTNONFINITE -- Print a NaN or infinite value.  SQL formats use the
+ *  names the database accepts, other formats the printf() 'fmt'.
+ */
+static void
+dl_putNonFinite (CtxPtr ctx, double dval, char *fmt)
+{
+    char  valbuf[SZ_VALBUF], *val = valbuf;
+    int   sign = 1, len = 0;
+
+
+    if (load_file) {
+        val = "\\N";                            // NULL in LOAD DATA
+    } else if (isnan (dval)) {
+        if (format == TAB_SQLITE || format == TAB_MYSQL)
+            val = "'NaN'";
+        else if (format == TAB_POSTGRES)
+            val = "NaN";
+        else
+            sprintf (valbuf, fmt, dval);
+
+    } else {
+        sign = isinf (dval);
+        if (format == TAB_SQLITE || format == TAB_MYSQL)
+            val = (sign ? "'Infinity'" : "'-Infinity'");
+        else if (format == TAB_POSTGRES)
+            val = (sign ? "Infinity" : "-Infinity");
+        else
+            sprintf (valbuf, fmt, dval);
+    }
+
+    memcpy (ctx->optr, val, (len = strlen (val)));
+    ctx->olen += len, ctx->optr += len;
+}
+
+
+/**
+ *  DL_PUTINT -- Encode an integer straight into the output buffer, two
+ *  digits at a time.  A non-zero 'width' pads the value as "%*lld" does.
+ */
+static void
+dl_putInt (CtxPtr ctx, long long value, int width)
+{
+    unsigned long long uval;
+    int   ndigits, bits, len, neg = (value < 0);
+    char *op;
+
+
+    uval = (unsigned long long) value;
+    if (neg)
+        uval = 0ULL - uval;
+
+    /*  Digit count from the bit length:  log10(2) ~= 1233/4096 gives a
+     *  guess that is at most one too large.
+     */
+    bits = 64 - __builtin_clzll (uval | 1);
+    ndigits = ((bits * 1233) >> 12) + 1;
+    ndigits -= (ndigits > 1 && uval < dl_pow10[ndigits - 1]);
+    len = ndigits + neg;
+
+    if (width > len) {                          // right-justify
+        memset (ctx->optr, ' ', width - len);
+        ctx->optr += width - len, ctx->olen += width - len;
+    }
+
+    if (neg)
+        *ctx->optr++ = '-';
+    op = ctx->optr + ndigits;
+    while (uval >= 100) {
+        unsigned int d = (unsigned int) (uval % 100) * 2;
+        uval /= 100;
+        *--op = dl_digits[d + 1];
+        *--op = dl_digits[d];
+    }
+    if (uval >= 10) {
+        *--op = dl_digits[uval * 2 + 1];
+        *--op = dl_digits[uval * 2];
+    } else
+        *--op = (char) ('0' + uval);
+    ctx->optr += ndigits, ctx->olen += len;
+
+    if (width < -len) {                         // left-justify
+        memset (ctx->optr, ' ', -width - len);
+        ctx->optr += -width - len, ctx->olen += -width - len;
+    }
+}
+
+
+/***********************************************************/
+/**************** FLOAT FORMATTING METHODS *****************/
+/***********************************************************/
+
+/*  Shortest round-trip formatting of floating-point values, following
+ *  U. Adams, "Ryu: Fast Float-to-String Conversion" (PLDI 2018).  The
+ *  power-of-5 multiplier tables are computed once at startup by
+ *  dl_initFloatFmt() rather than compiled in.
+ */
+typedef unsigned __int128 uint128;
+
+static uint128            d_pow5_inv[D_POW5_INV_SIZE];
+static uint128            d_pow5[D_POW5_SIZE];
+static unsigned long long f_pow5_inv[F_POW5_INV_SIZE];
+static unsigned long long f_pow5[F_POW5_SIZE];
+
+
+/**
+ *  DL_POW5BITS -- Bit length of 5^e (ceil(log2(5^e)), 1 for e == 0).
+ */
+static int
+dl_pow5bits (int e)
+{
+    return ((int) (((unsigned int) e * 1217359) >> 19) + 1);
+}
+
+
+/**
+ *  DL_LOG10POW2 -- floor(log10(2^e)).
+ */
+static int
+dl_log10Pow2 (int e)
+{
+    return ((int) (((unsigned int) e * 78913) >> 18));
+}
+
+
+/**
+ *  DL_LOG10POW5 -- floor(log10(5^e)).
+ */
+static int
+dl_log10Pow5 (int e)
+{
+    return ((int) (((unsigned int) e * 732923) >> 20));
+}
+
+
+/**
+ *  DL_POW5FACTOR -- Number of times 5 divides 'v'.
+ */
+static int
+dl_pow5Factor (unsigned long long v)
+{
+    int  n = 0;
+
+    while (v % 5 == 0)
+        v /= 5, n++;
+    return (n);
+}
+
+
+/**
+ *  DL_BIGBITS -- Return 128 bits of a bignum starting at bit 'shift'.
+ */
+static uint128
+dl_bigBits (unsigned int *big, int shift)
+{
+    int      i, w = shift / 32, b = shift % 32;
+    uint128  v = 0;
+
+
+    for (i=0; i < 4; i++) {
+        unsigned long long lo = ((w + i) < SZ_BIGNUM ? big[w + i] : 0);
+        unsigned long long hi = ((w + i + 1) < SZ_BIGNUM ? big[w + i + 1] : 0);
+
+        v |= (uint128) (unsigned int) (((hi << 32) | lo) >> b) << (32 * i);
+    }
+    return (v);
+}
+
+
+/**
+ *  DL_INITFLOATFMT -- Compute the multiplier tables for the shortest
+ *  float format.  Must be called before any conversion threads start.
+ */
+static void
+dl_initFloatFmt (void)
+{
+    unsigned int big[SZ_BIGNUM];
+    unsigned long long carry;
+    int  i, k, bits, top;
+
+
+    /*  5^i, scaled to exactly D_POW5_BITCOUNT (F_POW5_BITCOUNT) bits.
+     */
+    memset (big, 0, sizeof (big));
+    big[0] = 1;
+    for (i=0; i < D_POW5_SIZE; i++) {
+        bits = dl_pow5bits (i);
+        if (bits >= D_POW5_BITCOUNT)
+            d_pow5[i] = dl_bigBits (big, bits - D_POW5_BITCOUNT);
+        else
+            d_pow5[i] = dl_bigBits (big, 0) << (D_POW5_BITCOUNT - bits);
+        if (i < F_POW5_SIZE) {
+            if (bits >= F_POW5_BITCOUNT)
+                f_pow5[i] = dl_bigBits (big, bits - F_POW5_BITCOUNT);
+            else
+                f_pow5[i] = dl_bigBits (big, 0) << (F_POW5_BITCOUNT - bits);
+        }
+
+        for (k=0, carry=0; k < SZ_BIGNUM; k++) {       // big *= 5
+            carry += (unsigned long long) big[k] * 5;
+            big[k] = (unsigned int) carry;
+            carry >>= 32;
+        }
+    }
+
+    /*  floor(2^(pow5bits(i) - 1 + BITCOUNT) / 5^i) + 1, taken from the
+     *  top bits of 2^top / 5^i.
+     */
+    top = dl_pow5bits (D_POW5_INV_SIZE - 1) - 1 + D_POW5_INV_BITCOUNT;
+    memset (big, 0, sizeof (big));
+    big[top / 32] = 1U << (top % 32);
+    for (i=0; i < D_POW5_INV_SIZE; i++) {
+        bits = dl_pow5bits (i) - 1;
+        d_pow5_inv[i] = dl_bigBits (big, top - bits - D_POW5_INV_BITCOUNT) + 1;
+        if (i < F_POW5_INV_SIZE)
+            f_pow5_inv[i] = (unsigned long long)
+                dl_bigBits (big, top - bits - F_POW5_INV_BITCOUNT) + 1;
+
+        for (k=SZ_BIGNUM-1, carry=0; k >= 0; k--) {    // big /= 5
+            carry = (carry << 32) | big[k];
+            big[k] = (unsigned int) (carry / 5);
+            carry %= 5;
+        }
+    }
+}
+
+
+/**
+ *  DL_MULSHIFT64 -- (m * mul) >> j, for the double conversion.
+ */
+static unsigned long long
+dl_mulShift64 (unsigned long long m, uint128 mul, int j)
+{
+    uint128  b0 = (uint128) m * (unsigned long long) mul;
+    uint128  b2 = (uint128) m * (unsigned long long) (mul >> 64);
+
+    return ((unsigned long long) (((b0 >> 64) + b2) >> (j - 64)));
+}
+
+
+/**
+ *  DL_MULSHIFT32 -- (m * mul) >> j, for the float conversion.
+ */
+static unsigned int
+dl_mulShift32 (unsigned int m, unsigned long long mul, int j)
+{
+    unsigned long long b0 = (unsigned long long) m * (unsigned int) mul;
+    unsigned long long b1 = (unsigned long long) m * (unsigned int) (mul >> 32);
+
+    return ((unsigned int) (((b0 >> 32) + b1) >> (j - 32)));
+}
+
+
+/**
+ *  DL_D2D -- Convert the IEEE mantissa and exponent of a double to the
+ *  shortest decimal 'mant' x 10^'exp' that rounds back to the same value.
+ */
+static void
+dl_d2d (unsigned long long ieee_mant, int ieee_exp, unsigned long long *mant,
+                int *exp)
+{
+    unsigned long long m2, mv, vr, vp, vm, output;
+    int   e2, e10, q, i, k, removed = 0, even, mmShift;
+    int   vmTrailingZeros = 0, vrTrailingZeros = 0, lastDigit = 0;
+
+
+    if (ieee_exp == 0) {
+        e2 = 1 - 1023 - 52 - 2;
+        m2 = ieee_mant;
+    } else {
+        e2 = ieee_exp - 1023 - 52 - 2;
+        m2 = (1ULL << 52) | ieee_mant;
+    }
+    even = ((m2 & 1) == 0);
+    mv = 4 * m2;
+    mmShift = (ieee_mant != 0 || ieee_exp <= 1);
+
+    /*  Compute the decimal interval [vm, vp] around the value vr.
+     */
+    if (e2 >= 0) {
+        q = dl_log10Pow2 (e2) - (e2 > 3);
+        e10 = q;
+        k = D_POW5_INV_BITCOUNT + dl_pow5bits (q) - 1;
+        i = -e2 + q + k;
+        vr = dl_mulShift64 (mv, d_pow5_inv[q], i);
+        vp = dl_mulShift64 (mv + 2, d_pow5_inv[q], i);
+        vm = dl_mulShift64 (mv - 1 - mmShift, d_pow5_inv[q], i);
+        if (q <= 21) {
+            if (mv % 5 == 0)
+                vrTrailingZeros = (dl_pow5Factor (mv) >= q);
+            else if (even)
+                vmTrailingZeros = (dl_pow5Factor (mv - 1 - mmShift) >= q);
+            else
+                vp -= (dl_pow5Factor (mv + 2) >= q);
+        }
+    } else {
+        q = dl_log10Pow5 (-e2) - (-e2 > 1);
+        e10 = q + e2;
+        i = -e2 - q;
+        k = dl_pow5bits (i) - D_POW5_BITCOUNT;
+        vr = dl_mulShift64 (mv, d_pow5[i], q - k);
+        vp = dl_mulShift64 (mv + 2, d_pow5[i], q - k);
+        vm = dl_mulShift64 (mv - 1 - mmShift, d_pow5[i], q - k);
+        if (q <= 1) {
+            vrTrailingZeros = 1;
+            if (even)
+                vmTrailingZeros = (mmShift == 1);
+            else
+                --vp;
+        } else if (q < 63)
+            vrTrailingZeros = ((mv & ((1ULL << q) - 1)) == 0);
+    }
+
+    /*  Remove digits while the interval still holds a shorter value.
+     */
+    if (vmTrailingZeros || vrTrailingZeros) {
+        while (vp / 10 > vm / 10) {
+            vmTrailingZeros &= (vm % 10 == 0);
+            vrTrailingZeros &= (lastDigit == 0);
+            lastDigit = vr % 10;
+            vr /= 10, vp /= 10, vm /= 10, removed++;
+        }
+        if (vmTrailingZeros) {
+            while (vm % 10 == 0) {
+                vrTrailingZeros &= (lastDigit == 0);
+                lastDigit = vr % 10;
+                vr /= 10, vp /= 10, vm /= 10, removed++;
+            }
+        }
+        if (vrTrailingZeros && lastDigit == 5 && vr % 2 == 0)
+            lastDigit = 4;                      // round half to even
+        output = vr + ((vr == vm && (!even || !vmTrailingZeros)) ||
+            lastDigit >= 5);
+    } else {
+        while (vp / 10 > vm / 10) {
+            lastDigit = vr % 10;
+            vr /= 10, vp /= 10, vm /= 10, removed++;
+        }
+        output = vr + (vr == vm || lastDigit >= 5);
+    }
+
+    *mant = output;
+    *exp = e10 + removed;
+}
+
+
+/**
+ *  DL_F2D -- Single-precision version of dl_d2d().
+ */
+static void
+dl_f2d (unsigned int ieee_mant, int ieee_exp, unsigned long long *mant,
+                int *exp)
+{
+    unsigned int m2, mv, mp, mm, vr, vp, vm, output;
+    int   e2, e10, q, i, k, removed = 0, even, mmShift;
+    int   vmTrailingZeros = 0, vrTrailingZeros = 0, lastDigit = 0;
+
+
+    if (ieee_exp == 0) {
+        e2 = 1 - 127 - 23 - 2;
+        m2 = ieee_mant;
+    } else {
+        e2 = ieee_exp - 127 - 23 - 2;
+        m2 = (1U << 23) | ieee_mant;
+    }
+    even = ((m2 & 1) == 0);
+    mv = 4 * m2;
+    mp = 4 * m2 + 2;
+    mmShift = (ieee_mant != 0 || ieee_exp <= 1);
+    mm = 4 * m2 - 1 - mmShift;
+
+    if (e2 >= 0) {
+        q = dl_log10Pow2 (e2);
+        e10 = q;
+        k = F_POW5_INV_BITCOUNT + dl_pow5bits (q) - 1;
+        i = -e2 + q + k;
+        vr = dl_mulShift32 (mv, f_pow5_inv[q], i);
+        vp = dl_mulShift32 (mp, f_pow5_inv[q], i);
+        vm = dl_mulShift32 (mm, f_pow5_inv[q], i);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            // We need the last removed digit even if we won't loop.
+            k = F_POW5_INV_BITCOUNT + dl_pow5bits (q - 1) - 1;
+            lastDigit = dl_mulShift32 (mv, f_pow5_inv[q - 1],
+                -e2 + q - 1 + k) % 10;
+        }
+        if (q <= 9) {
+            if (mv % 5 == 0)
+                vrTrailingZeros = (dl_pow5Factor (mv) >= q);
+            else if (even)
+                vmTrailingZeros = (dl_pow5Factor (mm) >= q);
+            else
+                vp -= (dl_pow5Factor (mp) >= q);
+        }
+    } else {
+        q = dl_log10Pow5 (-e2);
+        e10 = q + e2;
+        i = -e2 - q;
+        k = dl_pow5bits (i) - F_POW5_BITCOUNT;
+        vr = dl_mulShift32 (mv, f_pow5[i], q - k);
+        vp = dl_mulShift32 (mp, f_pow5[i], q - k);
+        vm = dl_mulShift32 (mm, f_pow5[i], q - k);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            k = dl_pow5bits (i + 1) - F_POW5_BITCOUNT;
+            lastDigit = dl_mulShift32 (mv, f_pow5[i + 1], q - 1 - k) % 10;
+        }
+        if (q <= 1) {
+            vrTrailingZeros = 1;
+            if (even)
+                vmTrailingZeros = (mmShift == 1);
+            else
+                --vp;
+        } else if (q < 31)
+            vrTrailingZeros = ((mv & ((1U << (q - 1)) - 1)) == 0);
+    }
+
+    if (vmTrailingZeros || vrTrailingZeros) {
+        while (vp / 10 > vm / 10) {
+            vmTrailingZeros &= (vm % 10 == 0);
+            vrTrailingZeros &= (lastDigit == 0);
+            lastDigit = vr % 10;
+            vr /= 10, vp /= 10, vm /= 10, removed++;
+        }
+        if (vmTrailingZeros) {
+            while (vm % 10 == 0) {
+                vrTrailingZeros &= (lastDigit == 0);
+                lastDigit = vr % 10;
+                vr /= 10, vp /= 10, vm /= 10, removed++;
+            }
+        }
+        if (vrTrailingZeros && lastDigit == 5 && vr % 2 == 0)
+            lastDigit = 4;                      // round half to even
+        output = vr + ((vr == vm && (!even || !vmTrailingZeros)) ||
+            lastDigit >= 5);
+    } else {
+        while (vp / 10 > vm / 10) {
+            lastDigit = vr % 10;
+            vr /= 10, vp /= 10, vm /= 10, removed++;
+        }
+        output = vr + (vr == vm || lastDigit >= 5);
+    }
+
+    *mant = output;
+    *exp = e10 + removed;
+}
+
+
+/**
+ *  DL_PUTDECIMAL -- Write 'mant' x 10^'exp' to the output buffer.  Plain
+ *  notation is used for exponents in the range -7 .. 20, otherwise an
+ *  'e' exponent, as in ECMAScript's Number.toString().  A non-zero 'width'
+ *  right-justifies the value.
+ */
+static void
+dl_putDecimal (CtxPtr ctx, int neg, unsigned long long mant, int exp,
+                int width)
+{
+    char  digits[24], buf[48], *op = buf;
+    int   i, k, n, len;
+
+
+    for (k=0; mant >= 10; mant /= 10)           // digits, reversed
+        digits[k++] = '0' + (char) (mant % 10);
+    digits[k++] = '0' + (char) mant;
+    n = exp + k;                                // decimal point position
+
+    if (neg)
+        *op++ = '-';
+    if (k <= n && n <= 21) {                    // 1234000
+        for (i=k-1; i >= 0; i--)
+            *op++ = digits[i];
+        for (i=k; i < n; i++)
+            *op++ = '0';
+    } else if (0 < n && n <= 21) {              // 123.4
+        for (i=k-1; i >= 0; i--) {
+            *op++ = digits[i];
+            if (i == k - n)
+                *op++ = '.';
+        }
+    } else if (-6 < n && n <= 0) {              // 0.001234
+        *op++ = '0', *op++ = '.';
+        for (i=n; i < 0; i++)
+            *op++ = '0';
+        for (i=k-1; i >= 0; i--)
+            *op++ = digits[i];
+    } else {                                    // 1.234e-12
+        *op++ = digits[k-1];
+        if (k > 1) {
+            *op++ = '.';
+            for (i=k-2; i >= 0; i--)
+                *op++ = digits[i];
+        }
+        *op++ = 'e';
+        if ((n - 1) < 0)
+            *op++ = '-';
+        for (i=0, k=abs (n - 1); k > 0 || i == 0; k /= 10)
+            digits[i++] = '0' + (char) (k % 10);
+        while (i > 0)
+            *op++ = digits[--i];
+    }
+
+    len = (int) (op - buf);
+    if (width > len) {
+        memset (ctx->optr, ' ', width - len);
+        ctx->optr += width - len, ctx->olen += width - len;
+    }
+    memcpy (ctx->optr, buf, len);
+    ctx->optr += len, ctx->olen += len;
+}
+
+
+/**
+ *  DL_PUTDOUBLE -- Write the shortest round-trip form of a finite double.
+ */
+static void
+dl_putDouble (CtxPtr ctx, double dval, int width)
+{
+    unsigned long long bits, mant = 0;
+    int   exp = 0;
+
+
+    memcpy (&bits, &dval, sizeof (bits));
+    if ((bits << 1) != 0)
+        dl_d2d (bits & ((1ULL << 52) - 1), (int) ((bits >> 52) & 0x7ff),
+            &mant, &exp);
+    dl_putDecimal (ctx, (int) (bits >> 63), mant, exp, width);
+}
+
+
+/**
+ *  DL_PUTFLOAT -- Write the shortest round-trip form of a finite float.
+ */
+static void
+dl_putFloat (CtxPtr ctx, float rval, int width)
+{
+    unsigned int bits;
+    unsigned long long mant = 0;
+    int   exp = 0;
+
+
+    memcpy (&bits, &rval, sizeof (bits));
+    if ((bits << 1) != 0)
+        dl_f2d (bits & ((1U << 23) - 1), (int) ((bits >> 23) & 0xff),
+            &mant, &exp);
+    dl_putDecimal (ctx, (int) (bits >> 31), mant, exp, width);
+}
+
+
+/***********************************************************/
+/**************** OUTPUT AND THREAD METHODS ****************/
+/***********************************************************/
+
+/**
+ *  DL_OUTQUEUE -- Append a block to the task output queue.  Blocks for any
+ *  task other than the one being written are limited to MAX_QBLOCKS so that
+ *  workers running ahead of the writer don't buffer whole files.
+ */
+static void
+dl_outQueue (CtxPtr ctx, char *buf, long len, int wait)
+{
+    TaskPtr  t = ctx->task;
+    BlockPtr b = (BlockPtr) calloc (1, sizeof (Block));
+
+
+    b->buf = buf;
+    b->len = len;
+
+    pthread_mutex_lock (&pool.mutex);
+    while (wait && t->index != pool.wtask && t->nblocks >= MAX_QBLOCKS)
+        pthread_cond_wait (&pool.cond, &pool.mutex);
+
+    if (t->tail)
+        t->tail->next = b;
+    else
+        t->head = b;
+    t->tail = b;
+    t->nblocks++;
+
+    pthread_cond_broadcast (&pool.cond);
+    pthread_mutex_unlock (&pool.mutex);
+}
+
+
+/**
+ *  DL_OUTOPEN -- Open the output file.  In threaded mode the writer opens
+ *  the file when it reaches the (empty) marker block, unless the task
+ *  writes its own output shard.
+ */
+static void
+dl_outOpen (CtxPtr ctx, char *oname)
+{
+    if (ctx->queued) {
+        ctx->ofd = (FILE *) NULL;
+        dl_outQueue (ctx, NULL, 0, 0);
+
+    } else if (pg_conninfo) {
+        ctx->ofd = (FILE *) NULL;               // sent to the server
+
+    } else if (strcasecmp (oname, "stdout") == 0 || oname[0] == '-')
+        ctx->ofd = stdout;
+    else {
+        if ((ctx->ofd = fopen (oname, ctx->omode)) == (FILE *) NULL)
+            dl_error (3, "Error opening output file '%s'\n", oname);
+    }
+
+    if (zcompress && ctx->ofd)
+        ctx->ofd = dl_zOpen (ctx->ofd);
+}
+
+
+/**
+ *  DL_OUTCLOSE -- Close the output file.
+ */
+static void
+dl_outClose (CtxPtr ctx)
+{
+    if (zcompress && ctx->ofd)
+        ctx->ofd = dl_zClose ();
+    if (ctx->ofd && ctx->ofd != stdout)
+        fclose (ctx->ofd);
+    ctx->ofd = (FILE *) NULL;
+}
+
+
+/**
+ *  DL_OUTWRITE -- Write raw bytes to the output.
+ */
+static void
+dl_outWrite (CtxPtr ctx, void *buf, long len)
+{
+    if (ctx->queued) {
+        char *b = (char *) malloc (len);
+        memcpy (b, buf, len);
+        dl_outQueue (ctx, b, len, 0);
+    } else if (pg_conninfo) {
+        dl_pgWrite (buf, len);
+    } else {
+        fflush (ctx->ofd);                      // keep order w/ dl_outPrintf
+        dl_writeBuf (fileno(ctx->ofd), buf, len);
+    }
+}
+
+
+/**
+ *  DL_OUTPRINTF -- Print formatted text to the output.
+ */
+static void
+dl_outPrintf (CtxPtr ctx, char *fmt, ...)
+{
+    va_list  ap;
+
+
+    va_start (ap, fmt);
+    if (ctx->queued || pg_conninfo) {
+        va_list  aq;
+        char    *b;
+        int      len;
+
+        va_copy (aq, ap);
+        len = vsnprintf (NULL, 0, fmt, aq);
+        va_end (aq);
+
+        b = (char *) malloc (len + 1);
+        vsnprintf (b, len + 1, fmt, ap);
+        if (ctx->queued)
+            dl_outQueue (ctx, b, len, 0);
+        else
+            dl_pgWrite (b, len), free ((void *) b);
+    } else
+        vfprintf (ctx->ofd, fmt, ap);
+    va_end (ap);
+}
+
+
+/**
+ *  DL_OUTFLUSH -- Flush the output.
+ */
+static void
+dl_outFlush (CtxPtr ctx)
+{
+    if (!ctx->queued && ctx->ofd)
+        fflush (ctx->ofd);
+}
+
+
+/**
+ *  DL_OUTCHUNK -- Write the formatted chunk in the output buffer.  In
+ *  threaded mode the buffer itself is handed to the writer and replaced.
+ */
+static void
+dl_outChunk (CtxPtr ctx)
+{
+    if (ctx->queued) {
+        dl_outQueue (ctx, ctx->obuf, ctx->olen, 1);
+        ctx->obuf = ctx->optr = (char *) malloc (ctx->osize);
+        ctx->olen = 0;
+    } else if (pg_conninfo) {
+        dl_pgWrite (ctx->obuf, ctx->olen);
+    } else {
+        dl_writeBuf (fileno(ctx->ofd), ctx->obuf, ctx->olen);
+        fflush (ctx->ofd);
+    }
+}
+
+
+/**
+ *  DL_COPYLAYOUT -- Copy the table layout between contexts.
+ */
+static void
+dl_copyLayout (CtxPtr to, CtxPtr from)
+{
+    to->numInCols = from->numInCols;
+    to->numOutCols = from->numOutCols;
+    memcpy (&to->inColumns[0], &from->inColumns[0],
+        (from->numInCols + 1) * sizeof (Col));
+    memcpy (&to->outColumns[0], &from->outColumns[0],
+        (from->numOutCols + 1) * sizeof (Col));
+}
+
+
+/**
+ *  DL_BEGINTURN -- Begin the header phase of a conversion.  In threaded mode
+ *  this waits until all earlier files have finished theirs, so table names,
+ *  column checks and the sticky binary flag behave as in the serial case.
+ */
+static void
+dl_beginTurn (CtxPtr ctx)
+{
+    if (ctx->task) {
+        pthread_mutex_lock (&pool.mutex);
+        while (pool.turn != ctx->task->index)
+            pthread_cond_wait (&pool.cond, &pool.mutex);
+        pthread_mutex_unlock (&pool.mutex);
+
+        dl_copyLayout (ctx, &pool.layout);
+    }
+    ctx->do_binary = do_binary;
+    ctx->in_turn = 1;
+}
+
+
+/**
+ *  DL_ENDTURN -- End the header phase.  The file's serial IDs are reserved
+ *  here from the number of rows it will write.
+ */
+static void
+dl_endTurn (CtxPtr ctx, long nrows)
+{
+    if (!ctx->in_turn)
+        return;
+
+    ctx->serial_number = serial_number;
+    serial_number += (int) nrows;
+    ctx->in_turn = 0;
+
+    if (ctx->task) {
+        dl_copyLayout (&pool.layout, ctx);
+
+        pthread_mutex_lock (&pool.mutex);
+        pool.turn++;
+        pthread_cond_broadcast (&pool.cond);
+        pthread_mutex_unlock (&pool.mutex);
+    }
+}
+
+
+/**
+ *  DL_WORKER -- Worker thread, convert tasks until there are none left.
+ */
+static void *
+dl_worker (void *arg)
+{
+    int     nfiles = *((int *) arg);
+    CtxPtr  ctx = (CtxPtr) calloc (1, sizeof (Context));
+    TaskPtr t = (TaskPtr) NULL;
+
+
+    while (1) {
+        pthread_mutex_lock (&pool.mutex);
+        t = (pool.next < pool.ntasks ? &pool.tasks[pool.next++] : NULL);
+        pthread_mutex_unlock (&pool.mutex);
+        if (t == NULL)
+            break;
+
+        ctx->task = t;
+        ctx->queued = !sharded;
+        ctx->shard = t->shard;
+        ctx->omode = t->omode;
+        dl_fits2db (ctx, t->ifname, t->ofname, t->filenum, t->bnum, nfiles);
+
+        pthread_mutex_lock (&pool.mutex);
+        t->done = 1;
+        pthread_cond_broadcast (&pool.cond);
+        pthread_mutex_unlock (&pool.mutex);
+    }
+
+    if (ctx->pstack)
+        free ((void *) ctx->pstack);
+    free ((void *) ctx);
+    return (NULL);
+}
+
+
+/**
+ *  DL_RUNTASKS -- Convert the task list on a pool of worker threads.  The
+ *  calling thread is the single writer and outputs each task's blocks in
+ *  input order, so the result is identical to a serial conversion.
+ */
+static void
+dl_runTasks (TaskPtr tasks, int ntasks, int nfiles)
+{
+    pthread_t tid[MAX_THREADS];
+    TaskPtr   t = (TaskPtr) NULL;
+    BlockPtr  b = (BlockPtr) NULL;
+    FILE     *fd = (FILE *) NULL;
+    int       i, k, nworkers = (nthreads < ntasks ? nthreads : ntasks);
+
+
+    memset (&pool, 0, sizeof (Pool));
+    pool.tasks = tasks;
+    pool.ntasks = ntasks;
+    pthread_mutex_init (&pool.mutex, NULL);
+    pthread_cond_init (&pool.cond, NULL);
+
+    for (i=0; i < nworkers; i++)
+        pthread_create (&tid[i], NULL, dl_worker, (void *) &nfiles);
+
+    for (k=0; k < ntasks; k++) {
+        t = &tasks[k];
+
+        pthread_mutex_lock (&pool.mutex);
+        pool.wtask = k;
+        pthread_cond_broadcast (&pool.cond);
+
+        while (1) {
+            while (t->head == NULL && !t->done)
+                pthread_cond_wait (&pool.cond, &pool.mutex);
+            if ((b = t->head) == NULL)
+                break;                          // task is done
+
+            if ((t->head = b->next) == NULL)
+                t->tail = NULL;
+            t->nblocks--;
+            pthread_cond_broadcast (&pool.cond);
+            pthread_mutex_unlock (&pool.mutex);
+
+            /*  The first block of a task opens the output file.
+             */
+            if (fd == NULL) {
+                if (strcasecmp (t->ofname, "stdout") == 0 || 
+                    t->ofname[0] == '-')
+                        fd = stdout;
+                else if ((fd = fopen (t->ofname, t->omode)) == (FILE *) NULL)
+                    dl_error (3, "Error opening output file '%s'\n", 
+                        t->ofname);
+                if (zcompress && fd)
+                    fd = dl_zOpen (fd);
+            }
+            if (fd && b->len > 0)
+                dl_writeBuf (fileno(fd), b->buf, b->len);
+
+            if (b->buf) free ((void *) b->buf);
+            free ((void *) b);
+
+            pthread_mutex_lock (&pool.mutex);
+        }
+        pthread_mutex_unlock (&pool.mutex);
+
+        if (zcompress && fd)
+            fd = dl_zClose ();
+        if (fd && fd != stdout)
+            fclose (fd);
+        fd = (FILE *) NULL;
+    }
+
+    for (i=0; i < nworkers; i++)
+        pthread_join (tid[i], NULL);
+
+    pthread_mutex_destroy (&pool.mutex);
+    pthread_cond_destroy (&pool.cond);
+}
+
+
+/**
+ *  DL_GANGSLICES -- Format slices of the current chunk until none are left.
+ *  Called with the gang mutex held.
+ */
+static void
+dl_gangSlices (void)
+{
+    SlicePtr s = (SlicePtr) NULL;
+
+
+    while (gang.next < gang.nslices) {
+        s = &gang.slices[gang.next++];
+        pthread_mutex_unlock (&gang.mutex);
+
+        dl_formatRows (s->ctx, s->prog, s->dp, s->nrows, s->more);
+
+        pthread_mutex_lock (&gang.mutex);
+        if (++gang.ndone == gang.nslices)
+            pthread_cond_broadcast (&gang.cond);
+    }
+}
+
+
+/**
+ *  DL_GANGHELPER -- Helper thread, format slices of each new chunk.
+ */
+static void *
+dl_gangHelper (void *arg)
+{
+    int  gen = 0;
+
+
+    pthread_mutex_lock (&gang.mutex);
+    while (1) {
+        while (gang.gen == gen && !gang.quit)
+            pthread_cond_wait (&gang.cond, &gang.mutex);
+        if (gang.quit)
+            break;
+
+        gen = gang.gen;
+        dl_gangSlices ();
+    }
+    pthread_mutex_unlock (&gang.mutex);
+
+    return (NULL);
+}
+
+
+/**
+ *  DL_GANGSTART -- Start the helper threads for slice formatting.  The
+ *  calling thread formats slices as well.
+ */
+static void
+dl_gangStart (int nthreads)
+{
+    register int i;
+
+
+    memset (&gang, 0, sizeof (Gang));
+    pthread_mutex_init (&gang.mutex, NULL);
+    pthread_cond_init (&gang.cond, NULL);
+
+    gang.nhelpers = nthreads - 1;
+    for (i=0; i < gang.nhelpers; i++)
+        pthread_create (&gang.tid[i], NULL, dl_gangHelper, NULL);
+}
+
+
+/**
+ *  DL_GANGRUN -- Format a chunk's slices and wait until all are done.
+ */
+static void
+dl_gangRun (SlicePtr slices, int nslices)
+{
+    pthread_mutex_lock (&gang.mutex);
+    gang.slices = slices;
+    gang.nslices = nslices;
+    gang.next = gang.ndone = 0;
+    gang.gen++;
+    pthread_cond_broadcast (&gang.cond);
+
+    dl_gangSlices ();
+    while (gang.ndone < gang.nslices)
+        pthread_cond_wait (&gang.cond, &gang.mutex);
+    pthread_mutex_unlock (&gang.mutex);
+}
+
+
+/**
+ *  DL_GANGSTOP -- Stop the helper threads.
+ */
+static void
+dl_gangStop (void)
+{
+    register int i;
+
+
+    pthread_mutex_lock (&gang.mutex);
+    gang.quit = 1;
+    pthread_cond_broadcast (&gang.cond);
+    pthread_mutex_unlock (&gang.mutex);
+
+    for (i=0; i < gang.nhelpers; i++)
+        pthread_join (gang.tid[i], NULL);
+
+    pthread_mutex_destroy (&gang.mutex);
+    pthread_cond_destroy (&gang.cond);
+}
+
+
+/**
+ *  DL_RINGWAIT -- Back off while a ring is empty or full.  Spin briefly
+ *  since the other side is usually close behind, then sleep.
+ */
+static void
+dl_ringWait (int *nspin)
+{
+    struct timespec ts = { 0, 50000 };
+
+
+    if ((*nspin)++ < 100)
+        sched_yield ();
+    else
+        nanosleep (&ts, NULL);
+}
+
+
+/**
+ *  DL_RINGPUT -- Add a slot to a ring, waiting while it is full.
+ */
+static void
+dl_ringPut (RingPtr ring, ChunkPtr c)
+{
+    unsigned int tail = atomic_load_explicit (&ring->tail,
+                            memory_order_relaxed);
+    int  nspin = 0;
+
+
+    while (tail - atomic_load_explicit (&ring->head, memory_order_acquire)
+            >= NSLOTS)
+        dl_ringWait (&nspin);
+
+    ring->slot[tail & (NSLOTS - 1)] = c;
+    atomic_store_explicit (&ring->tail, tail + 1, memory_order_release);
+}
+
+
+/**
+ *  DL_RINGGET -- Take the next slot from a ring, waiting while it is empty.
+ */
+static ChunkPtr
+dl_ringGet (RingPtr ring)
+{
+    unsigned int head = atomic_load_explicit (&ring->head,
+                            memory_order_relaxed);
+    ChunkPtr c = (ChunkPtr) NULL;
+    int  nspin = 0;
+
+
+    while (atomic_load_explicit (&ring->tail, memory_order_acquire) == head)
+        dl_ringWait (&nspin);
+
+    c = ring->slot[head & (NSLOTS - 1)];
+    atomic_store_explicit (&ring->head, head + 1, memory_order_release);
+    return (c);
+}
+
+
+/**
+ *  DL_PIPEREADER -- Reader thread, fill free slots with chunks of the
+ *  table (or point them into the mapped table), byte-swapped as needed.
+ *  A slot marked 'eof' ends the stream.
+ */
+static void *
+dl_pipeReader (void *arg)
+{
+    PipePtr  p = (PipePtr) arg;
+    ChunkPtr c = (ChunkPtr) NULL;
+    LONGLONG firstchar = 1;
+    long     jj, nelem = 0;
+    int      status = 0;
+
+
+    for (jj=1; (nelem = dl_nextChunk (p->ctx, &jj, p->nelem, p->nrows));
+        jj += nelem) {
+        firstchar = (jj - 1) * p->naxis1 + 1;
+
+        c = dl_ringGet (&p->free);
+        c->nrows = nelem;
+        c->nbytes = nelem * p->naxis1;
+        if (p->table) {
+            c->data = p->table + (firstchar - 1);
+            if ((jj + nelem) <= p->nrows)
+                dl_willNeed (p->ctx, c->data + c->nbytes, c->nbytes);
+        } else {
+            dl_readTable (p->ctx, p->fptr, 1, firstchar, c->nbytes, c->buf,
+                &status);
+            if (status) {                       /* print any error message */
+                fits_report_error (stderr, status);
+                p->status = status;
+                break;
+            }
+            c->data = c->buf;
+        }
+        c->nrows = dl_prepChunk (p->ctx, c->buf, &c->data, nelem, p->naxis1);
+        dl_ringPut (&p->full, c);
+    }
+
+    if (!status)
+        c = dl_ringGet (&p->free);
+    c->eof = 1;
+    dl_ringPut (&p->full, c);
+
+    return (NULL);
+}
+
+
+/**
+ *  DL_PIPEWRITER -- Writer thread, write formatted slots in order and
+ *  hand them back to the reader.
+ */
+static void *
+dl_pipeWriter (void *arg)
+{
+    PipePtr  p = (PipePtr) arg;
+    ChunkPtr c = (ChunkPtr) NULL;
+
+
+    while ((c = dl_ringGet (&p->done))->eof == 0) {
+        dl_writeSlices (p->ctx, c->slices, p->nslices);
+        dl_ringPut (&p->free, c);
+    }
+
+    return (NULL);
+}
+
+
+/**
+ *  DL_PIPELINE -- Convert a table as a three-stage pipeline:  a reader
+ *  thread fills chunk slots, the calling thread formats them and a writer
+ *  thread writes them out.  Slots circulate in order through lock-free
+ *  rings, so output is identical to the serial loop.
+ */
+static int
+dl_pipeline (CtxPtr ctx, fitsfile *fptr, unsigned char *table, long nrows,
+                long naxis1, int nelem, int nslices, int more)
+{
+    Pipe      p;
+    Chunk     chunks[NSLOTS];
+    ChunkPtr  c = (ChunkPtr) NULL;
+    pthread_t rtid, wtid;
+    register int i;
+
+
+    memset (&p, 0, sizeof (Pipe));
+    p.ctx = ctx;
+    p.fptr = fptr;
+    p.table = table;
+    p.nrows = nrows;
+    p.naxis1 = naxis1;
+    p.nelem = nelem;
+    p.nslices = nslices;
+
+    /*  Each slot holds a chunk of input and its formatted slices, sized
+     *  for the extra row the last chunk may hold.
+     */
+    memset (chunks, 0, sizeof (chunks));
+    for (i=0; i < NSLOTS; i++) {
+        if (table == NULL || ctx->nswaps > 0 || ctx->pred.nops > 0 ||
+            partitioned)
+                chunks[i].buf = (unsigned char *) calloc (nelem + 1, naxis1);
+        chunks[i].slices = dl_newSlices (ctx, nslices,
+            ((nelem + nslices) / nslices) * ctx->prog.rowmax);
+        dl_ringPut (&p.free, &chunks[i]);
+    }
+
+    dl_outFlush (ctx);
+    pthread_create (&rtid, NULL, dl_pipeReader, (void *) &p);
+    pthread_create (&wtid, NULL, dl_pipeWriter, (void *) &p);
+
+    while ((c = dl_ringGet (&p.full))->eof == 0) {
+        dl_formatSlices (ctx, c->slices, nslices, c->data, naxis1, c->nrows,
+            more);
+        dl_ringPut (&p.done, c);
+    }
+    dl_ringPut (&p.done, c);                    // pass the eof along
+
+    pthread_join (rtid, NULL);
+    pthread_join (wtid, NULL);
+
+    for (i=0; i < NSLOTS; i++) {
+        if (chunks[i].buf)
+            free ((void *) chunks[i].buf);
+        dl_freeSlices (chunks[i].slices, nslices);
+    }
+
+    return (p.status);
+}
+
+
+/***********************************************************/
+/***************** DIRECT SQLITE LOADING *******************/
+/***********************************************************/
+
+#ifdef HAVE_SQLITE
+
+/**
+ *  DL_SQLITEOPEN -- Open the database for a direct SQLite load.  A failed
+ *  load is simply redone, so the journal and syncs are turned off and the
+ *  page cache made large for speed.
+ */
+static int
+dl_sqliteOpen (char *dbfile)
+{
+    char  *errmsg = NULL;
+
+
+    if (sqlite3_open (dbfile, &sql_db) != SQLITE_OK) {
+        dl_error (3, "Error opening SQLite database", dbfile);
+        return (ERR);
+    }
+    if (sqlite3_exec (sql_db, SQLITE_PRAGMAS, NULL, NULL, &errmsg)) {
+        dl_error (3, "Error configuring SQLite database", errmsg);
+        sqlite3_free (errmsg);
+        return (ERR);
+    }
+    return (OK);
+}
+
+
+/**
+ *  DL_SQLITECLOSE -- Close the SQLite database.
+ */
+static void
+dl_sqliteClose (void)
+{
+    if (sql_db)
+        sqlite3_close (sql_db);
+    sql_db = (sqlite3 *) NULL;
+}
+
+
+/**
+ *  DL_SQLITESETUP -- Collect the table setup SQL (DROP, CREATE, etc) in
+ *  memory in place of the output file, to be run by dl_sqliteExec().
+ */
+static void
+dl_sqliteSetup (CtxPtr ctx)
+{
+    ctx->sqlbuf = NULL, ctx->sqllen = 0;
+    if ((ctx->ofd = open_memstream (&ctx->sqlbuf, &ctx->sqllen)) == NULL)
+        dl_error (3, "Error opening SQL buffer", NULL);
+}
+
+
+/**
+ *  DL_SQLITEEXEC -- Run the collected table setup SQL in the database.
+ */
+static int
+dl_sqliteExec (CtxPtr ctx)
+{
+    char  *errmsg = NULL;
+    int    stat = OK;
+
+
+    if (ctx->ofd)
+        fclose (ctx->ofd);
+    ctx->ofd = (FILE *) NULL;
+
+    if (ctx->sqllen > 0 &&
+        sqlite3_exec (sql_db, ctx->sqlbuf, NULL, NULL, &errmsg)) {
+            dl_error (3, "Error creating SQLite table", errmsg);
+            sqlite3_free (errmsg);
+            stat = ERR;
+    }
+    if (ctx->sqlbuf)
+        free ((void *) ctx->sqlbuf);
+    ctx->sqlbuf = NULL, ctx->sqllen = 0;
+
+    return (stat);
+}
+
+
+/**
+ *  DL_SQLITELOAD -- Load the table rows into the SQLite database.  Values
+ *  are bound straight from each chunk to a prepared INSERT, committing
+ *  every 'commit_rows' rows.  Returns the CFITSIO status, SQLite errors
+ *  are reported here and end the load.
+ */
+static int
+dl_sqliteLoad (CtxPtr ctx, fitsfile *fptr, unsigned char *table,
+                unsigned char *buf, long nrows, long naxis1, int nelem)
+{
+    sqlite3_stmt *stmt = (sqlite3_stmt *) NULL;
+    unsigned char *data = NULL, *dp = NULL;
+    char  *sql = NULL, *sp = NULL;
+    long   jj, n, nbytes = 0, firstchar = 1, nload = 0;
+    int    i, nsel, status = 0, err = 0;
+
+
+    /*  Prepare the INSERT with one parameter per output column.
+     */
+    sql = (char *) calloc (1, 160 + strlen (tablename) +
+        ctx->numOutCols * (SZ_COLNAME + 3));
+    sp = sql + sprintf (sql, "INSERT INTO %s (", tablename);
+    for (i=1; i <= ctx->numOutCols; i++)
+        sp += sprintf (sp, "%s%s", (i > 1 ? "," : ""),
+            ctx->outColumns[i].colname);
+    sp += sprintf (sp, ") VALUES (");
+    for (i=1; i <= ctx->numOutCols; i++)
+        sp += sprintf (sp, "%s?", (i > 1 ? "," : ""));
+    strcpy (sp, ")");
+
+    if (sqlite3_prepare_v2 (sql_db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        dl_error (3, "Error preparing SQLite insert", 
+            (char *) sqlite3_errmsg (sql_db));
+        free ((void *) sql);
+        return (status);
+    }
+    sqlite3_exec (sql_db, "BEGIN", NULL, NULL, NULL);
+
+    for (jj=1; (n = dl_nextChunk (ctx, &jj, nelem, nrows)) && !err; jj += n) {
+        firstchar = (jj - 1) * naxis1 + 1;
+        nbytes = n * naxis1;
+        if (table) {
+            data = table + (firstchar - 1);
+            if ((jj + n) <= nrows)
+                dl_willNeed (ctx, data + nbytes, nbytes);
+        } else {
+            dl_readTable (ctx, fptr, 1, firstchar, nbytes, buf, &status);
+            if (status) {                       /* print any error message */
+                fits_report_error (stderr, status);
+                break;
+            }
+            data = buf;
+        }
+        nsel = dl_prepChunk (ctx, buf, &data, n, naxis1);
+
+        for (i=0, dp=data; i < nsel; i++, dp += naxis1) {
+            dl_sqliteRow (ctx, stmt, &ctx->prog, dp);
+            if (sqlite3_step (stmt) != SQLITE_DONE) {
+                dl_error (3, "Error loading SQLite row",
+                    (char *) sqlite3_errmsg (sql_db));
+                err++;
+                break;
+            }
+            sqlite3_reset (stmt);
+
+            if (++nload % commit_rows == 0)
+                sqlite3_exec (sql_db, "COMMIT; BEGIN", NULL, NULL, NULL);
+        }
+    }
+    sqlite3_exec (sql_db, "COMMIT", NULL, NULL, NULL);
+
+    sqlite3_finalize (stmt);
+    free ((void *) sql);
+
+    return (status);
+}
+
+
+/**
+ *  DL_SQLITEROW -- Bind the values of one row to the INSERT parameters.
+ *  Strings are bound in place, unexploded arrays as the same '{...}' text
+ *  the SQL output would hold.
+ */
+static void
+dl_sqliteRow (CtxPtr ctx, sqlite3_stmt *stmt, ProgPtr prog, unsigned char *dp)
+{
+    OpPtr  op = prog->ops;
+    ColPtr col = (ColPtr) NULL;
+    unsigned char *vp = NULL;
+    char  *start = NULL;
+    int    i, k, len, idx = 1, size = 0;
+
+
+    ctx->optr = ctx->obuf, ctx->olen = 0;
+    for (i=0; i < prog->nops; i++, op++) {
+        if ((col = op->col) == NULL) {          // added columns
+            if (op->emit == dl_opSerial)
+                sqlite3_bind_int (stmt, idx++, ctx->serial_number++);
+            else if (op->emit == dl_opRandom)
+                sqlite3_bind_double (stmt, idx++,
+                    (((float)rand()/(float)(RAND_MAX)) * RANDOM_SCALE));
+            else
+                sqlite3_bind_int (stmt, idx++, 1);
+            continue;
+        }
+
+        vp = dp + op->offset;
+        if (col->type == TSTRING) {
+            len = strnlen ((char *) vp, col->repeat);
+            if (do_strip) {
+                while (len > 0 && isspace (*vp))
+                    vp++, len--;
+                while (len > 0 && isspace (vp[len-1]))
+                    len--;
+            }
+            sqlite3_bind_text (stmt, idx++, (char *) vp, len, SQLITE_STATIC);
+
+        } else if (col->repeat > 1 && !explode && op->emit != dl_opBad) {
+            start = ctx->optr;
+            *ctx->optr++ = '{', ctx->olen++;
+            (*op->emit) (ctx, vp, col);
+            *ctx->optr++ = '}', ctx->olen++;
+            sqlite3_bind_text (stmt, idx++, start, (int)(ctx->optr - start),
+                SQLITE_STATIC);
+
+        } else if (op->emit == dl_opBad) {
+            for (k=0; k < (explode ? col->repeat : 1); k++)
+                sqlite3_bind_null (stmt, idx++);
+
+        } else {
+            dl_colBytes (col, &size);
+            for (k=0; k < col->repeat; k++, vp += (size ? size : 1))
+                dl_sqliteValue (stmt, idx++, col, vp);
+        }
+    }
+}
+
+
+/**
+ *  DL_SQLITEVALUE -- Bind one numeric or logical value.  Values are
+ *  converted as the text output prints them.
+ */
+static void
+dl_sqliteValue (sqlite3_stmt *stmt, int idx, ColPtr col, unsigned char *vp)
+{
+    short  sval = 0;
+    unsigned short usval = 0;
+    int    ival = 0;
+    long long lval = 0;
+    float  rval = 0.0;
+    double dval = 0.0;
+
+
+    switch (col->type) {
+    case TLOGICAL:
+        sqlite3_bind_int (stmt, idx, (tolower ((int) *vp) == 't' ? 1 : 0));
+        break;
+    case TBYTE:
+        sqlite3_bind_int (stmt, idx, (unsigned char) *vp);
+        break;
+    case TSBYTE:
+        sqlite3_bind_int (stmt, idx, (signed char) *vp);
+        break;
+    case TSHORT:
+        memcpy (&sval, vp, sz_short);
+        sqlite3_bind_int (stmt, idx, sval);
+        break;
+    case TUSHORT:
+        memcpy (&usval, vp, sz_short);
+        sqlite3_bind_int (stmt, idx, usval);
+        break;
+    case TINT:
+    case TUINT:
+    case TINT32BIT:
+        memcpy (&ival, vp, sz_int);
+        sqlite3_bind_int (stmt, idx, ival);
+        break;
+    case TLONGLONG:
+        memcpy (&lval, vp, sz_longlong);
+        sqlite3_bind_int64 (stmt, idx, lval);
+        break;
+    case TFLOAT:
+        memcpy (&rval, vp, sz_float);
+        sqlite3_bind_double (stmt, idx, rval);
+        break;
+    case TDOUBLE:
+        memcpy (&dval, vp, sz_double);
+        sqlite3_bind_double (stmt, idx, dval);
+        break;
+    default:
+        sqlite3_bind_null (stmt, idx);
+        break;
+    }
+}
+
+#else
+
+/*  Without SQLite the direct load is only refused when the database is
+ *  opened, the other methods are never reached.
+ */
+static int
+dl_sqliteOpen (char *dbfile)
+{
+    dl_error (3, "fits2db was built without SQLite support", dbfile);
+    return (ERR);
+}
+
+static void dl_sqliteClose (void) { }
+static void dl_sqliteSetup (CtxPtr ctx) { }
+static int  dl_sqliteExec (CtxPtr ctx) { return (ERR); }
+static int  dl_sqliteLoad (CtxPtr ctx, fitsfile *fptr, unsigned char *table,
+                unsigned char *buf, long nrows, long naxis1, int nelem)
+{
+    return (0);
+}
+
+#endif
+
+
+/***********************************************************/
+/***************** DIRECT POSTGRES LOADING *****************/
+/***********************************************************/
+
+#ifdef HAVE_LIBPQ
+
+/**
+ *  DL_PGOPEN -- Connect to the Postgres server for a direct load.
+ */
+static int
+dl_pgOpen (char *conninfo)
+{
+    pg_conn = PQconnectdb (conninfo);
+    if (PQstatus (pg_conn) != CONNECTION_OK) {
+        dl_pgError ("Error connecting to Postgres", PQerrorMessage (pg_conn));
+        PQfinish (pg_conn);
+        pg_conn = (PGconn *) NULL;
+        return (ERR);
+    }
+    return (OK);
+}
+
+
+/**
+ *  DL_PGCLOSE -- Finish any COPY or SQL still pending and disconnect.
+ */
+static void
+dl_pgClose (void)
+{
+    if (pg_conn == NULL)
+        return;
+
+    if (pg_copy)
+        dl_pgEnd ();
+    if (pg_nsql > 0)
+        dl_pgExec ();
+    PQfinish (pg_conn);
+    pg_conn = (PGconn *) NULL;
+
+    if (pg_sql)
+        free ((void *) pg_sql);
+    pg_sql = NULL, pg_nsql = pg_szsql = 0;
+}
+
+
+/**
+ *  DL_PGWRITE -- Send output to the server.  Outside a COPY the SQL text
+ *  is collected until dl_pgExec() runs it, during a COPY the data is sent
+ *  as it comes.  The data of a COPY that failed is dropped.
+ */
+static void
+dl_pgWrite (char *buf, long len)
+{
+    if (pg_copy) {
+        if (pg_copy > 0 && PQputCopyData (pg_conn, buf, (int) len) != 1) {
+            dl_pgError ("Error sending COPY data", PQerrorMessage (pg_conn));
+            dl_pgEnd ();
+            pg_copy = -1;
+        }
+        return;
+    }
+
+    if (pg_nsql + len + 1 > pg_szsql) {
+        pg_szsql = 2 * (pg_nsql + len + 1) + SZ_LINEBUF;
+        pg_sql = (char *) realloc (pg_sql, pg_szsql);
+    }
+    memcpy (pg_sql + pg_nsql, buf, len);
+    pg_nsql += len;
+    pg_sql[pg_nsql] = '\0';
+}
+
+
+/**
+ *  DL_PGEXEC -- Run the collected SQL.  When it ends in a COPY statement
+ *  the server is left waiting for the COPY data.
+ */
+static void
+dl_pgExec (void)
+{
+    PGresult *res = (PGresult *) NULL;
+
+
+    if ((res = PQexec (pg_conn, pg_sql)) == NULL) {
+        dl_pgError ("Error running SQL", PQerrorMessage (pg_conn));
+        pg_copy = -1;
+    } else {
+        switch (PQresultStatus (res)) {
+        case PGRES_COPY_IN:
+            pg_copy = 1;
+            break;
+        case PGRES_COMMAND_OK:
+        case PGRES_TUPLES_OK:
+        case PGRES_EMPTY_QUERY:
+            break;
+        default:
+            dl_pgError ("Error running SQL", PQresultErrorMessage (res));
+            pg_copy = -1;                       // drop any COPY data
+            break;
+        }
+        PQclear (res);
+    }
+    pg_nsql = 0, pg_sql[0] = '\0';
+}
+
+
+/**
+ *  DL_PGEND -- End the COPY and report the rows loaded as psql would.
+ */
+static void
+dl_pgEnd (void)
+{
+    PGresult *res = (PGresult *) NULL;
+
+
+    if (pg_copy > 0) {
+        pg_copy = 0;
+        PQputCopyEnd (pg_conn, NULL);
+        while ((res = PQgetResult (pg_conn)) != NULL) {
+            if (PQresultStatus (res) == PGRES_COMMAND_OK)
+                printf ("COPY %s\n", PQcmdTuples (res));
+            else
+                dl_pgError ("COPY failed", PQresultErrorMessage (res));
+            PQclear (res);
+        }
+        fflush (stdout);
+    }
+    pg_copy = 0;
+}
+
+
+/**
+ *  DL_PGERROR -- Report a server error, less its trailing newline.
+ */
+static void
+dl_pgError (char *msg, char *pgmsg)
+{
+    char  buf[SZ_LINEBUF];
+    int   len = 0;
+
+
+    memset (buf, 0, SZ_LINEBUF);
+    strncpy (buf, pgmsg, SZ_LINEBUF - 1);
+    for (len = strlen (buf); len > 0 && isspace (buf[len-1]); )
+        buf[--len] = '\0';
+    dl_error (3, msg, buf);
+}
+
+#else
+
+/*  Without libpq the direct load is only refused when connecting, the
+ *  other methods are never reached.
+ */
+static int
+dl_pgOpen (char *conninfo)
+{
+    dl_error (3, "fits2db was built without Postgres support", NULL);
+    return (ERR);
+}
+
+static void dl_pgClose (void) { }
+static void dl_pgWrite (char *buf, long len) { }
+static void dl_pgExec (void) { }
+static void dl_pgEnd (void) { }
+
+#endif
+
+
+/***********************************************************/
+/******************* OUTPUT COMPRESSION ********************/
+/***********************************************************/
+
+/**
+ *  DL_ZOPEN -- Start compressing an output file.  Every output path writes
+ *  to the file through stdio or its descriptor, so the output is redirected
+ *  to a pipe instead.  A reader thread cuts the stream into blocks which
+ *  the workers compress independently (gzip members or zstd frames), and
+ *  writes them to the file in order.  Returns the pipe to write to.
+ */
+static FILE *
+dl_zOpen (FILE *fd)
+{
+    int  i, p[2];
+
+
+    fflush (fd);
+    if (pipe (p) < 0)
+        dl_error (3, "Error creating compression pipe", NULL);
+
+    zout.fd = fd;
+    zout.rfd = p[0];
+    zout.pfd = fdopen (p[1], "w");
+    zout.nworkers = nthreads;
+    zout.nslots = 2 * nthreads + 2;
+    zout.nread = zout.ncomp = zout.nwritten = 0;
+    zout.eof = 0;
+    pthread_mutex_init (&zout.mutex, NULL);
+    pthread_cond_init (&zout.cond, NULL);
+
+    for (i=0; i < zout.nworkers; i++)
+        pthread_create (&zout.tid[i], NULL, dl_zWorker, NULL);
+    pthread_create (&zout.reader, NULL, dl_zReader, NULL);
+
+    return (zout.pfd);
+}
+
+
+/**
+ *  DL_ZCLOSE -- Finish a compressed output file.  Returns the file, for
+ *  the caller to close.
+ */
+static FILE *
+dl_zClose (void)
+{
+    int  i;
+
+
+    fclose (zout.pfd);                          // the reader sees EOF
+    pthread_join (zout.reader, NULL);
+    for (i=0; i < zout.nworkers; i++)
+        pthread_join (zout.tid[i], NULL);
+    close (zout.rfd);
+
+    pthread_mutex_destroy (&zout.mutex);
+    pthread_cond_destroy (&zout.cond);
+
+    return (zout.fd);
+}
+
+
+/**
+ *  DL_ZREADER -- Read the output stream into blocks for the workers and
+ *  write the compressed blocks in order.  At most 'nslots' blocks are in
+ *  flight.
+ */
+static void *
+dl_zReader (void *arg)
+{
+    ZblockPtr b = (ZblockPtr) NULL;
+    long   n = 0, nb = 0;
+
+
+    while (1) {
+        pthread_mutex_lock (&zout.mutex);
+        while (zout.nread - zout.nwritten >= zout.nslots)
+            if (!dl_zWrite ())
+                pthread_cond_wait (&zout.cond, &zout.mutex);
+        pthread_mutex_unlock (&zout.mutex);
+
+        b = &zout.blocks[zout.nread % zout.nslots];
+        if (b->in == NULL)
+            b->in = (unsigned char *) malloc (SZ_ZBLOCK);
+        for (nb=0; nb < SZ_ZBLOCK; nb += n)
+            if ((n = read (zout.rfd, b->in + nb, SZ_ZBLOCK - nb)) <= 0)
+                break;
+
+        pthread_mutex_lock (&zout.mutex);
+        if (nb > 0) {
+            b->inlen = nb;
+            b->done = 0;
+            zout.nread++;
+        }
+        if (nb < SZ_ZBLOCK)
+            zout.eof = 1;
+        pthread_cond_broadcast (&zout.cond);
+        while (dl_zWrite ())
+            ;
+        pthread_mutex_unlock (&zout.mutex);
+
+        if (nb < SZ_ZBLOCK)
+            break;
+    }
+
+    pthread_mutex_lock (&zout.mutex);
+    while (zout.nwritten < zout.nread)
+        if (!dl_zWrite ())
+            pthread_cond_wait (&zout.cond, &zout.mutex);
+    pthread_mutex_unlock (&zout.mutex);
+
+    return (NULL);
+}
+
+
+/**
+ *  DL_ZWORKER -- Compress blocks until the stream ends.
+ */
+static void *
+dl_zWorker (void *arg)
+{
+    ZblockPtr b = (ZblockPtr) NULL;
+
+
+    pthread_mutex_lock (&zout.mutex);
+    while (1) {
+        while (zout.ncomp == zout.nread && !zout.eof)
+            pthread_cond_wait (&zout.cond, &zout.mutex);
+        if (zout.ncomp == zout.nread)
+            break;
+
+        b = &zout.blocks[zout.ncomp++ % zout.nslots];
+        pthread_mutex_unlock (&zout.mutex);
+
+        dl_zCompress (b);
+
+        pthread_mutex_lock (&zout.mutex);
+        b->done = 1;
+        pthread_cond_broadcast (&zout.cond);
+    }
+    pthread_mutex_unlock (&zout.mutex);
+
+    return (NULL);
+}
+
+
+/**
+ *  DL_ZWRITE -- Write the next block if it has been compressed.  Called
+ *  with the mutex held, returns 1 if a block was written.
+ */
+static int
+dl_zWrite (void)
+{
+    ZblockPtr b = (ZblockPtr) NULL;
+
+
+    if (zout.nwritten == zout.nread)
+        return (0);
+    b = &zout.blocks[zout.nwritten % zout.nslots];
+    if (!b->done)
+        return (0);
+
+    pthread_mutex_unlock (&zout.mutex);
+    if (b->outlen > 0)
+        dl_writeBuf (fileno (zout.fd), b->out, b->outlen);
+    pthread_mutex_lock (&zout.mutex);
+
+    zout.nwritten++;
+    pthread_cond_broadcast (&zout.cond);
+    return (1);
+}
+
+
+/**
+ *  DL_ZCOMPRESS -- Compress a block as a complete gzip member or zstd
+ *  frame.  Concatenated, these decompress to the whole stream.
+ */
+static void
+dl_zCompress (ZblockPtr b)
+{
+    long  need = 0;
+
+
+    if (zcompress == CMP_GZIP) {
+        z_stream zs;
+
+        memset (&zs, 0, sizeof (zs));
+        b->outlen = 0;
+        if (deflateInit2 (&zs, (zlevel >= 0 ? zlevel : Z_DEFAULT_COMPRESSION),
+            Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {  // gzip
+                dl_error (3, "Error compressing output", zs.msg);
+                atomic_store (&failed, 1);
+                return;
+        }
+        need = deflateBound (&zs, b->inlen);
+        if (need > b->outsize)
+            b->out = (unsigned char *) realloc (b->out, (b->outsize = need));
+
+        zs.next_in = b->in;
+        zs.avail_in = b->inlen;
+        zs.next_out = b->out;
+        zs.avail_out = need;
+        if (deflate (&zs, Z_FINISH) == Z_STREAM_END)
+            b->outlen = zs.total_out;
+        else {
+            dl_error (3, "Error compressing output", zs.msg);
+            atomic_store (&failed, 1);
+        }
+        deflateEnd (&zs);
+    }
+#ifdef HAVE_ZSTD
+    else if (zcompress == CMP_ZSTD) {
+        need = ZSTD_compressBound (b->inlen);
+        if (need > b->outsize)
+            b->out = (unsigned char *) realloc (b->out, (b->outsize = need));
+
+        b->outlen = ZSTD_compress (b->out, need, b->in, b->inlen,
+            (zlevel >= 0 ? zlevel : 0));        // 0 is the default level
+        if (ZSTD_isError (b->outlen)) {
+            dl_error (3, "Error compressing output",
+                (char *) ZSTD_getErrorName (b->outlen));
+            atomic_store (&failed, 1);
+            b->outlen = 0;
+        }
+    }
+#endif
+}
+
+
+/**
+ *  DL_ZFREE -- Free the compression buffers.
+ */
+static void
+dl_zFree (void)
+{
+    int  i;
+
+
+    for (i=0; i < 2 * MAX_THREADS + 2; i++) {
+        if (zout.blocks[i].in) free ((void *) zout.blocks[i].in);
+        if (zout.blocks[i].out) free ((void *) zout.blocks[i].out);
+    }
+    memset (&zout, 0, sizeof (Zout));
+}
+
+
+/***********************************************************/
+/********************** ROW SELECTION **********************/
+/***********************************************************/
+
+/**
+ *  DL_PREDPARSE -- Parse a --select expression into a postfix program.
+ *  The syntax is the common core of the CFITSIO row filter:  column names
+ *  (with an optional [N] element), numbers, quoted strings, T and F, the
+ *  arithmetic, comparison and logical operators in C or Fortran (.eq.)
+ *  form, and parens.  Returns ERR for anything else, so the expression
+ *  can be left to CFITSIO.
+ */
+static int
+dl_predParse (char *expr, PredPtr pred)
+{
+    char  *ip = expr;
+
+
+    memset (pred, 0, sizeof (Pred));
+    if (dl_predOr (&ip, pred) != OK)
+        return (ERR);
+    while (isspace ((unsigned char) *ip))
+        ip++;
+
+    return (*ip ? ERR : OK);
+}
+
+
+/**
+ *  DL_PREDOR -- Parse a list of terms joined by '||'.
+ */
+static int
+dl_predOr (char **ip, PredPtr pred)
+{
+    if (dl_predAnd (ip, pred) != OK)
+        return (ERR);
+    while (dl_predMatch (ip, "||") || dl_predMatch (ip, ".or.")) {
+        if (dl_predAnd (ip, pred) != OK || !dl_predEmit (pred, P_OR))
+            return (ERR);
+    }
+    return (OK);
+}
+
+
+/**
+ *  DL_PREDAND -- Parse a list of comparisons joined by '&&'.
+ */
+static int
+dl_predAnd (char **ip, PredPtr pred)
+{
+    if (dl_predCmp (ip, pred) != OK)
+        return (ERR);
+    while (dl_predMatch (ip, "&&") || dl_predMatch (ip, ".and.")) {
+        if (dl_predCmp (ip, pred) != OK || !dl_predEmit (pred, P_AND))
+            return (ERR);
+    }
+    return (OK);
+}
+
+
+/**
+ *  DL_PREDCMP -- Parse a sum, or a comparison of two sums.
+ */
+static int
+dl_predCmp (char **ip, PredPtr pred)
+{
+    static char *opers[] = { "==", "!=", "<=", ">=", "<", ">", "=",
+                             ".eq.", ".ne.", ".le.", ".ge.", ".lt.", ".gt.",
+                             NULL };
+    static int   codes[] = { P_EQ, P_NE, P_LE, P_GE, P_LT, P_GT, P_EQ,
+                             P_EQ, P_NE, P_LE, P_GE, P_LT, P_GT };
+    int   i;
+
+
+    if (dl_predSum (ip, pred) != OK)
+        return (ERR);
+    for (i=0; opers[i]; i++) {
+        if (dl_predMatch (ip, opers[i])) {
+            if (dl_predSum (ip, pred) != OK || !dl_predEmit (pred, codes[i]))
+                return (ERR);
+            break;
+        }
+    }
+    return (OK);
+}
+
+
+/**
+ *  DL_PREDSUM -- Parse a list of products joined by '+' or '-'.
+ */
+static int
+dl_predSum (char **ip, PredPtr pred)
+{
+    int   op;
+
+
+    if (dl_predTerm (ip, pred) != OK)
+        return (ERR);
+    while (1) {
+        if (dl_predMatch (ip, "+"))
+            op = P_ADD;
+        else if (dl_predMatch (ip, "-"))
+            op = P_SUB;
+        else
+            break;
+        if (dl_predTerm (ip, pred) != OK || !dl_predEmit (pred, op))
+            return (ERR);
+    }
+    return (OK);
+}
+
+
+/**
+ *  DL_PREDTERM -- Parse a list of factors joined by '*', '/' or '%'.
+ */
+static int
+dl_predTerm (char **ip, PredPtr pred)
+{
+    int   op;
+
+
+    if (dl_predUnary (ip, pred) != OK)
+        return (ERR);
+    while (1) {
+        if (dl_predMatch (ip, "*"))
+            op = P_MUL;
+        else if (dl_predMatch (ip, "/"))
+            op = P_DIV;
+        else if (dl_predMatch (ip, "%"))
+            op = P_MOD;
+        else
+            break;
+        if (dl_predUnary (ip, pred) != OK || !dl_predEmit (pred, op))
+            return (ERR);
+    }
+    return (OK);
+}
+
+
+/**
+ *  DL_PREDUNARY -- Parse a factor with any leading '-', '+' or '!'.  A
+ *  negated number is folded into the constant.
+ */
+static int
+dl_predUnary (char **ip, PredPtr pred)
+{
+    PredOpPtr op = (PredOpPtr) NULL;
+
+
+    if (dl_predMatch (ip, "-")) {
+        if (dl_predUnary (ip, pred) != OK)
+            return (ERR);
+        op = &pred->ops[pred->nops - 1];
+        if (op->op == P_INT || op->op == P_DBL) {
+            op->ival = -op->ival;
+            op->dval = -op->dval;
+            return (OK);
+        }
+        return (dl_predEmit (pred, P_NEG) ? OK : ERR);
+
+    } else if (dl_predMatch (ip, "+")) {
+        return (dl_predUnary (ip, pred));
+
+    } else if (**ip == '!' && (*ip)[1] == '=') {
+        return (ERR);
+
+    } else if (dl_predMatch (ip, "!") || dl_predMatch (ip, ".not.")) {
+        if (dl_predUnary (ip, pred) != OK)
+            return (ERR);
+        return (dl_predEmit (pred, P_NOT) ? OK : ERR);
+    }
+
+    return (dl_predPrimary (ip, pred));
+}
+
+
+/**
+ *  DL_PREDPRIMARY -- Parse a parenthesized expression, a constant or a
+ *  column name.  Names may be delimited by '$' to hold other characters.
+ */
+static int
+dl_predPrimary (char **ip, PredPtr pred)
+{
+    PredOpPtr op = (PredOpPtr) NULL;
+    char  *cp = NULL, *ep = NULL, quote;
+    int    n = 0;
+
+
+    if (dl_predMatch (ip, "(")) {
+        if (dl_predOr (ip, pred) != OK || !dl_predMatch (ip, ")"))
+            return (ERR);
+        return (OK);
+    }
+
+    cp = *ip;
+    if (isdigit ((unsigned char) *cp) ||
+        (*cp == '.' && isdigit ((unsigned char) cp[1]))) {
+            if ((op = dl_predEmit (pred, P_INT)) == NULL)
+                return (ERR);
+            op->dval = strtod (cp, &ep);
+            for (n=0; &cp[n] < ep; n++)
+                if (cp[n] == '.' || cp[n] == 'e' || cp[n] == 'E')
+                    op->op = P_DBL;
+            if (op->op == P_INT)
+                op->ival = strtoll (cp, &ep, 10);
+            *ip = ep;
+
+    } else if (*cp == '"' || *cp == '\'') {
+        quote = *cp++;
+        if ((ep = strchr (cp, quote)) == NULL || (ep - cp) >= SZ_COLNAME)
+            return (ERR);
+        if ((op = dl_predEmit (pred, P_STR)) == NULL)
+            return (ERR);
+        strncpy (op->name, cp, (ep - cp));
+        *ip = ep + 1;
+
+    } else if (*cp == '$') {
+        cp++;
+        if ((ep = strchr (cp, '$')) == NULL || ep == cp ||
+            (ep - cp) >= SZ_COLNAME)
+                return (ERR);
+        if ((op = dl_predEmit (pred, P_COL)) == NULL)
+            return (ERR);
+        strncpy (op->name, cp, (ep - cp));
+        *ip = ep + 1;
+
+    } else if (isalpha ((unsigned char) *cp) || *cp == '_') {
+        for (ep=cp; isalnum ((unsigned char) *ep) || *ep == '_'; ep++)
+            ;
+        if ((ep - cp) >= SZ_COLNAME || (op = dl_predEmit (pred, P_COL)) == NULL)
+            return (ERR);
+        strncpy (op->name, cp, (ep - cp));
+        *ip = ep;
+
+    } else
+        return (ERR);
+
+    /*  An array column may be followed by the element wanted.
+     */
+    if (op->op == P_COL && **ip == '[') {
+        op->elem = (int) strtol (*ip + 1, &ep, 10);
+        if (ep == *ip + 1 || *ep != ']' || op->elem < 1)
+            return (ERR);
+        *ip = ep + 1;
+    }
+    return (OK);
+}
+
+
+/**
+ *  DL_PREDMATCH -- Skip whitespace and match an operator, ignoring case,
+ *  advancing the input if it is found.
+ */
+static int
+dl_predMatch (char **ip, char *oper)
+{
+    int   len = strlen (oper);
+
+
+    while (isspace ((unsigned char) **ip))
+        (*ip)++;
+    if (strncasecmp (*ip, oper, len) != 0)
+        return (0);
+
+    /*  Don't take the start of a longer operator.
+     */
+    if (len == 1 && strchr ("<>=!", *oper) && (*ip)[1] == '=')
+        return (0);
+    if (len == 1 && (*oper == '|' || *oper == '&') && (*ip)[1] == *oper)
+        return (0);
+
+    *ip += len;
+    return (1);
+}
+
+
+/**
+ *  DL_PREDEMIT -- Add an op to the program.
+ */
+static PredOpPtr
+dl_predEmit (PredPtr pred, int code)
+{
+    PredOpPtr op = (PredOpPtr) NULL;
+
+
+    if (pred->nops >= MAX_PREDOPS)
+        return ((PredOpPtr) NULL);
+    op = &pred->ops[pred->nops++];
+    memset (op, 0, sizeof (PredOp));
+    op->op = code;
+
+    return (op);
+}
+
+
+/**
+ *  DL_PREDBIND -- Bind the selection program to the columns of a table:
+ *  find the offset and type of each column used, and work out the type of
+ *  each value.  Returns ERR if a column is missing or can't be compared.
+ */
+static int
+dl_predBind (CtxPtr ctx, ColPtr cols, int ncols)
+{
+    register int i, j;
+    PredPtr   pred = &ctx->pred;
+    PredOpPtr op = (PredOpPtr) NULL;
+    ColPtr    col = (ColPtr) NULL;
+    int       ts[MAX_PREDSTACK], sp = 0, size = 0, a, b;
+
+
+    memcpy (pred, &select_pred, sizeof (Pred));
+    if (pred->nops == 0)
+        return (OK);
+    if (ctx->pstack == NULL)
+        ctx->pstack = (PValPtr) calloc (MAX_PREDSTACK * SZ_PREDBATCH,
+            sizeof (PVal));
+
+    for (i=0, op=pred->ops; i < pred->nops; i++, op++) {
+        switch (op->op) {
+        case P_COL:
+            for (j=1, col=NULL; j <= ncols; j++)
+                if (strcasecmp (cols[j].colname, op->name) == 0) {
+                    col = &cols[j];
+                    break;
+                }
+
+            /*  T and F are the logical constants, unless they are columns.
+             */
+            if (col == NULL && op->elem == 0 && (strcasecmp (op->name,
+                "T") == 0 || strcasecmp (op->name, "F") == 0)) {
+                    op->op = P_BOOL;
+                    op->ival = (toupper (op->name[0]) == 'T');
+                    op->type = PV_BOOL;
+                    break;
+            }
+            if (col == NULL) {
+                dl_error (3, "No such column in selection", op->name);
+                return (ERR);
+            }
+
+            op->ctype = col->type;
+            op->offset = col->offset;
+            op->width = dl_colBytes (col, &size) / col->repeat;
+            if (col->type == TSTRING) {
+                op->width = col->repeat;
+                op->type = PV_STR;
+            } else if (op->elem > col->repeat ||
+                (op->elem == 0 && col->repeat > 1)) {
+                    dl_error (3, "Bad array element in selection", op->name);
+                    return (ERR);
+            } else if (op->elem > 1)
+                op->offset += (op->elem - 1) * op->width;
+
+            switch (col->type) {
+            case TSTRING:                           break;
+            case TLOGICAL:      op->type = PV_BOOL; break;
+            case TBYTE:
+            case TSBYTE:
+            case TSHORT:
+            case TUSHORT:
+            case TINT:
+            case TUINT:
+            case TLONG:
+            case TULONG:
+            case TLONGLONG:
+            case TULONGLONG:    op->type = PV_INT;  break;
+            case TFLOAT:
+            case TDOUBLE:       op->type = PV_DBL;  break;
+            default:
+                dl_error (3, "Unsupported column type in selection",
+                    op->name);
+                return (ERR);
+            }
+            break;
+
+        case P_INT:     op->type = PV_INT;      break;
+        case P_DBL:     op->type = PV_DBL;      break;
+        case P_STR:     op->type = PV_STR;      break;
+
+        case P_NEG:
+            op->type = ts[sp-1];
+            if (op->type != PV_INT && op->type != PV_DBL)
+                goto mismatch;
+            sp--;
+            break;
+        case P_NOT:
+            op->type = PV_BOOL;
+            if (ts[sp-1] != PV_BOOL)
+                goto mismatch;
+            sp--;
+            break;
+
+        default:                                    // binary operators
+            a = ts[sp-2], b = ts[sp-1];
+            sp -= 2;
+            if (op->op == P_AND || op->op == P_OR) {
+                if (a != PV_BOOL || b != PV_BOOL)
+                    goto mismatch;
+                op->mode = op->type = PV_BOOL;
+
+            } else if (op->op >= P_EQ) {
+                if ((a == PV_INT || a == PV_DBL) &&
+                    (b == PV_INT || b == PV_DBL))
+                        op->mode = (a == PV_DBL || b == PV_DBL ? PV_DBL : PV_INT);
+                else if (a == b && (a == PV_STR ||
+                    (a == PV_BOOL && op->op <= P_NE)))
+                        op->mode = a;
+                else
+                    goto mismatch;
+                op->type = PV_BOOL;
+
+            } else {
+                if ((a != PV_INT && a != PV_DBL) ||
+                    (b != PV_INT && b != PV_DBL))
+                        goto mismatch;
+                op->mode = (a == PV_DBL || b == PV_DBL || op->op == P_DIV ?
+                    PV_DBL : PV_INT);
+                if (op->op == P_MOD && op->mode != PV_INT)
+                    goto mismatch;
+                op->type = op->mode;
+            }
+        }
+
+        if (sp >= MAX_PREDSTACK) {
+            dl_error (3, "Selection expression too complex", expr);
+            return (ERR);
+        }
+        ts[sp++] = op->type;
+    }
+
+    if (ts[0] != PV_BOOL) {
+        dl_error (3, "Selection is not a logical expression", expr);
+        return (ERR);
+    }
+    return (OK);
+
+mismatch:
+    dl_error (3, "Mismatched types in selection", expr);
+    return (ERR);
+}
+
+
+/**
+ *  DL_PREDROWS -- Keep the rows of a chunk the selection picks, copying
+ *  them from 'in' to the start of 'out' (which may be the same buffer).
+ *  The rows are tested a batch at a time.  Returns the number of rows
+ *  kept.
+ */
+static int
+dl_predRows (CtxPtr ctx, unsigned char *out, unsigned char *in, int nrows,
+                long naxis1)
+{
+    register int i, r, n;
+    unsigned char *src = NULL, *dst = out;
+    PValPtr  v = (PValPtr) NULL;
+
+
+    for (r=0; r < nrows; r += SZ_PREDBATCH) {
+        n = (nrows - r < SZ_PREDBATCH ? nrows - r : SZ_PREDBATCH);
+        v = dl_predEval (ctx, in + r * naxis1, n, naxis1);
+
+        for (i=0; i < n; i++) {
+            if (!v[i].i)
+                continue;
+            src = in + (r + i) * naxis1;
+            if (dst != src)
+                dl_copyRow (ctx, dst, src, naxis1);
+            dst += naxis1;
+        }
+    }
+
+    return ((int) ((dst - out) / naxis1));
+}
+
+
+/**
+ *  DL_COPYROW -- Copy a row that is kept to its place in the chunk, just
+ *  the spans of it that are used when the columns are projected.
+ */
+static void
+dl_copyRow (CtxPtr ctx, unsigned char *dst, unsigned char *src, long naxis1)
+{
+    register int j;
+    SpanPtr  sp = (SpanPtr) NULL;
+
+
+    if (ctx->nspans > 0) {
+        for (j=0, sp=ctx->spans; j < ctx->nspans; j++, sp++)
+            memcpy (dst + sp->offset, src + sp->offset, sp->len);
+    } else
+        memcpy (dst, src, naxis1);
+}
+
+
+/**
+ *  DL_PREDEVAL -- Run the selection program over a batch of 'n' rows.
+ *  Each op works on a whole vector of values, so the loops are short and
+ *  branch-free and the compiler may vectorize them.  Returns the logical
+ *  result vector.
+ */
+static PValPtr
+dl_predEval (CtxPtr ctx, unsigned char *dp, int n, long naxis1)
+{
+    register int i, k;
+    PredPtr   pred = &ctx->pred;
+    PredOpPtr op = (PredOpPtr) NULL;
+    PValPtr   a = (PValPtr) NULL, b = (PValPtr) NULL;
+    int       ts[MAX_PREDSTACK], sw[MAX_PREDSTACK], sp = 0;
+
+
+    for (k=0, op=pred->ops; k < pred->nops; k++, op++) {
+        switch (op->op) {
+        case P_NEG:                                 // unary operators
+            a = ctx->pstack + (sp - 1) * SZ_PREDBATCH;
+            if (op->type == PV_INT)
+                for (i=0; i < n; i++)  a[i].i = -a[i].i;
+            else
+                for (i=0; i < n; i++)  a[i].d = -a[i].d;
+            break;
+        case P_NOT:
+            a = ctx->pstack + (sp - 1) * SZ_PREDBATCH;
+            for (i=0; i < n; i++)  a[i].i = !a[i].i;
+            break;
+
+        case P_COL:                                 // values
+        case P_INT:
+        case P_BOOL:
+        case P_DBL:
+        case P_STR:
+            b = ctx->pstack + sp * SZ_PREDBATCH;
+            if (op->op == P_COL) {
+                dl_predLoad (op, b, dp, n, naxis1);
+            } else if (op->op == P_DBL) {
+                for (i=0; i < n; i++)  b[i].d = op->dval;
+            } else if (op->op == P_STR) {
+                for (i=0; i < n; i++)  b[i].s = (unsigned char *) op->name;
+            } else {
+                for (i=0; i < n; i++)  b[i].i = op->ival;
+            }
+            sw[sp] = (op->op == P_STR ? SZ_COLNAME : op->width);
+            ts[sp++] = op->type;
+            break;
+
+        default:                                    // binary operators
+            a = ctx->pstack + (sp - 2) * SZ_PREDBATCH;
+            b = a + SZ_PREDBATCH;
+            if (op->mode == PV_DBL && ts[sp-2] == PV_INT)
+                for (i=0; i < n; i++)  a[i].d = (double) a[i].i;
+            if (op->mode == PV_DBL && ts[sp-1] == PV_INT)
+                for (i=0; i < n; i++)  b[i].d = (double) b[i].i;
+            dl_predBinary (op, a, b, n, sw[sp-2], sw[sp-1]);
+            ts[--sp - 1] = op->type;
+        }
+    }
+
+    return (ctx->pstack);
+}
+
+
+/**
+ *  DL_PREDLOAD -- Load a column value from each row of a batch.  Values
+ *  are taken from the FITS (big-endian) bytes, before any swapping.  The
+ *  signed and unsigned types CFITSIO reports for a TZERO offset have the
+ *  sign bit flipped to give the true value.
+ */
+static void
+dl_predLoad (PredOpPtr op, PValPtr v, unsigned char *dp, int n, long naxis1)
+{
+    register int i;
+    register unsigned char *p = dp + op->offset;
+    unsigned int       u4 = 0;
+    unsigned long long u8 = 0;
+    float   fval = 0.0;
+    double  dval = 0.0;
+
+
+    switch (op->ctype) {
+    case TSTRING:
+        for (i=0; i < n; i++, p += naxis1)
+            v[i].s = p;
+        break;
+    case TLOGICAL:
+        for (i=0; i < n; i++, p += naxis1)
+            v[i].i = (*p == 'T');
+        break;
+    case TBYTE:
+        for (i=0; i < n; i++, p += naxis1)
+            v[i].i = *p;
+        break;
+    case TSBYTE:
+        for (i=0; i < n; i++, p += naxis1)
+            v[i].i = (signed char) (*p ^ 0x80);
+        break;
+    case TSHORT:
+        for (i=0; i < n; i++, p += naxis1)
+            v[i].i = (short) ((p[0] << 8) | p[1]);
+        break;
+    case TUSHORT:
+        for (i=0; i < n; i++, p += naxis1)
+            v[i].i = (unsigned short) (((p[0] ^ 0x80) << 8) | p[1]);
+        break;
+    case TINT:
+    case TLONG:
+        for (i=0; i < n; i++, p += naxis1)
+            v[i].i = (int) (((unsigned) p[0] << 24) | (p[1] << 16) |
+                (p[2] << 8) | p[3]);
+        break;
+    case TUINT:
+    case TULONG:
+        for (i=0; i < n; i++, p += naxis1)
+            v[i].i = (unsigned int) (((unsigned) (p[0] ^ 0x80) << 24) |
+                (p[1] << 16) | (p[2] << 8) | p[3]);
+        break;
+    case TLONGLONG:
+    case TULONGLONG:
+        for (i=0; i < n; i++, p += naxis1) {
+            u8 = ((unsigned long long) (op->ctype == TULONGLONG ?
+                    p[0] ^ 0x80 : p[0]) << 56) |
+                 ((unsigned long long) p[1] << 48) |
+                 ((unsigned long long) p[2] << 40) |
+                 ((unsigned long long) p[3] << 32) |
+                 ((unsigned long long) p[4] << 24) | (p[5] << 16) |
+                 (p[6] << 8) | p[7];
+            v[i].i = (long long) u8;
+        }
+        break;
+    case TFLOAT:
+        for (i=0; i < n; i++, p += naxis1) {
+            u4 = ((unsigned) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+            memcpy (&fval, &u4, sizeof (float));
+            v[i].d = fval;
+        }
+        break;
+    case TDOUBLE:
+        for (i=0; i < n; i++, p += naxis1) {
+            u8 = ((unsigned long long) p[0] << 56) |
+                 ((unsigned long long) p[1] << 48) |
+                 ((unsigned long long) p[2] << 40) |
+                 ((unsigned long long) p[3] << 32) |
+                 ((unsigned long long) p[4] << 24) | (p[5] << 16) |
+                 (p[6] << 8) | p[7];
+            memcpy (&dval, &u8, sizeof (double));
+            v[i].d = dval;
+        }
+        break;
+    }
+}
+
+
+/**
+ *  DL_PREDBINARY -- Apply a binary operator to two vectors of values,
+ *  leaving the result in the first.
+ */
+static void
+dl_predBinary (PredOpPtr op, PValPtr a, PValPtr b, int n, int wa, int wb)
+{
+    register int i, c;
+
+
+    if (op->mode == PV_STR) {
+        for (i=0; i < n; i++) {
+            c = dl_predStrcmp (a[i].s, wa, b[i].s, wb);
+            switch (op->op) {
+            case P_EQ:  a[i].i = (c == 0);  break;
+            case P_NE:  a[i].i = (c != 0);  break;
+            case P_LT:  a[i].i = (c < 0);   break;
+            case P_LE:  a[i].i = (c <= 0);  break;
+            case P_GT:  a[i].i = (c > 0);   break;
+            case P_GE:  a[i].i = (c >= 0);  break;
+            }
+        }
+
+    } else if (op->mode == PV_DBL) {
+        switch (op->op) {
+        case P_ADD: for (i=0; i < n; i++)  a[i].d += b[i].d;            break;
+        case P_SUB: for (i=0; i < n; i++)  a[i].d -= b[i].d;            break;
+        case P_MUL: for (i=0; i < n; i++)  a[i].d *= b[i].d;            break;
+        case P_DIV: for (i=0; i < n; i++)  a[i].d /= b[i].d;            break;
+        case P_EQ:  for (i=0; i < n; i++)  a[i].i = (a[i].d == b[i].d); break;
+        case P_NE:  for (i=0; i < n; i++)  a[i].i = (a[i].d != b[i].d); break;
+        case P_LT:  for (i=0; i < n; i++)  a[i].i = (a[i].d < b[i].d);  break;
+        case P_LE:  for (i=0; i < n; i++)  a[i].i = (a[i].d <= b[i].d); break;
+        case P_GT:  for (i=0; i < n; i++)  a[i].i = (a[i].d > b[i].d);  break;
+        case P_GE:  for (i=0; i < n; i++)  a[i].i = (a[i].d >= b[i].d); break;
+        }
+
+    } else {                                        // integer or logical
+        switch (op->op) {
+        case P_ADD: for (i=0; i < n; i++)  a[i].i += b[i].i;            break;
+        case P_SUB: for (i=0; i < n; i++)  a[i].i -= b[i].i;            break;
+        case P_MUL: for (i=0; i < n; i++)  a[i].i *= b[i].i;            break;
+        case P_MOD:
+            for (i=0; i < n; i++)
+                a[i].i = (b[i].i ? a[i].i % b[i].i : 0);
+            break;
+        case P_EQ:  for (i=0; i < n; i++)  a[i].i = (a[i].i == b[i].i); break;
+        case P_NE:  for (i=0; i < n; i++)  a[i].i = (a[i].i != b[i].i); break;
+        case P_LT:  for (i=0; i < n; i++)  a[i].i = (a[i].i < b[i].i);  break;
+        case P_LE:  for (i=0; i < n; i++)  a[i].i = (a[i].i <= b[i].i); break;
+        case P_GT:  for (i=0; i < n; i++)  a[i].i = (a[i].i > b[i].i);  break;
+        case P_GE:  for (i=0; i < n; i++)  a[i].i = (a[i].i >= b[i].i); break;
+        case P_AND: for (i=0; i < n; i++)  a[i].i &= b[i].i;            break;
+        case P_OR:  for (i=0; i < n; i++)  a[i].i |= b[i].i;            break;
+        }
+    }
+}
+
+
+/**
+ *  DL_PREDSTRCMP -- Compare two strings of at most 'alen' and 'blen'
+ *  bytes, as CFITSIO does:  trailing blanks don't count.
+ */
+static int
+dl_predStrcmp (unsigned char *a, int alen, unsigned char *b, int blen)
+{
+    register int i;
+
+
+    for (i=0; i < alen && a[i]; i++)
+        ;
+    for (alen=i; alen > 0 && a[alen-1] == ' '; alen--)
+        ;
+    for (i=0; i < blen && b[i]; i++)
+        ;
+    for (blen=i; blen > 0 && b[blen-1] == ' '; blen--)
+        ;
+
+    for (i=0; i < alen && i < blen; i++)
+        if (a[i] != b[i])
+            return ((int) a[i] - (int) b[i]);
+    return (alen - blen);
+}
+
+
+/***********************************************************/
+/******************* INPUT DECOMPRESSION *******************/
+/***********************************************************/
+
+/**
+ *  DL_OPENTABLE -- Open an input table.  CFITSIO inflates a compressed
+ *  file into memory before returning, so compressed files without
+ *  filename modifiers are streamed instead:  the headers are read from
+ *  the decompressed stream and opened as a memory file, and the rows are
+ *  read from the stream as the conversion asks for them.
+ */
+static int
+dl_openTable (CtxPtr ctx, char *iname, fitsfile **fptr, int *status)
+{
+    int  type = dl_zType (iname);
+
+
+    if (type != CMP_NONE && !strchr (iname, (int)'['))
+        ctx->zin = dl_zinOpen (iname, type, (ctx->task ? 1 : nthreads));
+    if (ctx->zin)
+        return (fits_open_memfile (fptr, iname, READONLY,
+            (void **) &ctx->zin->hdr, &ctx->zin->hdrlen, 0, NULL, status));
+
+    return (fits_open_file (fptr, iname, READONLY, status));
+}
+
+
+/**
+ *  DL_CLOSETABLE -- Close an input table and any stream it is read from.
+ */
+static void
+dl_closeTable (CtxPtr ctx, fitsfile *fptr, int *status)
+{
+    fits_close_file (fptr, status);
+    if (ctx->zin)
+        dl_zinClose (ctx->zin);
+    ctx->zin = (ZinPtr) NULL;
+}
+
+
+/**
+ *  DL_READTABLE -- Read bytes of the table, from the input stream if there
+ *  is one.  Streams are read in order, so 'firstchar' may only move
+ *  forward; rows up to it are decompressed and dropped.  Whole rows of a narrow projection
+ *  are read a span at a time, skipping the columns not wanted.
+ */
+static int
+dl_readTable (CtxPtr ctx, fitsfile *fptr, LONGLONG firstrow,
+                LONGLONG firstchar, LONGLONG nbytes, unsigned char *buf,
+                int *status)
+{
+    ZinPtr  z = ctx->zin;
+    SpanPtr sp = (SpanPtr) NULL;
+    long    naxis1 = ctx->prog.naxis1;
+    LONGLONG row, nrows, skip;
+    int     i;
+
+
+    /*  With a narrow projection read just the spans of each row.
+     */
+    if (z == NULL && ctx->narrow && (nbytes % naxis1) == 0 &&
+        ((firstchar - 1) % naxis1) == 0) {
+            firstrow += (firstchar - 1) / naxis1;
+            nrows = nbytes / naxis1;
+            for (row=0; row < nrows && *status == 0; row++, buf += naxis1) {
+                for (i=0, sp=ctx->spans; i < ctx->nspans; i++, sp++)
+                    fits_read_tblbytes (fptr, firstrow + row, sp->offset + 1,
+                        sp->len, buf + sp->offset, status);
+            }
+            return (*status);
+    }
+
+    if (z == NULL)
+        return (fits_read_tblbytes (fptr, firstrow, firstchar, nbytes, buf,
+            status));
+
+    while (firstrow == 1 && firstchar > z->offset + 1 && *status == 0) {
+        skip = firstchar - 1 - z->offset;       // skip to the next range
+        if (dl_zinRead (z, NULL, (skip < nbytes ? skip : nbytes)) == 0)
+            *status = END_OF_FILE;
+    }
+    if (firstrow != 1 || firstchar != z->offset + 1 ||
+        dl_zinRead (z, buf, nbytes) < nbytes)
+            *status = END_OF_FILE;
+    return (*status);
+}
+
+
+/**
+ *  DL_ZINOPEN -- Open a compressed input stream and read the FITS headers
+ *  up to the data of the first extension.  The primary HDU is replaced by
+ *  an empty one, so the header file holds no data.  A reader thread
+ *  decompresses the stream into a ring of blocks ahead of the conversion,
+ *  and zstd frames of known size are decompressed by 'nworkers' threads
+ *  in parallel.  Returns NULL if the stream can't be read.
+ */
+static ZinPtr
+dl_zinOpen (char *iname, int type, int nworkers)
+{
+    ZinPtr z = (ZinPtr) calloc (1, sizeof (Zin));
+    long   skip = 0;
+    int    i;
+
+
+    if ((z->fd = open (iname, O_RDONLY)) < 0) {
+        free ((void *) z);
+        return ((ZinPtr) NULL);
+    }
+    z->name = iname;
+    z->type = type;
+    z->isize = SZ_ZBLOCK;
+    z->ibuf = (unsigned char *) malloc (z->isize);
+    z->nworkers = (type == CMP_ZSTD ? nworkers : 0);
+    z->nslots = 2 * (nworkers > 1 ? nworkers : 1) + 2;
+#ifdef HAVE_ZSTD
+    if (type == CMP_ZSTD)
+        z->zd = ZSTD_createDStream ();
+#endif
+    pthread_mutex_init (&z->mutex, NULL);
+    pthread_cond_init (&z->cond, NULL);
+
+    for (i=0; i < z->nworkers; i++)
+        pthread_create (&z->tid[i], NULL, dl_zinWorker, (void *) z);
+    pthread_create (&z->reader, NULL, dl_zinReader, (void *) z);
+
+    /*  Skip the primary HDU, then read the extension header after an
+     *  empty primary header of our own.
+     */
+    if ((skip = dl_zinHeader (z, 0)) < 0 ||
+        dl_zinRead (z, NULL, skip) < skip ||
+        dl_zinHeader (z, SZ_FITSBLOCK) < 0) {
+            dl_zinClose (z);
+            return ((ZinPtr) NULL);
+    }
+    memset (z->hdr, ' ', SZ_FITSBLOCK);
+    dl_zinCard (z->hdr, 0, "SIMPLE", "T");
+    dl_zinCard (z->hdr, 1, "BITPIX", "8");
+    dl_zinCard (z->hdr, 2, "NAXIS", "0");
+    dl_zinCard (z->hdr, 3, "EXTEND", "T");
+    memcpy (z->hdr + 4 * 80, "END", 3);
+    z->offset = 0;                              // rows start here
+
+    return (z);
+}
+
+
+/**
+ *  DL_ZINCLOSE -- Stop the threads of an input stream and free it.
+ */
+static void
+dl_zinClose (ZinPtr z)
+{
+    int  i;
+
+
+    pthread_mutex_lock (&z->mutex);
+    z->stop = 1;
+    pthread_cond_broadcast (&z->cond);
+    pthread_mutex_unlock (&z->mutex);
+
+    pthread_join (z->reader, NULL);
+    for (i=0; i < z->nworkers; i++)
+        pthread_join (z->tid[i], NULL);
+
+    for (i=0; i < z->nslots; i++) {
+        if (z->blocks[i].in) free ((void *) z->blocks[i].in);
+        if (z->blocks[i].out) free ((void *) z->blocks[i].out);
+    }
+    if (z->type == CMP_GZIP && z->member > 0)
+        inflateEnd (&z->zs);
+#ifdef HAVE_BZIP2
+    if (z->type == CMP_BZIP2 && z->member > 0)
+        BZ2_bzDecompressEnd (&z->bz);
+#endif
+#ifdef HAVE_ZSTD
+    if (z->zd)
+        ZSTD_freeDStream (z->zd);
+#endif
+    close (z->fd);
+
+    pthread_mutex_destroy (&z->mutex);
+    pthread_cond_destroy (&z->cond);
+    if (z->hdr) free ((void *) z->hdr);
+    free ((void *) z->ibuf);
+    free ((void *) z);
+}
+
+
+/**
+ *  DL_ZINHEADER -- Read a FITS header from the stream, at 'start' in the
+ *  header buffer.  Returns the size of the data that follows it.
+ */
+static long
+dl_zinHeader (ZinPtr z, long start)
+{
+    long  bitpix = 8, naxis = 0, gcount = 1, size = 0;
+    char  key[16];
+    int   i, end = 0;
+
+
+    for (z->hdrlen = start; !end; z->hdrlen += SZ_FITSBLOCK) {
+        z->hdr = (unsigned char *) realloc (z->hdr,
+            z->hdrlen + SZ_FITSBLOCK);
+        if (dl_zinRead (z, z->hdr + z->hdrlen, SZ_FITSBLOCK) < SZ_FITSBLOCK)
+            return (-1);
+        for (i=0; i < SZ_FITSBLOCK && !end; i += 80)
+            end = (strncmp ((char *) z->hdr + z->hdrlen + i, "END     ",
+                8) == 0);
+    }
+    if (start == 0 && strncmp ((char *) z->hdr, "SIMPLE  =", 9))
+        return (-1);
+
+    bitpix = dl_zinKey (z, start, "BITPIX");
+    if ((naxis = dl_zinKey (z, start, "NAXIS")) > 0) {
+        for (i=1, size=1; i <= naxis; i++) {
+            sprintf (key, "NAXIS%d", i);
+            size *= dl_zinKey (z, start, key);
+        }
+        if (start > 0 && (gcount = dl_zinKey (z, start, "GCOUNT")) < 1)
+            gcount = 1;
+        size = (labs (bitpix) / 8) * (size + dl_zinKey (z, start, "PCOUNT")) *
+            gcount;
+    }
+    return (((size + SZ_FITSBLOCK - 1) / SZ_FITSBLOCK) * SZ_FITSBLOCK);
+}
+
+
+/**
+ *  DL_ZINKEY -- Get an integer keyword value from a header read at
+ *  'start', or 0 if it isn't there.
+ */
+static long
+dl_zinKey (ZinPtr z, long start, char *key)
+{
+    char  *card = (char *) z->hdr + start;
+    int    len = strlen (key);
+
+
+    for ( ; card < (char *) z->hdr + z->hdrlen; card += 80)
+        if (strncmp (card, key, len) == 0 && card[len] == ' ' &&
+            strncmp (card + 8, "= ", 2) == 0)
+                return (atol (card + 10));
+    return (0);
+}
+
+
+/**
+ *  DL_ZINCARD -- Write a header card with a fixed-format value.
+ */
+static void
+dl_zinCard (unsigned char *hdr, int n, char *key, char *value)
+{
+    char  card[81];
+
+
+    sprintf (card, "%-8.8s= %20s", key, value);
+    memcpy (hdr + n * 80, card, strlen (card));
+}
+
+
+/**
+ *  DL_ZINREAD -- Read decompressed bytes from the stream, or skip them if
+ *  'buf' is NULL.  Returns the number of bytes read, which is short at the
+ *  end of the stream or on an error.
+ */
+static long
+dl_zinRead (ZinPtr z, unsigned char *buf, long nbytes)
+{
+    ZblockPtr b = (ZblockPtr) NULL;
+    long   n = 0, nread = 0;
+    int    end = 0;
+
+
+    while (nread < nbytes) {
+        pthread_mutex_lock (&z->mutex);
+        while (!(z->nused < z->nread && z->blocks[z->nused % z->nslots].done)
+            && !(z->nused == z->nread && z->eof))
+                pthread_cond_wait (&z->cond, &z->mutex);
+        end = (z->nused == z->nread || z->error);
+        pthread_mutex_unlock (&z->mutex);
+        if (end)
+            break;                              // end of the stream
+
+        /*  The block can't be reused until it has been consumed, so it
+         *  is copied unlocked.
+         */
+        b = &z->blocks[z->nused % z->nslots];
+        n = (b->outlen - z->pos < nbytes - nread ?
+            b->outlen - z->pos : nbytes - nread);
+        if (buf)
+            memcpy (buf + nread, b->out + z->pos, n);
+        nread += n;
+        if ((z->pos += n) == b->outlen) {
+            pthread_mutex_lock (&z->mutex);
+            z->nused++;
+            z->pos = 0;
+            pthread_cond_broadcast (&z->cond);
+            pthread_mutex_unlock (&z->mutex);
+        }
+    }
+    z->offset += nread;
+
+    return (nread);
+}
+
+
+/**
+ *  DL_ZINREADER -- Decompress the stream into free blocks until it ends or
+ *  the stream is closed.  At a zstd frame boundary a frame of known size
+ *  is queued whole for a worker instead.
+ */
+static void *
+dl_zinReader (void *arg)
+{
+    ZinPtr    z = (ZinPtr) arg;
+    ZblockPtr b = (ZblockPtr) NULL;
+    int       error = 0, stop = 0;
+
+
+    while (1) {
+        /*  Wait for a free block, one no worker can still be about to
+         *  look at.
+         */
+        pthread_mutex_lock (&z->mutex);
+        while ((z->nread - z->nused >= z->nslots ||
+            (z->nworkers > 0 && z->nread - z->ncomp >= z->nslots)) && !z->stop)
+                pthread_cond_wait (&z->cond, &z->mutex);
+        stop = z->stop;
+        pthread_mutex_unlock (&z->mutex);
+        if (stop)
+            break;
+
+        b = &z->blocks[z->nread % z->nslots];
+        b->done = 0;
+#ifdef HAVE_ZSTD
+        if (z->nworkers > 0 && z->member == 0 && dl_zinFrame (z, b))
+            ;
+        else
+#endif
+        {
+            if (b->out == NULL)
+                b->out = (unsigned char *) malloc ((b->outsize = SZ_ZBLOCK));
+            if ((b->outlen = dl_zinInflate (z, b->out, SZ_ZBLOCK)) <= 0) {
+                error = (b->outlen < 0);
+                break;
+            }
+            b->done = 1;
+        }
+
+        pthread_mutex_lock (&z->mutex);
+        z->nread++;
+        pthread_cond_broadcast (&z->cond);
+        pthread_mutex_unlock (&z->mutex);
+    }
+
+    if (error)
+        dl_error (3, "Error decompressing input", z->name);
+
+    pthread_mutex_lock (&z->mutex);
+    z->error |= error;
+    z->eof = 1;
+    pthread_cond_broadcast (&z->cond);
+    pthread_mutex_unlock (&z->mutex);
+
+    return (NULL);
+}
+
+
+/**
+ *  DL_ZINWORKER -- Decompress queued zstd frames until the stream ends.
+ */
+static void *
+dl_zinWorker (void *arg)
+{
+    ZinPtr    z = (ZinPtr) arg;
+    ZblockPtr b = (ZblockPtr) NULL;
+
+
+    pthread_mutex_lock (&z->mutex);
+    while (1) {
+        while (z->ncomp < z->nread && z->blocks[z->ncomp % z->nslots].done) {
+            z->ncomp++;                         // decompressed by the reader
+            pthread_cond_broadcast (&z->cond);
+        }
+        if (z->ncomp == z->nread && z->eof)
+            break;
+        if (z->ncomp == z->nread) {
+            pthread_cond_wait (&z->cond, &z->mutex);
+            continue;
+        }
+
+        b = &z->blocks[z->ncomp++ % z->nslots];
+        pthread_mutex_unlock (&z->mutex);
+
+#ifdef HAVE_ZSTD
+        if (ZSTD_isError (ZSTD_decompress (b->out, b->outlen, b->in,
+            b->inlen)))
+                b->outlen = 0;
+#endif
+
+        pthread_mutex_lock (&z->mutex);
+        if (b->outlen == 0) {
+            dl_error (3, "Error decompressing input", z->name);
+            z->error = 1;
+        }
+        b->done = 1;
+        pthread_cond_broadcast (&z->cond);
+    }
+    pthread_mutex_unlock (&z->mutex);
+
+    return (NULL);
+}
+
+
+/**
+ *  DL_ZINFILL -- Refill the compressed input buffer.  Returns the number
+ *  of bytes buffered.
+ */
+static long
+dl_zinFill (ZinPtr z)
+{
+    long  n = 0;
+
+
+    memmove (z->ibuf, z->ibuf + z->ipos, z->ilen - z->ipos);
+    z->ilen -= z->ipos;
+    z->ipos = 0;
+
+    while (!z->ieof && z->ilen < z->isize) {
+        if ((n = read (z->fd, z->ibuf + z->ilen, z->isize - z->ilen)) <= 0)
+            z->ieof = 1;
+        else
+            z->ilen += n;
+    }
+    return (z->ilen);
+}
+
+
+/**
+ *  DL_ZININFLATE -- Decompress the stream into a block of up to 'size'
+ *  bytes.  Concatenated gzip members, bzip2 streams and zstd frames are
+ *  read as one stream, anything after them is ignored.  A zstd block ends
+ *  with its frame so the next frame may go to a worker.  Returns the
+ *  number of bytes decompressed, 0 at the end of the stream or -1 on an
+ *  error.
+ */
+static long
+dl_zinInflate (ZinPtr z, unsigned char *out, long size)
+{
+    long  n = 0, k = 0, used = 0;
+    int   stat = 0;
+
+
+    while (n < size) {
+        if (z->ilen - z->ipos < 4 && !z->ieof)
+            dl_zinFill (z);
+        if (z->ipos == z->ilen) {
+            if (z->member > 0)
+                return (-1);                    // truncated stream
+            break;
+        }
+
+        /*  A new member must start with the magic number.
+         */
+        if (z->member == 0 && dl_zTypeOf (z->ibuf + z->ipos,
+            z->ilen - z->ipos) != z->type) {
+                z->ipos = z->ilen, z->ieof = 1;
+                break;
+        }
+
+        stat = dl_zinStep (z, out + n, size - n, &k, &used);
+        n += k;
+        if (stat < 0 || (k == 0 && used == 0 && stat == 0))
+            return (-1);                        // corrupt stream
+        if (stat > 0 && z->type == CMP_ZSTD)
+            break;                              // end of a frame
+    }
+
+    return (n);
+}
+
+
+/**
+ *  DL_ZINSTEP -- Run the decoder once over the buffered input, starting a
+ *  new member if the last one ended.  Returns 1 at the end of a member,
+ *  -1 on an error, 0 otherwise.
+ */
+static int
+dl_zinStep (ZinPtr z, unsigned char *out, long size, long *nout, long *nin)
+{
+    unsigned char *in = z->ibuf + z->ipos;
+    long   avail = z->ilen - z->ipos;
+    int    stat = 0;
+
+
+    *nout = *nin = 0;
+    switch (z->type) {
+    case CMP_GZIP:
+        if (z->member == 0 && inflateInit2 (&z->zs, 15 + 32) != Z_OK)
+            return (-1);
+        z->member = 1;
+        z->zs.next_in = in, z->zs.avail_in = avail;
+        z->zs.next_out = out, z->zs.avail_out = size;
+        stat = inflate (&z->zs, Z_NO_FLUSH);
+        *nin = avail - z->zs.avail_in;
+        *nout = size - z->zs.avail_out;
+        if (stat == Z_STREAM_END) {
+            inflateEnd (&z->zs);
+            z->member = 0;
+        } else if (stat != Z_OK && stat != Z_BUF_ERROR)
+            return (-1);
+        break;
+
+#ifdef HAVE_BZIP2
+    case CMP_BZIP2:
+        if (z->member == 0 && BZ2_bzDecompressInit (&z->bz, 0, 0) != BZ_OK)
+            return (-1);
+        z->member = 1;
+        z->bz.next_in = (char *) in, z->bz.avail_in = avail;
+        z->bz.next_out = (char *) out, z->bz.avail_out = size;
+        stat = BZ2_bzDecompress (&z->bz);
+        *nin = avail - z->bz.avail_in;
+        *nout = size - z->bz.avail_out;
+        if (stat == BZ_STREAM_END) {
+            BZ2_bzDecompressEnd (&z->bz);
+            z->member = 0;
+        } else if (stat != BZ_OK)
+            return (-1);
+        break;
+#endif
+
+#ifdef HAVE_ZSTD
+    case CMP_ZSTD:
+        {   ZSTD_inBuffer  zin  = { in, avail, 0 };
+            ZSTD_outBuffer zout = { out, size, 0 };
+            size_t ret;
+
+            z->member = 1;
+            ret = ZSTD_decompressStream (z->zd, &zout, &zin);
+            *nin = zin.pos;
+            *nout = zout.pos;
+            if (ZSTD_isError (ret))
+                return (-1);
+            if (ret == 0)
+                z->member = 0;
+        }
+        break;
+#endif
+
+    default:
+        return (-1);
+    }
+
+    z->ipos += *nin;
+    return (z->member == 0);
+}
+
+
+#ifdef HAVE_ZSTD
+/**
+ *  DL_ZINFRAME -- Queue the next zstd frame for a worker if it is complete
+ *  within the input window and its size is known.  Returns 1 if the frame
+ *  was queued.
+ */
+static int
+dl_zinFrame (ZinPtr z, ZblockPtr b)
+{
+    size_t  fsize = 0;
+    unsigned long long csize = 0;
+
+
+    while (1) {
+        fsize = ZSTD_findFrameCompressedSize (z->ibuf + z->ipos,
+            z->ilen - z->ipos);
+        if (!ZSTD_isError (fsize))
+            break;
+        if (z->ieof || z->ilen - z->ipos >= MAX_ZFRAME)
+            return (0);
+        if (z->isize < MAX_ZFRAME) {
+            z->isize = MAX_ZFRAME;
+            z->ibuf = (unsigned char *) realloc (z->ibuf, z->isize);
+        }
+        dl_zinFill (z);
+    }
+
+    csize = ZSTD_getFrameContentSize (z->ibuf + z->ipos, fsize);
+    if (csize == ZSTD_CONTENTSIZE_UNKNOWN ||
+        csize == ZSTD_CONTENTSIZE_ERROR || csize == 0 || csize > MAX_ZFRAME)
+            return (0);
+
+    if (fsize > b->insize)
+        b->in = (unsigned char *) realloc (b->in, (b->insize = fsize));
+    if (csize > b->outsize)
+        b->out = (unsigned char *) realloc (b->out, (b->outsize = csize));
+    memcpy (b->in, z->ibuf + z->ipos, fsize);
+    b->inlen = fsize;
+    b->outlen = csize;
+    z->ipos += fsize;
+
+    return (1);
+}
+#endif
+
+
+/***********************************************************/
+/********************* PARQUET OUTPUT **********************/
+/***********************************************************/
+
+/**
+ *  DL_PARQUETBEGIN -- Start a Parquet file:  map the table columns and
+ *  write the file magic.
+ */
+static void
+dl_parquetBegin (CtxPtr ctx, long naxis1)
+{
+    dl_parquetFree ();
+    pq.cols = dl_pqColumns (ctx, &pq.ncols);
+    pthread_mutex_init (&pq.mutex, NULL);
+
+    /*  Unless given, row groups are as large as the buffer allows.
+     */
+    pq.naxis1 = naxis1;
+    pq.maxrows = (row_group > 0 ? row_group : DEF_ROWGROUP);
+    if (row_group <= 0 && naxis1 > 0 && pq.maxrows > MAX_RGBYTES / naxis1)
+        pq.maxrows = (MAX_RGBYTES / naxis1 > 0 ? MAX_RGBYTES / naxis1 : 1);
+
+    dl_outWrite (ctx, "PAR1", 4);
+    pq.offset = 4;
+}
+
+
+/**
+ *  DL_PARQUETLOAD -- Buffer the rows of a table for the Parquet file, a
+ *  chunk at a time.
+ */
+static int
+dl_parquetLoad (CtxPtr ctx, fitsfile *fptr, unsigned char *table,
+                unsigned char *buf, long nrows, long naxis1, int nelem)
+{
+    unsigned char *data = NULL;
+    long   jj, n, nbytes = 0, firstchar = 1;
+    int    nsel, status = 0;
+
+
+    for (jj=1; (n = dl_nextChunk (ctx, &jj, nelem, nrows)); jj += n) {
+        firstchar = (jj - 1) * naxis1 + 1;
+        nbytes = n * naxis1;
+        if (table) {
+            data = table + (firstchar - 1);
+            if ((jj + n) <= nrows)
+                dl_willNeed (ctx, data + nbytes, nbytes);
+        } else {
+            dl_readTable (ctx, fptr, 1, firstchar, nbytes, buf, &status);
+            if (status) {                       /* print any error message */
+                fits_report_error (stderr, status);
+                break;
+            }
+            data = buf;
+        }
+        nsel = dl_prepChunk (ctx, buf, &data, n, naxis1);
+
+        dl_parquetRows (ctx, data, nsel);
+    }
+
+    return (status);
+}
+
+
+/**
+ *  DL_PARQUETROWS -- Add rows to the row group, writing it when full.  The
+ *  serial and random IDs are assigned here to keep them in row order.
+ */
+static void
+dl_parquetRows (CtxPtr ctx, unsigned char *data, long nrows)
+{
+    long   i, n;
+
+
+    while (nrows > 0) {
+        n = pq.maxrows - pq.nrows;
+        if (n > nrows)
+            n = nrows;
+
+        if (pq.nrows + n > pq.szrows) {
+            pq.szrows = (2 * pq.szrows > pq.nrows + n ?
+                2 * pq.szrows : pq.nrows + n);
+            if (pq.szrows > pq.maxrows)
+                pq.szrows = pq.maxrows;
+            pq.rows = (unsigned char *) realloc (pq.rows,
+                pq.szrows * pq.naxis1 + 1);
+            if (sidname)
+                pq.sids = (int *) realloc (pq.sids, pq.szrows * sizeof (int));
+            if (ridname)
+                pq.rids = (float *) realloc (pq.rids,
+                    pq.szrows * sizeof (float));
+        }
+
+        memcpy (pq.rows + pq.nrows * pq.naxis1, data, n * pq.naxis1);
+        for (i=pq.nrows; i < pq.nrows + n; i++) {
+            if (sidname)
+                pq.sids[i] = ctx->serial_number++;
+            if (ridname)
+                pq.rids[i] = ((float)rand()/(float)(RAND_MAX)) * RANDOM_SCALE;
+        }
+        pq.nrows += n;
+        data += n * pq.naxis1;
+        nrows -= n;
+
+        if (pq.nrows == pq.maxrows)
+            dl_parquetFlush (ctx);
+    }
+}
+
+
+/**
+ *  DL_PARQUETFLUSH -- Write the buffered rows as a row group.  The column
+ *  chunks are encoded in parallel, then written in column order and
+ *  described for the footer.
+ */
+static void
+dl_parquetFlush (CtxPtr ctx)
+{
+    pthread_t tid[MAX_THREADS];
+    TbufPtr  t = &pq.groups;
+    PqColPtr c = (PqColPtr) NULL;
+    long     base, total = 0;
+    int      i, nt = (nthreads < pq.ncols ? nthreads : pq.ncols);
+
+
+    if (pq.nrows == 0 || pq.ncols == 0)
+        return;
+
+    pq.next = 0;
+    for (i=1; i < nt; i++)
+        pthread_create (&tid[i], NULL, dl_pqWorker, NULL);
+    dl_pqWorker (NULL);
+    for (i=1; i < nt; i++)
+        pthread_join (tid[i], NULL);
+
+    dl_tBegin (t);                              // RowGroup
+    dl_tList (t, 1, TT_STRUCT, pq.ncols);
+    for (i=0; i < pq.ncols; i++) {
+        c = &pq.cols[i];
+        base = pq.offset;
+        dl_outWrite (ctx, c->out.buf, c->out.len);
+        pq.offset += c->out.len;
+        total += c->out.len;
+
+        dl_tBegin (t);                          // ColumnChunk
+        dl_tI64 (t, 2, base);
+        dl_tStruct (t, 3);                      // ColumnMetaData
+        dl_tI32 (t, 1, c->type);
+        dl_tList (t, 2, TT_I32, 2);
+        dl_tInt (t, (c->dict_off >= 0 ? PQ_PLAIN_DICT : PQ_PLAIN));
+        dl_tInt (t, PQ_RLE);
+        dl_tList (t, 3, TT_BINARY, (c->nvals > 1 ? 3 : 1));
+        dl_tBytes (t, c->name);
+        if (c->nvals > 1) {
+            dl_tBytes (t, "list");
+            dl_tBytes (t, "element");
+        }
+        dl_tI32 (t, 4, 0);                      // uncompressed
+        dl_tI64 (t, 5, c->nvalues);
+        dl_tI64 (t, 6, c->out.len);
+        dl_tI64 (t, 7, c->out.len);
+        dl_tI64 (t, 9, base + c->data_off);
+        if (c->dict_off >= 0)
+            dl_tI64 (t, 11, base + c->dict_off);
+        dl_tEnd (t);
+        dl_tEnd (t);
+    }
+    dl_tI64 (t, 2, total);
+    dl_tI64 (t, 3, pq.nrows);
+    dl_tEnd (t);
+
+    pq.ngroups++;
+    pq.totrows += pq.nrows;
+    pq.nrows = 0;
+}
+
+
+/**
+ *  DL_PARQUETEND -- Write the last row group and the footer:  the file
+ *  metadata with the schema and row groups, its length and the magic.
+ */
+static void
+dl_parquetEnd (CtxPtr ctx)
+{
+    Tbuf     t;
+    PqColPtr c = (PqColPtr) NULL;
+    int      i, nschema = 1;
+
+
+    if (pq.cols == NULL)
+        return;
+    dl_parquetFlush (ctx);
+
+    memset (&t, 0, sizeof (Tbuf));
+    for (i=0; i < pq.ncols; i++)
+        nschema += (pq.cols[i].nvals > 1 ? 3 : 1);
+
+    dl_tBegin (&t);                             // FileMetaData
+    dl_tI32 (&t, 1, 1);
+    dl_tList (&t, 2, TT_STRUCT, nschema);
+    dl_tBegin (&t);
+    dl_tString (&t, 4, "schema");
+    dl_tI32 (&t, 5, pq.ncols);
+    dl_tEnd (&t);
+
+    /*  A list is a group holding a repeated group of the elements.
+     */
+    for (i=0; i < pq.ncols; i++) {
+        c = &pq.cols[i];
+        if (c->nvals > 1) {
+            dl_tBegin (&t);
+            dl_tI32 (&t, 3, PQ_REQUIRED);
+            dl_tString (&t, 4, c->name);
+            dl_tI32 (&t, 5, 1);
+            dl_tI32 (&t, 6, PQ_LIST);
+            dl_tStruct (&t, 10);
+            dl_tStruct (&t, 3);
+            dl_tEnd (&t);
+            dl_tEnd (&t);
+            dl_tEnd (&t);
+
+            dl_tBegin (&t);
+            dl_tI32 (&t, 3, PQ_REPEATED);
+            dl_tString (&t, 4, "list");
+            dl_tI32 (&t, 5, 1);
+            dl_tEnd (&t);
+            dl_pqSchema (&t, c, "element");
+        } else
+            dl_pqSchema (&t, c, c->name);
+    }
+    dl_tI64 (&t, 3, pq.totrows);
+    dl_tList (&t, 4, TT_STRUCT, pq.ngroups);
+    dl_tPut (&t, pq.groups.buf, pq.groups.len);
+    dl_tString (&t, 6, "fits2db");
+    dl_tEnd (&t);
+
+    i = (int) t.len;
+    dl_pqPut32 (&t, (unsigned int) i);
+    dl_tPut (&t, "PAR1", 4);
+    dl_outWrite (ctx, t.buf, t.len);
+    dl_outFlush (ctx);
+
+    dl_tFree (&t);
+    dl_parquetFree ();
+}
+
+
+/**
+ *  DL_PARQUETFREE -- Free the Parquet file state.
+ */
+static void
+dl_parquetFree (void)
+{
+    int  i;
+
+
+    if (pq.cols) {
+        for (i=0; i < pq.ncols; i++) {
+            dl_tFree (&pq.cols[i].out);
+            dl_tFree (&pq.cols[i].page);
+            dl_tFree (&pq.cols[i].tmp);
+        }
+        free ((void *) pq.cols);
+        pthread_mutex_destroy (&pq.mutex);
+    }
+    if (pq.rows) free ((void *) pq.rows);
+    if (pq.sids) free ((void *) pq.sids);
+    if (pq.rids) free ((void *) pq.rids);
+    dl_tFree (&pq.groups);
+
+    memset (&pq, 0, sizeof (Parquet));
+}
+
+
+/**
+ *  DL_PQCOLUMNS -- Map the table columns to binary output columns,
+ *  unexploded arrays to lists of their values, followed by any added
+ *  columns.  Columns of a type that can't be held are left out.
+ */
+static PqColPtr
+dl_pqColumns (CtxPtr ctx, int *ncols)
+{
+    ColPtr   col = (ColPtr) NULL;
+    PqColPtr cols = (PqColPtr) NULL, c = (PqColPtr) NULL;
+    char    *names[3] = { addname, sidname, ridname };
+    int      ftypes[3] = { PQ_VALUE, PQ_SERIAL, PQ_RANDOM };
+    int      i, k, n, size = 0, ocol = 1;
+
+
+    cols = (PqColPtr) calloc (ctx->numOutCols + 1, sizeof (PqCol));
+    *ncols = 0;
+
+    for (i=1; i <= ctx->numInCols; i++) {
+        col = (ColPtr) &ctx->inColumns[i];
+        dl_colBytes (col, &size);
+        n = ((explode && col->repeat > 1 && col->type != TSTRING) ?
+            col->repeat : 1);
+
+        for (k=0; k < n; k++, ocol++) {
+            c = &cols[*ncols];
+            if (dl_pqType (col, c) != OK) {
+                if (k == 0)
+                    fprintf (stderr,
+                        "Warning: skipping unsupported column '%s'\n",
+                        col->colname);
+                continue;
+            }
+            strcpy (c->name, ctx->outColumns[ocol].colname);
+            c->size = (size ? size : 1);
+            c->offset = col->offset + k * c->size;
+            c->width = col->repeat;
+            c->nvals = ((n > 1 || col->type == TSTRING) ? 1 : col->repeat);
+            (*ncols)++;
+        }
+    }
+
+    for (k=0; k < 3; k++) {                     // added columns
+        if (names[k] == NULL)
+            continue;
+        c = &cols[(*ncols)++];
+        strcpy (c->name, ctx->outColumns[ocol++].colname);
+        c->ftype = ftypes[k];
+        c->type = (ftypes[k] == PQ_RANDOM ? PQ_FLOAT : PQ_INT32);
+        c->ctype = -1;
+        c->size = 4;
+        c->nvals = 1;
+    }
+
+    return (cols);
+}
+
+
+/**
+ *  DL_PQTYPE -- Get the Parquet type of a column.  Small integers are
+ *  INT32 values annotated with their width, values are read as the text
+ *  output prints them.
+ */
+static int
+dl_pqType (ColPtr col, PqColPtr c)
+{
+    c->ftype = col->type;
+    c->ctype = -1;
+    c->bits = 0;
+
+    switch (col->type) {
+    case TSTRING:   c->type = PQ_BYTE_ARRAY, c->ctype = PQ_UTF8;
+                    break;
+    case TLOGICAL:  c->type = PQ_BOOLEAN;
+                    break;
+
+    case TBYTE:     c->type = PQ_INT32, c->ctype = PQ_UINT_8, c->bits = 8;
+                    break;
+    case TSBYTE:    c->type = PQ_INT32, c->ctype = PQ_INT_8, c->bits = 8;
+                    break;
+    case TSHORT:    c->type = PQ_INT32, c->ctype = PQ_INT_16, c->bits = 16;
+                    break;
+    case TUSHORT:   c->type = PQ_INT32, c->ctype = PQ_UINT_16, c->bits = 16;
+                    break;
+    case TINT:
+    case TUINT:
+    case TINT32BIT: c->type = PQ_INT32;
+                    break;
+
+    case TLONGLONG: c->type = PQ_INT64;
+                    break;
+    case TFLOAT:    c->type = PQ_FLOAT;
+                    break;
+    case TDOUBLE:   c->type = PQ_DOUBLE;
+                    break;
+
+    default:        return (ERR);
+    }
+
+    return (OK);
+}
+
+
+/**
+ *  DL_PQWORKER -- Encode column chunks until none are left.
+ */
+static void *
+dl_pqWorker (void *arg)
+{
+    int  i;
+
+
+    while (1) {
+        pthread_mutex_lock (&pq.mutex);
+        i = pq.next++;
+        pthread_mutex_unlock (&pq.mutex);
+
+        if (i >= pq.ncols)
+            break;
+        dl_pqEncode (&pq.cols[i]);
+    }
+
+    return (NULL);
+}
+
+
+/**
+ *  DL_PQENCODE -- Encode the column chunk of the buffered rows.  Strings
+ *  are dictionary encoded unless the dictionary grows too large, other
+ *  values are plain.  Each data page holds whole rows.
+ */
+static void
+dl_pqEncode (PqColPtr c)
+{
+    unsigned int *idx = NULL;
+    unsigned char width = 1;
+    long   r0, r1, prows, vsize;
+
+
+    c->out.len = 0;
+    c->nvalues = pq.nrows * c->nvals;
+    c->dict_off = -1;
+    c->ndict = 0;
+
+    if (c->type == PQ_BYTE_ARRAY && (idx = dl_pqDict (c))) {
+        c->dict_off = c->out.len;
+        dl_pqPage (c, PQ_DICT_PAGE, c->ndict, PQ_PLAIN_DICT);
+        while ((1 << width) < c->ndict)
+            width++;
+    }
+    c->data_off = c->out.len;
+
+    vsize = (c->type == PQ_BYTE_ARRAY ? c->width + 4 : c->size) * c->nvals;
+    prows = SZ_PQPAGE / (vsize > 0 ? vsize : 1);
+    if (prows < 1)
+        prows = 1;
+
+    for (r0=0; r0 < pq.nrows; r0 = r1) {
+        r1 = (r0 + prows < pq.nrows ? r0 + prows : pq.nrows);
+
+        c->page.len = 0;
+        if (c->nvals > 1)
+            dl_pqLevels (c, r0, r1);
+        if (idx) {
+            dl_tPut (&c->page, &width, 1);
+            dl_pqHybrid (&c->page, idx + r0, r1 - r0, width);
+        } else
+            dl_pqValues (c, r0, r1);
+
+        dl_pqPage (c, PQ_DATA_PAGE, (r1 - r0) * c->nvals,
+            (idx ? PQ_PLAIN_DICT : PQ_PLAIN));
+    }
+
+    if (idx)
+        free ((void *) idx);
+}
+
+
+/**
+ *  DL_PQDICT -- Build the dictionary of a string column chunk as the body
+ *  of its dictionary page.  Returns the dictionary index of each row, or
+ *  NULL when the dictionary would be too large.
+ */
+static unsigned int *
+dl_pqDict (PqColPtr c)
+{
+    unsigned char **eptr = NULL, *sp = NULL;
+    unsigned int *idx = NULL, h, mask = 2 * MAX_PQDICT - 1;
+    int    *slots = NULL, *elen = NULL;
+    long    r, nbytes = 0;
+    int     i, len, nd = 0;
+
+
+    slots = (int *) malloc (2 * MAX_PQDICT * sizeof (int));
+    memset (slots, 0xff, 2 * MAX_PQDICT * sizeof (int));
+    eptr = (unsigned char **) malloc (MAX_PQDICT * sizeof (char *));
+    elen = (int *) malloc (MAX_PQDICT * sizeof (int));
+    idx = (unsigned int *) malloc ((pq.nrows + 1) * sizeof (unsigned int));
+
+    for (r=0; r < pq.nrows; r++) {
+        sp = dl_pqString (c, pq.rows + r * pq.naxis1 + c->offset, &len);
+
+        for (h=2166136261u, i=0; i < len; i++)      // FNV-1a
+            h = (h ^ sp[i]) * 16777619u;
+        for (h &= mask; slots[h] >= 0; h = (h + 1) & mask)
+            if (elen[slots[h]] == len && memcmp (eptr[slots[h]], sp, len) == 0)
+                break;
+
+        if (slots[h] < 0) {
+            if (nd == MAX_PQDICT || nbytes + 4 + len > SZ_PQDICT) {
+                free ((void *) idx);
+                idx = NULL;
+                break;
+            }
+            slots[h] = nd;
+            eptr[nd] = sp, elen[nd++] = len;
+            nbytes += 4 + len;
+        }
+        idx[r] = slots[h];
+    }
+
+    if (idx) {
+        c->page.len = 0;
+        for (i=0; i < nd; i++) {
+            dl_pqPut32 (&c->page, elen[i]);
+            dl_tPut (&c->page, eptr[i], elen[i]);
+        }
+        c->ndict = nd;
+    }
+
+    free ((void *) slots);
+    free ((void *) eptr);
+    free ((void *) elen);
+
+    return (idx);
+}
+
+
+/**
+ *  DL_PQVALUES -- Append the plain encoded values of a run of rows to the
+ *  page.  Numbers are written little-endian, logicals as bits.
+ */
+static void
+dl_pqValues (PqColPtr c, long r0, long r1)
+{
+    unsigned char *rp, *vp, *op, *sp, tmp;
+    unsigned short usval = 0;
+    short  sval = 0;
+    long   r, i, n = (r1 - r0) * c->nvals;
+    int    k, j, len, ival = 0, vsize;
+
+
+    if (c->type == PQ_BYTE_ARRAY) {
+        for (r=r0; r < r1; r++) {
+            sp = dl_pqString (c, pq.rows + r * pq.naxis1 + c->offset, &len);
+            dl_pqPut32 (&c->page, len);
+            dl_tPut (&c->page, sp, len);
+        }
+        return;
+    }
+
+    if (c->type == PQ_BOOLEAN) {
+        dl_tPut (&c->page, NULL, (n + 7) / 8);
+        op = c->page.buf + c->page.len - (n + 7) / 8;
+        for (r=r0, i=0; r < r1; r++) {
+            rp = pq.rows + r * pq.naxis1 + c->offset;
+            for (k=0; k < c->nvals; k++, i++)
+                if (tolower ((int) rp[k]) == 't')
+                    op[i >> 3] |= (1 << (i & 7));
+        }
+        return;
+    }
+
+    vsize = (c->type == PQ_INT64 || c->type == PQ_DOUBLE ? 8 : 4);
+    dl_tPut (&c->page, NULL, n * vsize);
+    op = c->page.buf + c->page.len - n * vsize;
+
+    for (r=r0; r < r1; r++) {
+        rp = pq.rows + r * pq.naxis1 + c->offset;
+        for (k=0; k < c->nvals; k++, op += vsize) {
+            vp = rp + k * c->size;
+            switch (c->ftype) {
+            case TBYTE:     ival = (unsigned char) *vp;
+                            memcpy (op, &ival, 4);
+                            break;
+            case TSBYTE:    ival = (signed char) *vp;
+                            memcpy (op, &ival, 4);
+                            break;
+            case TSHORT:    memcpy (&sval, vp, sz_short), ival = sval;
+                            memcpy (op, &ival, 4);
+                            break;
+            case TUSHORT:   memcpy (&usval, vp, sz_short), ival = usval;
+                            memcpy (op, &ival, 4);
+                            break;
+            case PQ_SERIAL: memcpy (op, &pq.sids[r], 4);
+                            break;
+            case PQ_RANDOM: memcpy (op, &pq.rids[r], 4);
+                            break;
+            case PQ_VALUE:  ival = 1;
+                            memcpy (op, &ival, 4);
+                            break;
+            default:        memcpy (op, vp, vsize);
+                            break;
+            }
+        }
+    }
+
+    if (!mach_swap) {                           // big-endian host
+        op = c->page.buf + c->page.len - n * vsize;
+        for (i=0; i < n; i++, op += vsize)
+            for (j=0; j < vsize / 2; j++)
+                tmp = op[j], op[j] = op[vsize-1-j], op[vsize-1-j] = tmp;
+    }
+}
+
+
+/**
+ *  DL_PQSTRING -- Get a string value, stripped as the text output would be.
+ */
+static unsigned char *
+dl_pqString (PqColPtr c, unsigned char *vp, int *len)
+{
+    int  n = strnlen ((char *) vp, c->width);
+
+
+    if (do_strip) {
+        while (n > 0 && isspace (*vp))
+            vp++, n--;
+        while (n > 0 && isspace (vp[n-1]))
+            n--;
+    }
+    *len = n;
+
+    return (vp);
+}
+
+
+/**
+ *  DL_PQLEVELS -- Append the repetition and definition levels of a run of
+ *  list rows to the page.  Every row holds the whole list, so only the
+ *  first value of a row starts it and all values are defined.
+ */
+static void
+dl_pqLevels (PqColPtr c, long r0, long r1)
+{
+    unsigned int *lv = NULL;
+    long   i, n = (r1 - r0) * c->nvals;
+
+
+    lv = (unsigned int *) malloc ((n + 1) * sizeof (unsigned int));
+    for (i=0; i < n; i++)
+        lv[i] = (i % c->nvals ? 1 : 0);
+    c->tmp.len = 0;
+    dl_pqHybrid (&c->tmp, lv, n, 1);
+    dl_pqPut32 (&c->page, c->tmp.len);
+    dl_tPut (&c->page, c->tmp.buf, c->tmp.len);
+
+    for (i=0; i < n; i++)
+        lv[i] = 1;
+    c->tmp.len = 0;
+    dl_pqHybrid (&c->tmp, lv, n, 1);
+    dl_pqPut32 (&c->page, c->tmp.len);
+    dl_tPut (&c->page, c->tmp.buf, c->tmp.len);
+
+    free ((void *) lv);
+}
+
+
+/**
+ *  DL_PQHYBRID -- Append values in the RLE/bit-packed hybrid encoding:  one
+ *  repeated run if all are the same, otherwise one bit-packed run padded
+ *  to a multiple of 8 values.
+ */
+static void
+dl_pqHybrid (TbufPtr t, unsigned int *vals, long n, int width)
+{
+    unsigned char *op = NULL, b;
+    long   i, bit, ngroups = (n + 7) / 8;
+    int    k;
+
+
+    for (i=1; i < n && vals[i] == vals[0]; i++)
+        ;
+    if (i >= n) {
+        dl_tVarint (t, (unsigned long long) n << 1);
+        for (k=0; k < (width + 7) / 8; k++) {
+            b = (unsigned char) ((n > 0 ? vals[0] : 0) >> (8 * k));
+            dl_tPut (t, &b, 1);
+        }
+        return;
+    }
+
+    dl_tVarint (t, ((unsigned long long) ngroups << 1) | 1);
+    dl_tPut (t, NULL, ngroups * width);
+    op = t->buf + t->len - ngroups * width;
+    for (i=0, bit=0; i < n; i++)
+        for (k=0; k < width; k++, bit++)
+            if ((vals[i] >> k) & 1)
+                op[bit >> 3] |= (1 << (bit & 7));
+}
+
+
+/**
+ *  DL_PQPAGE -- Add the page being encoded to the column chunk, after its
+ *  header.
+ */
+static void
+dl_pqPage (PqColPtr c, int type, long nvalues, int encoding)
+{
+    TbufPtr  t = &c->tmp;
+
+
+    t->len = 0;
+    dl_tBegin (t);                              // PageHeader
+    dl_tI32 (t, 1, type);
+    dl_tI32 (t, 2, (int) c->page.len);
+    dl_tI32 (t, 3, (int) c->page.len);
+    if (type == PQ_DATA_PAGE) {
+        dl_tStruct (t, 5);                      // DataPageHeader
+        dl_tI32 (t, 1, (int) nvalues);
+        dl_tI32 (t, 2, encoding);
+        dl_tI32 (t, 3, PQ_RLE);
+        dl_tI32 (t, 4, PQ_RLE);
+        dl_tEnd (t);
+    } else {
+        dl_tStruct (t, 7);                      // DictionaryPageHeader
+        dl_tI32 (t, 1, (int) nvalues);
+        dl_tI32 (t, 2, encoding);
+        dl_tEnd (t);
+    }
+    dl_tEnd (t);
+
+    dl_tPut (&c->out, t->buf, t->len);
+    dl_tPut (&c->out, c->page.buf, c->page.len);
+}
+
+
+/**
+ *  DL_PQSCHEMA -- Write the schema element of a column's values.
+ */
+static void
+dl_pqSchema (TbufPtr t, PqColPtr c, char *name)
+{
+    unsigned char bits = (unsigned char) c->bits;
+
+
+    dl_tBegin (t);                              // SchemaElement
+    dl_tI32 (t, 1, c->type);
+    dl_tI32 (t, 3, PQ_REQUIRED);
+    dl_tString (t, 4, name);
+    if (c->ctype >= 0)
+        dl_tI32 (t, 6, c->ctype);
+
+    if (c->type == PQ_BYTE_ARRAY) {             // LogicalType STRING
+        dl_tStruct (t, 10);
+        dl_tStruct (t, 1);
+        dl_tEnd (t);
+        dl_tEnd (t);
+    } else if (c->bits) {                       // LogicalType INTEGER
+        dl_tStruct (t, 10);
+        dl_tStruct (t, 10);
+        dl_tField (t, 1, TT_BYTE);
+        dl_tPut (t, &bits, 1);
+        dl_tField (t, 2, ((c->ctype == PQ_INT_8 || c->ctype == PQ_INT_16) ?
+            TT_TRUE : TT_FALSE));
+        dl_tEnd (t);
+        dl_tEnd (t);
+    }
+    dl_tEnd (t);
+}
+
+
+/**
+ *  DL_PQPUT32 -- Append a 4-byte little-endian length.
+ */
+static void
+dl_pqPut32 (TbufPtr t, unsigned int v)
+{
+    unsigned char b[4];
+
+
+    b[0] = v & 0xff, b[1] = (v >> 8) & 0xff;
+    b[2] = (v >> 16) & 0xff, b[3] = (v >> 24) & 0xff;
+    dl_tPut (t, b, 4);
+}
+
+
+/**
+ *  DL_TPUT -- Append bytes to a buffer, or zeroed space if 'p' is NULL.
+ */
+static void
+dl_tPut (TbufPtr t, void *p, long n)
+{
+    if (n <= 0)
+        return;                                 // empty buffers stay NULL
+    if (t->len + n > t->size) {
+        t->size = 2 * (t->len + n) + 256;
+        t->buf = (unsigned char *) realloc (t->buf, t->size);
+    }
+    if (p)
+        memcpy (t->buf + t->len, p, n);
+    else
+        memset (t->buf + t->len, 0, n);
+    t->len += n;
+}
+
+
+/**
+ *  DL_TVARINT -- Append an unsigned LEB128 varint.
+ */
+static void
+dl_tVarint (TbufPtr t, unsigned long long v)
+{
+    unsigned char b[10];
+    int  n = 0;
+
+
+    for ( ; v >= 0x80; v >>= 7)
+        b[n++] = (unsigned char) ((v & 0x7f) | 0x80);
+    b[n++] = (unsigned char) v;
+    dl_tPut (t, b, n);
+}
+
+
+/**
+ *  DL_TINT -- Append a zigzag varint (a Thrift i32/i64 value).
+ */
+static void
+dl_tInt (TbufPtr t, long long v)
+{
+    dl_tVarint (t, ((unsigned long long) v << 1) ^ (unsigned long long) (v >> 63));
+}
+
+
+/**
+ *  DL_TBYTES -- Append a Thrift string value.
+ */
+static void
+dl_tBytes (TbufPtr t, char *s)
+{
+    long  len = strlen (s);
+
+
+    dl_tVarint (t, len);
+    dl_tPut (t, s, len);
+}
+
+
+/**
+ *  DL_TFIELD -- Append a Thrift field header, as a delta from the last field
+ *  of the struct when it is small.
+ */
+static void
+dl_tField (TbufPtr t, int id, int type)
+{
+    unsigned char b;
+    int  delta = id - t->last[t->depth];
 
-            for (i=1; i <= col->nrows; i++) {
-                for (j=1; j <= col->ncols; j++) {
-                    sval = htons((short) *dp++);
-                    memcpy (optr, &sval, sz_short);     optr += sz_short;
-                    olen += sz_short;
-                }
-            }
-        }
+
+    if (delta > 0 && delta <= 15) {
+        b = (unsigned char) ((delta << 4) | type);
+        dl_tPut (t, &b, 1);
     } else {
-        for (i=1; i <= col->nrows; i++) {
-            for (j=1; j <= col->ncols; j++) {
-                memset (valbuf, 0, SZ_VALBUF);
-                if (col->type == TBYTE) {
-                    uch = (unsigned char) *dp++;
-                    if (format == TAB_IPAC)
-                        sprintf (valbuf, "%*d", col->dispwidth, uch);
-                    else
-                        sprintf (valbuf, "%d", uch);
-                } else {
-                    ch = (char) *dp++;
-                    if (format == TAB_IPAC)
-                        sprintf (valbuf, "%*d", col->dispwidth, ch);
-                    else
-                        sprintf (valbuf, "%d", ch);
-                }
-                memcpy (optr, valbuf, (len = strlen (valbuf)));
-                olen += len;
-                optr += len;
-                if (col->repeat > 1 && j < col->ncols)
-                    *optr++ = arr_delimiter,  olen++;
-            }
-            if (col->repeat > 1 && i < col->nrows)
-                *optr++ = arr_delimiter,  olen++;
-        }
+        b = (unsigned char) type;
+        dl_tPut (t, &b, 1);
+        dl_tInt (t, id);
     }
+    t->last[t->depth] = id;
+}
 
-    return (dp);
+
+/**
+ *  DL_TBEGIN -- Begin a Thrift struct (a list element or the top level).
+ */
+static void
+dl_tBegin (TbufPtr t)
+{
+    t->last[++t->depth] = 0;
 }
 
 
 /**
- *  DL_PRINTSHORT -- Print the column as short integer values.
+ *  DL_TEND -- End a Thrift struct.
  */
-static unsigned char *
-dl_printShort (unsigned char *dp, ColPtr col)
+static void
+dl_tEnd (TbufPtr t)
 {
-    short sval = 0.0;
-    unsigned short usval = 0.0;
-    char  valbuf[SZ_VALBUF];
-    int   i, j, len = 0;
+    unsigned char stop = 0;
 
 
-    if (mach_swap && !do_binary)
-        bswap2 ((char *)dp, (char *)dp, sz_short * col->repeat);
+    dl_tPut (t, &stop, 1);
+    t->depth--;
+}
 
-    if (do_binary) {
-        unsigned int sz_val = 0;
-        if (explode) {
-            len = sz_short;
-            sz_val = htonl(sz_short);
-            for (i=1; i <= col->nrows; i++) {
-                for (j=1; j <= col->ncols; j++) {
-                    memcpy (optr, &sz_val, sz_int);     optr += sz_int;
-                    memcpy (optr, dp, sz_short);        optr += len;
-                    olen += sz_int + len;
-                    dp += sz_short;
-                }
-            }
-        } else {
-            len = col->repeat * sz_short;
-            sz_val = htonl(col->repeat * sz_short);
-            memcpy (optr, &sz_val, sz_int);             optr += sz_int;
-            memcpy (optr, dp, sz_short * col->repeat);  optr += len;
-            olen += sz_int + len;
-            dp += col->repeat * sz_short;
-        }
 
+/**
+ *  DL_TSTRUCT -- Begin a struct field.
+ */
+static void
+dl_tStruct (TbufPtr t, int id)
+{
+    dl_tField (t, id, TT_STRUCT);
+    dl_tBegin (t);
+}
+
+
+/**
+ *  DL_TLIST -- Begin a list field of 'n' elements, written by the caller.
+ */
+static void
+dl_tList (TbufPtr t, int id, int type, int n)
+{
+    unsigned char b;
+
+
+    dl_tField (t, id, TT_LIST);
+    if (n < 15) {
+        b = (unsigned char) ((n << 4) | type);
+        dl_tPut (t, &b, 1);
     } else {
-        for (i=1; i <= col->nrows; i++) {
-            for (j=1; j <= col->ncols; j++) {
-                memset (valbuf, 0, SZ_VALBUF);
-                if (col->type == TUSHORT) {
-                    memcpy (&usval, dp, sz_short);
-                    if (format == TAB_IPAC)
-                        sprintf (valbuf, "%*d", col->dispwidth, usval);
-                    else
-                        sprintf (valbuf, "%d", usval);
-                } else {
-                    memcpy (&sval, dp, sz_short);
-                    if (format == TAB_IPAC)
-                        sprintf (valbuf, "%*d", col->dispwidth, sval);
-                    else
-                        sprintf (valbuf, "%d", sval);
-                }
-                memcpy (optr, valbuf, (len = strlen (valbuf)));
-                olen += len;
-                optr += len;
-                dp += sz_short;
-                if (col->repeat > 1 && j < col->ncols)
-                    *optr++ = arr_delimiter,  olen++;
-            }
-            if (col->repeat > 1 && i < col->nrows)
-                *optr++ = arr_delimiter,  olen++;
-        }
+        b = (unsigned char) (0xf0 | type);
+        dl_tPut (t, &b, 1);
+        dl_tVarint (t, n);
     }
+}
 
-    return (dp);
+
+/**
+ *  DL_TI32 -- Append an i32 field.
+ */
+static void
+dl_tI32 (TbufPtr t, int id, int v)
+{
+    dl_tField (t, id, TT_I32);
+    dl_tInt (t, v);
 }
 
 
 /**
- *  DL_PRINTINT -- Print the column as integer values.
+ *  DL_TI64 -- Append an i64 field.
  */
-static unsigned char *
-dl_printInt (unsigned char *dp, ColPtr col)
+static void
+dl_tI64 (TbufPtr t, int id, long long v)
 {
-    int   ival = 0.0;
-    unsigned int uival = 0.0;
-    char  valbuf[SZ_VALBUF];
-    int   i, j, len = 0;
+    dl_tField (t, id, TT_I64);
+    dl_tInt (t, v);
+}
 
 
-    if (mach_swap && !do_binary)
-        bswap4 ((char *)dp, 1, (char *)dp, 1, sz_int * col->repeat);
+/**
+ *  DL_TSTRING -- Append a string field.
+ */
+static void
+dl_tString (TbufPtr t, int id, char *s)
+{
+    dl_tField (t, id, TT_BINARY);
+    dl_tBytes (t, s);
+}
 
-    if (do_binary) {
-        unsigned int sz_val = 0;
-        if (explode) {
-            len = sz_int;
-            sz_val = htonl(sz_int);
-            for (i=1; i <= col->nrows; i++) {
-                for (j=1; j <= col->ncols; j++) {
-                    memcpy (optr, &sz_val, sz_int);     optr += sz_int;
-                    memcpy (optr, dp, sz_int);          optr += len;
-                    olen += sz_int + len;
-                    dp += sz_int;
-                }
-            }
-        } else {
-            len = col->repeat * sz_int;
-            sz_val = htonl(col->repeat * sz_int);
-            memcpy (optr, &sz_val, sz_int);             optr += sz_int;
-            memcpy (optr, dp, sz_int * col->repeat);    optr += len;
-            olen += sz_int + len;
-            dp += col->repeat * sz_int;
-        }
 
-    } else {
-        for (i=1; i <= col->nrows; i++) {
-            for (j=1; j <= col->ncols; j++) {
-                memset (valbuf, 0, SZ_VALBUF);
-                if (col->type == TUINT) {
-                    memcpy (&uival, dp, sz_int);
-                    if (format == TAB_IPAC)
-                        sprintf (valbuf, "%*d", col->dispwidth, uival);
-                    else
-                        sprintf (valbuf, "%d", uival);
-                } else {
-                    memcpy (&ival, dp, sz_int);
-                    if (format == TAB_IPAC)
-                        sprintf (valbuf, "%*d", col->dispwidth, ival);
-                    else
-                        sprintf (valbuf, "%d", ival);
-                }
-                memcpy (optr, valbuf, (len = strlen (valbuf)));
-                olen += len;
-                optr += len;
-                dp += sz_int;
-                if (col->repeat > 1 && j < col->ncols)
-                    *optr++ = arr_delimiter,  olen++;
+/**
+ *  DL_TFREE -- Free a buffer.
+ */
+static void
+dl_tFree (TbufPtr t)
+{
+    if (t->buf)
+        free ((void *) t->buf);
+    memset (t, 0, sizeof (Tbuf));
+}
+
+
+/***********************************************************/
+/******************* ARROW STREAM OUTPUT *******************/
+/***********************************************************/
+
+/**
+ *  DL_ARROWBEGIN -- Start an Arrow IPC stream:  map the table columns and
+ *  write the schema message.
+ */
+static void
+dl_arrowBegin (CtxPtr ctx, long naxis1)
+{
+    TbufPtr  t = &arrow.meta;
+    PqColPtr c = (PqColPtr) NULL;
+    int      i, sz[2] = { 0, 4 };
+    long     f[2], hdr, vec;
+
+
+    dl_arrowFree ();
+    arrow.cols = dl_pqColumns (ctx, &arrow.ncols);
+    arrow.nodes = (long *) calloc (2 * arrow.ncols + 1, sizeof (long));
+    arrow.bufs = (long *) calloc (6 * arrow.ncols + 1, sizeof (long));
+    arrow.naxis1 = naxis1;
+
+    hdr = dl_arrowHeader (t, AR_SCHEMA, 0);
+    dl_fbPatch (t, hdr, dl_fbTable (t, 2, sz, f));      // Schema
+    vec = dl_fbVector (t, arrow.ncols, 4);
+    dl_fbPatch (t, f[1], vec);
+    for (i=0; i < arrow.ncols; i++) {
+        c = &arrow.cols[i];
+        dl_fbPatch (t, vec + 4 + 4 * i,
+            dl_arrowField (t, c, c->name, (c->nvals > 1)));
+    }
+
+    arrow.body.len = 0;
+    dl_arrowWrite (ctx);
+}
+
+
+/**
+ *  DL_ARROWLOAD -- Write the rows of a table to the Arrow stream, a record
+ *  batch per chunk.
+ */
+static int
+dl_arrowLoad (CtxPtr ctx, fitsfile *fptr, unsigned char *table,
+              unsigned char *buf, long nrows, long naxis1, int nelem)
+{
+    unsigned char *data = NULL;
+    long   jj, n, nbytes = 0, firstchar = 1;
+    int    nsel, status = 0;
+
+
+    for (jj=1; (n = dl_nextChunk (ctx, &jj, nelem, nrows)); jj += n) {
+        firstchar = (jj - 1) * naxis1 + 1;
+        nbytes = n * naxis1;
+        if (table) {
+            data = table + (firstchar - 1);
+            if ((jj + n) <= nrows)
+                dl_willNeed (ctx, data + nbytes, nbytes);
+        } else {
+            dl_readTable (ctx, fptr, 1, firstchar, nbytes, buf, &status);
+            if (status) {                       /* print any error message */
+                fits_report_error (stderr, status);
+                break;
             }
-            if (col->repeat > 1 && i < col->nrows)
-                *optr++ = arr_delimiter,  olen++;
+            data = buf;
         }
+        nsel = dl_prepChunk (ctx, buf, &data, n, naxis1);
+
+        if (nsel > 0)
+            dl_arrowBatch (ctx, data, nsel);
     }
 
-    return (dp);
+    return (status);
 }
 
 
 /**
- *  DL_PRINTLONG -- Print the column as long integer values.
+ *  DL_ARROWBATCH -- Write a chunk of rows as a record batch message.
  */
-static unsigned char *
-dl_printLong (unsigned char *dp, ColPtr col)
+static void
+dl_arrowBatch (CtxPtr ctx, unsigned char *data, long nrows)
 {
-    long  lval = 0.0;
-    char  valbuf[SZ_VALBUF];
-    int   i, j, len = 0;
+    TbufPtr  t = &arrow.meta;
+    int      i, sz[3] = { 8, 4, 4 };
+    long     f[3], hdr, vec;
+
+
+    arrow.body.len = 0;
+    arrow.nnodes = arrow.nbufs = 0;
+    for (i=0; i < arrow.ncols; i++)
+        dl_arrowColumn (ctx, &arrow.cols[i], data, nrows);
+    dl_fbAlign (&arrow.body, 8);
+
+    hdr = dl_arrowHeader (t, AR_BATCH, arrow.body.len);
+    dl_fbPatch (t, hdr, dl_fbTable (t, 3, sz, f));      // RecordBatch
+    dl_fbSet (t, f[0], nrows, 8);
+
+    vec = dl_fbVector (t, arrow.nnodes, 16);            // FieldNode
+    dl_fbPatch (t, f[1], vec);
+    for (i=0; i < arrow.nnodes; i++)
+        dl_fbSet (t, vec + 4 + 16 * i, arrow.nodes[i], 8);
+
+    vec = dl_fbVector (t, arrow.nbufs, 16);             // Buffer
+    dl_fbPatch (t, f[2], vec);
+    for (i=0; i < arrow.nbufs; i++) {
+        dl_fbSet (t, vec + 4 + 16 * i, arrow.bufs[2*i], 8);
+        dl_fbSet (t, vec + 12 + 16 * i, arrow.bufs[2*i+1], 8);
+    }
 
+    dl_arrowWrite (ctx);
+}
 
-    if (mach_swap && !do_binary)
-        bswap8 ((char *)dp, 1, (char *)dp, 1, sizeof(long) * col->repeat);
-        // FIXME -- We're in trouble if we comes across a 64-bit int column
-        //bswap4 ((char *)dp, 1, (char *)dp, 1, sz_long * col->repeat);
 
-    if (do_binary) {
-        unsigned int sz_val = 0;
-        if (explode) {
-            len = sz_long;
-            sz_val = htonl(sz_long);
-            for (i=1; i <= col->nrows; i++) {
-                for (j=1; j <= col->ncols; j++) {
-                    memcpy (optr, &sz_val, sz_int);     optr += sz_int;
-                    memcpy (optr, dp, sz_long);         optr += len;
-                    olen += sz_int + len;
-                    dp += sz_long;
-                }
-            }
-        } else {
-            len = col->repeat * sz_long;
-            sz_val = htonl(col->repeat * sz_long);
-            memcpy (optr, &sz_val, sz_int);             optr += sz_int;
-            memcpy (optr, dp, sz_long * col->repeat);   optr += len;
-            olen += sz_int + len;
-            dp += col->repeat * sz_long;
+/**
+ *  DL_ARROWCOLUMN -- Add the field nodes and buffers of a column to the
+ *  record batch.  No value is null, so the validity buffers are empty.
+ */
+static void
+dl_arrowColumn (CtxPtr ctx, PqColPtr c, unsigned char *data, long nrows)
+{
+    unsigned char *op = NULL, *rp = NULL, *sp = NULL;
+    long   r, i, n = nrows * c->nvals, nbytes = 0;
+    int    k, len, ival = 0;
+    float  fval = 0.0;
+
+
+    dl_arrowNode (nrows);
+    dl_arrowBuffer (0);
+    if (c->nvals > 1) {                         // fixed-size list values
+        dl_arrowNode (n);
+        dl_arrowBuffer (0);
+    }
+
+    if (c->ftype == TSTRING) {
+        op = dl_arrowBuffer ((nrows + 1) * 4);  // offsets, then the bytes
+        for (r=0; r < nrows; r++) {
+            dl_pqString (c, data + r * arrow.naxis1 + c->offset, &len);
+            nbytes += len;
+            ival = (int) nbytes;
+            memcpy (op + 4 * (r + 1), &ival, 4);
+        }
+        dl_arrowLE (op, 4, nrows + 1);
+
+        op = dl_arrowBuffer (nbytes);
+        for (r=0; r < nrows; r++, op += len) {
+            sp = dl_pqString (c, data + r * arrow.naxis1 + c->offset, &len);
+            memcpy (op, sp, len);
+        }
+
+    } else if (c->ftype == TLOGICAL) {
+        op = dl_arrowBuffer ((n + 7) / 8);
+        for (r=0, i=0; r < nrows; r++) {
+            rp = data + r * arrow.naxis1 + c->offset;
+            for (k=0; k < c->nvals; k++, i++)
+                if (tolower ((int) rp[k]) == 't')
+                    op[i >> 3] |= (1 << (i & 7));
+        }
+
+    } else if (c->ftype == PQ_SERIAL || c->ftype == PQ_VALUE) {
+        op = dl_arrowBuffer (nrows * 4);
+        for (r=0; r < nrows; r++) {
+            ival = (c->ftype == PQ_SERIAL ? ctx->serial_number++ : 1);
+            memcpy (op + 4 * r, &ival, 4);
+        }
+        dl_arrowLE (op, 4, nrows);
+
+    } else if (c->ftype == PQ_RANDOM) {
+        op = dl_arrowBuffer (nrows * 4);
+        for (r=0; r < nrows; r++) {
+            fval = ((float)rand()/(float)(RAND_MAX)) * RANDOM_SCALE;
+            memcpy (op + 4 * r, &fval, 4);
         }
+        dl_arrowLE (op, 4, nrows);
 
     } else {
-        for (i=1; i <= col->nrows; i++) {
-            for (j=1; j <= col->ncols; j++) {
-                memset (valbuf, 0, SZ_VALBUF);
-                memcpy (&lval, dp, sz_long);
-                if (format == TAB_IPAC)
-                    sprintf (valbuf, "%*ld", col->dispwidth, lval);
-                else
-                    sprintf (valbuf, "%ld", lval);
-                memcpy (optr, valbuf, (len = strlen (valbuf)));
-                olen += len;
-                optr += len;
-                dp += sz_long;
-                if (col->repeat > 1 && j < col->ncols)
-                    *optr++ = arr_delimiter,  olen++;
-            }
-            if (col->repeat > 1 && i < col->nrows)
-                *optr++ = arr_delimiter,  olen++;
+        op = dl_arrowBuffer (n * c->size);
+        for (r=0; r < nrows; r++)
+            memcpy (op + r * c->nvals * c->size,
+                data + r * arrow.naxis1 + c->offset, c->nvals * c->size);
+        dl_arrowLE (op, c->size, n);
+    }
+}
+
+
+/**
+ *  DL_ARROWEND -- End the Arrow stream.
+ */
+static void
+dl_arrowEnd (CtxPtr ctx)
+{
+    unsigned char eos[8] = { 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0 };
+
+
+    if (arrow.cols == NULL)
+        return;
+
+    dl_outWrite (ctx, eos, 8);
+    dl_outFlush (ctx);
+    dl_arrowFree ();
+}
+
+
+/**
+ *  DL_ARROWFREE -- Free the Arrow stream state.
+ */
+static void
+dl_arrowFree (void)
+{
+    if (arrow.cols) free ((void *) arrow.cols);
+    if (arrow.nodes) free ((void *) arrow.nodes);
+    if (arrow.bufs) free ((void *) arrow.bufs);
+    dl_tFree (&arrow.meta);
+    dl_tFree (&arrow.body);
+
+    memset (&arrow, 0, sizeof (Arrow));
+}
+
+
+/**
+ *  DL_ARROWFIELD -- Write the Field table of a column, or of a list column
+ *  and its values.  Returns the table position.
+ */
+static long
+dl_arrowField (TbufPtr t, PqColPtr c, char *name, int list)
+{
+    int   sz[6] = { 4, 1, 1, 4, 0, 4 }, tsz[2] = { 0, 0 };
+    int   type, bits = 32, sign = 1, prec = AR_SINGLE;
+    long  f[6], tf[2], pos, vec;
+
+
+    if (list)
+        type = AR_FIXEDLIST;
+    else {
+        switch (c->ftype) {
+        case TSTRING:   type = AR_UTF8;                 break;
+        case TLOGICAL:  type = AR_BOOL;                 break;
+        case TBYTE:     type = AR_INT, bits = 8, sign = 0;      break;
+        case TSBYTE:    type = AR_INT, bits = 8;                break;
+        case TSHORT:    type = AR_INT, bits = 16;               break;
+        case TUSHORT:   type = AR_INT, bits = 16, sign = 0;     break;
+        case TLONGLONG: type = AR_INT, bits = 64;               break;
+        case TFLOAT:
+        case PQ_RANDOM: type = AR_FLOAT;                        break;
+        case TDOUBLE:   type = AR_FLOAT, prec = AR_DOUBLE;      break;
+        default:        type = AR_INT;                  break;  // 32-bit
         }
     }
+    if (type == AR_FIXEDLIST || type == AR_INT)
+        tsz[0] = 4, tsz[1] = (type == AR_INT ? 1 : 0);
+    else if (type == AR_FLOAT)
+        tsz[0] = 2;
+
+    pos = dl_fbTable (t, 6, sz, f);             // Field
+    dl_fbSet (t, f[2], type, 1);
+    dl_fbPatch (t, f[0], dl_fbString (t, name));
+
+    dl_fbPatch (t, f[3], dl_fbTable (t, 2, tsz, tf));
+    if (type == AR_FIXEDLIST)
+        dl_fbSet (t, tf[0], c->nvals, 4);
+    else if (type == AR_INT)
+        dl_fbSet (t, tf[0], bits, 4), dl_fbSet (t, tf[1], sign, 1);
+    else if (type == AR_FLOAT)
+        dl_fbSet (t, tf[0], prec, 2);
+
+    vec = dl_fbVector (t, list, 4);             // children
+    dl_fbPatch (t, f[5], vec);
+    if (list)
+        dl_fbPatch (t, vec + 4, dl_arrowField (t, c, "item", 0));
+
+    return (pos);
+}
 
-    return (dp);
+
+/**
+ *  DL_ARROWHEADER -- Begin the flatbuffer of a message.  Returns the
+ *  position of the header offset for the caller to patch.
+ */
+static long
+dl_arrowHeader (TbufPtr t, int type, long bodylen)
+{
+    int   sz[4] = { 2, 1, 4, 8 };
+    long  f[4];
+
+
+    t->len = 0;
+    dl_tPut (t, NULL, 4);                       // root table offset
+    dl_fbPatch (t, 0, dl_fbTable (t, 4, sz, f));        // Message
+    dl_fbSet (t, f[0], AR_V5, 2);
+    dl_fbSet (t, f[1], type, 1);
+    dl_fbSet (t, f[3], bodylen, 8);
+
+    return (f[2]);
+}
+
+
+/**
+ *  DL_ARROWWRITE -- Write a message:  the continuation marker, metadata
+ *  length, metadata and body.
+ */
+static void
+dl_arrowWrite (CtxPtr ctx)
+{
+    TbufPtr  m = &arrow.meta;
+    unsigned char pre[8] = { 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0 };
+    int      i;
+
+
+    dl_fbAlign (m, 8);
+    for (i=0; i < 4; i++)
+        pre[4+i] = (unsigned char) ((m->len >> (8 * i)) & 0xff);
+
+    dl_outWrite (ctx, pre, 8);
+    dl_outWrite (ctx, m->buf, m->len);
+    if (arrow.body.len > 0)
+        dl_outWrite (ctx, arrow.body.buf, arrow.body.len);
+}
+
+
+/**
+ *  DL_ARROWNODE -- Add a field node to the record batch.
+ */
+static void
+dl_arrowNode (long length)
+{
+    arrow.nodes[arrow.nnodes++] = length;
 }
 
 
 /**
- *  DL_PRINTFLOAT -- Print the column as floating-point values.
+ *  DL_ARROWBUFFER -- Add a zeroed buffer of 'nbytes' to the record batch
+ *  body, 8-byte aligned.  The pointer is valid until the next buffer.
  */
 static unsigned char *
-dl_printFloat (unsigned char *dp, ColPtr col)
+dl_arrowBuffer (long nbytes)
 {
-    float rval = 0.0;
-    char  valbuf[SZ_VALBUF];
-    int   i, j, sign = 1, len = 0;
+    TbufPtr  b = &arrow.body;
 
 
-    if (mach_swap && !do_binary)
-        bswap4 ((char *)dp, 1, (char *)dp, 1, sz_float * col->repeat);
+    dl_fbAlign (b, 8);
+    arrow.bufs[2 * arrow.nbufs] = b->len;
+    arrow.bufs[2 * arrow.nbufs + 1] = nbytes;
+    arrow.nbufs++;
+    dl_tPut (b, NULL, nbytes);
 
-    if (do_binary) {
-        unsigned int sz_val = 0;
-        if (explode) {
-            len = sz_float;
-            sz_val = htonl(sz_float);
-            for (i=1; i <= col->nrows; i++) {
-                for (j=1; j <= col->ncols; j++) {
-                    memcpy (optr, &sz_val, sz_int);     optr += sz_int;
-                    memcpy (optr, dp, sz_float);        optr += len;
-                    olen += sz_int + len;
-                    dp += sz_float;
-                }
-            }
-        } else {
-            len = col->repeat * sz_float;
-            sz_val = htonl(col->repeat * sz_float);
-            memcpy (optr, &sz_val, sz_int);             optr += sz_int;
-            memcpy (optr, dp, sz_float * col->repeat);  optr += len;
-            olen += sz_int + len;
-            dp += col->repeat * sz_float;
-        }
+    return (b->buf + b->len - nbytes);
+}
 
-    } else {
-        for (i=1; i <= col->nrows; i++) {
-            for (j=1; j <= col->ncols; j++) {
-                memset (valbuf, 0, SZ_VALBUF);
-                memcpy (&rval, dp, sz_float);
 
-                if (isnan (rval) ) {
-                    if (format == TAB_SQLITE || format == TAB_MYSQL)
-                        memcpy (optr, "'NaN'", (len = strlen ("'NaN'")));
-                    else if (format == TAB_POSTGRES)
-                        memcpy (optr, "NaN", (len = strlen ("NaN")));
-                    else {
-                        sprintf (valbuf, "%lf", (double) rval);
-                        memcpy (optr, valbuf, (len = strlen (valbuf)));
-                    }
-                    olen += len, optr += len;
+/**
+ *  DL_ARROWLE -- Make 'n' values of 'size' bytes little-endian.
+ */
+static void
+dl_arrowLE (unsigned char *p, int size, long n)
+{
+    unsigned char tmp;
+    long   i;
+    int    j;
+
 
-                } else if ((sign = isinf (rval)) ) {
-                    if (format == TAB_SQLITE || format == TAB_MYSQL) {
-                        char *val = (sign ? "'Infinity'" : "'-Infinity'");
-                        memcpy (optr, val, (len = strlen (val)));
+    if (mach_swap || size == 1)                 // little-endian host
+        return;
+    for (i=0; i < n; i++, p += size)
+        for (j=0; j < size / 2; j++)
+            tmp = p[j], p[j] = p[size-1-j], p[size-1-j] = tmp;
+}
 
-                    } else if (format == TAB_POSTGRES) {
-                        char *val = (sign ? "Infinity" : "-Infinity");
-                        memcpy (optr, val, (len = strlen (val)));
 
-                    } else {
-                        sprintf (valbuf, "%lf", (double) rval);
-                        memcpy (optr, valbuf, (len = strlen (valbuf)));
-                    }
-                    olen += len, optr += len;
+/**
+ *  DL_FBTABLE -- Append a flatbuffer table, preceded by its vtable.  Fields
+ *  with a zero size are absent, the positions of the others are returned
+ *  in 'fpos' for the caller to fill in.  Tables are written before what
+ *  they refer to, since flatbuffer offsets point forward.  Returns the
+ *  table position.
+ */
+static long
+dl_fbTable (TbufPtr t, int nfields, int *sizes, long *fpos)
+{
+    unsigned short voff[SZ_FBFIELDS];
+    long   vpos, tpos;
+    int    i, off = 4;
 
-                } else {
-                    if (format == TAB_IPAC)
-                        sprintf (valbuf, "%*f", col->dispwidth, (double) rval);
-                    else
-                        sprintf (valbuf, "%f", (double) rval);
 
-                    memcpy (optr, valbuf, (len = strlen (valbuf)));
-                    olen += len, optr += len;
-                }
-                dp += sz_float;
-                if (col->repeat > 1 && j < col->ncols)
-                    *optr++ = arr_delimiter,  olen++;
-            }
-            if (col->repeat > 1 && i < col->nrows)
-                *optr++ = arr_delimiter,  olen++;
+    for (i=0; i < nfields; i++) {               // align fields in order
+        voff[i] = 0;
+        if (sizes[i] > 0) {
+            off = (off + sizes[i] - 1) / sizes[i] * sizes[i];
+            voff[i] = off;
+            off += sizes[i];
         }
     }
 
-    return (dp);
+    dl_fbAlign (t, 2);
+    vpos = t->len;
+    dl_tPut (t, NULL, 4 + 2 * nfields);
+    dl_fbSet (t, vpos, 4 + 2 * nfields, 2);
+    dl_fbSet (t, vpos + 2, off, 2);
+    for (i=0; i < nfields; i++)
+        dl_fbSet (t, vpos + 4 + 2 * i, voff[i], 2);
+
+    dl_fbAlign (t, 8);
+    tpos = t->len;
+    dl_tPut (t, NULL, off);
+    dl_fbSet (t, tpos, tpos - vpos, 4);
+    for (i=0; i < nfields; i++)
+        fpos[i] = (voff[i] ? tpos + voff[i] : -1);
+
+    return (tpos);
 }
 
 
 /**
- *  DL_PRINTDOUBLE -- Print the column as double-precision values.
+ *  DL_FBVECTOR -- Append a zeroed flatbuffer vector of 'n' elements of
+ *  'esize' bytes.  Returns the position of its length.
  */
-static unsigned char *
-dl_printDouble (unsigned char *dp, ColPtr col)
+static long
+dl_fbVector (TbufPtr t, int n, int esize)
 {
-    double dval = 0.0;
-    char  valbuf[SZ_VALBUF];
-    int   i, j, sign = 1, len = 0;
-
-
-    if (mach_swap && !do_binary)
-        bswap8 ((char *)dp, 1, (char *)dp, 1, sz_double * col->repeat);
+    long  pos;
 
-    if (do_binary) {
-        unsigned int sz_val = 0;
-        if (explode) {
-            len = sz_double;
-            sz_val = htonl(sz_double);
-            for (i=1; i <= col->nrows; i++) {
-                for (j=1; j <= col->ncols; j++) {
-                    memcpy (optr, &sz_val, sz_int);     optr += sz_int;
-                    memcpy (optr, dp, sz_double);       optr += len;
-                    olen += sz_int + len;
-                    dp += sz_double;
-                }
-            }
-        } else {
-            len = col->repeat * sz_double;
-            sz_val = htonl(col->repeat * sz_double);
-            memcpy (optr, &sz_val, sz_int);             optr += sz_int;
-            memcpy (optr, dp, sz_double * col->repeat); optr += len;
-            olen += sz_int + len;
-            dp += col->repeat * sz_double;
-        }
 
-    } else {
-        for (i=1; i <= col->nrows; i++) {
-            for (j=1; j <= col->ncols; j++) {
-                memset (valbuf, 0, SZ_VALBUF);
-                memcpy (&dval, dp, sizeof(double));
-
-                if (isnan (dval) ) {
-                    if (format == TAB_SQLITE || format == TAB_MYSQL)
-                        memcpy (optr, "'NaN'", (len = strlen ("'NaN'")));
-                    else if (format == TAB_POSTGRES)
-                        memcpy (optr, "NaN", (len = strlen ("NaN")));
-                    else {
-                        sprintf (valbuf, "%.16lf", (double) dval);
-                        memcpy (optr, valbuf, (len = strlen (valbuf)));
-                    }
-                    olen += len, optr += len;
+    dl_fbAlign (t, 4);
+    if (esize > 4 && t->len % 8 == 0)           // 8-byte aligned elements
+        dl_tPut (t, NULL, 4);
+    pos = t->len;
+    dl_tPut (t, NULL, 4 + (long) n * esize);
+    dl_fbSet (t, pos, n, 4);
 
-                } else if ((sign = isinf (dval)) ) {
-                    if (format == TAB_SQLITE || format == TAB_MYSQL) {
-                        char *val = (sign ? "'Infinity'" : "'-Infinity'");
-                        memcpy (optr, val, (len = strlen (val)));
+    return (pos);
+}
 
-                    } else if (format == TAB_POSTGRES) {
-                        char *val = (sign ? "Infinity" : "-Infinity");
-                        memcpy (optr, val, (len = strlen (val)));
 
-                    } else {
-                        sprintf (valbuf, "%.16lf", (double) dval);
-                        memcpy (optr, valbuf, (len = strlen (valbuf)));
-                    }
-                    olen += len, optr += len;
+/**
+ *  DL_FBSTRING -- Append a flatbuffer string.  Returns its position.
+ */
+static long
+dl_fbString (TbufPtr t, char *s)
+{
+    long  pos, len = strlen (s);
 
-                } else {
-                    if (format == TAB_IPAC)
-                        sprintf (valbuf, "%*f", col->dispwidth, (double) dval);
-                    else
-                        sprintf (valbuf, "%.16f", (double) dval);
 
-                    memcpy (optr, valbuf, (len = strlen (valbuf)));
-                    olen += len, optr += len;
-                }
-                dp += sz_double;
-                if (col->repeat > 1 && j < col->ncols)
-                    *optr++ = arr_delimiter,  olen++;
-            }
-            if (col->repeat > 1 && i < col->nrows)
-                *optr++ = arr_delimiter,  olen++;
-        }
-    }
+    dl_fbAlign (t, 4);
+    pos = t->len;
+    dl_tPut (t, NULL, 4 + len + 1);
+    dl_fbSet (t, pos, len, 4);
+    memcpy (t->buf + pos + 4, s, len);
 
-    return (dp);
+    return (pos);
 }
 
 
 /**
- *  DL_PRINTSERIAL -- Print the serial number column as integer values.
+ *  DL_FBSET -- Store a little-endian value of 'size' bytes.
  */
 static void
-dl_printSerial (void)
+dl_fbSet (TbufPtr t, long pos, unsigned long long v, int size)
 {
-    unsigned int len = 0, ival = serial_number++;
-    unsigned int sz_val = htonl(sz_int);
-    char  valbuf[SZ_VALBUF];
-
-    if (mach_swap && do_binary)
-        bswap4 ((unsigned char *)&ival, 1, (unsigned char *)&ival, 1, sz_int);
+    int  i;
 
-    if (do_binary) {
-        memcpy (optr, &sz_val, sz_int);         	optr += sz_int;
-        ival = htonl(ival);
-        memcpy (optr, (char *)&ival, sz_int);   	optr += sz_int;
-        olen += (2 * sz_int);
 
-    } else {
-        memset (valbuf, 0, SZ_VALBUF);
-        //sprintf (valbuf, "%c%d", delimiter, ival);
-        sprintf (valbuf, "%d", ival);
-        memcpy (optr, valbuf, (len = strlen (valbuf)));
-        olen += len;
-        optr += len;
-    }
+    for (i=0; i < size; i++)
+        t->buf[pos + i] = (unsigned char) ((v >> (8 * i)) & 0xff);
 }
 
 
 /**
- *  DL_PRINTRANDOM -- Print the random number column as float values.
+ *  DL_FBPATCH -- Point the offset at 'pos' to 'target'.
  */
 static void
-dl_printRandom (void)
+dl_fbPatch (TbufPtr t, long pos, long target)
 {
-    unsigned int len = 0, sz_val = htonl(sz_float);
-    float rval = (((float)rand()/(float)(RAND_MAX)) * RANDOM_SCALE);
-    char  valbuf[SZ_VALBUF];
-
-
-    if (mach_swap && do_binary)
-        bswap4 ((unsigned char *)&rval, 1, (unsigned char *)&rval, 1, sz_float);
-
-    if (do_binary) {
-        sz_val = htonl(sz_float);
-        memcpy (optr, &sz_val, sz_int);           	optr += sz_int;
-        memcpy (optr, (char *)&rval, sz_float);   	optr += sz_float;
-        olen += (sz_int + sz_float);
-
-    } else {
-        memset (valbuf, 0, SZ_VALBUF);
-        //sprintf (valbuf, "%c%f", delimiter, rval);
-        sprintf (valbuf, "%f", rval);
-        memcpy (optr, valbuf, (len = strlen (valbuf)));
-        olen += len;
-        optr += len;
-    }
+    dl_fbSet (t, pos, (unsigned long long) (target - pos), 4);
 }
 
 
 /**
- *  DL_PRINTVALUE -- Print a (integer) value to the output stream.
+ *  DL_FBALIGN -- Pad a buffer to a multiple of 'align' bytes.
  */
 static void
-dl_printValue (int value)
+dl_fbAlign (TbufPtr t, int align)
 {
-    unsigned int len, ival = value;
-    unsigned int sz_val = htonl(sz_int);
-    char  valbuf[SZ_VALBUF];
-
-
-    if (do_binary) {
-        memcpy (optr, &sz_val, sz_int);         optr += sz_int;
-        ival = htonl(ival);
-        memcpy (optr, (char *)&ival, sz_int);   optr += sz_int;
-        olen += (2 * sz_int);
-
-    } else {
-        memset (valbuf, 0, SZ_VALBUF);
-        sprintf (valbuf, "%d", ival);
-        memcpy (optr, valbuf, (len = strlen (valbuf)));
-        olen += len;
-        optr += len;
-    }
+    if (t->len % align)
+        dl_tPut (t, NULL, align - t->len % align);
 }
 
 
@@ -2307,12 +9918,12 @@ dl_makeTableName (char *fname)
  *  DL_ESCAPECSV -- Escape quotes for CSV printing.
  */
 static void
-dl_escapeCSV (char* in)
+dl_escapeCSV (CtxPtr ctx, char* in)
 {
     //int   in_len = 0;
-    char *ip = in, *op = esc_buf;
+    char *ip = in, *op = ctx->esc_buf;
 
-    memset (esc_buf, 0, SZ_ESCBUF);
+    memset (ctx->esc_buf, 0, SZ_ESCBUF);
     //if (in)
     //    in_len = strlen (in);
 
@@ -2330,12 +9941,12 @@ dl_escapeCSV (char* in)
  *  DL_QUOTE -- Set quotes for CSV printing.
  */
 static void
-dl_quote (char* in)
+dl_quote (CtxPtr ctx, char* in)
 {
     int    in_len = 0;
-    char  *op = esc_buf;
+    char  *op = ctx->esc_buf;
 
-    memset (esc_buf, 0, SZ_ESCBUF);
+    memset (ctx->esc_buf, 0, SZ_ESCBUF);
     in_len = (in ? strlen (in) : 0);
 
     *op++ = quote_char;
@@ -2347,36 +9958,29 @@ dl_quote (char* in)
 }
 
 
-
-/* BSWAP2 - Move bytes from array "a" to array "b", swapping successive
- * pairs of bytes.  The two arrays may be the same but may not be offset
- * and overlapping.
+/**
+ *  DL_ESCAPELOAD -- Escape a string for a MySQL LOAD DATA file into 'out',
+ *  returning the escaped length.
  */
-static void
-bswap2 (
-  char    *a,         	                        // input array
-  char    *b,         	                        // output array
-  int     nbytes         	                // number of bytes to swap
-)
+static int
+dl_escapeLoad (char *out, char *in)
 {
-        register char *ip=a, *op=b, *otop;
-        register unsigned temp;
-
-        /* Swap successive pairs of bytes.
-         */
-        for (otop = op + (nbytes & ~1);  op < otop;  ) {
-            temp  = *ip++;
-            *op++ = *ip++;
-            *op++ = temp;
+    char *op = out;
+
+    for ( ; *in; in++) {
+        switch (*in) {
+        case '\\':  *op++ = '\\', *op++ = '\\';     break;
+        case '\t':   *op++ = '\\', *op++ = 't';      break;
+        case '\n':   *op++ = '\\', *op++ = 'n';      break;
+        case '\r':   *op++ = '\\', *op++ = 'r';      break;
+        default:     *op++ = *in;                   break;
         }
-
-        /* If there is an odd byte left, move it to the output array.
-         */
-        if (nbytes & 1)
-            *op = *ip;
+    }
+    return ((int) (op - out));
 }
 
 
+
 /* BSWAP4 - Move bytes from array "a" to array "b", swapping the four bytes
  * in each successive 4 byte group, i.e., 12345678 becomes 43218765.
  * The input and output arrays may be the same but may not partially overlap.
@@ -2392,7 +9996,7 @@ bswap4 (
 {
 	register char	*ip, *op, *tp;
 	register int	n;
-	static	char temp[4];
+	char	temp[4];
 
 	tp = temp;
 	ip = (char *)a + aoff - 1;
@@ -2420,54 +10024,52 @@ bswap4 (
 }
 
 
-/* BSWAP8 - Move bytes from array "a" to array "b", swapping the eight bytes
- * in each successive 8 byte group, i.e., 12345678 becomes 87654321.
- * The input and output arrays may be the same but may not partially overlap.
+/* DL_SWAPRUN -- Byte-swap 'n' contiguous values of 'size' bytes in place.
+ * Whole vectors are swapped with AVX2 or SSE2 where available, the rest
+ * one value at a time.
  */
 static void
-bswap8 (
-  char  *a,			                // input array
-  int	aoff,			                // first byte in input array
-  char  *b,			                // output array
-  int	boff,			                // first byte in output array
-  int	nbytes		                        // number of bytes to swap
-)
+dl_swapRun (unsigned char *p, int n, int size)
 {
-	register char	*ip, *op, *tp;
-	register int	n;
-	static	char temp[8];
-
-	tp = temp;
-	ip = (char *)a + aoff - 1;
-	op = (char *)b + boff - 1;
-
-	/* Swap successive eight byte groups.
-	 */
-	for (n = nbytes >> 3;  --n >= 0;  ) {
-	    *tp++ = *ip++;
-	    *tp++ = *ip++;
-	    *tp++ = *ip++;
-	    *tp++ = *ip++;
-	    *tp++ = *ip++;
-	    *tp++ = *ip++;
-	    *tp++ = *ip++;
-	    *tp++ = *ip++;
-	    *op++ = *--tp;
-	    *op++ = *--tp;
-	    *op++ = *--tp;
-	    *op++ = *--tp;
-	    *op++ = *--tp;
-	    *op++ = *--tp;
-	    *op++ = *--tp;
-	    *op++ = *--tp;
+	register unsigned char *ip, t;
+	register int i = 0, nbytes = n * size, k;
+
+#if defined(__AVX2__)
+	const __m256i m2 = _mm256_setr_epi8 (1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+				1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+	const __m256i m4 = _mm256_setr_epi8 (3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+				3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+	const __m256i m8 = _mm256_setr_epi8 (7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,
+				7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+	const __m256i m = (size == 2 ? m2 : (size == 4 ? m4 : m8));
+
+	for ( ; i + 32 <= nbytes; i += 32) {
+	    __m256i v = _mm256_loadu_si256 ((__m256i *) (p + i));
+	    _mm256_storeu_si256 ((__m256i *) (p + i), _mm256_shuffle_epi8 (v, m));
+	}
+#elif defined(__SSE2__)
+	for ( ; i + 16 <= nbytes; i += 16) {
+	    __m128i v = _mm_loadu_si128 ((__m128i *) (p + i));
+
+	    if (size == 4) {                    // swap 16-bit words first
+		v = _mm_shufflelo_epi16 (v, 0xB1);
+		v = _mm_shufflehi_epi16 (v, 0xB1);
+	    } else if (size == 8) {
+		v = _mm_shufflelo_epi16 (v, 0x1B);
+		v = _mm_shufflehi_epi16 (v, 0x1B);
+	    }
+	    v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+	    _mm_storeu_si128 ((__m128i *) (p + i), v);
 	}
+#endif
 
-	/* If there are any odd bytes left, move them to the output array.
-	 * Do not bother to swap as it is unclear how to swap a partial
-	 * group, and really incorrect if the data is not modulus 8.
-	 */
-	for (n = nbytes & 03;  --n >= 0;  )
-	    *op++ = *ip++;
+	for ( ; i < nbytes; i += size) {
+	    for (ip = p + i, k = 0; k < size / 2; k++) {
+		t = ip[k];
+		ip[k] = ip[size - 1 - k];
+		ip[size - 1 - k] = t;
+	    }
+	}
 }
 
 
@@ -2554,24 +10156,109 @@ dl_isFITS (char *fits_name)
 
 
 /**
- *  DL_ISGZIP -- Test a file to see if it is GZip compressed.
+ *  DL_ZTYPE -- Test a file to see if it is compressed, returning the
+ *  compression type.
  */
 static int 
-dl_isGZip (char *fname)
+dl_zType (char *fname)
 {
-    int   fp, value = 0;
-    unsigned short sval = 0;
+    int   fp, value = CMP_NONE;
+    unsigned char magic[4];
 
-    if ((fp = open (fname, O_RDONLY))) {
-        read (fp, &sval, 2);
-        if (sval == 35615)              // ushort value of "\037\213"
-            value = 1;
+    if ((fp = open (fname, O_RDONLY)) >= 0) {
+        value = dl_zTypeOf (magic, read (fp, magic, 4));
         close (fp);
     }
     return value;
 }
 
 
+/**
+ *  DL_ZTYPEOF -- Get the compression type from the magic number at the
+ *  start of a buffer.  Only the types this build can read are recognized.
+ */
+static int 
+dl_zTypeOf (unsigned char *buf, long len)
+{
+    if (len >= 2 && buf[0] == 037 && buf[1] == 0213)
+        return (CMP_GZIP);
+#ifdef HAVE_BZIP2
+    if (len >= 3 && strncmp ((char *) buf, "BZh", 3) == 0)
+        return (CMP_BZIP2);
+#endif
+#ifdef HAVE_ZSTD
+    if (len >= 4 && buf[0] == 0x28 && buf[1] == 0xb5 && buf[2] == 0x2f &&
+        buf[3] == 0xfd)
+            return (CMP_ZSTD);
+#endif
+    return (CMP_NONE);
+}
+
+
+/**
+ *  DL_MAPTABLE -- Map an uncompressed, unfiltered FITS file read-only and
+ *  return a pointer to the data of the current table, or NULL if it must
+ *  be read through CFITSIO instead.  'nbytes' is the size of the table.
+ */
+static unsigned char *
+dl_mapTable (fitsfile *fptr, char *iname, long nbytes, void **base,
+                size_t *len)
+{
+    LONGLONG  hdrstart = 0, datastart = 0, dataend = 0;
+    struct stat st;
+    void  *map = NULL;
+    int    fd, status = 0;
+
+
+    *base = NULL, *len = 0;
+
+    /*  Filename modifiers and compressed files are read into memory by
+     *  CFITSIO, so the data address doesn't refer to the disk file.
+     */
+    if (strchr (iname, (int)'[') || !dl_isFITS (iname))
+        return (NULL);
+    if (fits_get_hduaddrll (fptr, &hdrstart, &datastart, &dataend, &status))
+        return (NULL);
+
+    if ((fd = open (iname, O_RDONLY)) < 0)
+        return (NULL);
+    if (fstat (fd, &st) < 0 || st.st_size < (datastart + nbytes) ||
+        st.st_size == 0) {
+            close (fd);
+            return (NULL);
+    }
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+        return (NULL);
+
+    madvise (map, st.st_size, MADV_SEQUENTIAL);
+    *base = map;
+    *len = st.st_size;
+
+    return ((unsigned char *) map + datastart);
+}
+
+
+/**
+ *  DL_WILLNEED -- Hint that a range of the mapped table will be read soon.
+ *  Not when only narrow spans of each row are used, the pages are then
+ *  faulted in as the columns are read.
+ */
+static void
+dl_willNeed (CtxPtr ctx, unsigned char *addr, long nbytes)
+{
+    long   pagesize = sysconf (_SC_PAGESIZE);
+    unsigned char *page;
+
+
+    if (ctx->narrow)
+        return;
+    page = (unsigned char *) ((unsigned long) addr & ~(pagesize - 1));
+    madvise (page, nbytes + (addr - page), MADV_WILLNEED);
+}
+
+
 /**
  *  DL_ATOI -- System atoi() with lexical argument checking.
  */
@@ -2590,6 +10277,22 @@ dl_atoi (char *val)
 }
 
 
+/**
+ *  DL_ATOLPOS -- Parse a positive count, or return -1 if the value is not
+ *  one.
+ */
+static long
+dl_atolPos (char *val)
+{
+    char *ep = NULL;
+    long  n = strtol (val, &ep, 10);
+
+    if (ep == val || *ep || n <= 0 || n > INT_MAX)
+        return (-1);
+    return (n);
+}
+
+
 /**
  *  Task Parameter Utiltities
  */
@@ -2813,24 +10516,36 @@ dl_paramFree (int argc, char *argv[])
 static char *
 dl_fextn (void)
 {
+    static char  ext[SZ_EXTNAME];
+    char  *fmt = "fmt";
+
+
     switch (format) {
     case TAB_DELIMITED:
         switch (delimiter) {
-        case ' ':       return "asv";
-        case '|':       return "bsv";
-        case ',':       return "csv";
-        case '\t':      return "tsv";
+        case ' ':       fmt = "asv";  break;
+        case '|':       fmt = "bsv";  break;
+        case ',':       fmt = "csv";  break;
+        case '\t':      fmt = "tsv";  break;
         }
         break;
     case TAB_IPAC:
-            return "ipac";
+            fmt = "ipac";               break;
+    case TAB_PARQUET:
+            fmt = "parquet";            break;
+    case TAB_ARROW:
+            fmt = "arrows";             break;
     case TAB_POSTGRES:
     case TAB_MYSQL:
     case TAB_SQLITE:
-            return "sql";
+            fmt = "sql";                break;
     }
 
-    return ("fmt");
+    /*  Compressed output gets the usual suffix.
+     */
+    snprintf (ext, SZ_EXTNAME, "%s%s", fmt, (zcompress == CMP_GZIP ? ".gz" :
+        (zcompress == CMP_ZSTD ? ".zst" : "")));
+    return (ext);
 }
 
 
@@ -2861,14 +10576,24 @@ Usage (void)
 "      -o,--output=<file>       set output filename\n"
 "      -r,--rowrange=<range>    convert rows within given <range>\n"
 "      -s,--select=<expr>       select rows based on <expr>\n"
+"      --columns=<list>         convert only the named columns, in order\n"
+"      --exclude=<list>         convert all but the named columns\n"
 "\n"
 "                                   PROCESSING OPTIONS\n"
 "      -C,--concat              concatenate all input files to output\n"
 "      -H,--noheader            suppress CSV column header\n"
+"      -M,--columnar            format each chunk a column at a time\n"
 "      -N,--nostrip             don't strip strings of whitespace\n"
+"      -P,--pipeline            overlap reading, formatting and writing\n"
 "      -Q,--noquote             don't quote strings in text formats\n"
 "      -S,--singlequote         use single quotes for strings\n"
+"      -T,--threads=<N>         use <N> conversion threads\n"
 "      -X,--explode             explode array cols to separate columns\n"
+"      --compress=<z>[:<N>]     compress output with gzip or zstd, level <N>\n"
+"      --shards=<N>             split each table into <N> output files\n"
+"      --shard-rows=<N>         split tables into output files of <N> rows\n"
+"      --shard-bytes=<N>        split tables into files of <N> table bytes\n"
+"      --partition-by=<spec>    split tables into partitions by a column\n"
 "\n"
 "                                   FORMAT OPTIONS\n"
 "      --asv                    output an ascii-separated value table\n"
@@ -2876,6 +10601,10 @@ Usage (void)
 "      --csv                    output a comma-separated value table\n"
 "      --tsv                    output a tab-separated value table\n"
 "      --ipac                   output an IPAC formatted table\n"
+"      --parquet                output a Parquet file\n"
+"      --row-group=<N>          <N> rows per Parquet row group\n"
+"      --arrow                  output an Arrow IPC stream\n"
+"      -F,--float=<fmt>         float format: 'fixed' (default) or 'shortest'\n"
 "\n"
 "                                   SQL OPTIONS\n"
 "      -B,--binary              output binary SQL\n"
@@ -2890,6 +10619,13 @@ Usage (void)
 "      --truncate               truncate DB table before loading\n"
 "      --pkey=<colname>         create a serial primary key column <colname>\n"
 "\n"
+"      --sqlite-db=<file>       load straight into SQLite database <file>\n"
+"      --commit=<N>             commit every <N> rows (--sqlite-db)\n"
+"      --pg-conn=<conninfo>     COPY straight to the Postgres server\n"
+"      --load-data=<file>       MySQL LOAD DATA via <file> (FIFO or spool)\n"
+"      --max-stmt-bytes=<N>     start a new INSERT before <N> bytes\n"
+"      --max-stmt-rows=<N>      start a new INSERT after <N> rows\n"
+"\n"
 "\n"
 "  Examples:\n"
 "\n"
@@ -2950,6 +10686,97 @@ Usage (void)
 "\n"
 "        Note in this case the selection expression must be quoted.\n"
 "\n"
+"    7)  Load a large number of files using 8 conversion threads.  Output\n"
+"        is written in input order and is identical to a serial run.  For a\n"
+"        single file the threads format slices of each chunk of rows:\n"
+"\n"
+"          %% fits2db --sql=postgres -B -C --threads=8 -t mytab *.fits | psql\n"
+"\n"
+"    8)  Convert a single large table while the next chunk is read and the\n"
+"        previous one written in separate threads:\n"
+"\n"
+"          %% fits2db --pipeline --threads=4 -o big.csv big.fits\n"
+"\n"
+"    9)  Write float columns with the fewest digits that read back to the\n"
+"        identical value, instead of fixed-point '%%f' / '%%.16f':\n"
+"\n"
+"          %% fits2db --float=shortest --csv test.fits\n"
+"\n"
+"   10)  Format each chunk a column at a time rather than a row at a time,\n"
+"        which is faster for wide tables of scalar numbers and strings:\n"
+"\n"
+"          %% fits2db --columnar --csv big.fits\n"
+"\n"
+"   11)  Load all FITS tables straight into the SQLite database 'mydb.db',\n"
+"        without going through the sqlite3 client:\n"
+"\n"
+"          %% fits2db --sqlite-db=mydb.db --create -t mytab *.fits\n"
+"\n"
+"   12)  Load all FITS tables straight into Postgres, without psql.  The\n"
+"        server reports the rows loaded by each COPY:\n"
+"\n"
+"          %% fits2db --pg-conn=\"host=/tmp dbname=mydb\" -B -C \\\n"
+"                       --create -t mytab *.fits\n"
+"\n"
+"   13)  Load into MySQL with LOAD DATA rather than INSERT statements.  The\n"
+"        rows are streamed through a named pipe as the client reads them:\n"
+"\n"
+"          %% mkfifo /tmp/rows\n"
+"          %% fits2db --load-data=/tmp/rows --create -t mytab *.fits | \\\n"
+"                       mysql --local-infile=1 mydb\n"
+"\n"
+"   14)  Keep each MySQL INSERT under the server's max_allowed_packet:\n"
+"\n"
+"          %% fits2db --sql=mysql --max-stmt-bytes=16000000 -t mytab *.fits | \\\n"
+"                       mysql mydb\n"
+"\n"
+"   15)  Convert a set of files to a single Parquet file:\n"
+"\n"
+"          %% fits2db --parquet -C -o mytab.parquet *.fits\n"
+"\n"
+"   16)  Stream a table to an Arrow consumer, a record batch per chunk:\n"
+"\n"
+"          %% fits2db --arrow -o test.arrows test.fits\n"
+"\n"
+"   17)  Write gzip-compressed CSV files, compressed by 4 threads:\n"
+"\n"
+"          %% fits2db --csv --compress=gzip -T 4 *.fits\n"
+"\n"
+"   18)  Convert a compressed table as it is decompressed:\n"
+"\n"
+"          %% fits2db --csv -T 4 -o big.csv big.fits.zst\n"
+"\n"
+"   19)  Convert only the RA, DEC and MAG columns of a wide table, reading\n"
+"        just those bytes of each row:\n"
+"\n"
+"          %% fits2db --csv --columns=ra,dec,mag -o pos.csv wide.fits\n"
+"\n"
+"   20)  Load only the bright, unflagged rows of a table.  Simple\n"
+"        expressions like this are evaluated natively as rows are read,\n"
+"        others are passed to CFITSIO as a row filter:\n"
+"\n"
+"          %% fits2db --sql=postgres -B --select=\'MAG < 18.5 && !FLAG\' test.fits\n"
+"\n"
+"   21)  Split a large table between two loader processes, each reading\n"
+"        only its own rows:\n"
+"\n"
+"          %% fits2db --sql=postgres -B --rowrange=1-5000000 big.fits | psql &\n"
+"          %% fits2db --sql=postgres -B --rowrange=5000001- big.fits | psql\n"
+"\n"
+"   22)  Write a large table as 8 COPY streams into FIFOs and load them\n"
+"        with 8 psql clients at once:\n"
+"\n"
+"          %% for i in 1 2 3 4 5 6 7 8; do mkfifo big_$i.sql; done\n"
+"          %% for i in 1 2 3 4 5 6 7 8; do psql -f big_$i.sql & done\n"
+"          %% fits2db --sql=postgres -T 8 --shards=8 -o big.sql big.fits\n"
+"\n"
+"   23)  Load a table straight into the 4 child tables of a Postgres table\n"
+"        hash partitioned on its OBJID column:\n"
+"\n"
+"          %% fits2db --sql=postgres -T 4 --partition-by=OBJID:hash:4 \\\n"
+"                -t cat -o cat.sql cat.fits\n"
+"          %% for i in 0 1 2 3; do psql -f cat_p$i.sql & done\n"
+"\n"
 "  Additionally, filename modifiers may be added in order to select the\n"
 "  specific file extension or filter the table for specific rows or columns.\n"
 "  Examples of this type of filtering include:\n"